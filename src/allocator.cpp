@@ -0,0 +1,152 @@
+#include "allocator.hpp"
+#include <stdint.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace LuGL;
+
+LinearArena::LinearArena(size_t block_size):
+    m_blocks(nullptr),
+    m_block_size(block_size),
+    m_used(0),
+    m_capacity(0),
+    m_peak(0),
+    m_block_count(0) {}
+
+LinearArena::~LinearArena()
+{
+    freeBlocks();
+}
+
+LinearArena::Block * LinearArena::createBlock(size_t size)
+{
+    Block *block = (Block*)::operator new(sizeof(Block) + size);
+    block->next = m_blocks;
+    block->size = size;
+    block->used = 0;
+    m_blocks = block;
+    m_capacity += size;
+    m_block_count++;
+    return block;
+}
+
+void LinearArena::freeBlocks()
+{
+    while (m_blocks)
+    {
+        Block *next = m_blocks->next;
+        ::operator delete(m_blocks);
+        m_blocks = next;
+    }
+    m_capacity = 0;
+}
+
+void * LinearArena::allocate(size_t bytes, size_t alignment)
+{
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+    Block *block = m_blocks;
+    uintptr_t address = 0;
+    if (block)
+    {
+        const uintptr_t base = (uintptr_t)(block + 1);
+        address = (base + block->used + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    }
+    if (!block || address + bytes > (uintptr_t)(block + 1) + block->size)
+    {
+        // blocks grow with the arena, and fit an allocation larger than a block
+        size_t size = m_capacity > m_block_size ? m_capacity : m_block_size;
+        if (size < bytes + alignment) size = bytes + alignment;
+        block = createBlock(size);
+        const uintptr_t base = (uintptr_t)(block + 1);
+        address = (base + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    }
+
+    const size_t end = address + bytes - (uintptr_t)(block + 1);
+    m_used += end - block->used;
+    block->used = end;
+    if (m_used > m_peak) m_peak = m_used;
+    return (void*)address;
+}
+
+void LinearArena::reset()
+{
+    if (m_blocks && m_blocks->next)
+    {
+        const size_t capacity = m_capacity;
+        freeBlocks();
+        createBlock(capacity);
+    }
+    else if (m_blocks)
+    {
+        m_blocks->used = 0;
+    }
+    m_used = 0;
+}
+
+FrameArena::FrameArena():
+    m_arenas(nullptr),
+    m_thread_count(1),
+    m_frame_count(0),
+    m_frame_used(0),
+    m_peak(0)
+{
+#ifdef _OPENMP
+    m_thread_count = omp_get_max_threads();
+#endif
+    m_arenas = new LinearArena[m_thread_count];
+}
+
+FrameArena::~FrameArena()
+{
+    delete[] m_arenas;
+}
+
+// arena of the calling thread
+LinearArena & FrameArena::local()
+{
+#ifdef _OPENMP
+    return arena(omp_get_thread_num());
+#else
+    return arena(0);
+#endif
+}
+
+LinearArena & FrameArena::arena(size_t thread_index)
+{
+    assert(thread_index < m_thread_count);
+    return m_arenas[thread_index];
+}
+
+void FrameArena::endFrame()
+{
+    m_frame_used = 0;
+    for (size_t tidx = 0; tidx < m_thread_count; tidx++)
+    {
+        m_frame_used += m_arenas[tidx].used();
+        m_arenas[tidx].reset();
+    }
+    if (m_frame_used > m_peak) m_peak = m_frame_used;
+    m_frame_count++;
+}
+
+size_t FrameArena::capacity() const
+{
+    size_t capacity = 0;
+    for (size_t tidx = 0; tidx < m_thread_count; tidx++)
+    {
+        capacity += m_arenas[tidx].capacity();
+    }
+    return capacity;
+}
+
+size_t FrameArena::blockCount() const
+{
+    size_t block_count = 0;
+    for (size_t tidx = 0; tidx < m_thread_count; tidx++)
+    {
+        block_count += m_arenas[tidx].blockCount();
+    }
+    return block_count;
+}
@@ -0,0 +1,154 @@
+#ifndef __ALLOCATOR_HPP__
+#define __ALLOCATOR_HPP__
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <stddef.h>
+#include <new>
+#include <type_traits>
+#include "global.hpp"
+
+namespace LuGL
+{
+
+#define ARENA_BLOCK_SIZE (1 << 20)  // bytes of the first block of a LinearArena
+#define ARENA_ALIGNMENT  16         // default alignment of arena allocations
+
+/**
+ * Allocators plugged into DynamicArray provide
+ *   void * allocate(size_t bytes, size_t alignment);
+ *   void deallocate(void * pointer, size_t bytes);
+ * and are copied along with the array they belong to.
+ */
+
+// the global heap, the default of DynamicArray
+struct HeapAllocator
+{
+    void * allocate(size_t bytes, size_t alignment)
+    {
+        assert(alignment <= alignof(max_align_t));
+        (void)alignment;
+        return ::operator new(bytes);
+    }
+    void deallocate(void * pointer, size_t bytes)
+    {
+        (void)bytes;
+        ::operator delete(pointer);
+    }
+};
+
+/**
+ * Bump allocator over a chain of blocks, for memory that lives until the next
+ * reset such as the transient data of a frame. Single allocations are never
+ * freed, reset() releases everything at once. When the arena had to chain
+ * blocks, reset() replaces them by one block of their total size, so the same
+ * workload does not allocate from the heap again. Not thread safe, give every
+ * thread its own arena.
+ */
+class LinearArena
+{
+private:
+    struct Block
+    {
+        Block   *next;
+        size_t  size;       // bytes after the header
+        size_t  used;
+    };
+
+    Block   *m_blocks;      // current block first
+    size_t  m_block_size;
+    size_t  m_used;
+    size_t  m_capacity;
+    size_t  m_peak;         // high-water mark of used()
+    size_t  m_block_count;  // blocks ever taken from the heap
+
+    Block * createBlock(size_t size);
+    void freeBlocks();
+public:
+    LinearArena(size_t block_size = ARENA_BLOCK_SIZE);
+    ~LinearArena();
+
+    LinearArena(const LinearArena &) = delete;
+    LinearArena & operator= (const LinearArena &) = delete;
+
+    void * allocate(size_t bytes, size_t alignment = ARENA_ALIGNMENT);
+    void reset();
+
+    // count default constructed elements, they are never destroyed
+    template<typename T>
+    T * allocateArray(size_t count)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "arena elements are not destroyed");
+        T *array = (T*)allocate(count * sizeof(T), alignof(T) > ARENA_ALIGNMENT ? alignof(T) : ARENA_ALIGNMENT);
+        for (size_t i = 0; i < count; i++)
+        {
+            new (array + i) T();
+        }
+        return array;
+    }
+
+    size_t used() const { return m_used; }
+    size_t capacity() const { return m_capacity; }
+    size_t peak() const { return m_peak; }
+    size_t blockCount() const { return m_block_count; }
+};
+
+// allocates from a LinearArena, memory is given back when the arena is reset
+struct ArenaAllocator
+{
+    LinearArena *arena;
+
+    ArenaAllocator(LinearArena * arena = nullptr): arena(arena) {}
+
+    void * allocate(size_t bytes, size_t alignment)
+    {
+        assert(arena);
+        return arena->allocate(bytes, alignment);
+    }
+    void deallocate(void * pointer, size_t bytes)
+    {
+        (void)pointer;
+        (void)bytes;
+    }
+};
+
+/**
+ * Transient memory of the frames drawn by the Pipeline, one LinearArena per
+ * OpenMP thread so that the threads of a parallel loop allocate without
+ * locking. Everything allocated during a draw is released at once when the
+ * Pipeline ends the frame, and the arenas keep their blocks, so after the
+ * first frames rendering the same scene takes no memory from the heap. Only
+ * the thread drawing and its OpenMP team may use the arenas.
+ */
+class FrameArena
+{
+private:
+    LinearArena *m_arenas;
+    size_t      m_thread_count;
+    size_t      m_frame_count;
+    size_t      m_frame_used;   // by all the threads in the last frame
+    size_t      m_peak;         // highest m_frame_used
+
+public:
+    FrameArena();
+    ~FrameArena();
+
+    FrameArena(const FrameArena &) = delete;
+    FrameArena & operator= (const FrameArena &) = delete;
+
+    LinearArena & local();
+    LinearArena & arena(size_t thread_index);
+    void endFrame();
+
+    size_t threadCount() const { return m_thread_count; }
+    size_t frameCount() const { return m_frame_count; }
+    size_t frameUsed() const { return m_frame_used; }
+    size_t peak() const { return m_peak; }
+    size_t capacity() const;
+    size_t blockCount() const;
+};
+
+}
+
+#endif
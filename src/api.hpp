@@ -4,8 +4,12 @@
 #include "global.hpp"
 #include "maths.hpp"
 #include "image.hpp"
+#include "qoi.hpp"
+#include "mapfile.hpp"
 #include "mesh.hpp"
+#include "stream.hpp"
 #include "buffer.hpp"
+#include "allocator.hpp"
 #include "darray.hpp"
 #include "rasterizer.hpp"
 #include "scene.hpp"
@@ -13,9 +17,12 @@
 #include "shader.hpp"
 #include "digits.hpp"
 #include "pipeline.hpp"
+#include "command.hpp"
 #include "misc.hpp"
 #include "material.hpp"
 #include "entity.hpp"
+#include "asset.hpp"
+#include "threadpool.hpp"
 #include "envmap.hpp"
 
 #endif
\ No newline at end of file
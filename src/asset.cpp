@@ -0,0 +1,302 @@
+#include "asset.hpp"
+#include "mapfile.hpp"
+#include "material.hpp"
+#include "image.hpp"
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <limits.h>
+#endif
+
+using namespace LuGL;
+
+#define ASSET_MAX_PATH 4096
+
+AssetCache::AssetCache():
+    m_budget(ASSET_CACHE_BUDGET),
+    m_resident_size(0),
+    m_file_reads(0),
+    m_clock(0) {}
+
+AssetCache::~AssetCache()
+{
+    // assets still referenced are left to their owners
+    for (size_t aidx = 0; aidx < m_assets.size(); aidx++)
+    {
+        if (m_assets[aidx]->ref_count == 0) freeAsset(m_assets[aidx]);
+    }
+}
+
+bool AssetCache::canonicalPath(const char * filename, char * path, size_t length)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    return _fullpath(path, filename, length) != NULL;
+#else
+    char resolved[PATH_MAX];
+    if (realpath(filename, resolved) == NULL || strlen(resolved) >= length) return false;
+    strcpy(path, resolved);
+    return true;
+#endif
+}
+
+// FNV-1a over 8 byte words of the file, the tail byte by byte
+bool AssetCache::hashFile(const char * filename, UINT64 * hash, UINT64 * size)
+{
+    MappedFile file;
+    if (!file.open(filename)) return false;
+
+    const byte_t *data = file.data();
+    const size_t word_count = file.size() / sizeof(UINT64);
+    UINT64 h = 14695981039346656037ULL;
+    for (size_t widx = 0; widx < word_count; widx++)
+    {
+        UINT64 word;
+        memcpy(&word, data + widx * sizeof(UINT64), sizeof(UINT64));
+        h = (h ^ word) * 1099511628211ULL;
+    }
+    for (size_t bidx = word_count * sizeof(UINT64); bidx < file.size(); bidx++)
+    {
+        h = (h ^ data[bidx]) * 1099511628211ULL;
+    }
+    *hash = h;
+    *size = file.size();
+    return true;
+}
+
+// assets still loading are found too, m_mutex has to be held
+AssetCache::Asset * AssetCache::find(AssetType type, TextureFormat format, TextureLayout layout, const char * path, INT64 modified_time, UINT64 content_hash, UINT64 content_size)
+{
+    for (size_t aidx = 0; aidx < m_assets.size(); aidx++)
+    {
+        Asset *asset = m_assets[aidx];
+        if (asset->type != type || asset->format != format || asset->layout != layout) continue;
+        if (path && strcmp(asset->path, path) == 0 && asset->modified_time == modified_time) return asset;
+        if (!path && asset->content_hash == content_hash && asset->content_size == content_size) return asset;
+    }
+    return nullptr;
+}
+
+// reference a found asset, waiting for it if another thread is loading it
+AssetCache::Asset * AssetCache::reference(Asset * asset, std::unique_lock<std::mutex> & lock)
+{
+    asset->ref_count++;
+    asset->last_use = m_clock++;
+    m_loaded.wait(lock, [asset] { return !asset->loading; });
+    if (asset->data == nullptr)
+    {
+        asset->ref_count--;
+        return nullptr;
+    }
+    return asset;
+}
+
+/**
+ * The file is loaded without holding m_mutex, so that several threads load
+ * different files at the same time. An asset being loaded is registered
+ * first, a thread asking for it meanwhile waits for that load instead of
+ * reading the file again.
+ */
+AssetCache::Asset * AssetCache::acquire(AssetType type, const char * filename, TextureFormat format, TextureLayout layout)
+{
+    char path[ASSET_MAX_PATH];
+    INT64 modified_time = 0;
+    if (!canonicalPath(filename, path, ASSET_MAX_PATH) || !MappedFile::modifiedTime(path, &modified_time))
+    {
+        printf("AssetCache : file: %s not found\n", filename);
+        return nullptr;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    Asset *asset = find(type, format, layout, path, modified_time, 0, 0);
+    if (asset) return reference(asset, lock);
+
+    // the same content under another name
+    lock.unlock();
+    UINT64 content_hash = 0;
+    UINT64 content_size = 0;
+    if (!hashFile(path, &content_hash, &content_size)) return nullptr;
+    lock.lock();
+    asset = find(type, format, layout, nullptr, 0, content_hash, content_size);
+    if (asset) return reference(asset, lock);
+
+    asset = new Asset();
+    asset->type = type;
+    asset->path = new char[strlen(path) + 1];
+    strcpy(asset->path, path);
+    asset->modified_time = modified_time;
+    asset->content_hash = content_hash;
+    asset->content_size = content_size;
+    asset->ref_count = 1;
+    asset->size = 0;
+    asset->last_use = m_clock++;
+    asset->loading = true;
+    asset->data = nullptr;
+    asset->mapped_file = nullptr;
+    asset->width = 0;
+    asset->height = 0;
+    asset->format = format;
+    asset->layout = layout;
+    m_assets.push_back(asset);
+    lock.unlock();
+
+    void *data = nullptr;
+    MappedFile *mapped_file = nullptr;
+    size_t size = 0;
+    long width = 0;
+    long height = 0;
+    if (type == ASSET_MESH)
+    {
+        TriangleMesh *mesh = new TriangleMesh(path);
+        if (mesh->faceCount() > 0)
+        {
+            data = mesh;
+            size = mesh->memorySize();
+        }
+        else
+        {
+            printf("AssetCache : mesh: %s has no faces\n", path);
+            delete mesh;
+        }
+    }
+    else if ((data = Texture::mapContainer(path, format, layout, &width, &height, &mapped_file)))
+    {
+        size = Texture::surfaceSize(width, height, format, layout);
+    }
+    else
+    {
+        BMPImage bmp_image(path);
+        if (bmp_image.isLoaded())
+        {
+            width = bmp_image.getImageWidth();
+            height = bmp_image.getImageHeight();
+            data = Texture::createSurface(bmp_image, format, layout);
+        }
+        size = Texture::surfaceSize(width, height, format, layout);
+    }
+
+    lock.lock();
+    m_file_reads++;
+    asset->data = data;
+    asset->mapped_file = mapped_file;
+    asset->size = size;
+    asset->width = width;
+    asset->height = height;
+    asset->loading = false;
+    m_resident_size += size;
+    m_loaded.notify_all();
+    if (data == nullptr)
+    {
+        // kept until evicted, so that the file is not read again while it is unchanged
+        asset->ref_count--;
+        return nullptr;
+    }
+    trim();
+    return asset;
+}
+
+TriangleMesh * AssetCache::acquireMesh(const char * filename)
+{
+    Asset *asset = acquire(ASSET_MESH, filename);
+    return asset ? (TriangleMesh*)asset->data : nullptr;
+}
+
+// a texture container is loaded in its own format and layout, written back to format and layout
+byte_t * AssetCache::acquireTexture(const char * filename, TextureFormat * format, TextureLayout * layout, long * width, long * height)
+{
+    Texture::containerFormat(filename, format, layout);
+    Asset *asset = acquire(ASSET_TEXTURE, filename, *format, *layout);
+    *width = asset ? asset->width : 0;
+    *height = asset ? asset->height : 0;
+    return asset ? (byte_t*)asset->data : nullptr;
+}
+
+void AssetCache::release(const void * data)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t aidx = 0; aidx < m_assets.size(); aidx++)
+    {
+        Asset *asset = m_assets[aidx];
+        if (asset->data != data) continue;
+
+        assert(asset->ref_count > 0);
+        asset->ref_count--;
+        asset->last_use = m_clock++;
+        if (asset->type == ASSET_MESH)
+        {
+            // meshlets, LODs and attributes may have been added since the load
+            m_resident_size -= asset->size;
+            asset->size = ((TriangleMesh*)asset->data)->memorySize();
+            m_resident_size += asset->size;
+        }
+        trim();
+        return;
+    }
+    printf("AssetCache : released data is not an asset\n");
+}
+
+void AssetCache::freeAsset(Asset * asset)
+{
+    m_resident_size -= asset->size;
+    if (asset->data && asset->type == ASSET_MESH) delete (TriangleMesh*)asset->data;
+    else if (asset->mapped_file) delete asset->mapped_file;
+    else if (asset->data) delete[] (byte_t*)asset->data;
+    delete[] asset->path;
+    delete asset;
+}
+
+// evict the least recently used unreferenced assets until the budget is met, m_mutex has to be held
+void AssetCache::trim()
+{
+    while (m_resident_size > m_budget)
+    {
+        size_t lru = m_assets.size();
+        for (size_t aidx = 0; aidx < m_assets.size(); aidx++)
+        {
+            if (m_assets[aidx]->ref_count > 0 || m_assets[aidx]->loading) continue;
+            if (lru == m_assets.size() || m_assets[aidx]->last_use < m_assets[lru]->last_use) lru = aidx;
+        }
+        if (lru == m_assets.size()) return;
+
+        freeAsset(m_assets[lru]);
+        m_assets[lru] = m_assets.back();
+        m_assets.pop_back();
+    }
+}
+
+void AssetCache::setBudget(size_t budget)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_budget = budget;
+    trim();
+}
+
+size_t AssetCache::getBudget() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_budget;
+}
+
+size_t AssetCache::assetCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_assets.size();
+}
+
+size_t AssetCache::residentSize() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_resident_size;
+}
+
+size_t AssetCache::fileReads() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_file_reads;
+}
+
+void AssetCache::evictUnused()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const size_t budget = m_budget;
+    m_budget = 0;
+    trim();
+    m_budget = budget;
+}
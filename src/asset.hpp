@@ -0,0 +1,96 @@
+#ifndef __ASSET_HPP__
+#define __ASSET_HPP__
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <mutex>
+#include <condition_variable>
+#include "global.hpp"
+#include "darray.hpp"
+#include "mesh.hpp"
+#include "material.hpp"
+
+namespace LuGL
+{
+
+#define ASSET_CACHE_BUDGET (256ULL << 20)  // bytes of unreferenced assets kept for reuse
+
+enum AssetType
+{
+    ASSET_MESH = 0,
+    ASSET_TEXTURE,
+};
+
+/**
+ * Process wide registry of the meshes and textures loaded from files, so that
+ * entities pointing at the same file share one copy and the file is read once.
+ * Assets are looked up by canonical path and modification time first, then by
+ * a hash of the file content, so a copy of a file under another name is not
+ * loaded again either. Every acquire has to be paired with a release. Assets
+ * nobody references stay resident for reuse while the resident size is under
+ * the budget, the least recently used ones are evicted first. All the methods
+ * can be called from any thread.
+ */
+class AssetCache
+{
+private:
+    struct Asset
+    {
+        AssetType   type;
+        char        *path;          // canonical path
+        INT64       modified_time;
+        UINT64      content_hash;
+        UINT64      content_size;
+        size_t      ref_count;
+        size_t      size;           // bytes in memory
+        UINT64      last_use;
+        bool        loading;        // being read by one of the threads
+        void        *data;          // TriangleMesh or texture surface, nullptr if the load failed
+        MappedFile  *mapped_file;   // of a texture surface used where a texture container is mapped
+        long        width;          // of a texture
+        long        height;
+        TextureFormat format;       // a file loaded in two formats or layouts is two assets
+        TextureLayout layout;
+    };
+
+    DynamicArray<Asset*> m_assets;
+    size_t  m_budget;
+    size_t  m_resident_size;
+    size_t  m_file_reads;
+    UINT64  m_clock;
+    mutable std::mutex      m_mutex;
+    std::condition_variable m_loaded;
+
+    Asset * find(AssetType type, TextureFormat format, TextureLayout layout, const char * path, INT64 modified_time, UINT64 content_hash, UINT64 content_size);
+    Asset * reference(Asset * asset, std::unique_lock<std::mutex> & lock);
+    Asset * acquire(AssetType type, const char * filename, TextureFormat format = TEXTURE_FORMAT_RGBA32F, TextureLayout layout = TEXTURE_LAYOUT_LINEAR);
+    void freeAsset(Asset * asset);
+    void trim();
+
+    static bool canonicalPath(const char * filename, char * path, size_t length);
+    static bool hashFile(const char * filename, UINT64 * hash, UINT64 * size);
+public:
+    AssetCache();
+    ~AssetCache();
+
+    AssetCache(const AssetCache &) = delete;
+    AssetCache & operator= (const AssetCache &) = delete;
+
+    TriangleMesh * acquireMesh(const char * filename);
+    byte_t * acquireTexture(const char * filename, TextureFormat * format, TextureLayout * layout, long * width, long * height);
+    void release(const void * data);
+
+    void setBudget(size_t budget);
+    void evictUnused();
+
+    size_t getBudget() const;
+    size_t assetCount() const;
+    size_t residentSize() const;
+    size_t fileReads() const;
+};
+
+}
+
+#endif
@@ -15,6 +15,8 @@ FrameBuffer::FrameBuffer(long width, long height): m_width(width), m_height(heig
     long buffer_size = m_width * m_height;
     m_color_buffer = new byte_t[buffer_size * 3];
     m_depth_buffer = new float[buffer_size];
+    m_msaa_color_buffer = nullptr;
+    m_msaa_depth_buffer = nullptr;
 
     setupSamplingOption();
 }
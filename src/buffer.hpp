@@ -72,12 +72,14 @@ public:
         const size_t & batch_step, 
         const size_t & offset )
     {
-        m_data_pointers[index] = DynamicArray<float*>();
-        m_batch_sizes[index] = batch_size;
         if (index >= m_data_count)
         {
             m_data_count = index + 1;
+            m_data_pointers.resize(m_data_count);
+            m_batch_sizes.resize(m_data_count);
         }
+        m_data_pointers[index].clear();
+        m_batch_sizes[index] = batch_size;
         size_t pos = offset;
         while (pos < m_buffer_size)
         {
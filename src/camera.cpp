@@ -95,3 +95,34 @@ void Camera::rotateByDrag(float delta_x, float delta_y, float drag_speed)
 
     m_position = m_target + dir;
 }
+
+Frustum::Frustum(const Matrix4 & matrix)
+{
+    const Vector4 row_x(matrix.m[0],  matrix.m[1],  matrix.m[2],  matrix.m[3]);
+    const Vector4 row_y(matrix.m[4],  matrix.m[5],  matrix.m[6],  matrix.m[7]);
+    const Vector4 row_z(matrix.m[8],  matrix.m[9],  matrix.m[10], matrix.m[11]);
+    const Vector4 row_w(matrix.m[12], matrix.m[13], matrix.m[14], matrix.m[15]);
+
+    m_planes[0] = row_w + row_x; // left
+    m_planes[1] = row_w - row_x; // right
+    m_planes[2] = row_w + row_y; // bottom
+    m_planes[3] = row_w - row_y; // top
+    m_planes[4] = row_w + row_z; // near
+    m_planes[5] = row_w - row_z; // far
+
+    for (long i = 0; i < 6; i++)
+    {
+        float len = Vector3(m_planes[i]).length();
+        if (len > EPSILON) m_planes[i] = m_planes[i] / len;
+    }
+}
+
+bool Frustum::intersectSphere(const Vector3 & center, float radius) const
+{
+    const Vector4 position(center, 1.0f);
+    for (long i = 0; i < 6; i++)
+    {
+        if (m_planes[i].dot(position) < -radius) return false;
+    }
+    return true;
+}
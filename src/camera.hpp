@@ -39,6 +39,23 @@ public:
     void rotateByDrag(float delta_x, float delta_y, float drag_speed = DRAG_SPEED);
 };
 
+/**
+ * Clipping planes extracted from a (model-)view-projection matrix, the planes
+ * live in the space the matrix transforms from.
+ * reference : https://www.gamedevs.org/uploads/fast-extraction-viewing-frustum-planes-from-world-view-projection-matrix.pdf
+ */
+class Frustum
+{
+private:
+    Vector4 m_planes[6];
+
+public:
+    Frustum() {}
+    Frustum(const Matrix4 & matrix);
+
+    bool intersectSphere(const Vector3 & center, float radius) const;
+};
+
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,284 @@
+#include "command.hpp"
+
+using namespace LuGL;
+
+/**
+ * RenderState
+ */
+
+RenderState::RenderState()
+{
+    const Global & global = Singleton<Global>::get();
+    wireframe_mode = global.wireframe_mode;
+    depth_test = global.depth_test;
+    backface_culling = global.backface_culling;
+    cluster_culling = global.cluster_culling;
+    texture_filtering_linear = global.texture_filtering_linear;
+    texture_mipmapping = global.texture_mipmapping;
+}
+
+void RenderState::apply() const
+{
+    LUGL_WIREFRAME_MODE(wireframe_mode);
+    LUGL_DEPTH_TEST(depth_test);
+    LUGL_BACKFACE_CULLING(backface_culling);
+    LUGL_CLUSTER_CULLING(cluster_culling);
+    LUGL_TEXTURE_FILTERING(texture_filtering_linear);
+    LUGL_TEXTURE_MIPMAPPING(texture_mipmapping);
+}
+
+bool RenderState::operator== (const RenderState & other) const
+{
+    return wireframe_mode == other.wireframe_mode &&
+           depth_test == other.depth_test &&
+           backface_culling == other.backface_culling &&
+           cluster_culling == other.cluster_culling &&
+           texture_filtering_linear == other.texture_filtering_linear &&
+           texture_mipmapping == other.texture_mipmapping;
+}
+
+/**
+ * CommandBuffer
+ */
+
+CommandBuffer::CommandBuffer():
+    m_shader(nullptr),
+    m_compiled(false),
+    m_loading_count(0) {}
+
+CommandBuffer::~CommandBuffer()
+{
+    reset();
+}
+
+void CommandBuffer::reset()
+{
+    for (size_t i = 0; i < m_owned_entities.size(); i++)
+    {
+        delete m_owned_entities[i];
+    }
+    m_owned_entities.clear();
+    m_commands.clear();
+    m_compiled = false;
+    m_loading_count = 0;
+}
+
+static void setCommandTransform(DrawCommand & command, const mat4 & transform)
+{
+    command.transform = transform;
+    command.transform_inv = transform.inversed();
+    command.model_inv_transpose = mat3(command.transform_inv.transposed());
+    command.scale = transform.maxScale();
+}
+
+// the entities are recorded as const, picking up their loaded assets does not change the draw
+static bool updateEntityLoading(const Entity * entity)
+{
+    return const_cast<Entity*>(entity)->updateLoading();
+}
+
+DrawCommand & CommandBuffer::record(const Entity * entity, const mat4 & transform)
+{
+    assert(m_shader != nullptr);
+
+    DrawCommand command;
+    command.entity = entity;
+    command.shader = m_shader;
+    command.state = m_state;
+    setCommandTransform(command, transform);
+    command.instanced = false;
+    command.entity_transform = false;
+    command.loading = entity->isLoading();
+    command.state_id = 0;
+    command.sort_key = 0;
+    command.order = m_commands.size();
+    m_commands.push_back(command);
+    m_compiled = false;
+
+    return m_commands[m_commands.size() - 1];
+}
+
+void CommandBuffer::draw(const Entity * entity)
+{
+    record(entity, entity->getTransform()).entity_transform = true;
+}
+
+void CommandBuffer::draw(const Entity * entity, const mat4 & transform)
+{
+    record(entity, transform);
+}
+
+void CommandBuffer::draw(TriangleMesh * mesh, Material * material, const mat4 & transform)
+{
+    Entity *entity = new Entity();
+    entity->setTriangleMesh(mesh);
+    entity->setMaterial(material);
+    entity->setTransform(transform);
+    m_owned_entities.push_back(entity);
+    record(entity, transform);
+}
+
+void CommandBuffer::draw(const InstancedEntity * entity)
+{
+    record(entity, mat4::IDENTITY).instanced = true;
+}
+
+void CommandBuffer::recordScene(const Scene & scene)
+{
+    const DynamicArray<Entity*>* entities = scene.getEntities();
+    for (size_t eidx = 0; eidx < entities->size(); eidx++)
+    {
+        draw((*entities)[eidx]);
+    }
+    const DynamicArray<InstancedEntity*>* instanced_entities = scene.getInstancedEntities();
+    for (size_t eidx = 0; eidx < instanced_entities->size(); eidx++)
+    {
+        draw((*instanced_entities)[eidx]);
+    }
+}
+
+struct IdEntry
+{
+    UINT64  key;
+    size_t  order;
+};
+
+static int compareIdEntry(const void * a, const void * b)
+{
+    const IdEntry *ea = static_cast<const IdEntry*>(a);
+    const IdEntry *eb = static_cast<const IdEntry*>(b);
+    if (ea->key != eb->key) return (ea->key > eb->key) - (ea->key < eb->key);
+    return (ea->order > eb->order) - (ea->order < eb->order);
+}
+
+/**
+ * Give the command of each entry a dense id for its key, equal keys share
+ * the id and ids are given in order of first appearance. The keys are
+ * sorted instead of looked up in the list of keys seen so far, which made
+ * compile O(commands * unique keys).
+ */
+static void assignDenseIds(DynamicArray<IdEntry> & entries, DynamicArray<UINT64> & ids)
+{
+    const size_t count = entries.size();
+    ids.resize(count);
+    if (count == 0) return;
+    ::qsort(entries.data(), count, sizeof(IdEntry), compareIdEntry);
+
+    // the first entry of each run of equal keys is the first appearance of the key
+    DynamicArray<IdEntry> runs;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (i == 0 || entries[i].key != entries[i - 1].key) runs.push_back({ (UINT64)entries[i].order, runs.size() });
+        ids[entries[i].order] = runs.size() - 1;
+    }
+    ::qsort(runs.data(), runs.size(), sizeof(IdEntry), compareIdEntry);
+
+    DynamicArray<UINT64> run_ids(runs.size());
+    for (size_t r = 0; r < runs.size(); r++)
+    {
+        run_ids[runs[r].order] = r;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        ids[i] = run_ids[ids[i]];
+    }
+}
+
+static UINT64 stateKey(const RenderState & state)
+{
+    return (UINT64)state.wireframe_mode |
+           (UINT64)state.depth_test << 1 |
+           (UINT64)state.backface_culling << 2 |
+           (UINT64)state.cluster_culling << 3 |
+           (UINT64)state.texture_filtering_linear << 4 |
+           (UINT64)state.texture_mipmapping << 5;
+}
+
+static int compareDrawCommand(const void * a, const void * b)
+{
+    const DrawCommand *ca = static_cast<const DrawCommand*>(a);
+    const DrawCommand *cb = static_cast<const DrawCommand*>(b);
+    if (ca->sort_key != cb->sort_key) return (ca->sort_key > cb->sort_key) - (ca->sort_key < cb->sort_key);
+    return (ca->order > cb->order) - (ca->order < cb->order);
+}
+
+/**
+ * Sort the commands so that draws sharing a state, a shader, a material and
+ * a mesh are replayed next to each other. Ids are given in order of first
+ * appearance, so the first recorded state and shader are drawn first. The
+ * draws of entities still loading have no mesh yet and share the null one.
+ */
+void CommandBuffer::compile()
+{
+    const size_t count = m_commands.size();
+    DynamicArray<IdEntry> states(count);
+    DynamicArray<IdEntry> shaders(count);
+    DynamicArray<IdEntry> materials(count);
+    DynamicArray<IdEntry> meshes(count);
+
+    m_loading_count = 0;
+    for (size_t cidx = 0; cidx < count; cidx++)
+    {
+        DrawCommand & command = m_commands[cidx];
+
+        const bool loading = updateEntityLoading(command.entity);
+        if (command.loading && !loading && command.entity_transform)
+        {
+            // a loaded entity moves its mesh center to the origin
+            setCommandTransform(command, command.entity->getTransform());
+        }
+        command.loading = loading;
+        if (loading) m_loading_count++;
+
+        if (command.entity->getTriangleMesh())
+        {
+            // attributes are computed once here instead of on the first submit
+            ((TriangleMesh*)command.entity->getTriangleMesh())->computeAttributes(command.shader->requiredAttributes());
+        }
+        states[cidx] = { stateKey(command.state), cidx };
+        shaders[cidx] = { (UINT64)(size_t)command.shader, cidx };
+        materials[cidx] = { (UINT64)(size_t)command.entity->getMaterial(), cidx };
+        meshes[cidx] = { (UINT64)(size_t)command.entity->getTriangleMesh(), cidx };
+    }
+
+    DynamicArray<UINT64> state_ids;
+    DynamicArray<UINT64> shader_ids;
+    DynamicArray<UINT64> material_ids;
+    DynamicArray<UINT64> mesh_ids;
+    assignDenseIds(states, state_ids);
+    assignDenseIds(shaders, shader_ids);
+    assignDenseIds(materials, material_ids);
+    assignDenseIds(meshes, mesh_ids);
+
+    for (size_t cidx = 0; cidx < count; cidx++)
+    {
+        DrawCommand & command = m_commands[cidx];
+        command.state_id = state_ids[cidx];
+        command.sort_key = (min(state_ids[cidx],    (UINT64)0xffff) << 48) |
+                           (min(shader_ids[cidx],   (UINT64)0xffff) << 32) |
+                           (min(material_ids[cidx], (UINT64)0xffff) << 16) |
+                            min(mesh_ids[cidx],     (UINT64)0xffff);
+    }
+
+    if (m_commands.size() > 1)
+    {
+        ::qsort(m_commands.data(), m_commands.size(), sizeof(DrawCommand), compareDrawCommand);
+    }
+    m_compiled = true;
+}
+
+bool CommandBuffer::updateLoading()
+{
+    if (m_loading_count == 0) return false;
+
+    for (size_t cidx = 0; cidx < m_commands.size(); cidx++)
+    {
+        const DrawCommand & command = m_commands[cidx];
+        if (command.loading && !updateEntityLoading(command.entity))
+        {
+            compile();
+            break;
+        }
+    }
+    return m_loading_count > 0;
+}
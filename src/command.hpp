@@ -0,0 +1,100 @@
+#ifndef __COMMAND_HPP__
+#define __COMMAND_HPP__
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include "global.hpp"
+#include "maths.hpp"
+#include "darray.hpp"
+#include "mesh.hpp"
+#include "material.hpp"
+#include "entity.hpp"
+#include "shader.hpp"
+#include "scene.hpp"
+
+namespace LuGL
+{
+
+/**
+ * The part of the global pipeline state a recorded draw depends on, the
+ * default constructor captures the current global state.
+ */
+struct RenderState
+{
+    bool wireframe_mode;
+    bool depth_test;
+    bool backface_culling;
+    bool cluster_culling;
+    bool texture_filtering_linear;
+    bool texture_mipmapping;
+
+    RenderState();
+
+    void apply() const;
+    bool operator== (const RenderState & other) const;
+    bool operator!= (const RenderState & other) const { return !(*this == other); }
+};
+
+struct DrawCommand
+{
+    const Entity    *entity;
+    const Shader    *shader;
+    RenderState     state;
+    mat4            transform;
+    mat4            transform_inv;
+    mat3            model_inv_transpose;
+    float           scale;      // largest scale factor of the transform
+    bool            instanced;  // entity is an InstancedEntity, transform is unused
+    bool            entity_transform;   // transform is the one of the entity, taken again once it is loaded
+    bool            loading;    // entity was still loading at the last compile, drawn as a placeholder
+    size_t          state_id;   // commands with the same state_id share the same state
+    UINT64          sort_key;
+    size_t          order;      // record order, keeps the sorting stable
+};
+
+/**
+ * Records draws once so that static parts of a scene do not have to be
+ * traversed every frame. compile() sorts the commands by state, shader,
+ * material and mesh, Pipeline::submit() replays them and only changes the
+ * global state between commands with different states. Entities still
+ * loading are drawn as placeholders, updateLoading() compiles again once
+ * they are loaded so that their meshes are sorted in.
+ */
+class CommandBuffer
+{
+private:
+    DynamicArray<DrawCommand>   m_commands;
+    DynamicArray<Entity*>       m_owned_entities;   // created for mesh and material draws
+    RenderState                 m_state;
+    const Shader                *m_shader;
+    bool                        m_compiled;
+    size_t                      m_loading_count;    // commands still loading at the last compile
+
+    DrawCommand & record(const Entity * entity, const mat4 & transform);
+public:
+    CommandBuffer();
+    ~CommandBuffer();
+
+    void reset();
+    void setState(const RenderState & state) { m_state = state; }
+    void setShader(const Shader * shader) { m_shader = shader; }
+
+    void draw(const Entity * entity);
+    void draw(const Entity * entity, const mat4 & transform);
+    void draw(TriangleMesh * mesh, Material * material, const mat4 & transform);
+    void draw(const InstancedEntity * entity);
+    void recordScene(const Scene & scene);
+
+    void compile();
+    // returns true while an entity of the commands is still loading
+    bool updateLoading();
+
+    bool isCompiled() const { return m_compiled; }
+    size_t commandCount() const { return m_commands.size(); }
+    const DrawCommand & getCommand(size_t index) const { return m_commands[index]; }
+};
+
+}
+
+#endif
@@ -6,7 +6,9 @@
 #include <assert.h>
 #include <string.h>
 #include <utility>
+#include <new>
 #include "global.hpp"
+#include "allocator.hpp"
 
 namespace LuGL
 {
@@ -29,160 +31,377 @@ public:
 
 typedef Array<long,3> vec3i;
 
-// DynamicArray implement basic functionalities as STL std::vector
-template<typename T>
-class DynamicArray
+/**
+ * Inline buffer of the first N elements of a DynamicArray, so that short
+ * arrays never allocate. Derives from the allocator, empty allocators then
+ * take no space in the array.
+ */
+template<typename T, size_t N, typename Allocator>
+struct DynamicArrayStorage : Allocator
+{
+    alignas(T) byte_t m_inline[N * sizeof(T)];
+
+    DynamicArrayStorage(const Allocator & allocator): Allocator(allocator) {}
+    T * inlineData() const { return reinterpret_cast<T*>(const_cast<byte_t*>(m_inline)); }
+};
+template<typename T, typename Allocator>
+struct DynamicArrayStorage<T, 0, Allocator> : Allocator
+{
+    DynamicArrayStorage(const Allocator & allocator): Allocator(allocator) {}
+    T * inlineData() const { return nullptr; }
+};
+
+/**
+ * DynamicArray implement basic functionalities as STL std::vector.
+ * Elements are moved when the array grows. The first N elements are stored
+ * inside the array itself, and the rest comes from Allocator (see
+ * allocator.hpp), for example an ArenaAllocator for arrays living one frame.
+ */
+template<typename T, size_t N = 0, typename Allocator = HeapAllocator>
+class DynamicArray : private DynamicArrayStorage<T, N, Allocator>
 {
 private:
+    typedef DynamicArrayStorage<T, N, Allocator> Storage;
+
     T       *m_array;
     size_t  m_size;
     size_t  m_capacity;
 
+    bool isInline() const { return N > 0 && m_array == this->inlineData(); }
+    T * allocate(size_t capacity);
+    void deallocate();
+    void reallocate(size_t capacity);
+    void moveFrom(DynamicArray & array);
+
 public:
-    DynamicArray(): m_array(NULL),
-                    m_size(0),
-                    m_capacity(0) {}
-    DynamicArray(const size_t & reserve);
+    DynamicArray(const Allocator & allocator = Allocator());
+    explicit DynamicArray(size_t count, const Allocator & allocator = Allocator());
     DynamicArray(const DynamicArray & array);
+    DynamicArray(DynamicArray && array);
     ~DynamicArray();
 
-    void push_back(const T element);
+    DynamicArray & operator= (const DynamicArray & array);
+    DynamicArray & operator= (DynamicArray && array);
+
+    void push_back(const T & element);
+    void push_back(T && element);
+    template<typename... Args>
+    T& emplace_back(Args&&... args);
     void pop_back();
-    void reserve(size_t size);
-    T back() const;
-    T front() const;
-    T at(const size_t & pos) const;
+    void reserve(size_t capacity);
+    void resize(size_t size);
+    void resize(size_t size, const T & value);
+    void shrink_to_fit();
+    T& back();
+    const T& back() const;
+    T& front();
+    const T& front() const;
+    T& at(const size_t & pos);
+    const T& at(const size_t & pos) const;
     T& operator[] (const size_t & pos);
     const T& operator[] (const size_t & pos) const;
     void clear();
     bool empty() const;
     size_t size() const;
     size_t capacity() const;
-    T* data() const;
+    T* data();
+    const T* data() const;
+    T* begin() { return m_array; }
+    T* end() { return m_array + m_size; }
+    const T* begin() const { return m_array; }
+    const T* end() const { return m_array + m_size; }
+    const Allocator & allocator() const { return *this; }
 
     void sort(bool (*cmp)(const T &, const T &));
 };
 
 // note : classes with template have to implement their member functions within the header file
 // see : https://stackoverflow.com/questions/495021/why-can-templates-only-be-implemented-in-the-header-file
-template<typename T>
-DynamicArray<T>::DynamicArray(const size_t & reserve)
-{
-    m_size = reserve;
-    m_capacity = reserve;
-    m_array = new T[m_size];
-}
-template<typename T>
-DynamicArray<T>::DynamicArray(const DynamicArray & array)
+template<typename T, size_t N, typename Allocator>
+T * DynamicArray<T, N, Allocator>::allocate(size_t capacity)
 {
-    m_size = array.m_size;
-    m_capacity = array.m_capacity;
-    for (size_t i = 0; i < m_size; i++)
-    {
-        m_array[i] = std::move(array.m_array[i]);
-    }
+    if (capacity <= N) return this->inlineData();
+    return (T*)Allocator::allocate(capacity * sizeof(T), alignof(T));
 }
 
-template<typename T>
-DynamicArray<T>::~DynamicArray()
+// releases the storage, the elements have to be destroyed already
+template<typename T, size_t N, typename Allocator>
+void DynamicArray<T, N, Allocator>::deallocate()
 {
-    delete[] m_array;
+    if (m_array && !isInline()) Allocator::deallocate(m_array, m_capacity * sizeof(T));
+    m_array = N > 0 ? this->inlineData() : nullptr;
+    m_capacity = N;
 }
 
-template<typename T>
-void DynamicArray<T>::push_back(const T element)
+// moves the elements to a new storage of capacity elements, at least size()
+template<typename T, size_t N, typename Allocator>
+void DynamicArray<T, N, Allocator>::reallocate(size_t capacity)
 {
-    if (m_capacity == 0)
+    assert(capacity >= m_size);
+    if (capacity < N) capacity = N;
+    if (capacity == m_capacity) return;
+
+    T *new_array = allocate(capacity);
+    if (new_array != m_array)
     {
-        m_capacity = 1;
-        m_array = new T[m_capacity];
-        m_array[m_size++] = element;
+        for (size_t i = 0; i < m_size; i++)
+        {
+            new (new_array + i) T(std::move(m_array[i]));
+            m_array[i].~T();
+        }
+        if (m_array && !isInline()) Allocator::deallocate(m_array, m_capacity * sizeof(T));
     }
-    else if (m_size == m_capacity)
+    m_array = new_array;
+    m_capacity = capacity;
+}
+
+// takes the elements of an array, stealing its storage unless it is inline
+template<typename T, size_t N, typename Allocator>
+void DynamicArray<T, N, Allocator>::moveFrom(DynamicArray & array)
+{
+    if (array.isInline())
     {
-        m_capacity *= 2;
-        T *new_array = new T[m_capacity];
-        for (size_t i = 0; i < m_size; i++)
+        for (size_t i = 0; i < array.m_size; i++)
         {
-            new_array[i] = m_array[i];
+            new (m_array + i) T(std::move(array.m_array[i]));
+            array.m_array[i].~T();
         }
-        delete[] m_array;
-        m_array = new_array;
-        m_array[m_size++] = element;
+        m_size = array.m_size;
+        array.m_size = 0;
+        return;
     }
-    else
+    m_array = array.m_array;
+    m_size = array.m_size;
+    m_capacity = array.m_capacity;
+    array.m_array = N > 0 ? array.inlineData() : nullptr;
+    array.m_size = 0;
+    array.m_capacity = N;
+}
+
+template<typename T, size_t N, typename Allocator>
+DynamicArray<T, N, Allocator>::DynamicArray(const Allocator & allocator):
+    Storage(allocator),
+    m_array(N > 0 ? this->inlineData() : nullptr),
+    m_size(0),
+    m_capacity(N) {}
+
+// count default constructed elements
+template<typename T, size_t N, typename Allocator>
+DynamicArray<T, N, Allocator>::DynamicArray(size_t count, const Allocator & allocator):
+    DynamicArray(allocator)
+{
+    resize(count);
+}
+
+template<typename T, size_t N, typename Allocator>
+DynamicArray<T, N, Allocator>::DynamicArray(const DynamicArray & array):
+    DynamicArray(array.allocator())
+{
+    reserve(array.m_size);
+    for (size_t i = 0; i < array.m_size; i++)
     {
-        m_array[m_size++] = element;
+        new (m_array + i) T(array.m_array[i]);
     }
+    m_size = array.m_size;
+}
+
+template<typename T, size_t N, typename Allocator>
+DynamicArray<T, N, Allocator>::DynamicArray(DynamicArray && array):
+    DynamicArray(array.allocator())
+{
+    moveFrom(array);
+}
+
+template<typename T, size_t N, typename Allocator>
+DynamicArray<T, N, Allocator>::~DynamicArray()
+{
+    clear();
+    deallocate();
+}
+
+template<typename T, size_t N, typename Allocator>
+DynamicArray<T, N, Allocator> & DynamicArray<T, N, Allocator>::operator= (const DynamicArray & array)
+{
+    if (this == &array) return *this;
+
+    clear();
+    reserve(array.m_size);
+    for (size_t i = 0; i < array.m_size; i++)
+    {
+        new (m_array + i) T(array.m_array[i]);
+    }
+    m_size = array.m_size;
+    return *this;
+}
+
+// the allocator moves along with the storage
+template<typename T, size_t N, typename Allocator>
+DynamicArray<T, N, Allocator> & DynamicArray<T, N, Allocator>::operator= (DynamicArray && array)
+{
+    if (this == &array) return *this;
+
+    clear();
+    deallocate();
+    static_cast<Allocator&>(*this) = array.allocator();
+    moveFrom(array);
+    return *this;
+}
+
+template<typename T, size_t N, typename Allocator>
+void DynamicArray<T, N, Allocator>::push_back(const T & element)
+{
+    emplace_back(element);
 }
 
-template<typename T>
-void DynamicArray<T>::reserve(size_t size) {
-    if (m_capacity >= size) return;
+template<typename T, size_t N, typename Allocator>
+void DynamicArray<T, N, Allocator>::push_back(T && element)
+{
+    emplace_back(std::move(element));
+}
 
-    m_capacity = size;
-    T *new_array = new T[m_capacity];
+/**
+ * On growth the new element is constructed before the old elements are moved,
+ * so the arguments may refer to elements of the array itself.
+ */
+template<typename T, size_t N, typename Allocator>
+template<typename... Args>
+T& DynamicArray<T, N, Allocator>::emplace_back(Args&&... args)
+{
+    if (m_size < m_capacity)
+    {
+        new (m_array + m_size) T(std::forward<Args>(args)...);
+        return m_array[m_size++];
+    }
+
+    const size_t capacity = m_capacity > 0 ? m_capacity * 2 : 4;
+    T *new_array = allocate(capacity);
+    new (new_array + m_size) T(std::forward<Args>(args)...);
     for (size_t i = 0; i < m_size; i++)
     {
-        new_array[i] = m_array[i];
+        new (new_array + i) T(std::move(m_array[i]));
+        m_array[i].~T();
     }
-    delete[] m_array;
+    if (m_array && !isInline()) Allocator::deallocate(m_array, m_capacity * sizeof(T));
     m_array = new_array;
-    m_size = size;
+    m_capacity = capacity;
+    return m_array[m_size++];
 }
 
-template<typename T>
-void DynamicArray<T>::pop_back()
+template<typename T, size_t N, typename Allocator>
+void DynamicArray<T, N, Allocator>::pop_back()
 {
     assert(m_size > 0);
     m_size--;
     m_array[m_size].~T();
 }
 
-template<typename T>
-T DynamicArray<T>::back() const
+// only grows the capacity, size() is unchanged
+template<typename T, size_t N, typename Allocator>
+void DynamicArray<T, N, Allocator>::reserve(size_t capacity)
+{
+    if (m_capacity >= capacity) return;
+    reallocate(capacity);
+}
+
+template<typename T, size_t N, typename Allocator>
+void DynamicArray<T, N, Allocator>::resize(size_t size)
+{
+    reserve(size);
+    for (size_t i = m_size; i < size; i++)
+    {
+        new (m_array + i) T();
+    }
+    for (size_t i = size; i < m_size; i++)
+    {
+        m_array[i].~T();
+    }
+    m_size = size;
+}
+
+template<typename T, size_t N, typename Allocator>
+void DynamicArray<T, N, Allocator>::resize(size_t size, const T & value)
+{
+    if (size > m_capacity && m_size > 0 && &value >= m_array && &value < m_array + m_size)
+    {
+        // value is an element that the growth would move away
+        const T copy(value);
+        resize(size, copy);
+        return;
+    }
+    reserve(size);
+    for (size_t i = m_size; i < size; i++)
+    {
+        new (m_array + i) T(value);
+    }
+    for (size_t i = size; i < m_size; i++)
+    {
+        m_array[i].~T();
+    }
+    m_size = size;
+}
+
+template<typename T, size_t N, typename Allocator>
+void DynamicArray<T, N, Allocator>::shrink_to_fit()
+{
+    if (m_size == 0 && !isInline())
+    {
+        deallocate();
+        return;
+    }
+    reallocate(m_size);
+}
+
+template<typename T, size_t N, typename Allocator>
+T& DynamicArray<T, N, Allocator>::back()
 {
     assert(m_size > 0);
     return m_array[m_size - 1];
 }
-template<typename T>
-T DynamicArray<T>::front() const
+template<typename T, size_t N, typename Allocator>
+const T& DynamicArray<T, N, Allocator>::back() const
+{
+    assert(m_size > 0);
+    return m_array[m_size - 1];
+}
+template<typename T, size_t N, typename Allocator>
+T& DynamicArray<T, N, Allocator>::front()
 {
     assert(m_size > 0);
     return m_array[0];
 }
-template<typename T>
-T DynamicArray<T>::at(const size_t & pos) const
-{   
+template<typename T, size_t N, typename Allocator>
+const T& DynamicArray<T, N, Allocator>::front() const
+{
+    assert(m_size > 0);
+    return m_array[0];
+}
+template<typename T, size_t N, typename Allocator>
+T& DynamicArray<T, N, Allocator>::at(const size_t & pos)
+{
     assert(pos < m_size);
     return m_array[pos];
 }
-template<typename T>
-T& DynamicArray<T>::operator[] (const size_t & pos)
-{
-    assert(pos < m_capacity);
-    // if (pos >= m_capacity)
-    // {
-    //     m_capacity = pos + 1;
-    //     T *new_array = new T[m_capacity];
-    //     for (size_t i = 0; i < m_size; i++)
-    //     {
-    //         new_array[i] = m_array[i];
-    //     }
-    //     delete[] m_array;
-    //     m_array = new_array;
-    //     m_size = m_capacity;
-    // }
+template<typename T, size_t N, typename Allocator>
+const T& DynamicArray<T, N, Allocator>::at(const size_t & pos) const
+{
+    assert(pos < m_size);
     return m_array[pos];
 }
-template<typename T>
-const T& DynamicArray<T>::operator[] (const size_t & pos) const
+template<typename T, size_t N, typename Allocator>
+T& DynamicArray<T, N, Allocator>::operator[] (const size_t & pos)
 {
-    assert(pos < m_capacity);
+    assert(pos < m_size);
     return m_array[pos];
 }
-template<typename T>
-void DynamicArray<T>::clear()
+template<typename T, size_t N, typename Allocator>
+const T& DynamicArray<T, N, Allocator>::operator[] (const size_t & pos) const
+{
+    assert(pos < m_size);
+    return m_array[pos];
+}
+// destroys the elements, the capacity is kept
+template<typename T, size_t N, typename Allocator>
+void DynamicArray<T, N, Allocator>::clear()
 {
     for (size_t i = 0; i < m_size; i++)
     {
@@ -190,31 +409,37 @@ void DynamicArray<T>::clear()
     }
     m_size = 0;
 }
-template<typename T>
-bool DynamicArray<T>::empty() const
+template<typename T, size_t N, typename Allocator>
+bool DynamicArray<T, N, Allocator>::empty() const
 {
     return m_size == 0;
 }
-template<typename T>
-size_t DynamicArray<T>::size() const
+template<typename T, size_t N, typename Allocator>
+size_t DynamicArray<T, N, Allocator>::size() const
 {
     return m_size;
 }
-template<typename T>
-size_t DynamicArray<T>::capacity() const
+template<typename T, size_t N, typename Allocator>
+size_t DynamicArray<T, N, Allocator>::capacity() const
 {
     return m_capacity;
 }
-template<typename T>
-T* DynamicArray<T>::data() const
+template<typename T, size_t N, typename Allocator>
+T* DynamicArray<T, N, Allocator>::data()
+{
+    return m_array;
+}
+template<typename T, size_t N, typename Allocator>
+const T* DynamicArray<T, N, Allocator>::data() const
 {
     return m_array;
 }
 
-template<typename T>
-void DynamicArray<T>::sort(bool(*cmp)(const T &, const T &))
+template<typename T, size_t N, typename Allocator>
+void DynamicArray<T, N, Allocator>::sort(bool(*cmp)(const T &, const T &))
 {
-    qsort(m_array, 0, m_size - 1, cmp);
+    if (m_size < 2) return;
+    qsort(m_array, 0, (long)m_size - 1, cmp);
 }
 
 }
@@ -1,4 +1,6 @@
 #include "entity.hpp"
+#include "asset.hpp"
+#include "threadpool.hpp"
 
 using namespace LuGL;
 
@@ -8,11 +10,28 @@ EntityConfig::EntityConfig(const char * filename):
     diffuse_map(nullptr),
     specular_map(nullptr),
     normal_map(nullptr),
+    albedo_format(TEXTURE_FORMAT_RGBA32F),
+    diffuse_format(TEXTURE_FORMAT_RGBA32F),
+    specular_format(TEXTURE_FORMAT_RGBA32F),
+    normal_format(TEXTURE_FORMAT_RGBA32F),
+    bake(false),
+    virtual_maps(false),
     scale(vec3(1.0f, 1.0f, 1.0f))
 {
     loadFromFile(filename);
 }
 
+// format of a map line with scanned_items tokens, RGBA32F when it has none
+static TextureFormat mapFormat(int scanned_items, const char * name)
+{
+    TextureFormat format = TEXTURE_FORMAT_RGBA32F;
+    if (scanned_items == 2 && !Texture::parseFormat(name, &format))
+    {
+        printf("EntityConfig : unknown texture format: %s\n", name);
+    }
+    return format;
+}
+
 void EntityConfig::loadFromFile(const char * filename)
 {
     FILE *fp;
@@ -27,6 +46,7 @@ void EntityConfig::loadFromFile(const char * filename)
 
     char line_buffer[MAX_CONF_LINE];
     char filename_buffer[MAX_CONF_LINE];
+    char format_buffer[MAX_CONF_LINE];
     int scanned_items;
 
     while (fgets(line_buffer, MAX_CONF_LINE, fp))
@@ -42,40 +62,56 @@ void EntityConfig::loadFromFile(const char * filename)
         }
         else if (strncmp(line_buffer, "albedo ", 7) == 0)
         {
-            scanned_items = sscanf(line_buffer, "albedo %s", filename_buffer);
-            if (scanned_items == 1)
+            scanned_items = sscanf(line_buffer, "albedo %s %s", filename_buffer, format_buffer);
+            if (scanned_items >= 1)
             {
                 albedo_map = new char[strlen(filename_buffer) + 1];
                 strcpy(albedo_map, filename_buffer);
+                albedo_format = mapFormat(scanned_items, format_buffer);
             }
         }
         else if (strncmp(line_buffer, "diffuse ", 8) == 0)
         {
-            scanned_items = sscanf(line_buffer, "diffuse %s", filename_buffer);
-            if (scanned_items == 1)
+            scanned_items = sscanf(line_buffer, "diffuse %s %s", filename_buffer, format_buffer);
+            if (scanned_items >= 1)
             {
                 diffuse_map = new char[strlen(filename_buffer) + 1];
                 strcpy(diffuse_map, filename_buffer);
+                diffuse_format = mapFormat(scanned_items, format_buffer);
             }
         }
         else if (strncmp(line_buffer, "specular ", 9) == 0)
         {
-            scanned_items = sscanf(line_buffer, "specular %s", filename_buffer);
-            if (scanned_items == 1)
+            scanned_items = sscanf(line_buffer, "specular %s %s", filename_buffer, format_buffer);
+            if (scanned_items >= 1)
             {
                 specular_map = new char[strlen(filename_buffer) + 1];
                 strcpy(specular_map, filename_buffer);
+                specular_format = mapFormat(scanned_items, format_buffer);
             }
         }
         else if (strncmp(line_buffer, "normal ", 7) == 0)
         {
-            scanned_items = sscanf(line_buffer, "normal %s", filename_buffer);
-            if (scanned_items == 1)
+            scanned_items = sscanf(line_buffer, "normal %s %s", filename_buffer, format_buffer);
+            if (scanned_items >= 1)
             {
                 normal_map = new char[strlen(filename_buffer) + 1];
                 strcpy(normal_map, filename_buffer);
+                normal_format = mapFormat(scanned_items, format_buffer);
             }
         }
+        else if (strncmp(line_buffer, "sampler ", 8) == 0)
+        {
+            SamplerState::parse(line_buffer + 8, &sampler);
+        }
+        else if (strncmp(line_buffer, "bake", 4) == 0)
+        {
+            bake = true;
+        }
+        else if (strncmp(line_buffer, "virtual", 7) == 0)
+        {
+            virtual_maps = true;
+        }
         else if (strncmp(line_buffer, "scale ", 6) == 0)
         {
             float x, y, z;
@@ -90,6 +126,29 @@ void EntityConfig::loadFromFile(const char * filename)
     }
 }
 
+static char * copyString(const char * string)
+{
+    if (string == nullptr) return nullptr;
+    char *copy = new char[strlen(string) + 1];
+    strcpy(copy, string);
+    return copy;
+}
+
+EntityConfig::EntityConfig(const EntityConfig & config):
+    mesh_filename(copyString(config.mesh_filename)),
+    albedo_map(copyString(config.albedo_map)),
+    diffuse_map(copyString(config.diffuse_map)),
+    specular_map(copyString(config.specular_map)),
+    normal_map(copyString(config.normal_map)),
+    albedo_format(config.albedo_format),
+    diffuse_format(config.diffuse_format),
+    specular_format(config.specular_format),
+    normal_format(config.normal_format),
+    sampler(config.sampler),
+    bake(config.bake),
+    virtual_maps(config.virtual_maps),
+    scale(config.scale) {}
+
 EntityConfig::~EntityConfig()
 {
     if (mesh_filename)  delete mesh_filename;
@@ -102,56 +161,253 @@ EntityConfig::~EntityConfig()
     diffuse_map = nullptr;
     specular_map = nullptr;
     normal_map = nullptr;
+    albedo_format = TEXTURE_FORMAT_RGBA32F;
+    diffuse_format = TEXTURE_FORMAT_RGBA32F;
+    specular_format = TEXTURE_FORMAT_RGBA32F;
+    normal_format = TEXTURE_FORMAT_RGBA32F;
+    sampler = SamplerState();
+    bake = false;
+    virtual_maps = false;
 }
 
+/**
+ * Assets read by a worker thread for an entity created asynchronously. The
+ * worker only brings them into the AssetCache and keeps them referenced, the
+ * entity picks them up from the cache on the rendering thread.
+ */
+struct LuGL::EntityLoad
+{
+    EntityConfig        config;
+    std::future<void>   done;
+    TriangleMesh        *mesh;
+    DynamicArray<byte_t*> textures;
+
+    EntityLoad(const EntityConfig & entity_config):
+        config(entity_config),
+        mesh(nullptr) {}
+
+    void prefetch()
+    {
+        AssetCache & cache = Singleton<AssetCache>::get();
+        if (config.mesh_filename) mesh = cache.acquireMesh(config.mesh_filename);
+        if (config.virtual_maps) return; // pages are loaded as they are sampled
+        const char *maps[4] = { config.albedo_map, config.diffuse_map, config.specular_map, config.normal_map };
+        const TextureFormat formats[4] = { config.albedo_format, config.diffuse_format, config.specular_format, config.normal_format };
+        for (size_t midx = 0; midx < 4; midx++)
+        {
+            long width, height;
+            TextureFormat format = formats[midx];
+            TextureLayout layout = Texture::surfaceLayout(format, Singleton<Global>::get().texture_tiling);
+            byte_t *texels = maps[midx] ? cache.acquireTexture(maps[midx], &format, &layout, &width, &height) : nullptr;
+            if (texels) textures.push_back(texels);
+        }
+    }
+
+    void release()
+    {
+        AssetCache & cache = Singleton<AssetCache>::get();
+        if (mesh) cache.release(mesh);
+        for (size_t tidx = 0; tidx < textures.size(); tidx++)
+        {
+            cache.release(textures[tidx]);
+        }
+    }
+};
+
 Entity::Entity():
     m_transform(mat4::IDENTITY),
     m_distance(0.0f),
+    m_lod_level(0),
     m_material(nullptr),
     m_mesh(nullptr),
     m_material_need_delete(false),
-    m_mesh_need_delete(false) {}
+    m_mesh_acquired(false),
+    m_recenter(false),
+    m_load(nullptr) {}
 
-Entity::Entity(const entityConf & config):
+/**
+ * An asynchronous entity returns at once, its files are read on the workers
+ * of Singleton<ThreadPool>. Until they are, the entity has no mesh and its
+ * material only has base colors; Pipeline::draw and Pipeline::submit show a
+ * placeholder box and call updateLoading to pick the assets up.
+ */
+Entity::Entity(const entityConf & config, bool async):
     Entity()
 {
-    if (config.mesh_filename)
+    m_recenter = true;
+    if (!async)
     {
-        m_mesh = new TriangleMesh(config.mesh_filename);
-        m_mesh_need_delete = true;
+        loadAssets(config);
+        return;
     }
 
     m_material = new Material();
     m_material_need_delete = true;
+    m_transform.scale(config.scale);
+
+    EntityLoad *load = new EntityLoad(config);
+    load->done = Singleton<ThreadPool>::get().submit([load] { load->prefetch(); });
+    m_load = load;
+}
+
+Entity::~Entity()
+{
+    if (m_load) releaseLoad();  // nothing is drawn any more, the assets are not taken
+    if (m_material_need_delete) delete m_material;
+    if (m_mesh_acquired) Singleton<AssetCache>::get().release(m_mesh);
+}
+
+void Entity::loadAssets(const entityConf & config)
+{
+    if (config.mesh_filename)
+    {
+        // entities loaded from the same file share the mesh and the textures
+        m_mesh = Singleton<AssetCache>::get().acquireMesh(config.mesh_filename);
+        m_mesh_acquired = m_mesh != nullptr;
+    }
+
+    if (m_material == nullptr)
+    {
+        m_material = new Material();
+        m_material_need_delete = true;
+    }
 
     if (config.albedo_map)
     {
-        m_material->albedo.loadTextureSurface(config.albedo_map);
+        if (!config.virtual_maps || !m_material->albedo.loadVirtualSurface(config.albedo_map, config.albedo_format))
+        {
+            m_material->albedo.loadTextureSurface(config.albedo_map, config.albedo_format);
+        }
+        m_material->albedo.setSampler(config.sampler);
     }
     if (config.diffuse_map)
     {
-        m_material->diffuse.loadTextureSurface(config.diffuse_map);
+        if (!config.virtual_maps || !m_material->diffuse.loadVirtualSurface(config.diffuse_map, config.diffuse_format))
+        {
+            m_material->diffuse.loadTextureSurface(config.diffuse_map, config.diffuse_format);
+        }
+        m_material->diffuse.setSampler(config.sampler);
     }
     if (config.specular_map)
     {
-        m_material->specular.loadTextureSurface(config.specular_map);
+        if (!config.virtual_maps || !m_material->specular.loadVirtualSurface(config.specular_map, config.specular_format))
+        {
+            m_material->specular.loadTextureSurface(config.specular_map, config.specular_format);
+        }
+        m_material->specular.setSampler(config.sampler);
     }
     if (config.normal_map)
     {
-        m_material->normal.loadTextureSurface(config.normal_map);
+        if (!config.virtual_maps || !m_material->normal.loadVirtualSurface(config.normal_map, config.normal_format))
+        {
+            m_material->normal.loadTextureSurface(config.normal_map, config.normal_format);
+        }
+        m_material->normal.setSampler(config.sampler);
     }
-    vec3 center = m_mesh->getMeshCenter();
-    m_transform = mat4::fromTRS(-center, Quaternion::IDENTITY, vec3(1.0f, 1.0f, 1.0f));
-    m_transform.scale(config.scale);
+    if (config.bake)
+    {
+        m_material->bake();
+    }
+    if (m_mesh && m_recenter)
+    {
+        vec3 center = m_mesh->getMeshCenter();
+        m_transform = mat4::fromTRS(-center, Quaternion::IDENTITY, vec3(1.0f, 1.0f, 1.0f));
+        m_transform.scale(config.scale);
+    }
+    m_recenter = false;
 }
 
-Entity::~Entity()
+// the assets are already in the cache, acquiring them again does not touch the files
+void Entity::finishLoading()
 {
-    if (m_material_need_delete) delete m_material;
-    if (m_mesh_need_delete) delete m_mesh;
+    m_load->done.wait();
+    loadAssets(m_load->config);
+    releaseLoad();
+}
+
+// the worker has to be done before the assets it acquired are released
+void Entity::releaseLoad()
+{
+    m_load->done.wait();
+    m_load->release();
+    delete m_load;
+    m_load = nullptr;
+}
+
+// returns true while the assets of an asynchronous entity are still being read
+bool Entity::updateLoading()
+{
+    if (m_load == nullptr) return false;
+    if (m_load->done.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return true;
+
+    finishLoading();
+    return false;
+}
+
+/**
+ * Pick the coarsest LOD of the mesh whose geometric error, projected at the
+ * closest point of the bounding sphere, stays under the screen space
+ * threshold set by LUGL_LOD_THRESHOLD.
+ */
+size_t Entity::selectLODLevel(const Camera & camera, const mat4 & model_matrix, float viewport_height) const
+{
+    if (m_mesh == nullptr || m_mesh->lodCount() == 1) return 0;
+
+    const float scale = model_matrix.maxScale();
+    const vec3 center = vec3(model_matrix * vec4(m_mesh->getMeshCenter(), 1.0f));
+    const float distance = (center - camera.getPosition()).length() - m_mesh->getBoundingRadius() * scale;
+    if (distance <= EPSILON) return 0;
+
+    // pixels per world unit at the given distance
+    const float pixels = viewport_height / (2.0f * tanf(camera.getFOV() * 0.5f) * distance);
+    const float threshold = Singleton<Global>::get().lod_threshold;
+    size_t level = 0;
+    while (level + 1 < m_mesh->lodCount() &&
+           m_mesh->getLODError(level + 1) * scale * pixels <= threshold)
+    {
+        level++;
+    }
+    return level;
+}
+
+const TriangleMesh * Entity::selectLOD(const Camera & camera, const mat4 & model_matrix, float viewport_height) const
+{
+    m_lod_level = selectLODLevel(camera, model_matrix, viewport_height);
+    return m_mesh ? m_mesh->getLOD(m_lod_level) : nullptr;
 }
 
 bool Entity::compareDistance(Entity * const & a, Entity * const & b)
 {
     return a->m_distance < b->m_distance;
 }
+
+void InstancedEntity::initInstance(Instance & instance, const mat4 & transform, const vec4 & color)
+{
+    instance.transform = transform;
+    instance.transform_inv = transform.inversed();
+    instance.model_inv_transpose = mat3(instance.transform_inv.transposed());
+    instance.color = color;
+    instance.scale = transform.maxScale();
+}
+
+void InstancedEntity::addInstance(const mat4 & transform, const vec4 & color)
+{
+    Instance instance;
+    initInstance(instance, transform, color);
+    m_instances.push_back(instance);
+}
+
+void InstancedEntity::setInstance(size_t index, const mat4 & transform, const vec4 & color)
+{
+    assert(index < m_instances.size());
+    initInstance(m_instances[index], transform, color);
+}
+
+void InstancedEntity::setInstances(const mat4 * transforms, const vec4 * colors, size_t count)
+{
+    m_instances.clear();
+    for (size_t i = 0; i < count; i++)
+    {
+        addInstance(transforms[i], colors ? colors[i] : vec4(1.0f, 1.0f, 1.0f, 1.0f));
+    }
+}
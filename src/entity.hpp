@@ -9,6 +9,8 @@
 #include "maths.hpp"
 #include "mesh.hpp"
 #include "material.hpp"
+#include "camera.hpp"
+#include "stream.hpp"
 
 namespace LuGL
 {
@@ -23,39 +25,59 @@ public:
     char *diffuse_map;
     char *specular_map;
     char *normal_map;
+    TextureFormat albedo_format;    // optional second token of a map line, e.g. "albedo file.bmp bc1"
+    TextureFormat diffuse_format;
+    TextureFormat specular_format;
+    TextureFormat normal_format;
+    SamplerState sampler;           // of the maps, e.g. "sampler repeat trilinear aniso 4"
+    bool bake;                      // "bake" packs the maps into one surface, see Material::bake
+    bool virtual_maps;              // "virtual" streams the pages of the maps, see VirtualTexture
     vec3 scale;
 
     EntityConfig() = delete;
     EntityConfig(const char * filename);
+    EntityConfig(const EntityConfig & config);
     ~EntityConfig();
 
     void loadFromFile(const char * filename);
 };
 typedef EntityConfig entityConf;
 
+#define ENTITY_PLACEHOLDER_EXTENT 0.5f  // half size of the box drawn while the mesh is loading
+
+struct EntityLoad;
+
 class Entity
 {
 private:
     mat4            m_transform;
     float           m_distance;
+    mutable size_t  m_lod_level;
 
     Material        *m_material;
     TriangleMesh    *m_mesh;
     bool            m_material_need_delete;
-    bool            m_mesh_need_delete;
+    bool            m_mesh_acquired;    // m_mesh is released to the AssetCache
+    bool            m_recenter;         // move the mesh center to the origin once it is loaded
+    EntityLoad      *m_load;            // asynchronous load in flight
+
+    void loadAssets(const entityConf & config);
+    void finishLoading();
+    void releaseLoad();
 
 public:
     Entity();
-    Entity(const entityConf & config);
+    Entity(const entityConf & config, bool async = false);
     ~Entity();
 
-    void setTransform(const mat4 & transform) { m_transform = transform; }
+    void setTransform(const mat4 & transform) { m_transform = transform; m_recenter = false; }
     void setTransform(
         const vec3 & translate,
         const Quaternion & rotation,
         const vec3 & scale )
     {
         m_transform = mat4::fromTRS(translate, rotation, scale);
+        m_recenter = false;
     }
     const mat4 getTransform() const { return m_transform; }
 
@@ -66,10 +88,66 @@ public:
     void setMaterial(Material * material) { m_material = material; }
     const Material * getMaterial() const { return m_material; }
 
+    bool isLoading() const { return m_load != nullptr; }
+    bool updateLoading();
+
+    size_t selectLODLevel(const Camera & camera, const mat4 & model_matrix, float viewport_height) const;
+    const TriangleMesh * selectLOD(const Camera & camera, const mat4 & model_matrix, float viewport_height) const;
+    size_t getLODLevel() const { return m_lod_level; }
+
     void setDistance(float distance) { m_distance = distance; }
     static bool compareDistance(Entity * const & a, Entity * const & b);
 };
 
+struct Instance
+{
+    mat4    transform;
+    mat4    transform_inv;
+    mat3    model_inv_transpose;
+    vec4    color;
+    float   scale;      // largest scale factor of the transform
+};
+
+/**
+ * An entity drawn once for every instance, all the instances share the mesh
+ * and the material of the entity. The transform of an instance is its whole
+ * model matrix, the entity transform is not applied on top of it.
+ */
+class InstancedEntity : public Entity
+{
+private:
+    DynamicArray<Instance> m_instances;
+
+    static void initInstance(Instance & instance, const mat4 & transform, const vec4 & color);
+public:
+    InstancedEntity() {}
+    InstancedEntity(const entityConf & config, bool async = false): Entity(config, async) {}
+
+    void addInstance(const mat4 & transform, const vec4 & color = vec4(1.0f, 1.0f, 1.0f, 1.0f));
+    void setInstance(size_t index, const mat4 & transform, const vec4 & color = vec4(1.0f, 1.0f, 1.0f, 1.0f));
+    void setInstances(const mat4 * transforms, const vec4 * colors, size_t count);
+    void clearInstances() { m_instances.clear(); }
+
+    size_t instanceCount() const { return m_instances.size(); }
+    const Instance & getInstance(size_t index) const { return m_instances[index]; }
+};
+
+/**
+ * An entity whose mesh is streamed from disk chunk by chunk, only the chunks
+ * in view are made resident when it is drawn. It has no TriangleMesh.
+ */
+class StreamingEntity : public Entity
+{
+private:
+    StreamingMesh   *m_streaming_mesh;
+public:
+    StreamingEntity(): m_streaming_mesh(nullptr) {}
+    StreamingEntity(StreamingMesh * mesh): m_streaming_mesh(mesh) {}
+
+    void setStreamingMesh(StreamingMesh * mesh) { m_streaming_mesh = mesh; }
+    StreamingMesh * getStreamingMesh() const { return m_streaming_mesh; }
+};
+
 }
 
 #endif
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "envmap.hpp"
+#include "threadpool.hpp"
 
 using namespace LuGL;
 
@@ -6,25 +7,73 @@ using namespace LuGL;
 #define V2THETA(v) (PI * (v))
 #define U2PHI(u) (2.0f * PI * (u))
 
-Envmap::Envmap(const char * filename)
+Envmap::Envmap(const char * filename, bool async):
+    m_envmap_surface(nullptr),
+    m_envmap_texture(nullptr),
+    m_loading(nullptr),
+    m_loaded(nullptr)
 {
-    size_t len = strlen(filename);
-    if (strncmp(&filename[len - 4], "bmp", 3) == 0 || strncmp(&filename[len - 4], "BMP", 3) == 0)
+    memset(m_L, 0, sizeof(m_L));
+    if (async)
     {
-        printf("support only BMP format\n");
+        char *path = new char[strlen(filename) + 1];
+        strcpy(path, filename);
+        m_loading = new std::future<void>(Singleton<ThreadPool>::get().submit([this, path] {
+            m_loaded = new Envmap(path);
+            delete[] path;
+        }));
         return;
     }
 
-    BMPImage bmp_image(filename);
-    m_envmap_surface = new UniformImage(bmp_image);
-    m_envmap_surface->convertColorSpace(COLOR_RGB);
+    const char *extension = strrchr(filename, '.');
+    if (extension && strcmp(extension, TEXTURE_CONTAINER_EXTENSION) == 0)
+    {
+        m_envmap_texture = new Texture();
+        m_envmap_texture->loadTextureSurface(filename, TEXTURE_FORMAT_RGBA8);
+        if (m_envmap_texture->levelCount() == 0)
+        {
+            delete m_envmap_texture;
+            m_envmap_texture = nullptr;
+            return;
+        }
+    }
+    else
+    {
+        BMPImage bmp_image(filename);
+        if (!bmp_image.isLoaded()) return;
+        m_envmap_surface = new UniformImage(bmp_image, COLOR_RGB);
+    }
 
     calcSHCoefficients();
 }
 
 Envmap::~Envmap()
 {
+    if (m_loading)
+    {
+        m_loading->wait();
+        updateLoading();
+    }
     delete m_envmap_surface;
+    delete m_envmap_texture;
+}
+
+// returns true while the worker is still loading the envmap
+bool Envmap::updateLoading() const
+{
+    if (m_loading == nullptr) return false;
+    if (m_loading->wait_for(std::chrono::seconds(0)) != std::future_status::ready) return true;
+
+    delete m_loading;
+    m_loading = nullptr;
+    m_envmap_surface = m_loaded->m_envmap_surface;
+    m_envmap_texture = m_loaded->m_envmap_texture;
+    memcpy(m_L, m_loaded->m_L, sizeof(m_L));
+    m_loaded->m_envmap_surface = nullptr;
+    m_loaded->m_envmap_texture = nullptr;
+    delete m_loaded;
+    m_loaded = nullptr;
+    return false;
 }
 
 // convert spherical coordinates to cartesian coordinates
@@ -194,10 +243,35 @@ rgb Envmap::calcIrradianceFast(const vec2 & sh) const
     );
 }
 
+long Envmap::surfaceWidth() const
+{
+    return m_envmap_texture ? m_envmap_texture->getTextureWidth() : m_envmap_surface->getImageWidth();
+}
+
+long Envmap::surfaceHeight() const
+{
+    return m_envmap_texture ? m_envmap_texture->getTextureHeight() : m_envmap_surface->getImageHeight();
+}
+
+// color in [0, 255] at row y from the top, texture rows start at the bottom like the BMP they come from
+rgb Envmap::surfaceColor(long x, long y) const
+{
+    if (m_envmap_texture)
+    {
+        const vec4 color = m_envmap_texture->colorAt(x, surfaceHeight() - 1 - y);
+        return rgb(color.r, color.g, color.b) * 255.0f;
+    }
+    return rgb(
+        (float)(*m_envmap_surface)(y, x, 0),
+        (float)(*m_envmap_surface)(y, x, 1),
+        (float)(*m_envmap_surface)(y, x, 2)
+    );
+}
+
 vec2 Envmap::getSH(long x, long y)
 {
-    float U = (float)x / (m_envmap_surface->getImageWidth() - 1);
-    float V = (float)y / (m_envmap_surface->getImageHeight() - 1);
+    float U = (float)x / (surfaceWidth() - 1);
+    float V = (float)y / (surfaceHeight() - 1);
     return vec2(
         V2THETA(V), // theta
         U2PHI(U)    // phi
@@ -207,8 +281,8 @@ vec2 Envmap::getSH(long x, long y)
 void Envmap::calcSHCoefficients()
 {
     float surface_integral = 0.0f;
-    long im_w = m_envmap_surface->getImageWidth();
-    long im_h = m_envmap_surface->getImageHeight();
+    long im_w = surfaceWidth();
+    long im_h = surfaceHeight();
     for (long y = 0; y < im_h; y++)
     {
         float V = (float)y / (im_h - 1);
@@ -230,9 +304,10 @@ void Envmap::calcSHCoefficients()
                 {
                     const vec2 sh = getSH(x, y);
                     const float Y_lm = getY(l, m, sh);
-                    m_L[getSHIndex(l, m) * 3] += (float)(*m_envmap_surface)(y, x, 0) * Y_lm * sinf(sh.theta);
-                    m_L[getSHIndex(l, m) * 3 + 1] += (float)(*m_envmap_surface)(y, x, 1) * Y_lm * sinf(sh.theta);
-                    m_L[getSHIndex(l, m) * 3 + 2] += (float)(*m_envmap_surface)(y, x, 2) * Y_lm * sinf(sh.theta);
+                    const rgb color = surfaceColor(x, y);
+                    m_L[getSHIndex(l, m) * 3] += color.r * Y_lm * sinf(sh.theta);
+                    m_L[getSHIndex(l, m) * 3 + 1] += color.g * Y_lm * sinf(sh.theta);
+                    m_L[getSHIndex(l, m) * 3 + 2] += color.b * Y_lm * sinf(sh.theta);
                 }
             }
             m_L[getSHIndex(l, m) * 3] *= factor / 255.0f;
@@ -256,6 +331,15 @@ rgb Envmap::getPixel(float theta, float phi) const
 
     assert(theta >= 0.0f && theta <= PI);
     assert(phi >= 0.0f && phi <= PI * 2.0f);
+    if (m_envmap_texture)
+    {
+        const vec4 color = Texture::sampler(*m_envmap_texture, vec2(
+            phi / (2.0f * PI),
+            theta / PI
+        ));
+        return rgb(color.r, color.g, color.b);
+    }
+    if (m_envmap_surface == nullptr) return rgb(0.0f, 0.0f, 0.0f);
 
     rgb color = UniformImage::sampler(*m_envmap_surface, vec2(
         phi / (2.0f * PI),
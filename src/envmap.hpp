@@ -6,26 +6,46 @@
 #include "assert.h"
 #include "global.hpp"
 #include "image.hpp"
+#include "material.hpp"
 #include "light.hpp"
 
 namespace LuGL
 {
 
+/**
+ * An envmap created asynchronously returns at once, the image is read and
+ * the SH coefficients computed on a worker of Singleton<ThreadPool>. It
+ * stays black until Pipeline::draw or Pipeline::submit calls updateLoading
+ * after the worker is done, which installs the result. A texture container
+ * is sampled where it is mapped instead of being copied into an image.
+ */
 class Envmap
 {
 private:
-    UniformImage* m_envmap_surface;
-    float m_L[27];
+    mutable UniformImage* m_envmap_surface;
+    mutable Texture* m_envmap_texture;
+    mutable float m_L[27];
+    mutable std::future<void> *m_loading;
+    mutable Envmap *m_loaded;   // written by the worker, read once m_loading is ready
 
+    long surfaceWidth() const;
+    long surfaceHeight() const;
+    rgb surfaceColor(long x, long y) const;
     float calcE(const vec2 & sh, long channel) const;
     vec2 getSH(long x, long y);
     void calcSHCoefficients();
 
 public:
     Envmap() = delete;
-    Envmap(const char * filename);
+    Envmap(const char * filename, bool async = false);
     ~Envmap();
 
+    Envmap(const Envmap &) = delete;
+    Envmap & operator= (const Envmap &) = delete;
+
+    bool isLoading() const { return m_loading != nullptr; }
+    bool updateLoading() const;
+
     const float * getCoefficients() const { return &m_L[0]; }
 
     rgb calcIrradiance(const vec3 & view_dir) const;
@@ -1,6 +1,14 @@
 #ifndef __GLOBAL_HPP__
 #define __GLOBAL_HPP__
 
+// standard headers using the names min and max go before the macros below
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <deque>
+
 namespace LuGL
 {
 
@@ -32,7 +40,12 @@ public:
     bool wireframe_mode = false;
     bool depth_test = true;
     bool backface_culling = true;
+    bool cluster_culling = true;
+    bool front_to_back = true;      // sort entities and meshlets by view depth every frame
+    float lod_threshold = 1.0f;     // screen space error in pixels allowed for mesh LODs
     bool texture_filtering_linear = TF_LINEAR;
+    bool texture_mipmapping = true; // sample minified textures from their mip chain
+    bool texture_tiling = true;     // store the textures loaded from now on in 4x4 tiles
     unsigned short sample_option = LUGL_SAMPLE_DEFAULT;
 
     Global() {}
@@ -41,7 +54,12 @@ public:
 #define LUGL_WIREFRAME_MODE(val)     (Singleton<Global>::get().wireframe_mode=val)
 #define LUGL_DEPTH_TEST(val)         (Singleton<Global>::get().depth_test=val)
 #define LUGL_BACKFACE_CULLING(val)   (Singleton<Global>::get().backface_culling=val)
+#define LUGL_CLUSTER_CULLING(val)    (Singleton<Global>::get().cluster_culling=val)
+#define LUGL_FRONT_TO_BACK(val)      (Singleton<Global>::get().front_to_back=val)
+#define LUGL_LOD_THRESHOLD(val)      (Singleton<Global>::get().lod_threshold=val)
 #define LUGL_TEXTURE_FILTERING(val)  (Singleton<Global>::get().texture_filtering_linear=val)
+#define LUGL_TEXTURE_MIPMAPPING(val) (Singleton<Global>::get().texture_mipmapping=val)
+#define LUGL_TEXTURE_TILING(val)     (Singleton<Global>::get().texture_tiling=val)
 #define LUGL_SAMPLE_OPTION(val)      (Singleton<Global>::get().sample_option=val)
 
 typedef unsigned char       byte_t;  // 1 bytes
@@ -8,13 +8,10 @@ using namespace LuGL;
  *  - limit the use of platte image
  */
 
-void BMPImage::loadFileHeaderx64(FILE *fp)
+void BMPImage::loadFileHeaderx64(const byte_t *data)
 {
-    byte_t *temp_buffer = new byte_t[LBI_FILE_HEADER_SIZE];
-    byte_t *ptr = temp_buffer;
+    const byte_t *ptr = data;
 
-    fseek(fp, 0L, SEEK_SET);
-    fread(temp_buffer, LBI_FILE_HEADER_SIZE, 1, fp);
     memcpy(&(m_file_header.signature), ptr, sizeof(UINT16));
     ptr += sizeof(UINT16);
     memcpy(&(m_file_header.file_size), ptr, sizeof(UINT32));
@@ -22,8 +19,6 @@ void BMPImage::loadFileHeaderx64(FILE *fp)
     memcpy(&(m_file_header.reserved), ptr, sizeof(UINT32));
     ptr += sizeof(UINT32);
     memcpy(&(m_file_header.data_offset), ptr, sizeof(UINT32));
-
-    delete[] temp_buffer;
 }
 void BMPImage::writeFileHeaderx64(FILE *fp) const
 {
@@ -44,26 +39,50 @@ void BMPImage::writeFileHeaderx64(FILE *fp) const
     delete[] temp_buffer;
 }
 
+/**
+ * The file is mapped instead of read. Rows without padding, as in 24 bit
+ * images whose width is a multiple of 4, are used where they are mapped
+ * and never copied. The mapping is copy-on-write, writing to the buffer
+ * does not change the file. A QOI file, whatever its name, is decoded into
+ * a 24 bit image.
+ */
 void BMPImage::loadImage()
 {
-    FILE *fp;
     assert(m_filename != nullptr);
-    fp = fopen(m_filename, "rb");
-    if (fp == nullptr)
+    MappedFile *file = new MappedFile();
+    if (!file->open(m_filename))
     {
         printf("BMPImage : image file: %s open failed\n", m_filename);
+        delete file;
         return;
     }
-    loadFileHeaderx64(fp);
-    if (m_file_header.signature != LBI_BM)
+    const byte_t *data = file->data();
+    const size_t file_size = file->size();
+    if (QOICodec::isStream(data, file_size))
+    {
+        long width, height;
+        byte_t *buffer = QOICodec::decode(data, file_size, &width, &height);
+        delete file;
+        if (buffer == nullptr)
+        {
+            printf("BMPImage : image file: %s is not a valid QOI image\n", m_filename);
+            clean();
+            return;
+        }
+        setupHeaders(width, height);
+        m_buffer = buffer;
+        m_is_loaded = true;
+        return;
+    }
+    if (file_size >= LBI_FILE_HEADER_SIZE + sizeof(BMPInfoHeader)) loadFileHeaderx64(data);
+    if (file_size < LBI_FILE_HEADER_SIZE + sizeof(BMPInfoHeader) || m_file_header.signature != LBI_BM)
     {
         printf("BMPImage : file format error\n");
+        delete file;
         clean();
-        fclose(fp);
         return;
     }
-    fseek(fp, LBI_FILE_HEADER_SIZE, SEEK_SET);
-    fread(&m_info_header, sizeof(BMPInfoHeader), 1, fp);
+    memcpy(&m_info_header, data + LBI_FILE_HEADER_SIZE, sizeof(BMPInfoHeader));
     if (m_info_header.height < 0)
     {
         m_info_header.height = fabs(m_info_header.height);
@@ -73,11 +92,16 @@ void BMPImage::loadImage()
     {
         m_use_color_table = true;
         size_t color_tables_offset = LBI_FILE_HEADER_SIZE + sizeof(BMPInfoHeader);
-        fseek(fp, color_tables_offset, SEEK_SET);
-
         size_t color_num = m_info_header.colors_used;
+        if (color_tables_offset + color_num * sizeof(BMPColorTable) > file_size)
+        {
+            printf("BMPImage : image file: %s is truncated\n", m_filename);
+            delete file;
+            clean();
+            return;
+        }
         m_color_tables = new BMPColorTable[color_num];
-        fread(m_color_tables, sizeof(BMPColorTable), color_num, fp);
+        memcpy(m_color_tables, data + color_tables_offset, color_num * sizeof(BMPColorTable));
     }
     else
     {
@@ -85,31 +109,41 @@ void BMPImage::loadImage()
     }
 
     size_t offset = m_file_header.data_offset;
-    fseek(fp, offset, SEEK_SET);
     size_t height = getImageHeight();
     size_t data_line = getDataLine();
 
     if (data_line == 0)
     {
         printf("BMPImage : unsupported bits per pixel\n");
+        delete file;
         clean();
-        fclose(fp);
         return;
     }
     size_t scan_line = ((data_line + 3) / 4) * 4;
+    if (height == 0 || offset + scan_line * (height - 1) + data_line > file_size)
+    {
+        printf("BMPImage : image file: %s is truncated\n", m_filename);
+        delete file;
+        clean();
+        return;
+    }
 
-    m_buffer = new byte_t[data_line * height];
-    byte_t *temp_buffer = new byte_t[scan_line];
-    for (size_t i = 0; i < height; i++)
+    if (scan_line == data_line)
     {
-        fread(temp_buffer, sizeof(byte_t), scan_line, fp);
-        memcpy(m_buffer + i * data_line, temp_buffer, data_line);
+        m_buffer = file->data() + offset;
+        m_mapped_file = file;
+    }
+    else
+    {
+        m_buffer = new byte_t[data_line * height];
+        for (size_t i = 0; i < height; i++)
+        {
+            memcpy(m_buffer + i * data_line, data + offset + i * scan_line, data_line);
+        }
+        delete file;
     }
-    
-    delete[] temp_buffer;
 
     m_is_loaded = true;
-    fclose(fp);
 }
 void BMPImage::setReverseY(bool val)
 {
@@ -119,10 +153,13 @@ void BMPImage::clean()
 {
     if (m_color_tables)
         delete[] m_color_tables;
-    delete[] m_buffer;
+    if (!isMapped())
+        delete[] m_buffer;
+    delete m_mapped_file;
     delete[] m_filename;
     m_color_tables = nullptr;
     m_buffer = nullptr;
+    m_mapped_file = nullptr;
     m_is_loaded = false;
     m_filename = nullptr;
 }
@@ -145,6 +182,7 @@ size_t BMPImage::getDataLine() const
 }
 BMPImage::BMPImage(const char* filename): m_color_tables(nullptr),
                                           m_buffer(nullptr),
+                                          m_mapped_file(nullptr),
                                           m_is_loaded(false),
                                           m_use_color_table(false),
                                           m_filename(nullptr)
@@ -158,6 +196,7 @@ BMPImage::BMPImage(const char* filename): m_color_tables(nullptr),
 BMPImage::BMPImage(const size_t & width, const size_t & height)
     : m_color_tables(nullptr)
     , m_buffer(nullptr)
+    , m_mapped_file(nullptr)
     , m_is_loaded(false)
     , m_use_color_table(false)
     , m_filename(nullptr)
@@ -166,7 +205,17 @@ BMPImage::BMPImage(const size_t & width, const size_t & height)
     size_t f_len = strlen(default_filename);
     m_filename = new char[f_len + 1];
     strcpy(m_filename, default_filename);
+    setupHeaders(width, height);
+
+    size_t data_line = getDataLine();
+    m_buffer = new byte_t[data_line * height];
+    memset(m_buffer, 0, data_line * height);
 
+    m_is_loaded = true;
+}
+// headers of a 24 bit image
+void BMPImage::setupHeaders(size_t width, size_t height)
+{
     m_file_header.signature = LBI_BM;
     m_file_header.file_size = width * height * 3;
     m_file_header.data_offset = 54;
@@ -182,15 +231,10 @@ BMPImage::BMPImage(const size_t & width, const size_t & height)
     m_info_header.Y_pixels_per_M = 3780;
     m_info_header.colors_used = 0;
     m_info_header.important_colors = 0;
-
-    size_t data_line = getDataLine();
-    m_buffer = new byte_t[data_line * height];
-    memset(m_buffer, 0, data_line * height);
-
-    m_is_loaded = true;
 }
 BMPImage::BMPImage(const BMPImage & image): m_color_tables(nullptr),
                                             m_buffer(nullptr),
+                                            m_mapped_file(nullptr),
                                             m_is_loaded(false),
                                             m_use_color_table(false),
                                             m_filename(nullptr)
@@ -254,6 +298,12 @@ void BMPImage::writeImage(const char* filename) const
         printf("BMPImage : image unloaded\n");
         return;
     }
+    const char *extension = strrchr(filename, '.');
+    if (extension && strcmp(extension, QOI_EXTENSION) == 0)
+    {
+        writeQOIImage(filename);
+        return;
+    }
     FILE *fp;
     fp = fopen(filename, "wb");
     if (fp == nullptr)
@@ -284,6 +334,31 @@ void BMPImage::writeImage(const char* filename) const
 
     fclose(fp);
 }
+void BMPImage::writeQOIImage(const char* filename) const
+{
+    if (m_info_header.bits_per_pixel != 24)
+    {
+        printf("BMPImage : only 24 bit images can be written as QOI\n");
+        return;
+    }
+    size_t size;
+    byte_t *stream = QOICodec::encode(m_buffer, getImageWidth(), getImageHeight(), m_info_header.height < 0, &size);
+    if (stream == nullptr) return;
+
+    FILE *fp = fopen(filename, "wb");
+    if (fp == nullptr)
+    {
+        printf("BMPImage : image file: %s open failed\n", filename);
+        delete[] stream;
+        return;
+    }
+    if (fwrite(stream, 1, size, fp) != size)
+    {
+        printf("BMPImage : image file: %s write failed\n", filename);
+    }
+    fclose(fp);
+    delete[] stream;
+}
 byte_t* & BMPImage::getImageBuffer()
 {
     return m_buffer;
@@ -318,12 +393,12 @@ UniformImage::UniformImage(size_t width, size_t height): m_width(width),
     m_buffer = new byte_t[m_width * m_height * 3];
     memset(m_buffer, 0, m_width * m_height * 3);
 }
-UniformImage::UniformImage(const BMPImage & bmp): m_width(0),
-                                                  m_height(0),
-                                                  m_buffer(nullptr),
-                                                  m_color_space(COLOR_RGB)
+UniformImage::UniformImage(const BMPImage & bmp, COLOR_SPACE color_space): m_width(0),
+                                                                          m_height(0),
+                                                                          m_buffer(nullptr),
+                                                                          m_color_space(COLOR_RGB)
 {
-    createFromBMPImage(bmp);
+    createFromBMPImage(bmp, color_space);
 }
 UniformImage::~UniformImage()
 {
@@ -459,7 +534,8 @@ Vector3 UniformImage::sampler(const UniformImage & image, const Vector2 & texcoo
     }
 }
 
-void UniformImage::createFromBMPImage(const BMPImage & bmp)
+// rows are flipped to top to bottom, and swapped to RGB in the same pass if color_space is COLOR_RGB
+void UniformImage::createFromBMPImage(const BMPImage & bmp, COLOR_SPACE color_space)
 {
     if (!bmp.isLoaded())
     {
@@ -473,17 +549,34 @@ void UniformImage::createFromBMPImage(const BMPImage & bmp)
     }
     m_width = bmp.getImageWidth();
     m_height = bmp.getImageHeight();
-    m_color_space = COLOR_BGR;
+    m_color_space = color_space == COLOR_RGB ? COLOR_RGB : COLOR_BGR;
 
     size_t row_size = m_width * 3;
     size_t buffer_size = row_size * m_height;
 
-    byte_t *src_buffer = bmp.getImageBufferConst();
+    const byte_t *src_buffer = bmp.getImageBufferConst();
+    delete[] m_buffer;
     m_buffer = new byte_t[buffer_size];
-    for (size_t i = 0; i < m_height; i++)
+#ifdef _OPENMP
+#pragma omp parallel for if(buffer_size >= (1 << 20))
+#endif
+    for (long i = 0; i < (long)m_height; i++)
     {
-        memcpy(m_buffer + i * row_size, src_buffer + (m_height - i - 1) * row_size, row_size);
+        byte_t *dst_row = m_buffer + i * row_size;
+        const byte_t *src_row = src_buffer + (m_height - i - 1) * row_size;
+        if (m_color_space == COLOR_BGR)
+        {
+            memcpy(dst_row, src_row, row_size);
+            continue;
+        }
+        for (size_t j = 0; j < row_size; j += 3)
+        {
+            dst_row[j] = src_row[j + 2];
+            dst_row[j + 1] = src_row[j + 1];
+            dst_row[j + 2] = src_row[j];
+        }
     }
+    convertColorSpace(color_space);
 }
 
 void UniformImage::convertColorSpace(const unsigned short mode)
@@ -8,6 +8,8 @@
 #include <utility>
 #include "maths.hpp"
 #include "global.hpp"
+#include "mapfile.hpp"
+#include "qoi.hpp"
 
 #define LBI_BM 0x4d42    // ASCII code for 'BM'
 #define LBI_FILE_HEADER_SIZE 14L
@@ -81,19 +83,23 @@ private:
     BMPColorTable *m_color_tables;
     byte_t *m_buffer;               // color is arranged in RGB order
                                     // rows are arranged from bottom to top
+    MappedFile    *m_mapped_file;   // m_buffer points into it when the rows are not padded
     bool          m_is_loaded;
     bool          m_use_color_table;
     char          *m_filename;
 
-    void loadFileHeaderx64(FILE *fp);
+    void loadFileHeaderx64(const byte_t *data);
     void writeFileHeaderx64(FILE *fp) const;
+    void setupHeaders(size_t width, size_t height);
     void loadImage();
+    void writeQOIImage(const char* filename) const;
     void clean();
     size_t getDataLine() const;
 
 public:
     BMPImage(): m_color_tables(nullptr),
                 m_buffer(nullptr),
+                m_mapped_file(nullptr),
                 m_is_loaded(false),
                 m_use_color_table(false),
                 m_filename(nullptr) {}
@@ -106,6 +112,7 @@ public:
     INT32  getImageWidth()  const { return m_info_header.width; }
     INT32  getImageHeight() const { return abs(m_info_header.height); }
     bool   isLoaded()       const { return m_is_loaded; }
+    bool   isMapped()       const { return m_mapped_file && m_mapped_file->contains(m_buffer); }
     size_t getChannelNum()  const;
     void   setReverseY(bool val);
 
@@ -113,6 +120,7 @@ public:
     byte_t& operator() (const size_t & row, const size_t & column, const size_t & channel);
 
     /* Member Functions */
+    // written as QOI if filename ends with QOI_EXTENSION
     void writeImage(const char* filename) const;
     void printImageInfo() const;
     byte_t* & getImageBuffer();
@@ -156,12 +164,12 @@ public:
                     m_buffer(nullptr),
                     m_color_space(COLOR_RGB) {}
     UniformImage(size_t width, size_t height);
-    UniformImage(const BMPImage & bmp);
+    UniformImage(const BMPImage & bmp, COLOR_SPACE color_space = COLOR_BGR);
     ~UniformImage();
 
     byte_t& operator() (const size_t & row, const size_t & column, const size_t & channel);
 
-    void createFromBMPImage(const BMPImage & bmp);
+    void createFromBMPImage(const BMPImage & bmp, COLOR_SPACE color_space = COLOR_BGR);
     void convertColorSpace(const unsigned short mode);
     byte_t* & getImageBuffer();
     byte_t* getImageBufferConst() const;
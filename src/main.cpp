@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "api.hpp"
 #include "sample/sample.hpp"
 
@@ -7,6 +8,8 @@ int main(int argc, char * argv[]) {
     int return_value = 0;
     int launch_case = 0;
     char default_model[] = "spot";
+    char default_mesh[] = "assets/meshes/spot.obj";
+    char default_texture[] = "assets/textures/spot.bmp";
     {
         if (argc > 1) launch_case = atoi(argv[1]);
         switch (launch_case)
@@ -26,6 +29,36 @@ int main(int argc, char * argv[]) {
             case 3:
                 return_value = normal_mapping_demo();
                 break;
+            case 4:
+                if (argc > 2)
+                    return_value = mesh_convert(argv[2], false, argc > 3 && strcmp(argv[3], "packed") == 0);
+                else
+                    return_value = mesh_convert(default_mesh);
+                break;
+            case 5:
+                if (argc > 2)
+                    return_value = mesh_convert(argv[2], true, argc > 3 && strcmp(argv[3], "packed") == 0);
+                else
+                    return_value = mesh_convert(default_mesh, true);
+                break;
+            case 6:
+                if (argc > 2)
+                    return_value = texture_bench(argv[2], argc > 3 ? atol(argv[3]) : 4);
+                else
+                    return_value = texture_bench(default_texture);
+                break;
+            case 7:
+                if (argc > 2)
+                    return_value = texture_convert(argv[2], argc > 3 ? argv[3] : nullptr);
+                else
+                    return_value = texture_convert(default_texture);
+                break;
+            case 8:
+                if (argc > 3)
+                    return_value = image_convert(argv[2], argv[3]);
+                else
+                    return_value = image_convert(default_texture, "spot.qoi");
+                break;
         }
     }
     return return_value;
@@ -0,0 +1,147 @@
+#include "mapfile.hpp"
+#include <sys/stat.h>
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace LuGL;
+
+MappedFile::MappedFile():
+    m_data(nullptr),
+    m_size(0),
+    m_view(nullptr),
+    m_view_size(0) {}
+
+MappedFile::MappedFile(const char * filename):
+    MappedFile()
+{
+    open(filename);
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const char * filename, UINT64 offset, UINT64 size)
+{
+    close();
+
+#if defined(_WIN32) || defined(_WIN64)
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        printf("MappedFile : file: %s open failed\n", filename);
+        return false;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || (UINT64)file_size.QuadPart <= offset ||
+        (size > 0 && offset + size > (UINT64)file_size.QuadPart))
+    {
+        CloseHandle(file);
+        printf("MappedFile : file: %s is empty or shorter than the region\n", filename);
+        return false;
+    }
+    if (size == 0) size = file_size.QuadPart - offset;
+
+    // views have to start at the allocation granularity
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    const UINT64 view_offset = offset / system_info.dwAllocationGranularity * system_info.dwAllocationGranularity;
+    const size_t view_size = (size_t)(size + offset - view_offset);
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    void *view = mapping ? MapViewOfFile(mapping, FILE_MAP_COPY, (DWORD)(view_offset >> 32), (DWORD)view_offset, view_size) : NULL;
+    if (mapping) CloseHandle(mapping);
+    CloseHandle(file);
+    if (view == NULL)
+    {
+        printf("MappedFile : file: %s map failed\n", filename);
+        return false;
+    }
+#else
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("MappedFile : file: %s open failed\n", filename);
+        return false;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || (UINT64)file_stat.st_size <= offset ||
+        (size > 0 && offset + size > (UINT64)file_stat.st_size))
+    {
+        ::close(fd);
+        printf("MappedFile : file: %s is empty or shorter than the region\n", filename);
+        return false;
+    }
+    if (size == 0) size = file_stat.st_size - offset;
+
+    // mappings have to start at a page boundary
+    const UINT64 page_size = sysconf(_SC_PAGESIZE);
+    const UINT64 view_offset = offset / page_size * page_size;
+    const size_t view_size = (size_t)(size + offset - view_offset);
+    void *view = mmap(nullptr, view_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, (off_t)view_offset);
+    ::close(fd);
+    if (view == MAP_FAILED)
+    {
+        printf("MappedFile : file: %s map failed\n", filename);
+        return false;
+    }
+#endif
+    m_view = static_cast<byte_t*>(view);
+    m_view_size = view_size;
+    m_data = m_view + (offset - view_offset);
+    m_size = (size_t)size;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (m_view == nullptr) return;
+
+#if defined(_WIN32) || defined(_WIN64)
+    UnmapViewOfFile(m_view);
+#else
+    munmap(m_view, m_view_size);
+#endif
+    m_view = nullptr;
+    m_view_size = 0;
+    m_data = nullptr;
+    m_size = 0;
+}
+
+// hint the system to read the mapped pages ahead of their first use
+void MappedFile::willNeed() const
+{
+    if (m_view == nullptr) return;
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    madvise(m_view, m_view_size, MADV_WILLNEED);
+#endif
+}
+
+bool MappedFile::modifiedTime(const char * filename, INT64 * time)
+{
+    struct stat file_stat;
+    if (stat(filename, &file_stat) != 0) return false;
+    *time = file_stat.st_mtime;
+    return true;
+}
+
+bool MappedFile::fileStamp(const char * filename, INT64 * time, UINT64 * size)
+{
+    struct stat file_stat;
+    if (stat(filename, &file_stat) != 0) return false;
+#if defined(_WIN32) || defined(_WIN64)
+    *time = (INT64)file_stat.st_mtime * 1000000000;
+#elif defined(__APPLE__)
+    *time = (INT64)file_stat.st_mtimespec.tv_sec * 1000000000 + file_stat.st_mtimespec.tv_nsec;
+#else
+    *time = (INT64)file_stat.st_mtim.tv_sec * 1000000000 + file_stat.st_mtim.tv_nsec;
+#endif
+    *size = file_stat.st_size;
+    return true;
+}
@@ -0,0 +1,53 @@
+#ifndef __MAPFILE_HPP__
+#define __MAPFILE_HPP__
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include "global.hpp"
+
+namespace LuGL
+{
+
+/**
+ * Read-only view of a file, or of a region of it, mapped into memory. The
+ * mapping is private copy-on-write, so writes through data() never reach the
+ * file. The file itself is closed once mapped, the view keeps it alive.
+ */
+class MappedFile
+{
+private:
+    byte_t  *m_data;
+    size_t  m_size;
+    byte_t  *m_view;        // start of the mapping, aligned down from m_data
+    size_t  m_view_size;
+
+public:
+    MappedFile();
+    MappedFile(const char * filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator= (const MappedFile &) = delete;
+
+    // map size bytes from offset, the whole rest of the file if size is 0
+    bool open(const char * filename, UINT64 offset = 0, UINT64 size = 0);
+    void close();
+    void willNeed() const;
+
+    bool isOpen() const { return m_data != nullptr; }
+    byte_t * data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool contains(const void * pointer) const
+    {
+        return pointer >= m_data && pointer < m_data + m_size;
+    }
+
+    static bool modifiedTime(const char * filename, INT64 * time);
+    // modification time in nanoseconds where the file system keeps them, and size
+    static bool fileStamp(const char * filename, INT64 * time, UINT64 * size);
+};
+
+}
+
+#endif
@@ -1,65 +1,735 @@
 #include "material.hpp"
+#include "asset.hpp"
+#include "mapfile.hpp"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXTURE_SSE2
+#endif
 
 using namespace LuGL;
 
-Texture::Texture(const char * filename): Texture()
+// 8 bit channels to floats, the linear table gives the same floats as dividing by 255
+struct UnormTables
 {
-    BMPImage bmp_image(filename);
+    float unorm[256];
+    float srgb[256];
+
+    UnormTables()
+    {
+        for (long i = 0; i < 256; i++)
+        {
+            const float c = i / 255.0f;
+            unorm[i] = c;
+            srgb[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+        }
+    }
+};
+
+static const UnormTables & unormTables()
+{
+    static const UnormTables tables;
+    return tables;
+}
+
+static inline byte_t encodeUnorm8(float value)
+{
+    return (byte_t)(clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+static inline byte_t encodeSrgb8(float value)
+{
+    value = clamp(value, 0.0f, 1.0f);
+    return encodeUnorm8(value <= 0.0031308f ? value * 12.92f : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f);
+}
+
+// z of a unit normal from its x and y stored in [0, 1]
+static inline vec4 rebuildNormal(float r, float g)
+{
+    const float x = r * 2.0f - 1.0f;
+    const float y = g * 2.0f - 1.0f;
+    const float z = sqrtf(fmaxf(1.0f - x * x - y * y, 0.0f));
+    return vec4(r, g, z * 0.5f + 0.5f, 1.0f);
+}
+
+static inline UINT16 encodeRGB565(const float * color)
+{
+    return (UINT16)((UINT16)(clamp(color[0], 0.0f, 1.0f) * 31.0f + 0.5f) << 11 |
+                    (UINT16)(clamp(color[1], 0.0f, 1.0f) * 63.0f + 0.5f) << 5 |
+                    (UINT16)(clamp(color[2], 0.0f, 1.0f) * 31.0f + 0.5f));
+}
+
+static inline void decodeRGB565(UINT16 color, float * rgb)
+{
+    rgb[0] = ((color >> 11) & 31) / 31.0f;
+    rgb[1] = ((color >> 5) & 63) / 63.0f;
+    rgb[2] = (color & 31) / 31.0f;
+}
+
+// the 16 RGBA texels of the block at (bx, by), edge texels repeated for partial blocks
+static void gatherBlock(const float * texels, long width, long height, long bx, long by, float block[16][4])
+{
+    for (long i = 0; i < 16; i++)
+    {
+        const long x = min(bx * 4 + (i & 3), width - 1);
+        const long y = min(by * 4 + (i >> 2), height - 1);
+        memcpy(block[i], texels + (y * width + x) * 4, 4 * sizeof(float));
+    }
+}
+
+/**
+ * Endpoints at the extremes of the block along its principal color axis,
+ * every texel then takes the nearest of the four palette colors.
+ * reference : https://www.reedbeta.com/blog/understanding-bcn-texture-compression-formats/
+ */
+static void encodeBC1Block(const float block[16][4], byte_t * output)
+{
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    for (long i = 0; i < 16; i++)
+    {
+        for (long c = 0; c < 3; c++) mean[c] += block[i][c] * (1.0f / 16.0f);
+    }
+    float covariance[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    for (long i = 0; i < 16; i++)
+    {
+        const float r = block[i][0] - mean[0];
+        const float g = block[i][1] - mean[1];
+        const float b = block[i][2] - mean[2];
+        covariance[0] += r * r; covariance[1] += r * g; covariance[2] += r * b;
+        covariance[3] += g * g; covariance[4] += g * b; covariance[5] += b * b;
+    }
+    // power iteration
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+    for (long iteration = 0; iteration < 4; iteration++)
+    {
+        const float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+        const float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+        const float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+        const float length = fmaxf(fabsf(x), fmaxf(fabsf(y), fabsf(z)));
+        if (length < EPSILON) break;
+        axis[0] = x / length;
+        axis[1] = y / length;
+        axis[2] = z / length;
+    }
+    long min_index = 0;
+    long max_index = 0;
+    float min_projection = FLOAT_INF;
+    float max_projection = -FLOAT_INF;
+    for (long i = 0; i < 16; i++)
+    {
+        const float projection = block[i][0] * axis[0] + block[i][1] * axis[1] + block[i][2] * axis[2];
+        if (projection < min_projection) { min_projection = projection; min_index = i; }
+        if (projection > max_projection) { max_projection = projection; max_index = i; }
+    }
+
+    UINT16 color0 = encodeRGB565(block[max_index]);
+    UINT16 color1 = encodeRGB565(block[min_index]);
+    if (color0 < color1)
+    {
+        const UINT16 color = color0;
+        color0 = color1;
+        color1 = color;
+    }
+    float palette[4][3];
+    decodeRGB565(color0, palette[0]);
+    decodeRGB565(color1, palette[1]);
+    for (long c = 0; c < 3; c++)
+    {
+        palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+        palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+    }
+
+    UINT32 indices = 0;
+    if (color0 != color1) // equal endpoints decode every index to color0
+    {
+        for (long i = 0; i < 16; i++)
+        {
+            UINT32 best = 0;
+            float best_distance = FLOAT_INF;
+            for (UINT32 p = 0; p < 4; p++)
+            {
+                const float r = block[i][0] - palette[p][0];
+                const float g = block[i][1] - palette[p][1];
+                const float b = block[i][2] - palette[p][2];
+                const float distance = r * r + g * g + b * b;
+                if (distance < best_distance) { best_distance = distance; best = p; }
+            }
+            indices |= best << (i * 2);
+        }
+    }
+    memcpy(output, &color0, 2);
+    memcpy(output + 2, &color1, 2);
+    memcpy(output + 4, &indices, 4);
+}
+
+// one channel of BC5 (a BC4 block), endpoints at the channel range in the 8 value mode
+static void encodeBC4Block(const float block[16][4], long channel, byte_t * output)
+{
+    byte_t values[16];
+    byte_t high = 0;
+    byte_t low = 255;
+    for (long i = 0; i < 16; i++)
+    {
+        values[i] = encodeUnorm8(block[i][channel]);
+        high = max(high, values[i]);
+        low = min(low, values[i]);
+    }
+
+    UINT64 indices = 0;
+    if (high != low)
+    {
+        for (long i = 0; i < 16; i++)
+        {
+            // nearest step from high (index 0) to low (index 1) in sevenths
+            const long step = (long)((high - values[i]) * 7.0f / (high - low) + 0.5f);
+            const UINT64 index = step == 0 ? 0 : step == 7 ? 1 : step + 1;
+            indices |= index << (i * 3);
+        }
+    }
+    output[0] = high;
+    output[1] = low;
+    for (long b = 0; b < 6; b++)
+    {
+        output[2 + b] = (byte_t)(indices >> (b * 8));
+    }
+}
+
+static float decodeBC4Texel(const byte_t * block, long i)
+{
+    const UnormTables & tables = unormTables();
+    UINT64 indices = 0;
+    for (long b = 0; b < 6; b++)
+    {
+        indices |= (UINT64)block[2 + b] << (b * 8);
+    }
+    const long index = (indices >> (i * 3)) & 7;
+    const long high = block[0];
+    const long low = block[1];
+    if (index < 2) return tables.unorm[block[index]];
+    if (high > low) return ((8 - index) * high + (index - 1) * low) / (7.0f * 255.0f);
+    if (index == 6) return 0.0f;
+    if (index == 7) return 1.0f;
+    return ((6 - index) * high + (index - 1) * low) / (5.0f * 255.0f);
+}
+
+static vec4 decodeBC1Texel(const byte_t * block, long i)
+{
+    UINT16 color0, color1;
+    UINT32 indices;
+    memcpy(&color0, block, 2);
+    memcpy(&color1, block + 2, 2);
+    memcpy(&indices, block + 4, 4);
+
+    float rgb0[3], rgb1[3];
+    decodeRGB565(color0, rgb0);
+    decodeRGB565(color1, rgb1);
+    switch ((indices >> (i * 2)) & 3)
+    {
+        case 0: return vec4(rgb0[0], rgb0[1], rgb0[2], 1.0f);
+        case 1: return vec4(rgb1[0], rgb1[1], rgb1[2], 1.0f);
+        case 2:
+            if (color0 > color1) return vec4((2.0f * rgb0[0] + rgb1[0]) / 3.0f, (2.0f * rgb0[1] + rgb1[1]) / 3.0f, (2.0f * rgb0[2] + rgb1[2]) / 3.0f, 1.0f);
+            return vec4((rgb0[0] + rgb1[0]) * 0.5f, (rgb0[1] + rgb1[1]) * 0.5f, (rgb0[2] + rgb1[2]) * 0.5f, 1.0f);
+        default:
+            if (color0 > color1) return vec4((rgb0[0] + 2.0f * rgb1[0]) / 3.0f, (rgb0[1] + 2.0f * rgb1[1]) / 3.0f, (rgb0[2] + 2.0f * rgb1[2]) / 3.0f, 1.0f);
+            return vec4(0.0f, 0.0f, 0.0f, 0.0f);
+    }
+}
+
+// texels of a tiled row are in Morton order, the bits of x and y interleaved
+static void setupLevelLayout(TextureLevel & level, TextureLayout layout)
+{
+    const long tiles_x = (level.width + 3) / 4;
+    for (long i = 0; i < 4; i++)
+    {
+        switch (layout)
+        {
+            case TEXTURE_LAYOUT_TILED:
+                level.column_offsets[i] = (i & 1) + ((i & 2) << 1);
+                level.row_offsets[i] = ((i & 1) << 1) + ((i & 2) << 2);
+                break;
+            case TEXTURE_LAYOUT_BLOCKS:
+                level.column_offsets[i] = i;
+                level.row_offsets[i] = i * 4;
+                break;
+            default:
+                level.column_offsets[i] = i;
+                level.row_offsets[i] = i * level.width;
+                break;
+        }
+    }
+    level.column_step = layout == TEXTURE_LAYOUT_LINEAR ? 4 : 16;
+    level.row_step = layout == TEXTURE_LAYOUT_LINEAR ? level.width * 4 : tiles_x * 16;
+}
 
-    loadTextureSurface(bmp_image);
+// encode one level of RGBA floats into format
+static void encodeLevel(const float * texels, long width, long height, TextureFormat format, TextureLayout layout, byte_t * output)
+{
+    TextureLevel level;
+    level.width = width;
+    level.height = height;
+    setupLevelLayout(level, layout);
+
+    if (format == TEXTURE_FORMAT_BC1 || format == TEXTURE_FORMAT_BC5)
+    {
+        const long blocks_x = (width + 3) / 4;
+        const long blocks_y = (height + 3) / 4;
+#ifdef _OPENMP
+#pragma omp parallel for if(blocks_x * blocks_y >= 256)
+#endif
+        for (long by = 0; by < blocks_y; by++)
+        {
+            float block[16][4];
+            for (long bx = 0; bx < blocks_x; bx++)
+            {
+                gatherBlock(texels, width, height, bx, by, block);
+                if (format == TEXTURE_FORMAT_BC1)
+                {
+                    encodeBC1Block(block, output + (by * blocks_x + bx) * 8);
+                }
+                else
+                {
+                    encodeBC4Block(block, 0, output + (by * blocks_x + bx) * 16);
+                    encodeBC4Block(block, 1, output + (by * blocks_x + bx) * 16 + 8);
+                }
+            }
+        }
+        return;
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel for if(width * height >= 16384)
+#endif
+    for (long y = 0; y < height; y++)
+    {
+        const long row = level.rowOffset(y);
+        for (long x = 0; x < width; x++)
+        {
+            const float *texel = texels + (y * width + x) * 4;
+            const long i = row + level.columnOffset(x);
+            switch (format)
+            {
+                case TEXTURE_FORMAT_RGBA32F:
+                    memcpy(output + i * 16, texel, 16);
+                    break;
+                case TEXTURE_FORMAT_RGBA16F:
+                    {
+                        UINT16 *half = reinterpret_cast<UINT16*>(output + i * 8);
+                        for (long c = 0; c < 4; c++) half[c] = floatToHalf(texel[c]);
+                    }
+                    break;
+                case TEXTURE_FORMAT_RGBA8:
+                    for (long c = 0; c < 4; c++) output[i * 4 + c] = encodeUnorm8(texel[c]);
+                    break;
+                case TEXTURE_FORMAT_SRGB8_ALPHA8:
+                    for (long c = 0; c < 3; c++) output[i * 4 + c] = encodeSrgb8(texel[c]);
+                    output[i * 4 + 3] = encodeUnorm8(texel[3]);
+                    break;
+                case TEXTURE_FORMAT_RG8:
+                    output[i * 2] = encodeUnorm8(texel[0]);
+                    output[i * 2 + 1] = encodeUnorm8(texel[1]);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+Texture::Texture(const char * filename, TextureFormat format): Texture()
+{
+    loadTextureSurface(filename, format);
 }
 
 // delegated constructor : c++11 feature
-Texture::Texture(const vec4 & base_color, const char * filename): 
-    Texture(filename)
+Texture::Texture(const vec4 & base_color, const char * filename, TextureFormat format): 
+    Texture(filename, format)
 {
     m_base_color = base_color;
 }
 
-Texture::Texture(const vec4 & base_color, const BMPImage & bmp_image):
-    Texture(bmp_image)
+Texture::Texture(const vec4 & base_color, const BMPImage & bmp_image, TextureFormat format):
+    Texture(bmp_image, format)
 {
     m_base_color = base_color;
 }
 
-Texture::Texture(const BMPImage & bmp_image): Texture()
+Texture::Texture(const BMPImage & bmp_image, TextureFormat format): Texture()
 {
-    loadTextureSurface(bmp_image);
+    loadTextureSurface(bmp_image, format);
 }
 
 Texture::~Texture()
 {
-    if (m_buffer)
-        delete[] m_buffer;
+    releaseSurface();
 }
 
-void Texture::loadTextureSurface(const BMPImage & bmp_image)
+void Texture::releaseSurface()
 {
-    if (m_buffer)
+    if (m_virtual)
     {
-        delete[] m_buffer;
+        delete m_virtual;
+        m_virtual = nullptr;
     }
+    else if (m_buffer)
+    {
+        if (m_shared) Singleton<AssetCache>::get().release(m_buffer);
+        else delete[] m_buffer;
+    }
+    m_buffer = nullptr;
+    m_shared = false;
+    m_level_count = 0;
+}
+
+void Texture::setupLevels()
+{
+    m_level_count = 0;
+    if (!m_buffer) return;
+
+    // the levels of a virtual texture above its tail have no texels, m_buffer starts at the tail
+    const long tail_level = m_virtual ? m_virtual->tailLevel() : 0;
+    byte_t *texels = m_buffer;
+    long width = m_width;
+    long height = m_height;
+    while (m_level_count < TEXTURE_MAX_LEVELS)
+    {
+        const bool paged = m_level_count < tail_level;
+        m_levels[m_level_count].texels = paged ? nullptr : texels;
+        m_levels[m_level_count].width = width;
+        m_levels[m_level_count].height = height;
+        setupLevelLayout(m_levels[m_level_count], m_layout);
+        m_level_count++;
+        if (width == 1 && height == 1) break;
+
+        if (!paged) texels += levelSize(width, height, m_format, m_layout);
+        width = max(width / 2, 1L);
+        height = max(height / 2, 1L);
+    }
+}
+
+void Texture::loadTextureSurface(const BMPImage & bmp_image, TextureFormat format)
+{
+    releaseSurface();
 
     m_width = bmp_image.getImageWidth();
     m_height = bmp_image.getImageHeight();
+    m_format = format;
+    m_layout = surfaceLayout(format, Singleton<Global>::get().texture_tiling);
+    m_buffer = createSurface(bmp_image, format, m_layout);
+    setupLevels();
+    bindSampler();
+}
+
+// the texels of a file are shared by every texture loading it, a texture container keeps its own format
+void Texture::loadTextureSurface(const char * filename, TextureFormat format)
+{
+    releaseSurface();
+
+    m_format = format;
+    m_layout = surfaceLayout(format, Singleton<Global>::get().texture_tiling);
+    m_buffer = Singleton<AssetCache>::get().acquireTexture(filename, &m_format, &m_layout, &m_width, &m_height);
+    m_shared = m_buffer != nullptr;
+    setupLevels();
+    bindSampler();
+}
 
-    long texture_size = m_width * m_height * 4;
+// the whole mip chain in linear rows of RGBA floats
+static byte_t * createMipChain(const BMPImage & bmp_image, TextureFormat format)
+{
+    const long width = bmp_image.getImageWidth();
+    const long height = bmp_image.getImageHeight();
+    const UnormTables & tables = unormTables();
+    const float *decode = format == TEXTURE_FORMAT_SRGB8_ALPHA8 ? tables.srgb : tables.unorm;
 
-    m_buffer = new float[texture_size];
+    byte_t *surface = new byte_t[Texture::surfaceSize(width, height, TEXTURE_FORMAT_RGBA32F, TEXTURE_LAYOUT_LINEAR)];
+    float *buffer = reinterpret_cast<float*>(surface);
     const byte_t* image_buffer = bmp_image.getImageBufferConst();
 
-    for (long x = 0; x < m_width; x++)
+    for (long x = 0; x < width; x++)
+    {
+        for (long y = 0; y < height; y++)
+        {
+            long texture_pos = (y * width + x) * 4;
+            // long texture_pos = ((height - y - 1) * width + x) * 4;
+            long image_pos = (y * width + x) * 3;
+            buffer[texture_pos] = decode[image_buffer[image_pos + 2]];
+            buffer[texture_pos + 1] = decode[image_buffer[image_pos + 1]];
+            buffer[texture_pos + 2] = decode[image_buffer[image_pos]];
+            buffer[texture_pos + 3] = 1.0f;
+        }
+    }
+    Texture::buildMipChain(buffer, width, height);
+    return surface;
+}
+
+/**
+ * Keep the levels of the texture larger than a page on disk, in the virtual
+ * texture file next to filename, built or rebuilt from filename when it is
+ * missing or older. Only the pages sampled are loaded, see VirtualTexture.
+ */
+bool Texture::loadVirtualSurface(const char * filename, TextureFormat format)
+{
+    releaseSurface();
+
+    const TextureLayout layout = surfaceLayout(format, Singleton<Global>::get().texture_tiling);
+    m_virtual = new VirtualTexture();
+    if (!m_virtual->open(filename, format, layout))
+    {
+        delete m_virtual;
+        m_virtual = nullptr;
+        return false;
+    }
+    // a virtual texture file opened directly keeps the format and layout it was built with
+    m_width = m_virtual->getWidth();
+    m_height = m_virtual->getHeight();
+    m_format = m_virtual->getFormat();
+    m_layout = m_virtual->getLayout();
+    m_buffer = m_virtual->tail();
+    setupLevels();
+    bindSampler();
+    return true;
+}
+
+/**
+ * The mip chain is built from RGBA floats, decoded from sRGB for the sRGB
+ * format so that the levels are filtered in linear space, and then encoded
+ * level by level into the format and layout.
+ */
+byte_t * Texture::createSurface(const BMPImage & bmp_image, TextureFormat format, TextureLayout layout)
+{
+    const long width = bmp_image.getImageWidth();
+    const long height = bmp_image.getImageHeight();
+    byte_t *surface = createMipChain(bmp_image, format);
+    if (format == TEXTURE_FORMAT_RGBA32F && layout == TEXTURE_LAYOUT_LINEAR) return surface;
+
+    // the texels padding partial tiles are never sampled
+    byte_t *encoded = new byte_t[surfaceSize(width, height, format, layout)]();
+    const float *source = reinterpret_cast<const float*>(surface);
+    byte_t *target = encoded;
+    long level_width = width;
+    long level_height = height;
+    for (long level = 0; level < TEXTURE_MAX_LEVELS; level++)
     {
-        for (long y = 0; y < m_height; y++)
+        encodeLevel(source, level_width, level_height, format, layout, target);
+        if (level_width == 1 && level_height == 1) break;
+
+        source += level_width * level_height * 4;
+        target += levelSize(level_width, level_height, format, layout);
+        level_width = max(level_width / 2, 1L);
+        level_height = max(level_height / 2, 1L);
+    }
+    delete[] surface;
+    return encoded;
+}
+
+// block compressed formats are stored in blocks whatever the tiling
+TextureLayout Texture::surfaceLayout(TextureFormat format, bool tiled)
+{
+    if (format == TEXTURE_FORMAT_BC1 || format == TEXTURE_FORMAT_BC5) return TEXTURE_LAYOUT_BLOCKS;
+    return tiled ? TEXTURE_LAYOUT_TILED : TEXTURE_LAYOUT_LINEAR;
+}
+
+// bytes of one mip level, tiled levels are padded to whole tiles
+size_t Texture::levelSize(long width, long height, TextureFormat format, TextureLayout layout)
+{
+    if (layout != TEXTURE_LAYOUT_LINEAR)
+    {
+        width = (width + 3) / 4 * 4;
+        height = (height + 3) / 4 * 4;
+    }
+    switch (format)
+    {
+        case TEXTURE_FORMAT_RGBA16F:        return width * height * 8;
+        case TEXTURE_FORMAT_RGBA8:
+        case TEXTURE_FORMAT_SRGB8_ALPHA8:   return width * height * 4;
+        case TEXTURE_FORMAT_RG8:            return width * height * 2;
+        case TEXTURE_FORMAT_BC1:            return width * height / 2;
+        case TEXTURE_FORMAT_BC5:            return width * height;
+        default:                            return width * height * 16;
+    }
+}
+
+// bytes of the mip chain of a width x height texture
+size_t Texture::surfaceSize(long width, long height, TextureFormat format, TextureLayout layout)
+{
+    if (width <= 0 || height <= 0) return 0;
+
+    size_t size = 0;
+    for (long level = 0; level < TEXTURE_MAX_LEVELS; level++)
+    {
+        size += levelSize(width, height, format, layout);
+        if (width == 1 && height == 1) break;
+        width = max(width / 2, 1L);
+        height = max(height / 2, 1L);
+    }
+    return size;
+}
+
+// names used in entity config files
+bool Texture::parseFormat(const char * name, TextureFormat * format)
+{
+    static const char *names[TEXTURE_FORMAT_COUNT] = { "rgba32f", "rgba16f", "rgba8", "srgb8", "rg8", "bc1", "bc5" };
+    for (long fidx = 0; fidx < TEXTURE_FORMAT_COUNT; fidx++)
+    {
+        if (strcmp(name, names[fidx]) == 0)
+        {
+            *format = (TextureFormat)fidx;
+            return true;
+        }
+    }
+    return false;
+}
+
+// write the surface into a texture container
+bool Texture::saveContainer(const char * filename) const
+{
+    if (!m_buffer || m_virtual)
+    {
+        printf("Texture : texture without a surface in memory can not be saved\n");
+        return false;
+    }
+
+    TextureContainerHeader header;
+    memset(&header, 0, sizeof(TextureContainerHeader));
+    header.magic = TEXTURE_CONTAINER_MAGIC;
+    header.version = TEXTURE_CONTAINER_VERSION;
+    header.format = m_format;
+    header.layout = m_layout;
+    header.width = (UINT32)m_width;
+    header.height = (UINT32)m_height;
+    header.surface_offset = TEXTURE_CONTAINER_ALIGNMENT;
+    header.surface_size = surfaceSize(m_width, m_height, m_format, m_layout);
+
+    FILE *fp = fopen(filename, "wb");
+    if (fp == nullptr)
+    {
+        printf("Texture : texture container: %s open failed\n", filename);
+        return false;
+    }
+    const byte_t padding[TEXTURE_CONTAINER_ALIGNMENT] = { 0 };
+    const size_t padding_size = header.surface_offset - sizeof(TextureContainerHeader);
+    bool written = fwrite(&header, sizeof(TextureContainerHeader), 1, fp) == 1 &&
+                   fwrite(padding, 1, padding_size, fp) == padding_size &&
+                   fwrite(m_buffer, 1, header.surface_size, fp) == header.surface_size;
+    written = fclose(fp) == 0 && written;
+    if (!written)
+    {
+        printf("Texture : texture container: %s write failed\n", filename);
+        remove(filename);
+    }
+    return written;
+}
+
+// replace the extension of filename with TEXTURE_CONTAINER_EXTENSION
+bool Texture::containerFilename(const char * filename, char * container_filename, size_t length)
+{
+    const char *extension = strrchr(filename, '.');
+    const char *separator = strrchr(filename, '/');
+    const char *backslash = strrchr(filename, '\\');
+    if (backslash > separator) separator = backslash;
+    size_t stem_len = (extension && extension > separator) ? extension - filename : strlen(filename);
+    if (stem_len + strlen(TEXTURE_CONTAINER_EXTENSION) + 1 > length) return false;
+
+    memcpy(container_filename, filename, stem_len);
+    strcpy(container_filename + stem_len, TEXTURE_CONTAINER_EXTENSION);
+    return true;
+}
+
+static bool isContainer(const char * filename)
+{
+    const char *extension = strrchr(filename, '.');
+    return extension && strcmp(extension, TEXTURE_CONTAINER_EXTENSION) == 0;
+}
+
+static bool readContainerHeader(const MappedFile & file, TextureContainerHeader * header)
+{
+    if (file.size() < sizeof(TextureContainerHeader)) return false;
+    memcpy(header, file.data(), sizeof(TextureContainerHeader));
+    return header->magic == TEXTURE_CONTAINER_MAGIC &&
+           header->version == TEXTURE_CONTAINER_VERSION &&
+           header->format < TEXTURE_FORMAT_COUNT &&
+           header->layout == Texture::surfaceLayout((TextureFormat)header->format, header->layout == TEXTURE_LAYOUT_TILED) &&
+           header->surface_size == Texture::surfaceSize(header->width, header->height, (TextureFormat)header->format, (TextureLayout)header->layout) &&
+           header->surface_offset + header->surface_size <= file.size();
+}
+
+// the format and layout of a texture container, left as they are for other files
+bool Texture::containerFormat(const char * filename, TextureFormat * format, TextureLayout * layout)
+{
+    if (!isContainer(filename)) return false;
+
+    MappedFile file;
+    TextureContainerHeader header;
+    if (!file.open(filename) || !readContainerHeader(file, &header)) return false;
+    *format = (TextureFormat)header.format;
+    *layout = (TextureLayout)header.layout;
+    return true;
+}
+
+/**
+ * Map the surface of a texture container, filename itself or the container
+ * next to an image when it is up to date and in format and layout. The
+ * surface is used where it is mapped, it lives as long as file.
+ */
+byte_t * Texture::mapContainer(const char * filename, TextureFormat format, TextureLayout layout, long * width, long * height, MappedFile ** file)
+{
+    const bool direct = isContainer(filename);
+    const size_t length = strlen(filename) + strlen(TEXTURE_CONTAINER_EXTENSION) + 1;
+    char *container_filename = new char[length];
+    INT64 image_time, container_time;
+    const bool found = direct ? (strcpy(container_filename, filename), true) :
+        containerFilename(filename, container_filename, length) &&
+        MappedFile::modifiedTime(container_filename, &container_time) &&
+        MappedFile::modifiedTime(filename, &image_time) &&
+        container_time >= image_time;
+
+    MappedFile *mapped = new MappedFile();
+    TextureContainerHeader header;
+    if (!found || !mapped->open(container_filename) || !readContainerHeader(*mapped, &header) ||
+        header.format != (UINT32)format || header.layout != (UINT32)layout)
+    {
+        if (direct) printf("Texture : texture container: %s is invalid or outdated\n", container_filename);
+        delete[] container_filename;
+        delete mapped;
+        return nullptr;
+    }
+    delete[] container_filename;
+
+    *width = header.width;
+    *height = header.height;
+    *file = mapped;
+    return mapped->data() + header.surface_offset;
+}
+
+// fill the levels after level 0 with 2x2 box filtered texels of the previous level
+void Texture::buildMipChain(float * surface, long width, long height)
+{
+    float *source = surface;
+    for (long level = 1; level < TEXTURE_MAX_LEVELS && (width > 1 || height > 1); level++)
+    {
+        const long level_width = max(width / 2, 1L);
+        const long level_height = max(height / 2, 1L);
+        float *target = source + width * height * 4;
+#ifdef _OPENMP
+#pragma omp parallel for if(level_width * level_height >= 4096)
+#endif
+        for (long y = 0; y < level_height; y++)
         {
-            long texture_pos = (y * m_width + x) * 4;
-            // long texture_pos = ((m_height - y - 1) * m_width + x) * 4;
-            long image_pos = (y * m_width + x) * 3;
-            m_buffer[texture_pos] = image_buffer[image_pos + 2] / 255.0f;
-            m_buffer[texture_pos + 1] = image_buffer[image_pos + 1] / 255.0f;
-            m_buffer[texture_pos + 2] = image_buffer[image_pos] / 255.0f;
-            m_buffer[texture_pos + 3] = 1.0f;
+            const float *row0 = source + min(y * 2, height - 1) * width * 4;
+            const float *row1 = source + min(y * 2 + 1, height - 1) * width * 4;
+            for (long x = 0; x < level_width; x++)
+            {
+                const long x0 = min(x * 2, width - 1) * 4;
+                const long x1 = min(x * 2 + 1, width - 1) * 4;
+                float *texel = target + (y * level_width + x) * 4;
+                for (long c = 0; c < 4; c++)
+                {
+                    texel[c] = 0.25f * (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]);
+                }
+            }
         }
+        source = target;
+        width = level_width;
+        height = level_height;
     }
 }
 
@@ -83,52 +753,1560 @@ vec4 Texture::colorAt(long x, long y) const
     if (!m_buffer) return m_base_color;
     assert(x >= 0);
     assert(y >= 0);
-    if (x >= m_width)
+    if (!m_levels[0].texels)
     {
-        x = m_width - 1;
+        const vec2 texcoord((min(x, m_width - 1) + 0.5f) / m_width, (min(y, m_height - 1) + 0.5f) / m_height);
+        return sampleVirtual(0, texcoord, false);
     }
-    if (y >= m_height)
+
+    return texelAt(m_levels[0], x, y);
+}
+// decodes the texel at offset index of the texels of a level, the switch is resolved at compile time
+template<TextureFormat format>
+static inline vec4 decodeTexel(const byte_t * texels, long index)
+{
+    switch (format)
     {
-        y = m_height - 1;
+        case TEXTURE_FORMAT_RGBA16F:
+            {
+                UINT16 half[4];
+                memcpy(half, texels + index * 8, sizeof(half));
+                return vec4(halfToFloat(half[0]), halfToFloat(half[1]), halfToFloat(half[2]), halfToFloat(half[3]));
+            }
+        case TEXTURE_FORMAT_RGBA8:
+            {
+                const UnormTables & tables = unormTables();
+                const byte_t *texel = texels + index * 4;
+                return vec4(tables.unorm[texel[0]], tables.unorm[texel[1]], tables.unorm[texel[2]], tables.unorm[texel[3]]);
+            }
+        case TEXTURE_FORMAT_SRGB8_ALPHA8:
+            {
+                const UnormTables & tables = unormTables();
+                const byte_t *texel = texels + index * 4;
+                return vec4(tables.srgb[texel[0]], tables.srgb[texel[1]], tables.srgb[texel[2]], tables.unorm[texel[3]]);
+            }
+        case TEXTURE_FORMAT_RG8:
+            {
+                const UnormTables & tables = unormTables();
+                const byte_t *texel = texels + index * 2;
+                return rebuildNormal(tables.unorm[texel[0]], tables.unorm[texel[1]]);
+            }
+        case TEXTURE_FORMAT_BC1:
+            return decodeBC1Texel(texels + (index >> 4) * 8, index & 15);
+        case TEXTURE_FORMAT_BC5:
+            {
+                const byte_t *block = texels + (index >> 4) * 16;
+                return rebuildNormal(decodeBC4Texel(block, index & 15), decodeBC4Texel(block + 8, index & 15));
+            }
+        default:
+            return vec4(reinterpret_cast<const float*>(texels + index * 16));
     }
-
-    return vec4(&m_buffer[(y * m_width + x) * 4]);
 }
 
+/**
+ * Texel coordinates of the two columns or rows of a bilinear footprint along
+ * one axis, and the weight of the second. Texel centers are at half texels,
+ * so a linear footprint starts half a texel before the coordinate and the
+ * nearest texel is the one the coordinate falls in. A repeated footprint
+ * wraps around from the last texel to the first, a mirrored coordinate is
+ * folded back into [0, 1], and a clamped footprint stops at the edge texels.
+ */
+template<TextureWrap wrap>
+static inline void wrapCoordinate(float coord, long size, bool linear, long & i0, long & i1, float & alpha)
+{
+    const float offset = linear ? 0.5f : 0.0f;
+    if (wrap == TEXTURE_WRAP_REPEAT)
+    {
+        const float f = (float)size * (coord - floorf(coord)) - offset;
+        const long i = FTOD(f);
+        alpha = f - i;
+        // -1 is the last texel, a fraction rounded up to 1 is the first, so are coordinates that are not finite
+        i0 = i == -1 ? size - 1 : (unsigned long)i < (unsigned long)size ? i : 0;
+        i1 = i0 + 1 < size ? i0 + 1 : 0;
+        return;
+    }
+    if (wrap == TEXTURE_WRAP_MIRROR)
+    {
+        coord -= 2.0f * floorf(coord * 0.5f);
+        if (coord > 1.0f) coord = 2.0f - coord;
+    }
+    const float f = (float)size * clamp(coord, 0.0f, 1.0f) - offset;
+    const long i = FTOD(f);
+    alpha = f - i;
+    i0 = clamp(i, 0L, size - 1);
+    i1 = min(i + 1, size - 1);
+}
 
-vec4 Texture::sampler(const Texture & texture, const vec2 & texcoord)
+template<TextureFormat format, TextureWrap wrap_u, TextureWrap wrap_v>
+static vec4 filterLevel(const TextureLevel & level, const vec2 & texcoord, bool linear)
 {
-    if (!texture.m_buffer) return texture.m_base_color;
+    long x0, x1, y0, y1;
+    float alpha_x, alpha_y;
+    wrapCoordinate<wrap_u>(texcoord.u, level.width, linear, x0, x1, alpha_x);
+    wrapCoordinate<wrap_v>(texcoord.v, level.height, linear, y0, y1, alpha_y);
+    const long column0 = level.columnOffset(x0);
+    const long row0 = level.rowOffset(y0);
+    if (!linear)
+    {
+        return decodeTexel<format>(level.texels, column0 + row0);
+    }
+
+    // the footprint is two columns and two rows, their offsets are added up
+    const long column1 = level.columnOffset(x1);
+    const long row1 = level.rowOffset(y1);
+    return vec4::lerp(
+        vec4::lerp(decodeTexel<format>(level.texels, row0 + column0), decodeTexel<format>(level.texels, row0 + column1), alpha_x),
+        vec4::lerp(decodeTexel<format>(level.texels, row1 + column0), decodeTexel<format>(level.texels, row1 + column1), alpha_x),
+        alpha_y
+    );
+}
 
-    if (Singleton<Global>::get().texture_filtering_linear)
+/**
+ * filterLevel for a level of a virtual texture, every texel read from the
+ * page holding it. Fails if one of the pages is not resident, after having
+ * requested all the missing ones.
+ */
+template<TextureFormat format, TextureWrap wrap_u, TextureWrap wrap_v>
+static bool filterPages(const VirtualTexture & texture, long level, const vec2 & texcoord, bool linear, vec4 * color)
+{
+    const VirtualLevel & vlevel = texture.getLevel(level);
+    const TextureLevel & page = texture.pageLevel();
+    const long mask = VIRTUAL_PAGE_SIZE - 1;
+    long x0, x1, y0, y1;
+    float alpha_x, alpha_y;
+    wrapCoordinate<wrap_u>(texcoord.u, vlevel.width, linear, x0, x1, alpha_x);
+    wrapCoordinate<wrap_v>(texcoord.v, vlevel.height, linear, y0, y1, alpha_y);
+    const long column0 = page.columnOffset(x0 & mask);
+    const long row0 = page.rowOffset(y0 & mask);
+    const byte_t *texels00 = texture.findPage(level, x0, y0);
+    if (!linear)
     {
-        float xf = (float)texture.m_width * clamp(texcoord.u, 0.0f, 1.0f);
-        float yf = (float)texture.m_height * clamp(texcoord.v, 0.0f, 1.0f);
-        long x = FTOD(xf);
-        long y = FTOD(yf);
-        float alpha_x = (xf - x);
-        float alpha_y = (yf - y);
+        if (!texels00) return false;
+        *color = decodeTexel<format>(texels00, column0 + row0);
+        return true;
+    }
+
+    const long column1 = page.columnOffset(x1 & mask);
+    const long row1 = page.rowOffset(y1 & mask);
+    const byte_t *texels01 = texture.findPage(level, x1, y0);
+    const byte_t *texels10 = texture.findPage(level, x0, y1);
+    const byte_t *texels11 = texture.findPage(level, x1, y1);
+    if (!texels00 || !texels01 || !texels10 || !texels11) return false;
+    *color = vec4::lerp(
+        vec4::lerp(decodeTexel<format>(texels00, row0 + column0), decodeTexel<format>(texels01, row0 + column1), alpha_x),
+        vec4::lerp(decodeTexel<format>(texels10, row1 + column0), decodeTexel<format>(texels11, row1 + column1), alpha_x),
+        alpha_y
+    );
+    return true;
+}
 
-        vec4 color0 = texture.colorAt(x,     y    );
-        vec4 color1 = texture.colorAt(x + 1, y    );
-        vec4 color2 = texture.colorAt(x,     y + 1);
-        vec4 color3 = texture.colorAt(x + 1, y + 1);
+/**
+ * filterLevel for a level of a baked material, whose texels are the texels
+ * of its maps one after the other, into one color per map.
+ */
+template<TextureFormat format, TextureWrap wrap_u, TextureWrap wrap_v>
+static void filterPacked(const TextureLevel & level, const vec2 & texcoord, bool linear, long slots, vec4 * colors)
+{
+    long x0, x1, y0, y1;
+    float alpha_x, alpha_y;
+    wrapCoordinate<wrap_u>(texcoord.u, level.width, linear, x0, x1, alpha_x);
+    wrapCoordinate<wrap_v>(texcoord.v, level.height, linear, y0, y1, alpha_y);
+    const long column0 = level.columnOffset(x0);
+    const long row0 = level.rowOffset(y0);
+    if (!linear)
+    {
+        for (long slot = 0; slot < slots; slot++)
+        {
+            colors[slot] = decodeTexel<format>(level.texels, (column0 + row0) * slots + slot);
+        }
+        return;
+    }
 
-        // duel linear filtering
-        return vec4::lerp(
-            vec4::lerp(color0, color1, alpha_x),
-            vec4::lerp(color2, color3, alpha_x),
+    const long column1 = level.columnOffset(x1);
+    const long row1 = level.rowOffset(y1);
+    const long texel00 = (row0 + column0) * slots;
+    const long texel01 = (row0 + column1) * slots;
+    const long texel10 = (row1 + column0) * slots;
+    const long texel11 = (row1 + column1) * slots;
+    for (long slot = 0; slot < slots; slot++)
+    {
+        colors[slot] = vec4::lerp(
+            vec4::lerp(decodeTexel<format>(level.texels, texel00 + slot), decodeTexel<format>(level.texels, texel01 + slot), alpha_x),
+            vec4::lerp(decodeTexel<format>(level.texels, texel10 + slot), decodeTexel<format>(level.texels, texel11 + slot), alpha_x),
             alpha_y
         );
     }
-    else
+}
+
+#ifdef TEXTURE_SSE2
+// a texel in the 4 lanes of a register, RGBA32F and RGBA8 without going through vec4
+template<TextureFormat format>
+static inline __m128 loadTexel(const TextureLevel & level, long index)
+{
+    const vec4 texel = decodeTexel<format>(level.texels, index);
+    return _mm_loadu_ps(&texel.x);
+}
+
+template<>
+inline __m128 loadTexel<TEXTURE_FORMAT_RGBA32F>(const TextureLevel & level, long index)
+{
+    return _mm_loadu_ps(reinterpret_cast<const float*>(level.texels + index * 16));
+}
+
+template<>
+inline __m128 loadTexel<TEXTURE_FORMAT_RGBA8>(const TextureLevel & level, long index)
+{
+    int texel;
+    memcpy(&texel, level.texels + index * 4, 4);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i channels = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(texel), zero), zero);
+    // divided like the unorm table, not multiplied by the reciprocal, for the same floats
+    return _mm_div_ps(_mm_cvtepi32_ps(channels), _mm_set1_ps(255.0f));
+}
+
+// low 32 bits of the lane products, SSE2 only multiplies even lanes
+static inline __m128i multiply32(__m128i a, __m128i b)
+{
+    const __m128i even = _mm_mul_epu32(a, b);
+    const __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static inline __m128i minimum32(__m128i a, __m128i b)
+{
+    const __m128i greater = _mm_cmpgt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(greater, b), _mm_andnot_si128(greater, a));
+}
+
+// offsets of 4 columns or rows, the group step plus the offsets of bits 0 and 1 within the group
+static inline __m128i offsets4(__m128i coords, long step, const long * offsets)
+{
+    const __m128i bit0 = _mm_cmpeq_epi32(_mm_and_si128(coords, _mm_set1_epi32(1)), _mm_set1_epi32(1));
+    const __m128i bit1 = _mm_cmpeq_epi32(_mm_and_si128(coords, _mm_set1_epi32(2)), _mm_set1_epi32(2));
+    return _mm_add_epi32(multiply32(_mm_srai_epi32(coords, 2), _mm_set1_epi32((int)step)),
+                         _mm_add_epi32(_mm_and_si128(bit0, _mm_set1_epi32((int)offsets[1])),
+                                       _mm_and_si128(bit1, _mm_set1_epi32((int)offsets[2]))));
+}
+
+static inline __m128 lerp4(__m128 from, __m128 to, __m128 alpha)
+{
+    return _mm_add_ps(_mm_mul_ps(from, _mm_sub_ps(_mm_set1_ps(1.0f), alpha)), _mm_mul_ps(to, alpha));
+}
+
+// lane q of a register in all 4 lanes
+static inline __m128 broadcast(__m128 value, long q)
+{
+    switch (q)
     {
-        float xf = (float)texture.m_width * clamp(texcoord.u, 0.0f, 1.0f);
-        float yf = (float)texture.m_height * clamp(texcoord.v, 0.0f, 1.0f);
-        long x = FTOD(xf);
-        long y = FTOD(yf);
+        case 0:  return _mm_shuffle_ps(value, value, _MM_SHUFFLE(0, 0, 0, 0));
+        case 1:  return _mm_shuffle_ps(value, value, _MM_SHUFFLE(1, 1, 1, 1));
+        case 2:  return _mm_shuffle_ps(value, value, _MM_SHUFFLE(2, 2, 2, 2));
+        default: return _mm_shuffle_ps(value, value, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+}
+
+// floorf of 4 floats, the ones too large for a fraction are already whole
+static inline __m128 floor4(__m128 value)
+{
+    const __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(value));
+    const __m128 floored = _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, value), _mm_set1_ps(1.0f)));
+    const __m128 whole = _mm_cmpge_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), value), _mm_set1_ps(8388608.0f));
+    return _mm_or_ps(_mm_and_ps(whole, value), _mm_andnot_ps(whole, floored));
+}
+
+// wrapCoordinate for 4 coordinates
+template<TextureWrap wrap>
+static inline void wrapCoordinate4(__m128 coords, long size, bool linear, __m128i & i0, __m128i & i1, __m128 & alpha)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 offset = _mm_set1_ps(linear ? 0.5f : 0.0f);
+    const __m128i step = _mm_set1_epi32(1);
+    const __m128i last = _mm_set1_epi32((int)size - 1);
+    if (wrap == TEXTURE_WRAP_REPEAT)
+    {
+        const __m128i texels = _mm_set1_epi32((int)size);
+        const __m128 f = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps((float)size), _mm_sub_ps(coords, floor4(coords))), offset);
+        const __m128i i = _mm_cvttps_epi32(floor4(f));
+        alpha = _mm_sub_ps(f, _mm_cvtepi32_ps(i));
+        const __m128i inside = _mm_and_si128(_mm_cmpgt_epi32(i, _mm_set1_epi32(-1)), _mm_cmplt_epi32(i, texels));
+        const __m128i before = _mm_cmpeq_epi32(i, _mm_set1_epi32(-1));
+        i0 = _mm_or_si128(_mm_and_si128(inside, i), _mm_and_si128(before, last));
+        const __m128i next = _mm_add_epi32(i0, step);
+        i1 = _mm_and_si128(_mm_cmplt_epi32(next, texels), next);
+        return;
+    }
+    if (wrap == TEXTURE_WRAP_MIRROR)
+    {
+        const __m128 two = _mm_set1_ps(2.0f);
+        coords = _mm_sub_ps(coords, _mm_mul_ps(two, floor4(_mm_mul_ps(coords, _mm_set1_ps(0.5f)))));
+        const __m128 folded = _mm_cmpgt_ps(coords, one);
+        coords = _mm_or_ps(_mm_and_ps(folded, _mm_sub_ps(two, coords)), _mm_andnot_ps(folded, coords));
+    }
+    const __m128 f = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps((float)size), _mm_min_ps(_mm_max_ps(coords, _mm_setzero_ps()), one)), offset);
+    // the footprint of a clamped coordinate starts at most half a texel before the first texel
+    const __m128i i = _mm_cvttps_epi32(floor4(f));
+    alpha = _mm_sub_ps(f, _mm_cvtepi32_ps(i));
+    i0 = minimum32(_mm_andnot_si128(_mm_cmplt_epi32(i, _mm_setzero_si128()), i), last);
+    i1 = minimum32(_mm_add_epi32(i, step), last);
+}
+
+// texel indices of the corners of the footprints of 4 coordinates, [corner][lane], only corner 0 when not linear
+template<TextureWrap wrap_u, TextureWrap wrap_v>
+static inline void footprint4(const TextureLevel & level, const vec2 * texcoords, bool linear, int indices[4][4], __m128 & alpha_x, __m128 & alpha_y)
+{
+    const __m128 u = _mm_set_ps(texcoords[3].u, texcoords[2].u, texcoords[1].u, texcoords[0].u);
+    const __m128 v = _mm_set_ps(texcoords[3].v, texcoords[2].v, texcoords[1].v, texcoords[0].v);
+    __m128i x0, x1, y0, y1;
+    wrapCoordinate4<wrap_u>(u, level.width, linear, x0, x1, alpha_x);
+    wrapCoordinate4<wrap_v>(v, level.height, linear, y0, y1, alpha_y);
+    const __m128i column0 = offsets4(x0, level.column_step, level.column_offsets);
+    const __m128i row0 = offsets4(y0, level.row_step, level.row_offsets);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(indices[0]), _mm_add_epi32(row0, column0));
+    if (!linear) return;
+
+    const __m128i column1 = offsets4(x1, level.column_step, level.column_offsets);
+    const __m128i row1 = offsets4(y1, level.row_step, level.row_offsets);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(indices[1]), _mm_add_epi32(row0, column1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(indices[2]), _mm_add_epi32(row1, column0));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(indices[3]), _mm_add_epi32(row1, column1));
+}
 
-        // nearest filtering
-        return texture.colorAt(x, y);
+/**
+ * filterLevel for 4 texture coordinates. Texel coordinates, wrapping,
+ * offsets and weights are computed for the 4 lanes at once, then every lane
+ * loads its texels and blends them with the channels in the 4 lanes. The
+ * operations are the ones of the scalar sampler, so the colors are the same.
+ */
+template<TextureFormat format, TextureWrap wrap_u, TextureWrap wrap_v>
+static void filterLevel4(const TextureLevel & level, const vec2 * texcoords, bool linear, vec4 * colors)
+{
+    int indices[4][4];
+    __m128 alpha_x, alpha_y;
+    footprint4<wrap_u, wrap_v>(level, texcoords, linear, indices, alpha_x, alpha_y);
+    if (!linear)
+    {
+        for (long q = 0; q < 4; q++)
+        {
+            _mm_storeu_ps(&colors[q].x, loadTexel<format>(level, indices[0][q]));
+        }
+        return;
+    }
+
+    for (long q = 0; q < 4; q++)
+    {
+        const __m128 ax = broadcast(alpha_x, q);
+        const __m128 top = lerp4(loadTexel<format>(level, indices[0][q]), loadTexel<format>(level, indices[1][q]), ax);
+        const __m128 bottom = lerp4(loadTexel<format>(level, indices[2][q]), loadTexel<format>(level, indices[3][q]), ax);
+        _mm_storeu_ps(&colors[q].x, lerp4(top, bottom, broadcast(alpha_y, q)));
+    }
+}
+
+// filterPacked for 4 texture coordinates, the colors of lane q start at colors[q * slots]
+template<TextureFormat format, TextureWrap wrap_u, TextureWrap wrap_v>
+static void filterPacked4(const TextureLevel & level, const vec2 * texcoords, bool linear, long slots, vec4 * colors)
+{
+    int indices[4][4];
+    __m128 alpha_x, alpha_y;
+    footprint4<wrap_u, wrap_v>(level, texcoords, linear, indices, alpha_x, alpha_y);
+    if (!linear)
+    {
+        for (long q = 0; q < 4; q++)
+        {
+            for (long slot = 0; slot < slots; slot++)
+            {
+                _mm_storeu_ps(&colors[q * slots + slot].x, loadTexel<format>(level, indices[0][q] * slots + slot));
+            }
+        }
+        return;
+    }
+
+    for (long q = 0; q < 4; q++)
+    {
+        const __m128 ax = broadcast(alpha_x, q);
+        const __m128 ay = broadcast(alpha_y, q);
+        const long texel00 = indices[0][q] * slots;
+        const long texel01 = indices[1][q] * slots;
+        const long texel10 = indices[2][q] * slots;
+        const long texel11 = indices[3][q] * slots;
+        for (long slot = 0; slot < slots; slot++)
+        {
+            const __m128 top = lerp4(loadTexel<format>(level, texel00 + slot), loadTexel<format>(level, texel01 + slot), ax);
+            const __m128 bottom = lerp4(loadTexel<format>(level, texel10 + slot), loadTexel<format>(level, texel11 + slot), ax);
+            _mm_storeu_ps(&colors[q * slots + slot].x, lerp4(top, bottom, ay));
+        }
+    }
+}
+#else
+template<TextureFormat format, TextureWrap wrap_u, TextureWrap wrap_v>
+static void filterLevel4(const TextureLevel & level, const vec2 * texcoords, bool linear, vec4 * colors)
+{
+    for (long q = 0; q < 4; q++)
+    {
+        colors[q] = filterLevel<format, wrap_u, wrap_v>(level, texcoords[q], linear);
+    }
+}
+
+template<TextureFormat format, TextureWrap wrap_u, TextureWrap wrap_v>
+static void filterPacked4(const TextureLevel & level, const vec2 * texcoords, bool linear, long slots, vec4 * colors)
+{
+    for (long q = 0; q < 4; q++)
+    {
+        filterPacked<format, wrap_u, wrap_v>(level, texcoords[q], linear, slots, colors + q * slots);
+    }
+}
+#endif
+
+template<TextureFormat format, TextureWrap wrap_u>
+static void resolveWrapV(TextureWrap wrap_v, LevelSampler * sampler, LevelSampler4 * sampler4, VirtualSampler * virtual_sampler)
+{
+    switch (wrap_v)
+    {
+        case TEXTURE_WRAP_REPEAT:
+            *sampler = filterLevel<format, wrap_u, TEXTURE_WRAP_REPEAT>;
+            *sampler4 = filterLevel4<format, wrap_u, TEXTURE_WRAP_REPEAT>;
+            *virtual_sampler = filterPages<format, wrap_u, TEXTURE_WRAP_REPEAT>;
+            break;
+        case TEXTURE_WRAP_MIRROR:
+            *sampler = filterLevel<format, wrap_u, TEXTURE_WRAP_MIRROR>;
+            *sampler4 = filterLevel4<format, wrap_u, TEXTURE_WRAP_MIRROR>;
+            *virtual_sampler = filterPages<format, wrap_u, TEXTURE_WRAP_MIRROR>;
+            break;
+        default:
+            *sampler = filterLevel<format, wrap_u, TEXTURE_WRAP_CLAMP>;
+            *sampler4 = filterLevel4<format, wrap_u, TEXTURE_WRAP_CLAMP>;
+            *virtual_sampler = filterPages<format, wrap_u, TEXTURE_WRAP_CLAMP>;
+            break;
+    }
+}
+
+template<TextureFormat format>
+static void resolveWrap(const SamplerState & state, LevelSampler * sampler, LevelSampler4 * sampler4, VirtualSampler * virtual_sampler)
+{
+    switch (state.wrap_u)
+    {
+        case TEXTURE_WRAP_REPEAT:   resolveWrapV<format, TEXTURE_WRAP_REPEAT>(state.wrap_v, sampler, sampler4, virtual_sampler); break;
+        case TEXTURE_WRAP_MIRROR:   resolveWrapV<format, TEXTURE_WRAP_MIRROR>(state.wrap_v, sampler, sampler4, virtual_sampler); break;
+        default:                    resolveWrapV<format, TEXTURE_WRAP_CLAMP>(state.wrap_v, sampler, sampler4, virtual_sampler); break;
+    }
+}
+
+// coordinates past the last row or column are clamped
+vec4 Texture::texelAt(const TextureLevel & level, long x, long y) const
+{
+    const long offset = level.columnOffset(min(x, level.width - 1)) + level.rowOffset(min(y, level.height - 1));
+    switch (m_format)
+    {
+        case TEXTURE_FORMAT_RGBA16F:        return decodeTexel<TEXTURE_FORMAT_RGBA16F>(level.texels, offset);
+        case TEXTURE_FORMAT_RGBA8:          return decodeTexel<TEXTURE_FORMAT_RGBA8>(level.texels, offset);
+        case TEXTURE_FORMAT_SRGB8_ALPHA8:   return decodeTexel<TEXTURE_FORMAT_SRGB8_ALPHA8>(level.texels, offset);
+        case TEXTURE_FORMAT_RG8:            return decodeTexel<TEXTURE_FORMAT_RG8>(level.texels, offset);
+        case TEXTURE_FORMAT_BC1:            return decodeTexel<TEXTURE_FORMAT_BC1>(level.texels, offset);
+        case TEXTURE_FORMAT_BC5:            return decodeTexel<TEXTURE_FORMAT_BC5>(level.texels, offset);
+        default:                            return decodeTexel<TEXTURE_FORMAT_RGBA32F>(level.texels, offset);
+    }
+}
+
+template<TextureFormat format, TextureWrap wrap_u>
+static void resolvePackedV(TextureWrap wrap_v, PackedSampler * sampler, PackedSampler4 * sampler4)
+{
+    switch (wrap_v)
+    {
+        case TEXTURE_WRAP_REPEAT:
+            *sampler = filterPacked<format, wrap_u, TEXTURE_WRAP_REPEAT>;
+            *sampler4 = filterPacked4<format, wrap_u, TEXTURE_WRAP_REPEAT>;
+            break;
+        case TEXTURE_WRAP_MIRROR:
+            *sampler = filterPacked<format, wrap_u, TEXTURE_WRAP_MIRROR>;
+            *sampler4 = filterPacked4<format, wrap_u, TEXTURE_WRAP_MIRROR>;
+            break;
+        default:
+            *sampler = filterPacked<format, wrap_u, TEXTURE_WRAP_CLAMP>;
+            *sampler4 = filterPacked4<format, wrap_u, TEXTURE_WRAP_CLAMP>;
+            break;
+    }
+}
+
+template<TextureFormat format>
+static void resolvePackedWrap(const SamplerState & state, PackedSampler * sampler, PackedSampler4 * sampler4)
+{
+    switch (state.wrap_u)
+    {
+        case TEXTURE_WRAP_REPEAT:   resolvePackedV<format, TEXTURE_WRAP_REPEAT>(state.wrap_v, sampler, sampler4); break;
+        case TEXTURE_WRAP_MIRROR:   resolvePackedV<format, TEXTURE_WRAP_MIRROR>(state.wrap_v, sampler, sampler4); break;
+        default:                    resolvePackedV<format, TEXTURE_WRAP_CLAMP>(state.wrap_v, sampler, sampler4); break;
+    }
+}
+
+// a baked surface is RGBA8, RGBA16F or RGBA32F, see Material::bake
+static void resolvePacked(TextureFormat format, const SamplerState & state, PackedSampler * sampler, PackedSampler4 * sampler4)
+{
+    switch (format)
+    {
+        case TEXTURE_FORMAT_RGBA8:      resolvePackedWrap<TEXTURE_FORMAT_RGBA8>(state, sampler, sampler4); break;
+        case TEXTURE_FORMAT_RGBA16F:    resolvePackedWrap<TEXTURE_FORMAT_RGBA16F>(state, sampler, sampler4); break;
+        default:                        resolvePackedWrap<TEXTURE_FORMAT_RGBA32F>(state, sampler, sampler4); break;
+    }
+}
+
+// the sampling functions of the format and the wrap modes, picked once instead of per sample
+void Texture::bindSampler()
+{
+    switch (m_format)
+    {
+        case TEXTURE_FORMAT_RGBA16F:        resolveWrap<TEXTURE_FORMAT_RGBA16F>(m_sampler, &m_level_sampler, &m_level_sampler4, &m_virtual_sampler); break;
+        case TEXTURE_FORMAT_RGBA8:          resolveWrap<TEXTURE_FORMAT_RGBA8>(m_sampler, &m_level_sampler, &m_level_sampler4, &m_virtual_sampler); break;
+        case TEXTURE_FORMAT_SRGB8_ALPHA8:   resolveWrap<TEXTURE_FORMAT_SRGB8_ALPHA8>(m_sampler, &m_level_sampler, &m_level_sampler4, &m_virtual_sampler); break;
+        case TEXTURE_FORMAT_RG8:            resolveWrap<TEXTURE_FORMAT_RG8>(m_sampler, &m_level_sampler, &m_level_sampler4, &m_virtual_sampler); break;
+        case TEXTURE_FORMAT_BC1:            resolveWrap<TEXTURE_FORMAT_BC1>(m_sampler, &m_level_sampler, &m_level_sampler4, &m_virtual_sampler); break;
+        case TEXTURE_FORMAT_BC5:            resolveWrap<TEXTURE_FORMAT_BC5>(m_sampler, &m_level_sampler, &m_level_sampler4, &m_virtual_sampler); break;
+        default:                            resolveWrap<TEXTURE_FORMAT_RGBA32F>(m_sampler, &m_level_sampler, &m_level_sampler4, &m_virtual_sampler); break;
+    }
+}
+
+void Texture::setSampler(const SamplerState & sampler)
+{
+    m_sampler = sampler;
+    m_sampler.anisotropy = clamp(sampler.anisotropy, 1L, (long)TEXTURE_MAX_ANISOTROPY);
+    bindSampler();
+}
+
+// the global filtering decides between nearest and trilinear for TEXTURE_FILTER_GLOBAL
+TextureFilter Texture::filterMode() const
+{
+    if (m_sampler.filter != TEXTURE_FILTER_GLOBAL) return m_sampler.filter;
+    return Singleton<Global>::get().texture_filtering_linear ? TEXTURE_FILTER_TRILINEAR : TEXTURE_FILTER_NEAREST;
+}
+
+bool Texture::mipmapped() const
+{
+    return m_level_count > 1 && (m_sampler.filter != TEXTURE_FILTER_GLOBAL || Singleton<Global>::get().texture_mipmapping);
+}
+
+/**
+ * Sampler from words separated by spaces, e.g. "repeat trilinear bias -0.5 aniso 4".
+ * clamp, repeat and mirror wrap both axes, nearest, bilinear, trilinear and
+ * global set the filter, bias and aniso are followed by their value. The
+ * values not given are left as they are in state.
+ */
+bool SamplerState::parse(const char * description, SamplerState * state)
+{
+    char word[64];
+    int consumed = 0;
+    while (sscanf(description, "%63s%n", word, &consumed) == 1)
+    {
+        description += consumed;
+        if (strcmp(word, "clamp") == 0)             state->wrap_u = state->wrap_v = TEXTURE_WRAP_CLAMP;
+        else if (strcmp(word, "repeat") == 0)       state->wrap_u = state->wrap_v = TEXTURE_WRAP_REPEAT;
+        else if (strcmp(word, "mirror") == 0)       state->wrap_u = state->wrap_v = TEXTURE_WRAP_MIRROR;
+        else if (strcmp(word, "global") == 0)       state->filter = TEXTURE_FILTER_GLOBAL;
+        else if (strcmp(word, "nearest") == 0)      state->filter = TEXTURE_FILTER_NEAREST;
+        else if (strcmp(word, "bilinear") == 0)     state->filter = TEXTURE_FILTER_BILINEAR;
+        else if (strcmp(word, "trilinear") == 0)    state->filter = TEXTURE_FILTER_TRILINEAR;
+        else if (strcmp(word, "bias") == 0 && sscanf(description, "%f%n", &state->lod_bias, &consumed) == 1)
+        {
+            description += consumed;
+        }
+        else if (strcmp(word, "aniso") == 0 && sscanf(description, "%ld%n", &state->anisotropy, &consumed) == 1)
+        {
+            description += consumed;
+            state->anisotropy = clamp(state->anisotropy, 1L, (long)TEXTURE_MAX_ANISOTROPY);
+        }
+        else
+        {
+            printf("SamplerState : unknown sampler setting: %s\n", word);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * log2 of the texels covered by a pixel along its longer axis, from the
+ * derivatives of the texture coordinates across the pixel.
+ * reference : https://registry.khronos.org/OpenGL/specs/gl/glspec46.core.pdf (8.14.1)
+ */
+float Texture::levelOfDetail(const vec2 & texcoord_dx, const vec2 & texcoord_dy) const
+{
+    const float dx_u = texcoord_dx.u * m_width;
+    const float dx_v = texcoord_dx.v * m_height;
+    const float dy_u = texcoord_dy.u * m_width;
+    const float dy_v = texcoord_dy.v * m_height;
+    const float rho_squared = max(dx_u * dx_u + dx_v * dx_v, dy_u * dy_u + dy_v * dy_v);
+    return 0.5f * log2f(rho_squared);
+}
+
+/**
+ * Level of detail of the footprint of a pixel with the bias of the sampler,
+ * and the taps covering it. A footprint longer than wide is split into taps
+ * along axis, the level is then picked for the length of one tap, which is
+ * at least the width of the footprint.
+ */
+long Texture::footprint(const vec2 & texcoord_dx, const vec2 & texcoord_dy, float * lod, vec2 * axis) const
+{
+    *lod = levelOfDetail(texcoord_dx, texcoord_dy) + m_sampler.lod_bias;
+    if (m_sampler.anisotropy < 2) return 1;
+
+    const float dx_u = texcoord_dx.u * m_width;
+    const float dx_v = texcoord_dx.v * m_height;
+    const float dy_u = texcoord_dy.u * m_width;
+    const float dy_v = texcoord_dy.v * m_height;
+    const float length_x = dx_u * dx_u + dx_v * dx_v;
+    const float length_y = dy_u * dy_u + dy_v * dy_v;
+    const float minor = min(length_x, length_y);
+    if (!(minor > 0.0f)) return 1;
+
+    const float ratio = sqrtf(max(length_x, length_y) / minor);
+    const long taps = ratio >= (float)m_sampler.anisotropy ? m_sampler.anisotropy : (long)ceilf(ratio);
+    if (taps < 2) return 1;
+    *lod -= log2f((float)taps);
+    *axis = length_x >= length_y ? texcoord_dx : texcoord_dy;
+    return taps;
+}
+
+// levels read at lod, 2 when trilinear filtering blends level and level + 1 by weight
+long Texture::pickLevels(float lod, TextureFilter filter, long * level, float * weight) const
+{
+    *level = 0;
+    *weight = 0.0f;
+    if (!(lod > 0.0f)) return 1; // a magnified texture, also without derivatives or if they are not finite
+
+    const long last_level = m_level_count - 1;
+    if (filter != TEXTURE_FILTER_TRILINEAR)
+    {
+        *level = lod + 0.5f >= last_level ? last_level : FTOD(lod + 0.5f);
+        return 1;
+    }
+    if (lod >= last_level)
+    {
+        *level = last_level;
+        return 1;
+    }
+
+    *level = FTOD(lod);
+    *weight = lod - *level;
+    return 2;
+}
+
+// a level of a virtual texture, or the first coarser level whose pages are resident, the tail at last
+vec4 Texture::sampleVirtual(long level, const vec2 & texcoord, bool linear) const
+{
+    vec4 color;
+    const long tail_level = m_virtual->tailLevel();
+    for (; level < tail_level; level++)
+    {
+        if (m_virtual_sampler(*m_virtual, level, texcoord, linear, &color)) return color;
+    }
+    return m_level_sampler(m_levels[tail_level], texcoord, linear);
+}
+
+void Texture::sampleVirtual4(long level, const vec2 * texcoords, bool linear, vec4 * colors) const
+{
+    for (long q = 0; q < 4; q++)
+    {
+        colors[q] = sampleVirtual(level, texcoords[q], linear);
+    }
+}
+
+vec4 Texture::sampleMip(const vec2 & texcoord, float lod, TextureFilter filter) const
+{
+    long level;
+    float weight;
+    if (pickLevels(lod, filter, &level, &weight) == 1) return sampleLevel(level, texcoord, filter != TEXTURE_FILTER_NEAREST);
+
+    return vec4::lerp(
+        sampleLevel(level, texcoord, true),
+        sampleLevel(level + 1, texcoord, true),
+        weight
+    );
+}
+
+void Texture::sampleMip4(const vec2 * texcoords, float lod, TextureFilter filter, vec4 * colors) const
+{
+    long level;
+    float weight;
+    if (pickLevels(lod, filter, &level, &weight) == 1)
+    {
+        sampleLevel4(level, texcoords, filter != TEXTURE_FILTER_NEAREST, colors);
+        return;
+    }
+
+    vec4 coarse[4];
+    sampleLevel4(level, texcoords, true, colors);
+    sampleLevel4(level + 1, texcoords, true, coarse);
+    for (long q = 0; q < 4; q++)
+    {
+        colors[q] = vec4::lerp(colors[q], coarse[q], weight);
+    }
+}
+
+vec4 Texture::sampler(const Texture & texture, const vec2 & texcoord)
+{
+    if (!texture.m_buffer) return texture.m_base_color;
+
+    return texture.sampleLevel(0, texcoord, texture.filterMode() != TEXTURE_FILTER_NEAREST);
+}
+
+/**
+ * Sample the mip levels picked by the screen space derivatives of texcoord,
+ * as set by the sampler of the texture. Taps of anisotropic filtering are
+ * spread evenly over the longer axis of the footprint and averaged.
+ */
+vec4 Texture::sampler(const Texture & texture, const vec2 & texcoord, const vec2 & texcoord_dx, const vec2 & texcoord_dy)
+{
+    if (!texture.m_buffer) return texture.m_base_color;
+    if (!texture.mipmapped()) return sampler(texture, texcoord);
+
+    float lod;
+    vec2 axis;
+    const long taps = texture.footprint(texcoord_dx, texcoord_dy, &lod, &axis);
+    const TextureFilter filter = texture.filterMode();
+    if (taps == 1) return texture.sampleMip(texcoord, lod, filter);
+
+    vec4 color;
+    for (long t = 0; t < taps; t++)
+    {
+        color += texture.sampleMip(texcoord + axis * ((t + 0.5f) / taps - 0.5f), lod, filter);
+    }
+    return color / (float)taps;
+}
+
+void Texture::sample4(const Texture & texture, const vec2 * texcoords, vec4 * colors)
+{
+    if (!texture.m_buffer)
+    {
+        for (long q = 0; q < 4; q++) colors[q] = texture.m_base_color;
+        return;
+    }
+    texture.sampleLevel4(0, texcoords, texture.filterMode() != TEXTURE_FILTER_NEAREST, colors);
+}
+
+// the quad shares its derivatives, so the 4 pixels read the same levels with the same taps
+void Texture::sample4(const Texture & texture, const vec2 * texcoords, const vec2 & texcoord_dx, const vec2 & texcoord_dy, vec4 * colors)
+{
+    if (!texture.m_buffer || !texture.mipmapped())
+    {
+        sample4(texture, texcoords, colors);
+        return;
+    }
+
+    float lod;
+    vec2 axis;
+    const long taps = texture.footprint(texcoord_dx, texcoord_dy, &lod, &axis);
+    const TextureFilter filter = texture.filterMode();
+    if (taps == 1)
+    {
+        texture.sampleMip4(texcoords, lod, filter, colors);
+        return;
+    }
+
+    vec2 tap_texcoords[4];
+    vec4 tap_colors[4];
+    for (long q = 0; q < 4; q++) colors[q] = vec4();
+    for (long t = 0; t < taps; t++)
+    {
+        const vec2 offset = axis * ((t + 0.5f) / taps - 0.5f);
+        for (long q = 0; q < 4; q++) tap_texcoords[q] = texcoords[q] + offset;
+        texture.sampleMip4(tap_texcoords, lod, filter, tap_colors);
+        for (long q = 0; q < 4; q++) colors[q] += tap_colors[q];
+    }
+    for (long q = 0; q < 4; q++) colors[q] = colors[q] / (float)taps;
+}
+
+VirtualTexture::VirtualTexture():
+    m_filename(nullptr),
+    m_pages(nullptr),
+    m_tail(nullptr),
+    m_frame(0),
+    m_resident_count(0)
+{
+    memset(&m_header, 0, sizeof(VirtualTextureHeader));
+}
+
+VirtualTexture::~VirtualTexture()
+{
+    close();
+}
+
+// replace the extension of filename with VIRTUAL_TEXTURE_EXTENSION
+bool VirtualTexture::cacheFilename(const char * filename, char * cache_filename, size_t length)
+{
+    const char *extension = strrchr(filename, '.');
+    const char *separator = strrchr(filename, '/');
+    const char *backslash = strrchr(filename, '\\');
+    if (backslash > separator) separator = backslash;
+    size_t stem_len = (extension && extension > separator) ? extension - filename : strlen(filename);
+    if (stem_len + strlen(VIRTUAL_TEXTURE_EXTENSION) + 1 > length) return false;
+
+    memcpy(cache_filename, filename, stem_len);
+    strcpy(cache_filename + stem_len, VIRTUAL_TEXTURE_EXTENSION);
+    return true;
+}
+
+/**
+ * The tail level, the page count and the sizes are derived again from the
+ * size, format and layout the same way build does, so that a damaged header
+ * is rejected before anything is allocated or indexed from it.
+ */
+bool VirtualTexture::readHeader(TextureFormat format, TextureLayout layout, bool any_format)
+{
+    MappedFile file;
+    if (!file.open(m_filename) || file.size() < sizeof(VirtualTextureHeader)) return false;
+    memcpy(&m_header, file.data(), sizeof(VirtualTextureHeader));
+    if (m_header.magic != VIRTUAL_TEXTURE_MAGIC ||
+        m_header.version != VIRTUAL_TEXTURE_VERSION ||
+        m_header.page_shift != VIRTUAL_PAGE_SHIFT ||
+        m_header.format >= TEXTURE_FORMAT_COUNT ||
+        m_header.layout != (UINT32)Texture::surfaceLayout((TextureFormat)m_header.format, m_header.layout == TEXTURE_LAYOUT_TILED) ||
+        m_header.width == 0 || m_header.height == 0 ||
+        m_header.width > (1U << (TEXTURE_MAX_LEVELS - 1)) || m_header.height > (1U << (TEXTURE_MAX_LEVELS - 1)) ||
+        (!any_format && (m_header.format != (UINT32)format || m_header.layout != (UINT32)layout)))
+    {
+        return false;
+    }
+
+    const TextureFormat header_format = (TextureFormat)m_header.format;
+    const TextureLayout header_layout = (TextureLayout)m_header.layout;
+    long width = m_header.width;
+    long height = m_header.height;
+    UINT32 tail_level = 0;
+    UINT64 page_count = 0;
+    while (width > VIRTUAL_PAGE_SIZE || height > VIRTUAL_PAGE_SIZE)
+    {
+        page_count += ((width + VIRTUAL_PAGE_SIZE - 1) >> VIRTUAL_PAGE_SHIFT) * ((height + VIRTUAL_PAGE_SIZE - 1) >> VIRTUAL_PAGE_SHIFT);
+        tail_level++;
+        width = max(width / 2, 1L);
+        height = max(height / 2, 1L);
+    }
+    UINT64 tail_size = 0;
+    for (long level = tail_level; level < TEXTURE_MAX_LEVELS; level++)
+    {
+        tail_size += Texture::levelSize(width, height, header_format, header_layout);
+        if (width == 1 && height == 1) break;
+        width = max(width / 2, 1L);
+        height = max(height / 2, 1L);
+    }
+    return m_header.tail_level == tail_level &&
+           m_header.page_count == page_count &&
+           m_header.page_size == Texture::levelSize(VIRTUAL_PAGE_SIZE, VIRTUAL_PAGE_SIZE, header_format, header_layout) &&
+           m_header.tail_size == tail_size &&
+           m_header.tail_offset >= sizeof(VirtualTextureHeader) &&
+           m_header.tail_offset + m_header.tail_size <= file.size() &&
+           m_header.pages_offset >= m_header.tail_offset + m_header.tail_size &&
+           m_header.pages_offset <= file.size() &&
+           m_header.page_count * m_header.page_size <= file.size() - m_header.pages_offset;
+}
+
+/**
+ * Open the virtual texture file of an image, built first if it is missing,
+ * older than the image or in another format or layout. A virtual texture
+ * file itself is opened in the format and layout it was built with.
+ */
+bool VirtualTexture::open(const char * filename, TextureFormat format, TextureLayout layout)
+{
+    close();
+
+    const size_t length = strlen(filename) + strlen(VIRTUAL_TEXTURE_EXTENSION) + 1;
+    m_filename = new char[length];
+    const char *extension = strrchr(filename, '.');
+    const bool direct = extension && strcmp(extension, VIRTUAL_TEXTURE_EXTENSION) == 0;
+    if (direct) strcpy(m_filename, filename);
+    else cacheFilename(filename, m_filename, length);
+
+    INT64 image_time, cache_time;
+    bool valid = MappedFile::modifiedTime(m_filename, &cache_time) &&
+                 (direct || !MappedFile::modifiedTime(filename, &image_time) || cache_time >= image_time) &&
+                 readHeader(format, layout, direct);
+    if (!valid && !direct) valid = build(filename, m_filename, format, layout) && readHeader(format, layout, false);
+    if (!valid)
+    {
+        printf("VirtualTexture : texture file: %s is invalid or outdated\n", m_filename);
+        close();
+        return false;
+    }
+
+    MappedFile tail_file;
+    if (!tail_file.open(m_filename, m_header.tail_offset, m_header.tail_size))
+    {
+        close();
+        return false;
+    }
+    m_tail = new byte_t[m_header.tail_size];
+    memcpy(m_tail, tail_file.data(), m_header.tail_size);
+    tail_file.close();
+
+    long width = m_header.width;
+    long height = m_header.height;
+    long first_page = 0;
+    for (long level = 0; level < (long)m_header.tail_level; level++)
+    {
+        VirtualLevel & vlevel = m_levels[level];
+        vlevel.width = width;
+        vlevel.height = height;
+        vlevel.pages_x = (width + VIRTUAL_PAGE_SIZE - 1) >> VIRTUAL_PAGE_SHIFT;
+        vlevel.pages_y = (height + VIRTUAL_PAGE_SIZE - 1) >> VIRTUAL_PAGE_SHIFT;
+        vlevel.first_page = first_page;
+        first_page += vlevel.pages_x * vlevel.pages_y;
+        width = max(width / 2, 1L);
+        height = max(height / 2, 1L);
+    }
+    assert((UINT64)first_page == m_header.page_count);
+
+    m_pages = new VirtualPage[m_header.page_count];
+    for (size_t pidx = 0; pidx < m_header.page_count; pidx++)
+    {
+        m_pages[pidx].texels = nullptr;
+        m_pages[pidx].requested.store(0);
+        m_pages[pidx].used.store(0);
+    }
+    m_page_level.texels = nullptr;
+    m_page_level.width = VIRTUAL_PAGE_SIZE;
+    m_page_level.height = VIRTUAL_PAGE_SIZE;
+    setupLevelLayout(m_page_level, (TextureLayout)m_header.layout);
+
+    Singleton<VirtualTextureCache>::get().attach(this);
+    return true;
+}
+
+void VirtualTexture::close()
+{
+    if (m_pages)
+    {
+        Singleton<VirtualTextureCache>::get().detach(this);
+        for (size_t pidx = 0; pidx < m_header.page_count; pidx++)
+        {
+            delete[] m_pages[pidx].texels;
+        }
+    }
+    delete[] m_pages;
+    delete[] m_tail;
+    delete[] m_filename;
+    m_pages = nullptr;
+    m_tail = nullptr;
+    m_filename = nullptr;
+    m_resident_count = 0;
+    memset(&m_header, 0, sizeof(VirtualTextureHeader));
+}
+
+// texels of a page read from the file, nullptr if the read failed
+byte_t * VirtualTexture::readPage(size_t pidx) const
+{
+    MappedFile page_file;
+    if (!page_file.open(m_filename, m_header.pages_offset + pidx * m_header.page_size, m_header.page_size)) return nullptr;
+
+    byte_t *texels = new byte_t[m_header.page_size];
+    memcpy(texels, page_file.data(), m_header.page_size);
+    return texels;
+}
+
+void VirtualTexture::evictPage(size_t pidx)
+{
+    delete[] m_pages[pidx].texels;
+    m_pages[pidx].texels = nullptr;
+    m_resident_count--;
+}
+
+/**
+ * Write the virtual texture file of an image. The mip chain is built as for
+ * Texture::createSurface, the levels that fit in one page are encoded as the
+ * tail and every page of the larger levels is encoded as a level of its own,
+ * from the texels of the level under it, the last ones repeated past its
+ * edges like the blocks of a partial tile. Pages are then decoded to the
+ * same texels as the surface of a texture.
+ */
+bool VirtualTexture::build(const char * filename, const char * cache_filename, TextureFormat format, TextureLayout layout)
+{
+    BMPImage bmp_image(filename);
+    if (!bmp_image.isLoaded())
+    {
+        printf("VirtualTexture : image file: %s load failed\n", filename);
+        return false;
+    }
+
+    const float *sources[TEXTURE_MAX_LEVELS];
+    long widths[TEXTURE_MAX_LEVELS];
+    long heights[TEXTURE_MAX_LEVELS];
+    long level_count = 0;
+    byte_t *chain = createMipChain(bmp_image, format);
+    const float *source = reinterpret_cast<const float*>(chain);
+    long width = bmp_image.getImageWidth();
+    long height = bmp_image.getImageHeight();
+    while (level_count < TEXTURE_MAX_LEVELS)
+    {
+        sources[level_count] = source;
+        widths[level_count] = width;
+        heights[level_count] = height;
+        level_count++;
+        if (width == 1 && height == 1) break;
+
+        source += width * height * 4;
+        width = max(width / 2, 1L);
+        height = max(height / 2, 1L);
+    }
+
+    VirtualTextureHeader header;
+    memset(&header, 0, sizeof(VirtualTextureHeader));
+    header.magic = VIRTUAL_TEXTURE_MAGIC;
+    header.version = VIRTUAL_TEXTURE_VERSION;
+    header.format = format;
+    header.layout = layout;
+    header.width = (UINT32)widths[0];
+    header.height = (UINT32)heights[0];
+    header.page_shift = VIRTUAL_PAGE_SHIFT;
+    while (header.tail_level < (UINT32)level_count - 1 &&
+           (widths[header.tail_level] > VIRTUAL_PAGE_SIZE || heights[header.tail_level] > VIRTUAL_PAGE_SIZE))
+    {
+        const long level = header.tail_level++;
+        header.page_count += ((widths[level] + VIRTUAL_PAGE_SIZE - 1) >> VIRTUAL_PAGE_SHIFT) *
+                             ((heights[level] + VIRTUAL_PAGE_SIZE - 1) >> VIRTUAL_PAGE_SHIFT);
+    }
+    header.page_size = Texture::levelSize(VIRTUAL_PAGE_SIZE, VIRTUAL_PAGE_SIZE, format, layout);
+    header.tail_offset = sizeof(VirtualTextureHeader);
+    for (long level = header.tail_level; level < level_count; level++)
+    {
+        header.tail_size += Texture::levelSize(widths[level], heights[level], format, layout);
+    }
+    header.pages_offset = (header.tail_offset + header.tail_size + VIRTUAL_TEXTURE_ALIGNMENT - 1) / VIRTUAL_TEXTURE_ALIGNMENT * VIRTUAL_TEXTURE_ALIGNMENT;
+
+    size_t f_len = strlen(cache_filename);
+    char *temp_filename = new char[f_len + 5];
+    strcpy(temp_filename, cache_filename);
+    strcat(temp_filename, ".tmp");
+    FILE *fp = fopen(temp_filename, "wb");
+    if (fp == nullptr)
+    {
+        printf("VirtualTexture : texture file: %s open failed\n", temp_filename);
+        delete[] temp_filename;
+        delete[] chain;
+        return false;
+    }
+
+    byte_t *tail = new byte_t[header.tail_size]();
+    byte_t *target = tail;
+    for (long level = header.tail_level; level < level_count; level++)
+    {
+        encodeLevel(sources[level], widths[level], heights[level], format, layout, target);
+        target += Texture::levelSize(widths[level], heights[level], format, layout);
+    }
+    const size_t padding_size = header.pages_offset - header.tail_offset - header.tail_size;
+    const byte_t padding[VIRTUAL_TEXTURE_ALIGNMENT] = { 0 };
+    bool written = fwrite(&header, sizeof(VirtualTextureHeader), 1, fp) == 1 &&
+                   fwrite(tail, 1, header.tail_size, fp) == header.tail_size &&
+                   fwrite(padding, 1, padding_size, fp) == padding_size;
+    delete[] tail;
+
+    float *page_texels = new float[VIRTUAL_PAGE_SIZE * VIRTUAL_PAGE_SIZE * 4];
+    byte_t *page = new byte_t[header.page_size];
+    for (long level = 0; level < (long)header.tail_level && written; level++)
+    {
+        const long pages_x = (widths[level] + VIRTUAL_PAGE_SIZE - 1) >> VIRTUAL_PAGE_SHIFT;
+        const long pages_y = (heights[level] + VIRTUAL_PAGE_SIZE - 1) >> VIRTUAL_PAGE_SHIFT;
+        for (long py = 0; py < pages_y && written; py++)
+        {
+            for (long px = 0; px < pages_x && written; px++)
+            {
+                for (long y = 0; y < VIRTUAL_PAGE_SIZE; y++)
+                {
+                    const long source_y = min((py << VIRTUAL_PAGE_SHIFT) + y, heights[level] - 1);
+                    for (long x = 0; x < VIRTUAL_PAGE_SIZE; x++)
+                    {
+                        const long source_x = min((px << VIRTUAL_PAGE_SHIFT) + x, widths[level] - 1);
+                        memcpy(page_texels + (y * VIRTUAL_PAGE_SIZE + x) * 4, sources[level] + (source_y * widths[level] + source_x) * 4, 4 * sizeof(float));
+                    }
+                }
+                encodeLevel(page_texels, VIRTUAL_PAGE_SIZE, VIRTUAL_PAGE_SIZE, format, layout, page);
+                written = fwrite(page, 1, header.page_size, fp) == header.page_size;
+            }
+        }
+    }
+    delete[] page;
+    delete[] page_texels;
+    delete[] chain;
+    written = fclose(fp) == 0 && written;
+
+    if (written)
+    {
+        remove(cache_filename);
+        written = rename(temp_filename, cache_filename) == 0;
+    }
+    if (!written)
+    {
+        printf("VirtualTexture : texture file: %s write failed\n", cache_filename);
+        remove(temp_filename);
+    }
+    delete[] temp_filename;
+    return written;
+}
+
+VirtualTextureCache::VirtualTextureCache():
+    m_budget(VIRTUAL_TEXTURE_BUDGET),
+    m_resident_size(0),
+    m_load_count(0),
+    m_frame(1) {}
+
+void VirtualTextureCache::attach(VirtualTexture * texture)
+{
+    m_textures.push_back(texture);
+    texture->m_frame = m_frame;
+}
+
+void VirtualTextureCache::detach(VirtualTexture * texture)
+{
+    for (size_t tidx = 0; tidx < m_textures.size(); tidx++)
+    {
+        if (m_textures[tidx] != texture) continue;
+
+        m_resident_size -= texture->m_resident_count * texture->pageSize();
+        m_textures[tidx] = m_textures.back();
+        m_textures.pop_back();
+        return;
+    }
+}
+
+void VirtualTextureCache::setBudget(size_t budget)
+{
+    m_budget = budget;
+    makeRoom(0, false);
+}
+
+// evict pages until size more bytes fit in the budget, least recently used
+// first, the pages sampled during the frame being ended are kept if keep_frame
+bool VirtualTextureCache::makeRoom(size_t size, bool keep_frame)
+{
+    while (m_resident_size + size > m_budget)
+    {
+        VirtualTexture *victim_texture = nullptr;
+        size_t victim = 0;
+        UINT32 victim_used = 0;
+        for (size_t tidx = 0; tidx < m_textures.size(); tidx++)
+        {
+            VirtualTexture *texture = m_textures[tidx];
+            for (size_t pidx = 0; pidx < texture->pageCount(); pidx++)
+            {
+                const VirtualPage & page = texture->m_pages[pidx];
+                if (!page.texels) continue;
+                const UINT32 used = page.used.load(std::memory_order_relaxed);
+                if (keep_frame && used == m_frame) continue;
+                if (victim_texture == nullptr || used < victim_used)
+                {
+                    victim_texture = texture;
+                    victim = pidx;
+                    victim_used = used;
+                }
+            }
+        }
+        if (victim_texture == nullptr) return false;
+        m_resident_size -= victim_texture->pageSize();
+        victim_texture->evictPage(victim);
+    }
+    return true;
+}
+
+/**
+ * End a frame : read the pages requested during it, coarser levels first as
+ * the finer ones fall back to them, then start the next frame. Call it when
+ * no texture is being sampled, Pipeline::draw does at the end of a frame.
+ */
+void VirtualTextureCache::update()
+{
+    struct PageLoad
+    {
+        VirtualTexture  *texture;
+        size_t          pidx;
+        byte_t          *texels;
+    };
+    PageLoad loads[VIRTUAL_PAGES_PER_UPDATE];
+    long load_count = 0;
+    bool full = false;
+    for (long level = TEXTURE_MAX_LEVELS - 1; level >= 0 && !full; level--)
+    {
+        for (size_t tidx = 0; tidx < m_textures.size() && !full; tidx++)
+        {
+            VirtualTexture *texture = m_textures[tidx];
+            if (level >= texture->tailLevel()) continue;
+
+            const VirtualLevel & vlevel = texture->m_levels[level];
+            const long last_page = vlevel.first_page + vlevel.pages_x * vlevel.pages_y;
+            for (long pidx = vlevel.first_page; pidx < last_page && !full; pidx++)
+            {
+                const VirtualPage & page = texture->m_pages[pidx];
+                if (page.texels || page.requested.load(std::memory_order_relaxed) != m_frame) continue;
+
+                full = !makeRoom(texture->pageSize(), true);
+                if (full) break;
+                m_resident_size += texture->pageSize();
+                loads[load_count].texture = texture;
+                loads[load_count].pidx = pidx;
+                full = ++load_count == VIRTUAL_PAGES_PER_UPDATE;
+            }
+        }
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel for if(load_count > 1)
+#endif
+    for (long lidx = 0; lidx < load_count; lidx++)
+    {
+        loads[lidx].texels = loads[lidx].texture->readPage(loads[lidx].pidx);
+    }
+    for (long lidx = 0; lidx < load_count; lidx++)
+    {
+        VirtualTexture *texture = loads[lidx].texture;
+        if (loads[lidx].texels == nullptr)
+        {
+            m_resident_size -= texture->pageSize();
+            continue;
+        }
+        VirtualPage & page = texture->m_pages[loads[lidx].pidx];
+        page.texels = loads[lidx].texels;
+        page.used.store(m_frame, std::memory_order_relaxed);
+        texture->m_resident_count++;
+        m_load_count++;
+    }
+
+    m_frame++;
+    for (size_t tidx = 0; tidx < m_textures.size(); tidx++)
+    {
+        m_textures[tidx]->m_frame = m_frame;
+    }
+}
+
+Material::~Material()
+{
+    unbake();
+}
+
+const Texture & Material::map(long index) const
+{
+    switch (index)
+    {
+        case 0:  return albedo;
+        case 1:  return diffuse;
+        case 2:  return specular;
+        default: return normal;
+    }
+}
+
+static bool sameSampler(const SamplerState & a, const SamplerState & b)
+{
+    return a.wrap_u == b.wrap_u &&
+           a.wrap_v == b.wrap_v &&
+           a.filter == b.filter &&
+           a.lod_bias == b.lod_bias &&
+           a.anisotropy == b.anisotropy;
+}
+
+// RGBA8 maps keep their texels exactly in RGBA8, other maps fit in half floats
+// within the precision of their 8 bit channels, RGBA32F maps need RGBA32F
+static TextureFormat bakedFormat(TextureFormat surface_format, TextureFormat map_format)
+{
+    if (surface_format == TEXTURE_FORMAT_RGBA32F || map_format == TEXTURE_FORMAT_RGBA32F) return TEXTURE_FORMAT_RGBA32F;
+    if (surface_format == TEXTURE_FORMAT_RGBA8 && map_format == TEXTURE_FORMAT_RGBA8) return TEXTURE_FORMAT_RGBA8;
+    return TEXTURE_FORMAT_RGBA16F;
+}
+
+static void encodeBakedTexel(const vec4 & color, TextureFormat format, byte_t * output)
+{
+    const float *channels = &color.x;
+    switch (format)
+    {
+        case TEXTURE_FORMAT_RGBA8:
+            for (long c = 0; c < 4; c++) output[c] = encodeUnorm8(channels[c]);
+            break;
+        case TEXTURE_FORMAT_RGBA16F:
+            {
+                UINT16 half[4];
+                for (long c = 0; c < 4; c++) half[c] = floatToHalf(channels[c]);
+                memcpy(output, half, sizeof(half));
+            }
+            break;
+        default:
+            memcpy(output, channels, sizeof(float) * 4);
+            break;
+    }
+}
+
+/**
+ * Groups the maps by size and sampler, then interleaves the decoded texels
+ * of every group level by level, linear or in tiles like the maps, in the
+ * narrowest format holding the texels of all the maps of the group. Returns
+ * false and leaves the material sampling its maps if none has a surface.
+ */
+bool Material::bake()
+{
+    unbake();
+
+    bool shared[MATERIAL_MAPS];
+    for (long midx = 0; midx < MATERIAL_MAPS; midx++)
+    {
+        const Texture & texture = map(midx);
+        m_surface_of[midx] = -1;
+        shared[midx] = false;
+        if (!texture.m_buffer || texture.m_virtual) continue;
+
+        for (long other = 0; other < midx && !shared[midx]; other++)
+        {
+            if (m_surface_of[other] < 0 || map(other).m_buffer != texture.m_buffer) continue;
+            if (!sameSampler(map(other).m_sampler, texture.m_sampler)) continue;
+            m_surface_of[midx] = m_surface_of[other];
+            m_slot_of[midx] = m_slot_of[other];
+            shared[midx] = true;
+        }
+        if (shared[midx]) continue;
+
+        long sidx = 0;
+        for (; sidx < m_surface_count; sidx++)
+        {
+            const Texture & reference = *m_surfaces[sidx].reference;
+            if (reference.m_width == texture.m_width && reference.m_height == texture.m_height &&
+                sameSampler(reference.m_sampler, texture.m_sampler)) break;
+        }
+        if (sidx == m_surface_count)
+        {
+            m_surfaces[sidx].texels = nullptr;
+            m_surfaces[sidx].size = 0;
+            m_surfaces[sidx].format = texture.m_format == TEXTURE_FORMAT_RGBA8 ? TEXTURE_FORMAT_RGBA8 : TEXTURE_FORMAT_RGBA16F;
+            m_surfaces[sidx].slot_count = 0;
+            m_surfaces[sidx].reference = &texture;
+            m_surface_count++;
+        }
+        m_surfaces[sidx].format = bakedFormat(m_surfaces[sidx].format, texture.m_format);
+        m_surface_of[midx] = sidx;
+        m_slot_of[midx] = m_surfaces[sidx].slot_count++;
+    }
+
+    for (long sidx = 0; sidx < m_surface_count; sidx++)
+    {
+        MaterialSurface & surface = m_surfaces[sidx];
+        const Texture & reference = *surface.reference;
+        const TextureLayout layout = reference.m_layout == TEXTURE_LAYOUT_LINEAR ? TEXTURE_LAYOUT_LINEAR : TEXTURE_LAYOUT_TILED;
+        for (long level = 0; level < reference.m_level_count; level++)
+        {
+            surface.size += Texture::levelSize(reference.m_levels[level].width, reference.m_levels[level].height, surface.format, layout) * surface.slot_count;
+        }
+        surface.texels = new byte_t[surface.size]();
+
+        byte_t *texels = surface.texels;
+        for (long level = 0; level < reference.m_level_count; level++)
+        {
+            TextureLevel & packed = surface.levels[level];
+            packed.texels = texels;
+            packed.width = reference.m_levels[level].width;
+            packed.height = reference.m_levels[level].height;
+            setupLevelLayout(packed, layout);
+
+            const size_t texel_size = Texture::levelSize(1, 1, surface.format, TEXTURE_LAYOUT_LINEAR);
+            const long stride = surface.slot_count * texel_size;
+#ifdef _OPENMP
+#pragma omp parallel for if(packed.width * packed.height >= 4096)
+#endif
+            for (long y = 0; y < packed.height; y++)
+            {
+                for (long x = 0; x < packed.width; x++)
+                {
+                    byte_t *texel = texels + (packed.columnOffset(x) + packed.rowOffset(y)) * stride;
+                    for (long midx = 0; midx < MATERIAL_MAPS; midx++)
+                    {
+                        if (m_surface_of[midx] != sidx || shared[midx]) continue;
+                        const Texture & texture = map(midx);
+                        encodeBakedTexel(texture.texelAt(texture.m_levels[level], x, y), surface.format, texel + m_slot_of[midx] * texel_size);
+                    }
+                }
+            }
+            texels += Texture::levelSize(packed.width, packed.height, surface.format, layout) * surface.slot_count;
+        }
+    }
+    bindSurfaces();
+    return m_surface_count > 0;
+}
+
+void Material::unbake()
+{
+    for (long sidx = 0; sidx < m_surface_count; sidx++)
+    {
+        delete[] m_surfaces[sidx].texels;
+    }
+    m_surface_count = 0;
+}
+
+size_t Material::bakedSize() const
+{
+    size_t size = 0;
+    for (long sidx = 0; sidx < m_surface_count; sidx++)
+    {
+        size += m_surfaces[sidx].size;
+    }
+    return size;
+}
+
+// the sampling functions of the wrap modes of every surface
+void Material::bindSurfaces()
+{
+    for (long sidx = 0; sidx < m_surface_count; sidx++)
+    {
+        resolvePacked(m_surfaces[sidx].format, m_surfaces[sidx].reference->m_sampler, &m_surfaces[sidx].sampler, &m_surfaces[sidx].sampler4);
+    }
+}
+
+void Material::sampleLevels(const MaterialSurface & surface, const vec2 & texcoord, float lod, TextureFilter filter, vec4 * colors)
+{
+    long level;
+    float weight;
+    if (surface.reference->pickLevels(lod, filter, &level, &weight) == 1)
+    {
+        surface.sampler(surface.levels[level], texcoord, filter != TEXTURE_FILTER_NEAREST, surface.slot_count, colors);
+        return;
+    }
+
+    vec4 coarse[MATERIAL_MAPS];
+    surface.sampler(surface.levels[level], texcoord, true, surface.slot_count, colors);
+    surface.sampler(surface.levels[level + 1], texcoord, true, surface.slot_count, coarse);
+    for (long slot = 0; slot < surface.slot_count; slot++)
+    {
+        colors[slot] = vec4::lerp(colors[slot], coarse[slot], weight);
+    }
+}
+
+void Material::sampleLevels4(const MaterialSurface & surface, const vec2 * texcoords, float lod, TextureFilter filter, vec4 * colors)
+{
+    long level;
+    float weight;
+    if (surface.reference->pickLevels(lod, filter, &level, &weight) == 1)
+    {
+        surface.sampler4(surface.levels[level], texcoords, filter != TEXTURE_FILTER_NEAREST, surface.slot_count, colors);
+        return;
+    }
+
+    vec4 coarse[4 * MATERIAL_MAPS];
+    surface.sampler4(surface.levels[level], texcoords, true, surface.slot_count, colors);
+    surface.sampler4(surface.levels[level + 1], texcoords, true, surface.slot_count, coarse);
+    for (long slot = 0; slot < 4 * surface.slot_count; slot++)
+    {
+        colors[slot] = vec4::lerp(colors[slot], coarse[slot], weight);
+    }
+}
+
+// Texture::sampler for all the maps of a surface at once, one color per slot
+void Material::sampleSurface(const MaterialSurface & surface, const vec2 & texcoord, const vec2 & texcoord_dx, const vec2 & texcoord_dy, vec4 * colors)
+{
+    const Texture & reference = *surface.reference;
+    const TextureFilter filter = reference.filterMode();
+    float lod = 0.0f;
+    vec2 axis;
+    const long taps = reference.mipmapped() ? reference.footprint(texcoord_dx, texcoord_dy, &lod, &axis) : 1;
+    if (taps == 1)
+    {
+        sampleLevels(surface, texcoord, lod, filter, colors);
+        return;
+    }
+
+    vec4 tap_colors[MATERIAL_MAPS];
+    for (long slot = 0; slot < surface.slot_count; slot++) colors[slot] = vec4();
+    for (long t = 0; t < taps; t++)
+    {
+        sampleLevels(surface, texcoord + axis * ((t + 0.5f) / taps - 0.5f), lod, filter, tap_colors);
+        for (long slot = 0; slot < surface.slot_count; slot++) colors[slot] += tap_colors[slot];
+    }
+    for (long slot = 0; slot < surface.slot_count; slot++) colors[slot] = colors[slot] / (float)taps;
+}
+
+// Texture::sample4 for all the maps of a surface at once, the colors of lane q start at colors[q * slot_count]
+void Material::sampleSurface4(const MaterialSurface & surface, const vec2 * texcoords, const vec2 & texcoord_dx, const vec2 & texcoord_dy, vec4 * colors)
+{
+    const Texture & reference = *surface.reference;
+    const TextureFilter filter = reference.filterMode();
+    const long count = 4 * surface.slot_count;
+    float lod = 0.0f;
+    vec2 axis;
+    const long taps = reference.mipmapped() ? reference.footprint(texcoord_dx, texcoord_dy, &lod, &axis) : 1;
+    if (taps == 1)
+    {
+        sampleLevels4(surface, texcoords, lod, filter, colors);
+        return;
+    }
+
+    vec2 tap_texcoords[4];
+    vec4 tap_colors[4 * MATERIAL_MAPS];
+    for (long slot = 0; slot < count; slot++) colors[slot] = vec4();
+    for (long t = 0; t < taps; t++)
+    {
+        const vec2 offset = axis * ((t + 0.5f) / taps - 0.5f);
+        for (long q = 0; q < 4; q++) tap_texcoords[q] = texcoords[q] + offset;
+        sampleLevels4(surface, tap_texcoords, lod, filter, tap_colors);
+        for (long slot = 0; slot < count; slot++) colors[slot] += tap_colors[slot];
+    }
+    for (long slot = 0; slot < count; slot++) colors[slot] = colors[slot] / (float)taps;
+}
+
+/**
+ * All the maps at texcoord, the same colors as Texture::sampler of every map.
+ * A baked material picks the levels and the taps once per surface.
+ */
+void Material::sample(const Material & material, const vec2 & texcoord, const vec2 & texcoord_dx, const vec2 & texcoord_dy, MaterialSample & sample)
+{
+    if (material.m_surface_count == 0)
+    {
+        sample.albedo = Texture::sampler(material.albedo, texcoord, texcoord_dx, texcoord_dy);
+        sample.diffuse = Texture::sampler(material.diffuse, texcoord, texcoord_dx, texcoord_dy);
+        sample.specular = Texture::sampler(material.specular, texcoord, texcoord_dx, texcoord_dy);
+        sample.normal = Texture::sampler(material.normal, texcoord, texcoord_dx, texcoord_dy);
+        return;
+    }
+
+    vec4 colors[MATERIAL_MAPS][MATERIAL_MAPS];
+    for (long sidx = 0; sidx < material.m_surface_count; sidx++)
+    {
+        sampleSurface(material.m_surfaces[sidx], texcoord, texcoord_dx, texcoord_dy, colors[sidx]);
+    }
+    vec4 *maps[MATERIAL_MAPS] = { &sample.albedo, &sample.diffuse, &sample.specular, &sample.normal };
+    for (long midx = 0; midx < MATERIAL_MAPS; midx++)
+    {
+        const long sidx = material.m_surface_of[midx];
+        const Texture & texture = material.map(midx);
+        if (sidx >= 0) *maps[midx] = colors[sidx][material.m_slot_of[midx]];
+        else if (texture.m_virtual) *maps[midx] = Texture::sampler(texture, texcoord, texcoord_dx, texcoord_dy);
+        else *maps[midx] = texture.m_base_color;
+    }
+}
+
+void Material::sample4(const Material & material, const vec2 * texcoords, const vec2 & texcoord_dx, const vec2 & texcoord_dy, MaterialSample * samples)
+{
+    if (material.m_surface_count == 0)
+    {
+        vec4 colors[4];
+        Texture::sample4(material.albedo, texcoords, texcoord_dx, texcoord_dy, colors);
+        for (long q = 0; q < 4; q++) samples[q].albedo = colors[q];
+        Texture::sample4(material.diffuse, texcoords, texcoord_dx, texcoord_dy, colors);
+        for (long q = 0; q < 4; q++) samples[q].diffuse = colors[q];
+        Texture::sample4(material.specular, texcoords, texcoord_dx, texcoord_dy, colors);
+        for (long q = 0; q < 4; q++) samples[q].specular = colors[q];
+        Texture::sample4(material.normal, texcoords, texcoord_dx, texcoord_dy, colors);
+        for (long q = 0; q < 4; q++) samples[q].normal = colors[q];
+        return;
+    }
+
+    vec4 colors[MATERIAL_MAPS][4 * MATERIAL_MAPS];
+    for (long sidx = 0; sidx < material.m_surface_count; sidx++)
+    {
+        sampleSurface4(material.m_surfaces[sidx], texcoords, texcoord_dx, texcoord_dy, colors[sidx]);
+    }
+    vec4 virtual_colors[MATERIAL_MAPS][4];
+    for (long midx = 0; midx < MATERIAL_MAPS; midx++)
+    {
+        if (material.m_surface_of[midx] < 0 && material.map(midx).m_virtual)
+        {
+            Texture::sample4(material.map(midx), texcoords, texcoord_dx, texcoord_dy, virtual_colors[midx]);
+        }
+    }
+    for (long q = 0; q < 4; q++)
+    {
+        vec4 *maps[MATERIAL_MAPS] = { &samples[q].albedo, &samples[q].diffuse, &samples[q].specular, &samples[q].normal };
+        for (long midx = 0; midx < MATERIAL_MAPS; midx++)
+        {
+            const long sidx = material.m_surface_of[midx];
+            const Texture & texture = material.map(midx);
+            if (sidx >= 0) *maps[midx] = colors[sidx][q * material.m_surfaces[sidx].slot_count + material.m_slot_of[midx]];
+            else if (texture.m_virtual) *maps[midx] = virtual_colors[midx][q];
+            else *maps[midx] = texture.m_base_color;
+        }
     }
 }
@@ -4,47 +4,446 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
+#include <atomic>
 #include "global.hpp"
 #include "image.hpp"
 #include "maths.hpp"
+#include "darray.hpp"
 
 namespace LuGL
 {
 
+#define TEXTURE_MAX_LEVELS 16   // mip levels of a texture, enough for 32768 texels
+#define TEXTURE_MAX_ANISOTROPY 16   // taps of anisotropic filtering
+
+/**
+ * Internal formats of a texture surface, decoded to RGBA floats when sampled.
+ * RG8 and BC5 keep the x and y of a normal map, z is rebuilt as the positive
+ * root of a unit normal. BC1 and BC5 are stored in blocks of 4x4 texels.
+ */
+enum TextureFormat
+{
+    TEXTURE_FORMAT_RGBA32F = 0, // 16 bytes per texel
+    TEXTURE_FORMAT_RGBA16F,     // 8 bytes, half floats
+    TEXTURE_FORMAT_RGBA8,       // 4 bytes, linear
+    TEXTURE_FORMAT_SRGB8_ALPHA8,// 4 bytes, color decoded from sRGB to linear
+    TEXTURE_FORMAT_RG8,         // 2 bytes, normal maps
+    TEXTURE_FORMAT_BC1,         // 8 bytes per block, two RGB565 endpoints and 2 bit indices
+    TEXTURE_FORMAT_BC5,         // 16 bytes per block, two channels of 8 bit endpoints and 3 bit indices
+    TEXTURE_FORMAT_COUNT
+};
+
+/**
+ * Order of the texels of a level in memory. A bilinear footprint or a row of
+ * pixels walking the texture at an angle touches 2 rows of texels, which are
+ * a whole row apart in the linear layout. The tiled layout stores 4x4 tiles
+ * in rows with the texels of a tile in Morton order, so the 2x2 texels of an
+ * aligned footprint are adjacent (one cache line for RGBA32F) and a tile
+ * covers 4 rows in a few lines. Block compressed formats are always in tiles.
+ */
+enum TextureLayout
+{
+    TEXTURE_LAYOUT_LINEAR = 0,  // rows of texels
+    TEXTURE_LAYOUT_TILED,       // rows of 4x4 tiles, texels in Morton order
+    TEXTURE_LAYOUT_BLOCKS,      // rows of 4x4 blocks, texels in rows, for BC1 and BC5
+};
+
+/**
+ * One level of the mip chain. Whatever the layout, the offset of texel (x, y)
+ * is the offset of its column plus the offset of its row, each a step per
+ * group of 4 plus an offset within the group, so addressing never branches.
+ */
+struct TextureLevel
+{
+    byte_t  *texels;
+    long    width;
+    long    height;
+    long    column_step;
+    long    row_step;
+    long    column_offsets[4];
+    long    row_offsets[4];
+
+    long columnOffset(long x) const { return (x >> 2) * column_step + column_offsets[x & 3]; }
+    long rowOffset(long y) const { return (y >> 2) * row_step + row_offsets[y & 3]; }
+};
+
+// what a texture coordinate outside [0, 1] reads
+enum TextureWrap
+{
+    TEXTURE_WRAP_CLAMP = 0,     // the edge texels
+    TEXTURE_WRAP_REPEAT,        // the texture tiled
+    TEXTURE_WRAP_MIRROR,        // the texture tiled, every other tile mirrored
+    TEXTURE_WRAP_COUNT
+};
+
+enum TextureFilter
+{
+    TEXTURE_FILTER_GLOBAL = 0,  // LUGL_TEXTURE_FILTERING and LUGL_TEXTURE_MIPMAPPING
+    TEXTURE_FILTER_NEAREST,     // nearest texel of the nearest mip level
+    TEXTURE_FILTER_BILINEAR,    // 2x2 texels of the nearest mip level
+    TEXTURE_FILTER_TRILINEAR,   // 2x2 texels of the two mip levels around the level of detail
+};
+
+/**
+ * How a texture is sampled, set per texture or for all the maps of a
+ * material. With an anisotropy above 1, a footprint longer than wide is
+ * covered by up to that many taps along its longer axis, each sampled at the
+ * level of detail of the footprint width instead of its length.
+ */
+struct SamplerState
+{
+    TextureWrap     wrap_u;
+    TextureWrap     wrap_v;
+    TextureFilter   filter;
+    float           lod_bias;   // added to the level of detail
+    long            anisotropy; // 1 to TEXTURE_MAX_ANISOTROPY
+
+    SamplerState(TextureWrap wrap = TEXTURE_WRAP_CLAMP, TextureFilter filter = TEXTURE_FILTER_GLOBAL, float lod_bias = 0.0f, long anisotropy = 1):
+        wrap_u(wrap),
+        wrap_v(wrap),
+        filter(filter),
+        lod_bias(lod_bias),
+        anisotropy(anisotropy) {}
+
+    static bool parse(const char * description, SamplerState * state);
+};
+
+typedef vec4 (*LevelSampler)(const TextureLevel & level, const vec2 & texcoord, bool linear);
+typedef void (*LevelSampler4)(const TextureLevel & level, const vec2 * texcoords, bool linear, vec4 * colors);
+typedef void (*PackedSampler)(const TextureLevel & level, const vec2 & texcoord, bool linear, long slots, vec4 * colors);
+typedef void (*PackedSampler4)(const TextureLevel & level, const vec2 * texcoords, bool linear, long slots, vec4 * colors);
+
+class VirtualTexture;
+// false if a page of the footprint is not resident
+typedef bool (*VirtualSampler)(const VirtualTexture & texture, long level, const vec2 & texcoord, bool linear, vec4 * color);
+
+#define TEXTURE_CONTAINER_MAGIC 0x58544c4c    // "LLTX"
+#define TEXTURE_CONTAINER_VERSION 1
+#define TEXTURE_CONTAINER_EXTENSION ".ltx"
+#define TEXTURE_CONTAINER_ALIGNMENT 4096        // of the surface in the file
+
+/**
+ * Texture container file (.ltx) : a TextureContainerHeader, then at
+ * header.surface_offset the surface of the texture exactly as it is sampled,
+ * encoded and mipmapped, so that it is used where it is mapped.
+ */
+struct TextureContainerHeader
+{
+    UINT32 magic;
+    UINT32 version;
+    UINT32 format;
+    UINT32 layout;
+    UINT32 width;
+    UINT32 height;
+    UINT64 surface_offset;
+    UINT64 surface_size;
+};
+
+class MappedFile;
+
+/**
+ * The surface of a texture is its whole mip chain in one buffer, level 0
+ * first and every next level half the size of the previous one down to 1x1.
+ * Minified textures are sampled from the level whose texels are about the
+ * size of a pixel, so neighbouring pixels read neighbouring texels.
+ */
 class Texture
 {
+    friend class Material;
 private:
     long         m_width;
     long         m_height;
     mutable vec4 m_base_color;
-    float        *m_buffer;
+    byte_t       *m_buffer;
+    bool         m_shared;  // m_buffer belongs to the AssetCache
+    VirtualTexture *m_virtual;  // pages of the levels above the tail, m_buffer is the tail
+    TextureFormat m_format;
+    TextureLayout m_layout;
+    TextureLevel m_levels[TEXTURE_MAX_LEVELS];
+    long         m_level_count;
+    SamplerState m_sampler;
+    LevelSampler m_level_sampler;   // specialized for the format and the wrap modes
+    LevelSampler4 m_level_sampler4;
+    VirtualSampler m_virtual_sampler;
+
+    void releaseSurface();
+    void setupLevels();
+    void bindSampler();
+    vec4 texelAt(const TextureLevel & level, long x, long y) const;
+    vec4 sampleVirtual(long level, const vec2 & texcoord, bool linear) const;
+    void sampleVirtual4(long level, const vec2 * texcoords, bool linear, vec4 * colors) const;
+    // levels of a virtual texture without texels are sampled page by page
+    vec4 sampleLevel(long level, const vec2 & texcoord, bool linear) const
+    {
+        if (!m_levels[level].texels) return sampleVirtual(level, texcoord, linear);
+        return m_level_sampler(m_levels[level], texcoord, linear);
+    }
+    void sampleLevel4(long level, const vec2 * texcoords, bool linear, vec4 * colors) const
+    {
+        if (!m_levels[level].texels) sampleVirtual4(level, texcoords, linear, colors);
+        else m_level_sampler4(m_levels[level], texcoords, linear, colors);
+    }
+    TextureFilter filterMode() const;
+    bool mipmapped() const;
+    long footprint(const vec2 & texcoord_dx, const vec2 & texcoord_dy, float * lod, vec2 * axis) const;
+    long pickLevels(float lod, TextureFilter filter, long * level, float * weight) const;
+    vec4 sampleMip(const vec2 & texcoord, float lod, TextureFilter filter) const;
+    void sampleMip4(const vec2 * texcoords, float lod, TextureFilter filter, vec4 * colors) const;
 
 public:
     Texture():
         m_width(0),
         m_height(0),
         m_base_color(vec4(1.0f, 1.0f, 1.0f, 1.0f)),
-        m_buffer(nullptr) {}
-    Texture(const vec4 & base_color, const BMPImage & bmp_image);
-    Texture(const BMPImage & bmp_image);
-    Texture(const char * filename);
-    Texture(const vec4 & base_color, const char * filename);
+        m_buffer(nullptr),
+        m_shared(false),
+        m_virtual(nullptr),
+        m_format(TEXTURE_FORMAT_RGBA32F),
+        m_layout(TEXTURE_LAYOUT_LINEAR),
+        m_level_count(0),
+        m_level_sampler(nullptr),
+        m_level_sampler4(nullptr),
+        m_virtual_sampler(nullptr) {}
+    Texture(const vec4 & base_color, const BMPImage & bmp_image, TextureFormat format = TEXTURE_FORMAT_RGBA32F);
+    Texture(const BMPImage & bmp_image, TextureFormat format = TEXTURE_FORMAT_RGBA32F);
+    Texture(const char * filename, TextureFormat format = TEXTURE_FORMAT_RGBA32F);
+    Texture(const vec4 & base_color, const char * filename, TextureFormat format = TEXTURE_FORMAT_RGBA32F);
     ~Texture();
 
     void setBaseColor(const vec4 & base_color) const { m_base_color = base_color; }
     vec4 getBaseColor() const { return m_base_color; }
-    void loadTextureSurface(const BMPImage & bmp_image);
+    void loadTextureSurface(const BMPImage & bmp_image, TextureFormat format = TEXTURE_FORMAT_RGBA32F);
+    void loadTextureSurface(const char * filename, TextureFormat format = TEXTURE_FORMAT_RGBA32F);
+    bool loadVirtualSurface(const char * filename, TextureFormat format = TEXTURE_FORMAT_RGBA32F);
+    bool isVirtual() const { return m_virtual != nullptr; }
+    static byte_t * createSurface(const BMPImage & bmp_image, TextureFormat format, TextureLayout layout);
+    static TextureLayout surfaceLayout(TextureFormat format, bool tiled);
+    static size_t levelSize(long width, long height, TextureFormat format, TextureLayout layout);
+    static size_t surfaceSize(long width, long height, TextureFormat format, TextureLayout layout);
+    static void buildMipChain(float * surface, long width, long height);
+    static bool parseFormat(const char * name, TextureFormat * format);
+
+    bool saveContainer(const char * filename) const;
+    static bool containerFilename(const char * filename, char * container_filename, size_t length);
+    static bool containerFormat(const char * filename, TextureFormat * format, TextureLayout * layout);
+    static byte_t * mapContainer(const char * filename, TextureFormat format, TextureLayout layout, long * width, long * height, MappedFile ** file);
+
+    // resolves the sampling functions, kept when a surface is loaded afterwards
+    void setSampler(const SamplerState & sampler);
+    const SamplerState & getSampler() const { return m_sampler; }
 
     long getTextureWidth() const { return m_width; }
     long getTextureHeight() const { return m_height; }
+    TextureFormat getFormat() const { return m_format; }
+    TextureLayout getLayout() const { return m_layout; }
+    long levelCount() const { return m_level_count; }
+    const TextureLevel & getLevel(long level) const { return m_levels[level]; }
 
     vec4 colorAt(long x, long y) const;
     vec4 sampleAt(const vec2 & texcoord) const;
+    float levelOfDetail(const vec2 & texcoord_dx, const vec2 & texcoord_dy) const;
     static vec4 sampler(const Texture & texture, const vec2 & texcoord);
+    static vec4 sampler(const Texture & texture, const vec2 & texcoord, const vec2 & texcoord_dx, const vec2 & texcoord_dy);
+    // the 4 pixels of a quad at once, with the derivatives of the quad, same colors as sampler
+    static void sample4(const Texture & texture, const vec2 * texcoords, vec4 * colors);
+    static void sample4(const Texture & texture, const vec2 * texcoords, const vec2 & texcoord_dx, const vec2 & texcoord_dy, vec4 * colors);
+};
+
+#define VIRTUAL_TEXTURE_MAGIC 0x54564c4c  // "LLVT"
+#define VIRTUAL_TEXTURE_VERSION 1
+#define VIRTUAL_TEXTURE_EXTENSION ".lvt"
+#define VIRTUAL_PAGE_SHIFT 7                // pages of 128x128 texels
+#define VIRTUAL_PAGE_SIZE (1L << VIRTUAL_PAGE_SHIFT)
+#define VIRTUAL_TEXTURE_BUDGET (64 << 20)   // bytes of resident pages
+#define VIRTUAL_PAGES_PER_UPDATE 16         // pages read at the end of a frame
+#define VIRTUAL_TEXTURE_ALIGNMENT 4096      // of the first page in the file
+
+/**
+ * Virtual texture file (.lvt) : a VirtualTextureHeader, the tail of the mip
+ * chain (the levels that fit in one page) encoded like a surface, then the
+ * pages of the other levels, level 0 first and row by row, every page a
+ * VIRTUAL_PAGE_SIZE square level of its own in the format and layout of the
+ * texture. Pages over the edge of a level repeat its last texels.
+ */
+struct VirtualTextureHeader
+{
+    UINT32 magic;
+    UINT32 version;
+    UINT32 format;
+    UINT32 layout;
+    UINT32 width;
+    UINT32 height;
+    UINT32 page_shift;
+    UINT32 tail_level;      // first level of the tail
+    UINT64 page_count;
+    UINT64 page_size;       // bytes of a page
+    UINT64 tail_offset;
+    UINT64 tail_size;
+    UINT64 pages_offset;
+};
+
+struct VirtualPage
+{
+    byte_t              *texels;    // resident data, nullptr while on disk
+    std::atomic<UINT32> requested;  // frame of the last sample missing the page
+    std::atomic<UINT32> used;       // frame of the last sample reading it
+};
+
+struct VirtualLevel
+{
+    long width;
+    long height;
+    long pages_x;
+    long pages_y;
+    long first_page;
+};
+
+/**
+ * The pages of a texture too large to keep in memory. Sampling reads the
+ * resident pages only, a footprint on a missing page requests it and is
+ * read from the next coarser level instead, down to the tail which is always
+ * resident. The VirtualTextureCache loads the requested pages between frames.
+ */
+class VirtualTexture
+{
+    friend class VirtualTextureCache;
+private:
+    char                *m_filename;
+    VirtualTextureHeader m_header;
+    VirtualLevel        m_levels[TEXTURE_MAX_LEVELS];
+    VirtualPage         *m_pages;
+    TextureLevel        m_page_level;   // layout of every page, without texels
+    byte_t              *m_tail;
+    UINT32              m_frame;
+    size_t              m_resident_count;
+
+    bool readHeader(TextureFormat format, TextureLayout layout, bool any_format);
+    byte_t * readPage(size_t pidx) const;
+    void evictPage(size_t pidx);
+public:
+    VirtualTexture();
+    ~VirtualTexture();
+
+    VirtualTexture(const VirtualTexture &) = delete;
+    VirtualTexture & operator= (const VirtualTexture &) = delete;
+
+    bool open(const char * filename, TextureFormat format, TextureLayout layout);
+    void close();
+    static bool build(const char * filename, const char * cache_filename, TextureFormat format, TextureLayout layout);
+    static bool cacheFilename(const char * filename, char * cache_filename, size_t length);
+
+    // texels of the page holding texel (x, y) of a level above the tail, nullptr and requested when not resident
+    const byte_t * findPage(long level, long x, long y) const
+    {
+        const VirtualLevel & vlevel = m_levels[level];
+        VirtualPage & page = m_pages[vlevel.first_page + (y >> VIRTUAL_PAGE_SHIFT) * vlevel.pages_x + (x >> VIRTUAL_PAGE_SHIFT)];
+        std::atomic<UINT32> & stamp = page.texels ? page.used : page.requested;
+        if (stamp.load(std::memory_order_relaxed) != m_frame) stamp.store(m_frame, std::memory_order_relaxed);
+        return page.texels;
+    }
+    const TextureLevel & pageLevel() const { return m_page_level; }
+    const VirtualLevel & getLevel(long level) const { return m_levels[level]; }
+
+    byte_t * tail() const { return m_tail; }
+    long tailLevel() const { return m_header.tail_level; }
+    long getWidth() const { return m_header.width; }
+    long getHeight() const { return m_header.height; }
+    TextureFormat getFormat() const { return (TextureFormat)m_header.format; }
+    TextureLayout getLayout() const { return (TextureLayout)m_header.layout; }
+    size_t pageCount() const { return m_header.page_count; }
+    size_t pageSize() const { return m_header.page_size; }
+    size_t residentCount() const { return m_resident_count; }
+    bool isResident(size_t pidx) const { return m_pages[pidx].texels != nullptr; }
 };
 
+/**
+ * Process wide pool of the pages of the virtual textures. update() ends a
+ * frame : the pages requested during it are read, coarser levels first and
+ * at most VIRTUAL_PAGES_PER_UPDATE of them, and pages not read during the
+ * frame are evicted least recently used first to keep the pages under the
+ * budget. The pages sampled in the frame are never evicted for a new one,
+ * so a view needing more than the budget settles on coarser levels.
+ */
+class VirtualTextureCache
+{
+private:
+    DynamicArray<VirtualTexture*> m_textures;
+    size_t  m_budget;
+    size_t  m_resident_size;
+    size_t  m_load_count;
+    UINT32  m_frame;
+
+    bool makeRoom(size_t size, bool keep_frame);
+public:
+    VirtualTextureCache();
+    ~VirtualTextureCache() {}
+
+    VirtualTextureCache(const VirtualTextureCache &) = delete;
+    VirtualTextureCache & operator= (const VirtualTextureCache &) = delete;
+
+    void attach(VirtualTexture * texture);
+    void detach(VirtualTexture * texture);
+    void update();
+
+    void setBudget(size_t budget);
+    size_t getBudget() const { return m_budget; }
+    size_t residentSize() const { return m_resident_size; }
+    size_t loadCount() const { return m_load_count; }
+    UINT32 frame() const { return m_frame; }
+};
+
+#define MATERIAL_MAPS 4
+
+// the maps of a material sampled at one texture coordinate
+struct MaterialSample
+{
+    vec4 albedo;
+    vec4 diffuse;
+    vec4 specular;
+    vec4 normal;
+};
+
+// maps of a material baked into one surface, their texels one after the other
+struct MaterialSurface
+{
+    byte_t          *texels;
+    size_t          size;
+    TextureFormat   format;         // RGBA8, RGBA16F or RGBA32F
+    TextureLevel    levels[TEXTURE_MAX_LEVELS];
+    long            slot_count;
+    const Texture   *reference;     // one of the maps, sets the levels of detail and the sampler
+    PackedSampler   sampler;
+    PackedSampler4  sampler4;
+};
+
+/**
+ * A baked material keeps the texels of the maps with the same size and
+ * sampler interleaved in one surface, so that sampling them computes one
+ * footprint and reads one run of bytes per texel instead of one per map.
+ * Maps loaded from the same file take one slot. Maps without a surface are
+ * left out and sample their base color, virtual maps are sampled on their
+ * own. A surface is RGBA8 if all its maps are, RGBA32F if one of them is
+ * and RGBA16F otherwise, so it takes 4, 8 or 16 bytes per texel and slot on
+ * top of the maps, which shaders still sample directly; a BC1 map baked in
+ * half floats takes 16 times its own size. Bake after loading the maps and
+ * setting their samplers, the colors sampled are the same as with the maps
+ * up to the half float rounding of RGBA16F surfaces.
+ */
 class Material
 {
+private:
+    MaterialSurface m_surfaces[MATERIAL_MAPS];
+    long            m_surface_count;
+    long            m_surface_of[MATERIAL_MAPS];    // of every map, -1 for a map without a surface
+    long            m_slot_of[MATERIAL_MAPS];
+
+    const Texture & map(long index) const;
+    void bindSurfaces();
+    static void sampleSurface(const MaterialSurface & surface, const vec2 & texcoord, const vec2 & texcoord_dx, const vec2 & texcoord_dy, vec4 * colors);
+    static void sampleSurface4(const MaterialSurface & surface, const vec2 * texcoords, const vec2 & texcoord_dx, const vec2 & texcoord_dy, vec4 * colors);
+    static void sampleLevels(const MaterialSurface & surface, const vec2 & texcoord, float lod, TextureFilter filter, vec4 * colors);
+    static void sampleLevels4(const MaterialSurface & surface, const vec2 * texcoords, float lod, TextureFilter filter, vec4 * colors);
+
 public:
     Texture albedo;
     Texture diffuse;
@@ -52,6 +451,7 @@ public:
     Texture normal;
 
     Material():
+        m_surface_count(0),
         albedo(Texture()),
         diffuse(Texture()),
         specular(Texture()),
@@ -59,7 +459,28 @@ public:
 
         normal.setBaseColor(vec4(0.5f, 0.5f, 1.0f, 1.0f));
     }
+    ~Material();
+
+    Material(const Material &) = delete;
+    Material & operator= (const Material &) = delete;
+
+    void setSampler(const SamplerState & sampler)
+    {
+        albedo.setSampler(sampler);
+        diffuse.setSampler(sampler);
+        specular.setSampler(sampler);
+        normal.setSampler(sampler);
+        bindSurfaces();
+    }
+
+    bool bake();
+    void unbake();
+    bool isBaked() const { return m_surface_count > 0; }
+    long bakedSurfaceCount() const { return m_surface_count; }
+    size_t bakedSize() const;
 
+    static void sample(const Material & material, const vec2 & texcoord, const vec2 & texcoord_dx, const vec2 & texcoord_dy, MaterialSample & sample);
+    static void sample4(const Material & material, const vec2 * texcoords, const vec2 & texcoord_dx, const vec2 & texcoord_dy, MaterialSample * samples);
 };
 
 }
@@ -1174,6 +1174,14 @@ float Matrix4::det() const
                        m[8],  m[9],  m[10], 
                        m[12], m[13], m[14]).det();
 }
+// largest scale factor along the basis vectors of the upper 3x3
+float Matrix4::maxScale() const
+{
+    return sqrtf(max(max(
+        m[0] * m[0] + m[4] * m[4] + m[8] * m[8],
+        m[1] * m[1] + m[5] * m[5] + m[9] * m[9]),
+        m[2] * m[2] + m[6] * m[6] + m[10] * m[10]));
+}
 Matrix4 Matrix4::transposed() const
 {
     Matrix4 mat(
@@ -8,6 +8,10 @@
 #include <string.h>
 #include <utility>
 #include "global.hpp"
+#include "allocator.hpp"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace LuGL
 {
@@ -149,7 +153,7 @@ public:
     Vector4(float x, float y, float z, float w): x(x), y(y), z(z), w(w) {}
     Vector4(const Vector4 & vec): x(vec.x), y(vec.y), z(vec.z), w(vec.w) {}
     Vector4(const Vector3 & vec, float w): x(vec.x), y(vec.y), z(vec.z), w(w) {}
-    Vector4(float * array):
+    Vector4(const float * array):
         x(*(array + 0)),
         y(*(array + 1)),
         z(*(array + 2)),
@@ -300,6 +304,7 @@ public:
     void multiply(const Matrix4 & other);
     Matrix4 inversed() const;
     float det() const;
+    float maxScale() const;
     Matrix4 transposed() const;
     void print() const;
 
@@ -320,6 +325,110 @@ public:
     void rotate(const Quaternion & rotation);
 };
 
+/**
+ * IEEE 754 half precision conversions, rounding to nearest even
+ * reference : https://gist.github.com/rygorous/2156668
+ */
+inline UINT16 floatToHalf(float value)
+{
+    const UINT32 f32_infinity = 255u << 23;
+    const UINT32 f16_max = (127u + 16u) << 23;
+    const UINT32 denorm_magic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+    UINT32 bits;
+    memcpy(&bits, &value, sizeof(UINT32));
+    const UINT32 sign = bits & 0x80000000u;
+    bits ^= sign;
+
+    UINT16 half;
+    if (bits >= f16_max)
+    {
+        half = bits > f32_infinity ? 0x7e00 : 0x7c00;  // NaN stays NaN, overflow becomes infinity
+    }
+    else if (bits < (113u << 23))
+    {
+        // denormal, let the float addition do the rounding
+        float f, magic;
+        memcpy(&f, &bits, sizeof(UINT32));
+        memcpy(&magic, &denorm_magic, sizeof(UINT32));
+        f += magic;
+        memcpy(&bits, &f, sizeof(UINT32));
+        half = (UINT16)(bits - denorm_magic);
+    }
+    else
+    {
+        const UINT32 mantissa_odd = (bits >> 13) & 1;
+        bits += 0xc8000fffu;    // rebias the exponent from 127 to 15 and round
+        bits += mantissa_odd;
+        half = (UINT16)(bits >> 13);
+    }
+    return half | (UINT16)(sign >> 16);
+}
+
+inline float halfToFloat(UINT16 half)
+{
+    const UINT32 shifted_exponent = 0x7c00u << 13;
+    UINT32 bits = (half & 0x7fffu) << 13;
+    const UINT32 exponent = bits & shifted_exponent;
+    bits += (127u - 15u) << 23;
+
+    float f;
+    if (exponent == shifted_exponent)
+    {
+        bits += (128u - 16u) << 23; // infinity or NaN
+    }
+    else if (exponent == 0)
+    {
+        // denormal, renormalize with a float subtraction
+        const UINT32 magic_bits = 113u << 23;
+        float magic;
+        memcpy(&magic, &magic_bits, sizeof(UINT32));
+        bits += 1u << 23;
+        memcpy(&f, &bits, sizeof(UINT32));
+        f -= magic;
+        memcpy(&bits, &f, sizeof(UINT32));
+    }
+    bits |= (UINT32)(half & 0x8000u) << 16;
+    memcpy(&f, &bits, sizeof(UINT32));
+    return f;
+}
+
+/**
+ * Octahedral encoding of unit vectors into two 16 bit snorm values, the zero
+ * vector encodes to +z.
+ * reference : https://jcgt.org/published/0003/02/01/
+ */
+inline void encodeOctahedral(const Vector3 & v, INT16 * encoded)
+{
+    const float l1 = fabsf(v.x) + fabsf(v.y) + fabsf(v.z);
+    float x = l1 > 0.0f ? v.x / l1 : 0.0f;
+    float y = l1 > 0.0f ? v.y / l1 : 0.0f;
+    if (v.z < 0.0f)
+    {
+        const float fold_x = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        const float fold_y = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = fold_x;
+        y = fold_y;
+    }
+    encoded[0] = (INT16)roundf(fminf(fmaxf(x, -1.0f), 1.0f) * 32767.0f);
+    encoded[1] = (INT16)roundf(fminf(fmaxf(y, -1.0f), 1.0f) * 32767.0f);
+}
+
+inline Vector3 decodeOctahedral(const INT16 * encoded)
+{
+    float x = encoded[0] * (1.0f / 32767.0f);
+    float y = encoded[1] * (1.0f / 32767.0f);
+    const float z = 1.0f - fabsf(x) - fabsf(y);
+    if (z < 0.0f)
+    {
+        const float fold_x = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        const float fold_y = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = fold_x;
+        y = fold_y;
+    }
+    return Vector3(x, y, z).normalized();
+}
+
 /**
  * Quick Sort Function
  * reference : https://www.geeksforgeeks.org/cpp-program-for-quicksort/
@@ -363,6 +472,107 @@ void qsort(T* array, long low, long high, bool (*cmp)(const T &, const T &))
     }
 }
 
+// map a float to an unsigned key with the same ordering
+// reference : http://stereopsis.com/radix.html
+inline UINT32 floatToRadixKey(float value)
+{
+    UINT32 bits;
+    memcpy(&bits, &value, sizeof(UINT32));
+    return (bits & 0x80000000) ? ~bits : (bits | 0x80000000);
+}
+
+#define RADIX_SORT_PARALLEL_MIN 4096
+
+/**
+ * Stable LSD Radix Sort of 32 bit keys, the values are moved along with their
+ * keys. Every pass counts 8 bit digits into per-thread histograms, so that
+ * the threads can scatter their own chunk of the input in parallel. The
+ * buffers of the passes come from scratch when given, else from the heap.
+ * reference : http://stereopsis.com/radix.html
+ */
+template<typename T>
+void radixSort(UINT32 * keys, T * values, size_t count, LinearArena * scratch = nullptr)
+{
+    if (count < 2) return;
+
+#ifdef _OPENMP
+    const long thread_count = count >= RADIX_SORT_PARALLEL_MIN ? omp_get_max_threads() : 1;
+#else
+    const long thread_count = 1;
+#endif
+    const size_t chunk = (count + thread_count - 1) / thread_count;
+    size_t *histograms = scratch ? scratch->allocateArray<size_t>(thread_count * 256) : new size_t[thread_count * 256];
+    UINT32 *keys_from = keys;
+    UINT32 *keys_to = scratch ? scratch->allocateArray<UINT32>(count) : new UINT32[count];
+    T *values_from = values;
+    T *values_to = scratch ? scratch->allocateArray<T>(count) : new T[count];
+
+    for (UINT32 shift = 0; shift < 32; shift += 8)
+    {
+        memset(histograms, 0, thread_count * 256 * sizeof(size_t));
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(thread_count) if(thread_count > 1)
+#endif
+        for (long tidx = 0; tidx < thread_count; tidx++)
+        {
+            size_t *histogram = histograms + tidx * 256;
+            const size_t end = tidx * chunk + chunk < count ? tidx * chunk + chunk : count;
+            for (size_t i = tidx * chunk; i < end; i++)
+            {
+                histogram[(keys_from[i] >> shift) & 0xff]++;
+            }
+        }
+
+        // offsets in digit-major, thread-minor order keep the sort stable
+        size_t offset = 0;
+        bool single_digit = false;
+        for (size_t digit = 0; digit < 256; digit++)
+        {
+            const size_t digit_begin = offset;
+            for (long tidx = 0; tidx < thread_count; tidx++)
+            {
+                const size_t digit_count = histograms[tidx * 256 + digit];
+                histograms[tidx * 256 + digit] = offset;
+                offset += digit_count;
+            }
+            if (offset - digit_begin == count) single_digit = true;
+        }
+        if (single_digit) continue; // every key has the same digit, nothing moves
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(thread_count) if(thread_count > 1)
+#endif
+        for (long tidx = 0; tidx < thread_count; tidx++)
+        {
+            size_t *histogram = histograms + tidx * 256;
+            const size_t end = tidx * chunk + chunk < count ? tidx * chunk + chunk : count;
+            for (size_t i = tidx * chunk; i < end; i++)
+            {
+                const size_t position = histogram[(keys_from[i] >> shift) & 0xff]++;
+                keys_to[position] = keys_from[i];
+                values_to[position] = values_from[i];
+            }
+        }
+        std::swap(keys_from, keys_to);
+        std::swap(values_from, values_to);
+    }
+
+    if (keys_from != keys)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            keys[i] = keys_from[i];
+            values[i] = values_from[i];
+        }
+        std::swap(keys_from, keys_to);
+        std::swap(values_from, values_to);
+    }
+    if (scratch) return;
+    delete[] keys_to;
+    delete[] values_to;
+    delete[] histograms;
+}
+
 }
 
 
@@ -336,176 +336,488 @@ TriangleMesh::TriangleMesh():
     m_mesh_center(vec3::ZERO),
     m_tangent(nullptr),
     m_bitangent(nullptr),
+    m_meshlets(nullptr),
+    m_welded_vertices(nullptr),
+    m_indices(nullptr),
+    m_packed_vertices(nullptr),
+    m_packed_tangents(nullptr),
+    m_packed_indices(nullptr),
+    m_packed_index_size(0),
+    m_pack_offset(vec3::ZERO),
+    m_pack_scale(vec3::ZERO),
+    m_bounding_radius(0.0f),
     m_vertex_count(0),
     m_face_count(0),
+    m_texcoord_count(0),
+    m_normal_count(0),
+    m_meshlet_count(0),
+    m_welded_vertex_count(0),
+    m_lod_count(0),
     m_has_vertex_normals(false),
     m_has_triangle_normals(false),
     m_has_texture_coords(false),
-    m_has_tangent(false) {}
+    m_has_tangent(false),
+    m_mapped_file(nullptr) {}
 
 TriangleMesh::TriangleMesh(const char * filename):
     TriangleMesh()
 {
-    FILE *fp;
     assert(filename != nullptr);
-    fp = fopen(filename, "rb");
-    if (fp == nullptr)
+
+    // load a mesh cache directly, or prefer the cache next to an OBJ file when it is up to date
+    const char *extension = strrchr(filename, '.');
+    if (extension && strcmp(extension, MESH_CACHE_EXTENSION) == 0)
+    {
+        loadCache(filename);
+        return;
+    }
+    char cache_filename[MAX_OBJ_LINE];
+    if (cacheFilename(filename, cache_filename, MAX_OBJ_LINE) &&
+        loadCache(cache_filename, 0, 0, filename))
     {
-        printf("TriangleMesh : mesh file: %s open failed\n", filename);
         return;
     }
 
-    char line_buffer[MAX_OBJ_LINE];
+    loadOBJ(filename);
+}
+
+/**
+ * OBJ parsing : the mapped file is split into chunks at line boundaries that
+ * are parsed in parallel, then merged. Relative (negative) indices are resolved
+ * against the chunk during parsing and rebased when merging.
+ * reference : http://paulbourke.net/dataformats/obj/
+ */
+struct OBJChunk
+{
+    const char *begin;
+    const char *end;
+
     DynamicArray<vec3>  vertices;
+    DynamicArray<vec2>  texture_coords;
     DynamicArray<vec3>  vertex_normals;
     DynamicArray<vec3i> faces;
-    DynamicArray<vec3i> face_texcoords;
-    DynamicArray<vec3i> face_normals;
-    DynamicArray<vec2>  texture_coords;
+    DynamicArray<vec3i> face_texcoords;     // empty until a face has texture coordinates, -1 when absent
+    DynamicArray<vec3i> face_normals;       // empty until a face has normals, -1 when absent
+    DynamicArray<size_t> relative_vertices;  // corners indexed relative to this chunk
+    DynamicArray<size_t> relative_texcoords;
+    DynamicArray<size_t> relative_normals;
+    bool    has_face_texcoords;
+    bool    has_face_normals;
+    bool    has_invalid_faces;
+
+    OBJChunk(): begin(nullptr), end(nullptr),
+                has_face_texcoords(false), has_face_normals(false), has_invalid_faces(false) {}
+};
+
+static inline bool isOBJSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
 
-    float x, y, z;
-    size_t v1, v2, v3, vt1, vt2, vt3, vn1, vn2, vn3;
-    long scanned_items;
-    while (fgets(line_buffer, MAX_OBJ_LINE, fp))
+static inline const char * skipOBJSpaces(const char * p, const char * end)
+{
+    while (p < end && isOBJSpace(*p)) p++;
+    return p;
+}
+
+static inline const char * nextOBJLine(const char * p, const char * end)
+{
+    const char *line_end = static_cast<const char*>(memchr(p, '\n', end - p));
+    return line_end ? line_end + 1 : end;
+}
+
+static inline const char * parseOBJInt(const char * p, const char * end, long * value)
+{
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+    const char *start = p;
+    long result = 0;
+    while (p < end && *p >= '0' && *p <= '9')
     {
-        if (strncmp(line_buffer, "v ", 2) == 0)
+        result = result * 10 + (*p++ - '0');
+    }
+    if (p == start) return nullptr;
+
+    *value = negative ? -result : result;
+    return p;
+}
+
+static inline const char * parseOBJFloat(const char * p, const char * end, float * value)
+{
+    static const double powers_of_ten[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+    p = skipOBJSpaces(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+    // up to 19 significant digits are accumulated exactly, the rest only scale
+    UINT64 mantissa = 0;
+    long digits = 0;
+    long exponent = 0;
+    const char *start = p;
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) digits++; }
+        else exponent++;
+        p++;
+    }
+    if (p < end && *p == '.')
+    {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9')
         {
-            scanned_items = sscanf(line_buffer, "v %f %f %f", &x, &y, &z);
-            assert(scanned_items == 3);
-            vertices.push_back(vec3(x, y, z));
+            if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) digits++; exponent--; }
+            p++;
         }
-        else if (strncmp(line_buffer, "vt ", 3) == 0)
+    }
+    if (p == start || (p == start + 1 && *start == '.')) return nullptr;
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        long e;
+        const char *q = parseOBJInt(p + 1, end, &e);
+        if (q)
         {
-            scanned_items = sscanf(line_buffer, "vt %f %f", &x, &y);
-            assert(scanned_items == 2);
-            texture_coords.push_back(vec2(x, y));
+            exponent += e;
+            p = q;
         }
-        else if (strncmp(line_buffer, "vn ", 3) == 0)
+    }
+
+    double result = (double)mantissa;
+    if (exponent < 0)
+        result = -exponent <= 22 ? result / powers_of_ten[-exponent] : result * pow(10.0, (double)exponent);
+    else if (exponent > 0)
+        result = exponent <= 22 ? result * powers_of_ten[exponent] : result * pow(10.0, (double)exponent);
+
+    *value = (float)(negative ? -result : result);
+    return p;
+}
+
+// parse up to count floats into values, missing trailing components are left untouched
+static inline const char * parseOBJFloats(const char * p, const char * end, float * values, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        const char *q = parseOBJFloat(p, end, &values[i]);
+        if (q == nullptr) break;
+        p = q;
+    }
+    return p;
+}
+
+// convert an OBJ index to 0-based, negative indices are relative to the elements seen so far
+static inline long resolveOBJIndex(long index, size_t count, DynamicArray<size_t> & relative, size_t corner)
+{
+    if (index > 0) return index - 1;
+    if (index == 0) return -1;
+    relative.push_back(corner);
+    return (long)count + index;
+}
+
+// attribute indices are only stored once any face has them, earlier faces are padded with -1
+static inline void appendOBJIndices(DynamicArray<vec3i> & indices, bool & has_indices, bool present,
+                                    const vec3i & index, size_t face_count)
+{
+    if (!has_indices)
+    {
+        if (!present) return;
+        vec3i absent;
+        absent[0] = absent[1] = absent[2] = -1;
+        while (indices.size() + 1 < face_count) indices.push_back(absent);
+        has_indices = true;
+    }
+    indices.push_back(index);
+}
+
+static void parseOBJChunk(OBJChunk & chunk)
+{
+    DynamicArray<long> polygon_vertices;
+    DynamicArray<long> polygon_texcoords;
+    DynamicArray<long> polygon_normals;
+
+    const char *p = chunk.begin;
+    const char *end = chunk.end;
+    while (p < end)
+    {
+        const char *line = skipOBJSpaces(p, end);
+        p = nextOBJLine(line, end);
+        if (line + 1 >= end) continue;
+
+        if (line[0] == 'v' && isOBJSpace(line[1]))
         {
-            scanned_items = sscanf(line_buffer, "vn %f %f %f", &x, &y, &z);
-            assert(scanned_items == 3);
-            vertex_normals.push_back(vec3(x, y, z));
+            float xyz[3] = { 0.0f, 0.0f, 0.0f };
+            parseOBJFloats(line + 2, p, xyz, 3);
+            chunk.vertices.push_back(vec3(xyz[0], xyz[1], xyz[2]));
         }
-        else if (strncmp(line_buffer, "f ", 2) == 0)
+        else if (line[0] == 'v' && line[1] == 't' && line + 2 < end && isOBJSpace(line[2]))
         {
-            scanned_items = sscanf(line_buffer, "f %lu/%lu/%lu %lu/%lu/%lu %lu/%lu/%lu", &v1, &vt1, &vn1, &v2, &vt2, &vn2, &v3, &vt3, &vn3);
-            if (scanned_items != 9)
+            float uv[2] = { 0.0f, 0.0f };
+            parseOBJFloats(line + 3, p, uv, 2);
+            chunk.texture_coords.push_back(vec2(uv[0], uv[1]));
+        }
+        else if (line[0] == 'v' && line[1] == 'n' && line + 2 < end && isOBJSpace(line[2]))
+        {
+            float xyz[3] = { 0.0f, 0.0f, 0.0f };
+            parseOBJFloats(line + 3, p, xyz, 3);
+            chunk.vertex_normals.push_back(vec3(xyz[0], xyz[1], xyz[2]));
+        }
+        else if (line[0] == 'f' && isOBJSpace(line[1]))
+        {
+            // corners are v, v/vt, v//vn or v/vt/vn
+            polygon_vertices.clear();
+            polygon_texcoords.clear();
+            polygon_normals.clear();
+            const char *q = line + 2;
+            while (true)
             {
-                scanned_items = sscanf(line_buffer, "f %lu %lu %lu", &v1, &v2, &v3);
-                if (scanned_items != 3)
+                q = skipOBJSpaces(q, p);
+                long v, vt = 0, vn = 0;
+                const char *r = parseOBJInt(q, p, &v);
+                if (r == nullptr) break;
+                q = r;
+                if (q < p && *q == '/')
                 {
-                    scanned_items = sscanf(line_buffer, "f %lu//%lu %lu//%lu %lu//%lu", &v1, &vn1, &v2, &vn2, &v3, &vn3);
-                    if (scanned_items != 6)
+                    q++;
+                    if (q < p && *q != '/')
                     {
-                        scanned_items = sscanf(line_buffer, "f %lu/%lu %lu/%lu %lu/%lu", &v1, &vt1, &v2, &vt2, &v3, &vt3);
-                        vec3i ft;
-                        ft[0] = vt1 - 1;
-                        ft[1] = vt2 - 1;
-                        ft[2] = vt3 - 1;
-                        face_texcoords.push_back(ft);
+                        r = parseOBJInt(q, p, &vt);
+                        if (r) q = r;
                     }
-                    else
+                    if (q < p && *q == '/')
                     {
-                        vec3i fn;
-                        fn[0] = vn1 - 1;
-                        fn[1] = vn2 - 1;
-                        fn[2] = vn3 - 1;
-                        face_normals.push_back(fn);
+                        r = parseOBJInt(q + 1, p, &vn);
+                        if (r) q = r;
                     }
-                    vec3i f;
-                    f[0] = v1 - 1;
-                    f[1] = v2 - 1;
-                    f[2] = v3 - 1;
-                    faces.push_back(f);
-                }
-                else
-                {
-                    vec3i f;
-                    f[0] = v1 - 1;
-                    f[1] = v2 - 1;
-                    f[2] = v3 - 1;
-                    faces.push_back(f);
                 }
+                polygon_vertices.push_back(v);
+                polygon_texcoords.push_back(vt);
+                polygon_normals.push_back(vn);
             }
-            else
+            if (polygon_vertices.size() < 3)
+            {
+                chunk.has_invalid_faces = true;
+                continue;
+            }
+
+            // triangulate polygons as a fan around the first corner
+            for (size_t cidx = 1; cidx + 1 < polygon_vertices.size(); cidx++)
             {
-                vec3i f;
-                f[0] = v1 - 1;
-                f[1] = v2 - 1;
-                f[2] = v3 - 1;
-                faces.push_back(f);
-                vec3i ft;
-                ft[0] = vt1 - 1;
-                ft[1] = vt2 - 1;
-                ft[2] = vt3 - 1;
-                face_texcoords.push_back(ft);
-                vec3i fn;
-                fn[0] = vn1 - 1;
-                fn[1] = vn2 - 1;
-                fn[2] = vn3 - 1;
-                face_normals.push_back(fn);
+                const size_t corners[3] = { 0, cidx, cidx + 1 };
+                const size_t first_corner = chunk.faces.size() * 3;
+                vec3i f, ft, fn;
+                for (size_t i = 0; i < 3; i++)
+                {
+                    f[i]  = resolveOBJIndex(polygon_vertices[corners[i]], chunk.vertices.size(), chunk.relative_vertices, first_corner + i);
+                    ft[i] = resolveOBJIndex(polygon_texcoords[corners[i]], chunk.texture_coords.size(), chunk.relative_texcoords, first_corner + i);
+                    fn[i] = resolveOBJIndex(polygon_normals[corners[i]], chunk.vertex_normals.size(), chunk.relative_normals, first_corner + i);
+                }
+                chunk.faces.push_back(f);
+                appendOBJIndices(chunk.face_texcoords, chunk.has_face_texcoords, polygon_texcoords[0] != 0, ft, chunk.faces.size());
+                appendOBJIndices(chunk.face_normals, chunk.has_face_normals, polygon_normals[0] != 0, fn, chunk.faces.size());
             }
         }
     }
+}
 
-    if (vertices.size() > 0)
+// copy the array of every chunk to its offset, padding up to the next offset with fill
+template<typename T>
+static void mergeOBJArray(OBJChunk * chunks, size_t chunk_count, DynamicArray<T> OBJChunk::* member,
+                          const size_t * offsets, size_t count, T * array, const T & fill = T())
+{
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (long cidx = 0; cidx < (long)chunk_count; cidx++)
     {
-        m_vertex_count = vertices.size();
-        m_vertices = new vec3[vertices.size()];
-        for (size_t i = 0; i < vertices.size(); i++)
+        const DynamicArray<T> & source = chunks[cidx].*member;
+        const size_t end = cidx + 1 < (long)chunk_count ? offsets[cidx + 1] : count;
+        T *target = array + offsets[cidx];
+        for (size_t i = 0; i < source.size(); i++)
         {
-            m_vertices[i] = vertices[i];
+            target[i] = source[i];
         }
-    }
-    if (faces.size() > 0)
-    {
-        m_face_count = faces.size();
-        m_faces = new vec3i[faces.size()];
-        for (size_t i = 0; i < faces.size(); i++)
+        for (size_t i = offsets[cidx] + source.size(); i < end; i++)
         {
-            m_faces[i] = faces[i];
+            array[i] = fill;
         }
     }
-    if (face_texcoords.size() > 0)
+}
+
+/**
+ * Rebase relative indices, then clamp out of range indices to 0, returns the
+ * number out of range. With absent_count, the indices of an attribute, -1
+ * marks a face without it and is counted instead, a mesh with faces lacking
+ * an attribute does not have it.
+ */
+static size_t fixOBJIndices(vec3i * indices, size_t count, size_t element_count,
+                            const OBJChunk * chunks, size_t chunk_count, DynamicArray<size_t> OBJChunk::* relative,
+                            const size_t * face_offsets, const size_t * element_offsets, size_t * absent_count)
+{
+    size_t invalid_count = 0;
+    size_t absent = 0;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:invalid_count, absent)
+#endif
+    for (long cidx = 0; cidx < (long)chunk_count; cidx++)
     {
-        assert(face_texcoords.size() == m_face_count);
-        m_face_texcoords = new vec3i[face_texcoords.size()];
-        for (size_t i = 0; i < face_texcoords.size(); i++)
+        const DynamicArray<size_t> & corners = chunks[cidx].*relative;
+        for (size_t i = 0; i < corners.size(); i++)
         {
-            m_face_texcoords[i] = face_texcoords[i];
+            const size_t corner = face_offsets[cidx] * 3 + corners[i];
+            indices[corner / 3][corner % 3] += element_offsets[cidx];
         }
-    }
-    if (face_normals.size() > 0)
-    {
-        assert(face_normals.size() == m_face_count);
-        m_face_normals = new vec3i[face_normals.size()];
-        for (size_t i = 0; i < face_normals.size(); i++)
+        const size_t face_end = cidx + 1 < (long)chunk_count ? face_offsets[cidx + 1] : count;
+        for (size_t fidx = face_offsets[cidx]; fidx < face_end; fidx++)
         {
-            m_face_normals[i] = face_normals[i];
+            for (size_t i = 0; i < 3; i++)
+            {
+                if (indices[fidx][i] == -1 && absent_count)
+                {
+                    absent++;
+                }
+                else if (indices[fidx][i] < 0 || indices[fidx][i] >= (long)element_count)
+                {
+                    invalid_count++;
+                    indices[fidx][i] = 0;
+                }
+            }
         }
     }
-    if (texture_coords.size() > 0)
+    if (absent_count) *absent_count = absent;
+    return invalid_count;
+}
+
+bool TriangleMesh::loadOBJ(const char * filename)
+{
+    MappedFile file;
+    if (!file.open(filename))
+    {
+        printf("TriangleMesh : mesh file: %s open failed\n", filename);
+        return false;
+    }
+    releaseData();
+    clearLODChain();
+
+    const char *data = reinterpret_cast<const char*>(file.data());
+    const char *data_end = data + file.size();
+    size_t chunk_count = file.size() / OBJ_CHUNK_SIZE + 1;
+    OBJChunk *chunks = new OBJChunk[chunk_count];
+    const char *chunk_begin = data;
+    for (size_t cidx = 0; cidx < chunk_count; cidx++)
+    {
+        const char *chunk_end = cidx + 1 == chunk_count ? data_end : data + (cidx + 1) * OBJ_CHUNK_SIZE;
+        if (chunk_end < chunk_begin) chunk_end = chunk_begin;
+        if (chunk_end < data_end) chunk_end = nextOBJLine(chunk_end, data_end);
+        chunks[cidx].begin = chunk_begin;
+        chunks[cidx].end = chunk_end;
+        chunk_begin = chunk_end;
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (long cidx = 0; cidx < (long)chunk_count; cidx++)
+    {
+        parseOBJChunk(chunks[cidx]);
+    }
+
+    size_t *offsets = new size_t[chunk_count * 4];
+    size_t *vertex_offsets = offsets;
+    size_t *texcoord_offsets = offsets + chunk_count;
+    size_t *normal_offsets = offsets + chunk_count * 2;
+    size_t *face_offsets = offsets + chunk_count * 3;
+    bool has_face_texcoords = false;
+    bool has_face_normals = false;
+    bool has_invalid_faces = false;
+    for (size_t cidx = 0; cidx < chunk_count; cidx++)
+    {
+        vertex_offsets[cidx] = m_vertex_count;
+        texcoord_offsets[cidx] = m_texcoord_count;
+        normal_offsets[cidx] = m_normal_count;
+        face_offsets[cidx] = m_face_count;
+        m_vertex_count += chunks[cidx].vertices.size();
+        m_texcoord_count += chunks[cidx].texture_coords.size();
+        m_normal_count += chunks[cidx].vertex_normals.size();
+        m_face_count += chunks[cidx].faces.size();
+        has_face_texcoords |= chunks[cidx].has_face_texcoords;
+        has_face_normals |= chunks[cidx].has_face_normals;
+        has_invalid_faces |= chunks[cidx].has_invalid_faces;
+    }
+    if (has_invalid_faces)
+    {
+        printf("TriangleMesh : mesh file: %s has faces with less than 3 vertices, skipped\n", filename);
+    }
+
+    vec3i absent;
+    absent[0] = absent[1] = absent[2] = -1;
+    size_t invalid_count = 0;
+    size_t absent_count = 0;
+    if (m_vertex_count > 0)
+    {
+        m_vertices = new vec3[m_vertex_count];
+        mergeOBJArray(chunks, chunk_count, &OBJChunk::vertices, vertex_offsets, m_vertex_count, m_vertices);
+    }
+    if (m_face_count > 0)
+    {
+        m_faces = new vec3i[m_face_count];
+        mergeOBJArray(chunks, chunk_count, &OBJChunk::faces, face_offsets, m_face_count, m_faces);
+        invalid_count += fixOBJIndices(m_faces, m_face_count, m_vertex_count, chunks, chunk_count,
+                                       &OBJChunk::relative_vertices, face_offsets, vertex_offsets, nullptr);
+    }
+    if (m_texcoord_count > 0 && has_face_texcoords)
     {
-        // assert(texture_coords.size() == m_vertex_count);
-        m_texture_coords = new vec2[texture_coords.size()];
-        for (size_t i = 0; i < texture_coords.size(); i++)
+        m_texture_coords = new vec2[m_texcoord_count];
+        mergeOBJArray(chunks, chunk_count, &OBJChunk::texture_coords, texcoord_offsets, m_texcoord_count, m_texture_coords);
+        m_face_texcoords = new vec3i[m_face_count];
+        mergeOBJArray(chunks, chunk_count, &OBJChunk::face_texcoords, face_offsets, m_face_count, m_face_texcoords, absent);
+        invalid_count += fixOBJIndices(m_face_texcoords, m_face_count, m_texcoord_count, chunks, chunk_count,
+                                       &OBJChunk::relative_texcoords, face_offsets, texcoord_offsets, &absent_count);
+        m_has_texture_coords = absent_count == 0;
+        if (absent_count > 0)
         {
-            m_texture_coords[i] = texture_coords[i];
+            printf("TriangleMesh : mesh file: %s has faces without texture coordinates, ignored\n", filename);
         }
-        m_has_texture_coords = true;
     }
-    if (vertex_normals.size() > 0)
+    if (!m_has_texture_coords)
     {
-        // assert(vertex_normals.size() == m_vertex_count);
-        m_vertex_normals = new vec3[vertex_normals.size()];
-        for (size_t i = 0; i < vertex_normals.size(); i++)
+        releaseArray(m_texture_coords);
+        releaseArray(m_face_texcoords);
+        m_texcoord_count = 0;
+    }
+    if (m_normal_count > 0 && has_face_normals)
+    {
+        m_vertex_normals = new vec3[m_normal_count];
+        mergeOBJArray(chunks, chunk_count, &OBJChunk::vertex_normals, normal_offsets, m_normal_count, m_vertex_normals);
+        m_face_normals = new vec3i[m_face_count];
+        mergeOBJArray(chunks, chunk_count, &OBJChunk::face_normals, face_offsets, m_face_count, m_face_normals, absent);
+        invalid_count += fixOBJIndices(m_face_normals, m_face_count, m_normal_count, chunks, chunk_count,
+                                       &OBJChunk::relative_normals, face_offsets, normal_offsets, &absent_count);
+        m_has_vertex_normals = absent_count == 0;
+        if (absent_count > 0)
         {
-            m_vertex_normals[i] = vertex_normals[i];
+            printf("TriangleMesh : mesh file: %s has faces without normals, computed from the faces instead\n", filename);
         }
-        m_has_vertex_normals = true;
     }
-    fclose(fp);
+    if (!m_has_vertex_normals)
+    {
+        releaseArray(m_vertex_normals);
+        releaseArray(m_face_normals);
+        m_normal_count = 0;
+    }
+    if (invalid_count > 0)
+    {
+        printf("TriangleMesh : mesh file: %s has %lu out of range indices, clamped to 0\n", filename, invalid_count);
+    }
+
+    delete[] offsets;
+    delete[] chunks;
     computeMeshCenter();
+    weld();
+
+    return true;
 }
 
 TriangleMesh::TriangleMesh(const TriangleMesh & tri_mesh):
@@ -513,6 +825,8 @@ TriangleMesh::TriangleMesh(const TriangleMesh & tri_mesh):
 {
     m_vertex_count = tri_mesh.m_vertex_count;
     m_face_count = tri_mesh.m_face_count;
+    m_texcoord_count = tri_mesh.m_texcoord_count;
+    m_normal_count = tri_mesh.m_normal_count;
     m_has_vertex_normals = tri_mesh.m_has_vertex_normals;
     m_has_triangle_normals = tri_mesh.m_has_triangle_normals;
     m_has_texture_coords = tri_mesh.m_has_texture_coords;
@@ -536,8 +850,8 @@ TriangleMesh::TriangleMesh(const TriangleMesh & tri_mesh):
     }
     if (m_has_vertex_normals)
     {
-        m_vertex_normals = new vec3[m_vertex_count];
-        for (size_t i = 0; i < m_vertex_count; i++)
+        m_vertex_normals = new vec3[m_normal_count];
+        for (size_t i = 0; i < m_normal_count; i++)
         {
             m_vertex_normals[i] = tri_mesh.m_vertex_normals[i];
         }
@@ -558,8 +872,8 @@ TriangleMesh::TriangleMesh(const TriangleMesh & tri_mesh):
     }
     if (m_has_texture_coords)
     {
-        m_texture_coords = new vec2[m_vertex_count];
-        for (size_t i = 0; i < m_vertex_count; i++)
+        m_texture_coords = new vec2[m_texcoord_count];
+        for (size_t i = 0; i < m_texcoord_count; i++)
         {
             m_texture_coords[i] = tri_mesh.m_texture_coords[i];
         }
@@ -580,21 +894,55 @@ TriangleMesh::TriangleMesh(const TriangleMesh & tri_mesh):
             m_bitangent[i] = tri_mesh.m_bitangent[i];
         }
     }
+    if (tri_mesh.m_meshlet_count > 0)
+    {
+        m_meshlet_count = tri_mesh.m_meshlet_count;
+        m_meshlets = new Meshlet[m_meshlet_count];
+        for (size_t i = 0; i < m_meshlet_count; i++)
+        {
+            m_meshlets[i] = tri_mesh.m_meshlets[i];
+        }
+    }
+    if (tri_mesh.m_indices)
+    {
+        m_welded_vertex_count = tri_mesh.m_welded_vertex_count;
+        m_welded_vertices = new WeldedVertex[m_welded_vertex_count];
+        for (size_t i = 0; i < m_welded_vertex_count; i++)
+        {
+            m_welded_vertices[i] = tri_mesh.m_welded_vertices[i];
+        }
+        m_indices = new UINT32[m_face_count * 3];
+        memcpy(m_indices, tri_mesh.m_indices, m_face_count * 3 * sizeof(UINT32));
+    }
+    if (tri_mesh.m_packed_vertices)
+    {
+        m_welded_vertex_count = tri_mesh.m_welded_vertex_count;
+        m_packed_vertices = new PackedVertex[m_welded_vertex_count];
+        memcpy(m_packed_vertices, tri_mesh.m_packed_vertices, m_welded_vertex_count * sizeof(PackedVertex));
+        m_packed_index_size = tri_mesh.m_packed_index_size;
+        m_packed_indices = new byte_t[m_face_count * 3 * m_packed_index_size];
+        memcpy(m_packed_indices, tri_mesh.m_packed_indices, m_face_count * 3 * m_packed_index_size);
+        if (tri_mesh.m_packed_tangents)
+        {
+            m_packed_tangents = new PackedTangent[m_face_count];
+            memcpy(m_packed_tangents, tri_mesh.m_packed_tangents, m_face_count * sizeof(PackedTangent));
+        }
+        m_pack_offset = tri_mesh.m_pack_offset;
+        m_pack_scale = tri_mesh.m_pack_scale;
+    }
+    copyLODChain(tri_mesh);
     computeMeshCenter();
 }
 
 TriangleMesh & TriangleMesh::operator= (const TriangleMesh & tri_mesh)
 {
-    if (m_vertices)         delete[] m_vertices;
-    if (m_vertex_normals)   delete[] m_vertex_normals;
-    if (m_triangle_normals) delete[] m_triangle_normals;
-    if (m_faces)            delete[] m_faces;
-    if (m_texture_coords)   delete[] m_texture_coords;
-    if (m_tangent)          delete[] m_tangent;
-    if (m_bitangent)        delete[] m_bitangent;
+    releaseData();
+    clearLODChain();
 
     m_vertex_count = tri_mesh.m_vertex_count;
     m_face_count = tri_mesh.m_face_count;
+    m_texcoord_count = tri_mesh.m_texcoord_count;
+    m_normal_count = tri_mesh.m_normal_count;
     m_has_vertex_normals = tri_mesh.m_has_vertex_normals;
     m_has_triangle_normals = tri_mesh.m_has_triangle_normals;
     m_has_texture_coords = tri_mesh.m_has_texture_coords;
@@ -618,8 +966,8 @@ TriangleMesh & TriangleMesh::operator= (const TriangleMesh & tri_mesh)
     }
     if (m_has_vertex_normals)
     {
-        m_vertex_normals = new vec3[m_vertex_count];
-        for (size_t i = 0; i < m_vertex_count; i++)
+        m_vertex_normals = new vec3[m_normal_count];
+        for (size_t i = 0; i < m_normal_count; i++)
         {
             m_vertex_normals[i] = tri_mesh.m_vertex_normals[i];
         }
@@ -640,8 +988,8 @@ TriangleMesh & TriangleMesh::operator= (const TriangleMesh & tri_mesh)
     }
     if (m_has_texture_coords)
     {
-        m_texture_coords = new vec2[m_vertex_count];
-        for (size_t i = 0; i < m_vertex_count; i++)
+        m_texture_coords = new vec2[m_texcoord_count];
+        for (size_t i = 0; i < m_texcoord_count; i++)
         {
             m_texture_coords[i] = tri_mesh.m_texture_coords[i];
         }
@@ -662,6 +1010,43 @@ TriangleMesh & TriangleMesh::operator= (const TriangleMesh & tri_mesh)
             m_bitangent[i] = tri_mesh.m_bitangent[i];
         }
     }
+    if (tri_mesh.m_meshlet_count > 0)
+    {
+        m_meshlet_count = tri_mesh.m_meshlet_count;
+        m_meshlets = new Meshlet[m_meshlet_count];
+        for (size_t i = 0; i < m_meshlet_count; i++)
+        {
+            m_meshlets[i] = tri_mesh.m_meshlets[i];
+        }
+    }
+    if (tri_mesh.m_indices)
+    {
+        m_welded_vertex_count = tri_mesh.m_welded_vertex_count;
+        m_welded_vertices = new WeldedVertex[m_welded_vertex_count];
+        for (size_t i = 0; i < m_welded_vertex_count; i++)
+        {
+            m_welded_vertices[i] = tri_mesh.m_welded_vertices[i];
+        }
+        m_indices = new UINT32[m_face_count * 3];
+        memcpy(m_indices, tri_mesh.m_indices, m_face_count * 3 * sizeof(UINT32));
+    }
+    if (tri_mesh.m_packed_vertices)
+    {
+        m_welded_vertex_count = tri_mesh.m_welded_vertex_count;
+        m_packed_vertices = new PackedVertex[m_welded_vertex_count];
+        memcpy(m_packed_vertices, tri_mesh.m_packed_vertices, m_welded_vertex_count * sizeof(PackedVertex));
+        m_packed_index_size = tri_mesh.m_packed_index_size;
+        m_packed_indices = new byte_t[m_face_count * 3 * m_packed_index_size];
+        memcpy(m_packed_indices, tri_mesh.m_packed_indices, m_face_count * 3 * m_packed_index_size);
+        if (tri_mesh.m_packed_tangents)
+        {
+            m_packed_tangents = new PackedTangent[m_face_count];
+            memcpy(m_packed_tangents, tri_mesh.m_packed_tangents, m_face_count * sizeof(PackedTangent));
+        }
+        m_pack_offset = tri_mesh.m_pack_offset;
+        m_pack_scale = tri_mesh.m_pack_scale;
+    }
+    copyLODChain(tri_mesh);
     computeMeshCenter();
 
     return *this;
@@ -669,15 +1054,91 @@ TriangleMesh & TriangleMesh::operator= (const TriangleMesh & tri_mesh)
 
 TriangleMesh::~TriangleMesh()
 {
-    if (m_vertices)         delete[] m_vertices;
-    if (m_vertex_normals)   delete[] m_vertex_normals;
-    if (m_triangle_normals) delete[] m_triangle_normals;
-    if (m_faces)            delete[] m_faces;
-    if (m_face_texcoords)   delete[] m_face_texcoords;
-    if (m_face_normals)     delete[] m_face_normals;
-    if (m_texture_coords)   delete[] m_texture_coords;
-    if (m_tangent)          delete[] m_tangent;
-    if (m_bitangent)        delete[] m_bitangent;
+    releaseData();
+    clearLODChain();
+}
+
+// arrays that point into the mapped cache file are released with the mapping
+template<typename T>
+void TriangleMesh::releaseArray(T * & array)
+{
+    if (array && !(m_mapped_file && m_mapped_file->contains(array)))
+    {
+        delete[] array;
+    }
+    array = nullptr;
+}
+
+void TriangleMesh::releaseData()
+{
+    releaseArray(m_vertices);
+    releaseArray(m_vertex_normals);
+    releaseArray(m_triangle_normals);
+    releaseArray(m_faces);
+    releaseArray(m_face_texcoords);
+    releaseArray(m_face_normals);
+    releaseArray(m_texture_coords);
+    releaseArray(m_tangent);
+    releaseArray(m_bitangent);
+    releaseArray(m_meshlets);
+    releaseWeld();
+    releasePack();
+    m_vertex_count = 0;
+    m_face_count = 0;
+    m_texcoord_count = 0;
+    m_normal_count = 0;
+    m_meshlet_count = 0;
+    m_has_vertex_normals = false;
+    m_has_triangle_normals = false;
+    m_has_texture_coords = false;
+    m_has_tangent = false;
+    if (m_mapped_file)
+    {
+        delete m_mapped_file;
+        m_mapped_file = nullptr;
+    }
+}
+
+void TriangleMesh::releaseWeld()
+{
+    releaseArray(m_welded_vertices);
+    releaseArray(m_indices);
+    m_welded_vertex_count = 0;
+}
+
+void TriangleMesh::releasePack()
+{
+    releaseArray(m_packed_vertices);
+    releaseArray(m_packed_tangents);
+    releaseArray(m_packed_indices);
+    m_packed_index_size = 0;
+    if (m_indices == nullptr) m_welded_vertex_count = 0;
+}
+
+// bytes held by the arrays of the mesh and of its LODs, mapped arrays included
+size_t TriangleMesh::memorySize() const
+{
+    size_t size = 0;
+    if (m_vertices) size += m_vertex_count * sizeof(vec3);
+    if (m_vertex_normals) size += m_normal_count * sizeof(vec3);
+    if (m_triangle_normals) size += m_face_count * sizeof(vec3);
+    if (m_texture_coords) size += m_texcoord_count * sizeof(vec2);
+    if (m_faces) size += m_face_count * sizeof(vec3i);
+    if (m_face_texcoords) size += m_face_count * sizeof(vec3i);
+    if (m_face_normals) size += m_face_count * sizeof(vec3i);
+    if (m_tangent) size += m_face_count * sizeof(vec3);
+    if (m_bitangent) size += m_face_count * sizeof(vec3);
+    if (m_meshlets) size += m_meshlet_count * sizeof(Meshlet);
+    if (m_welded_vertices) size += m_welded_vertex_count * sizeof(WeldedVertex);
+    if (m_indices) size += m_face_count * 3 * sizeof(UINT32);
+    if (m_packed_vertices) size += m_welded_vertex_count * sizeof(PackedVertex);
+    if (m_packed_tangents) size += m_face_count * sizeof(PackedTangent);
+    if (m_packed_indices) size += m_face_count * 3 * m_packed_index_size;
+    for (size_t lidx = 0; lidx < m_lod_count; lidx++)
+    {
+        size += m_lods[lidx]->memorySize();
+    }
+    return size;
 }
 
 void TriangleMesh::printMeshInfo() const
@@ -703,6 +1164,16 @@ void TriangleMesh::printMeshInfo() const
             printf("  tangent vector : True\n");
         else
             printf("  tangent vector : False\n");
+        if (m_meshlet_count > 0)
+            printf("        meshlets : %-6lu\n", m_meshlet_count);
+        if (m_indices)
+            printf(" welded vertices : %-6lu\n", m_welded_vertex_count);
+        if (m_packed_vertices)
+            printf(" packed vertices : %-6lu (%u bit indices)\n", m_welded_vertex_count, m_packed_index_size * 8);
+        if (m_indices || m_packed_vertices)
+            printf("            ACMR : %.3f\n", computeACMR());
+        if (m_lod_count > 0)
+            printf("      lod levels : %-6lu\n", m_lod_count + 1);
         
         printf("----------------------------------------------\n");
     }
@@ -715,90 +1186,149 @@ void TriangleMesh::printMeshInfo() const
 void TriangleMesh::computeVertexNormals()
 {
     if (m_has_vertex_normals) return;
-    
+
     if (!m_has_triangle_normals)
     {
         computeTriangleNormals();
     }
 
-    if (m_face_normals) delete[] m_face_normals;
-    m_face_normals = new vec3i[m_face_count];
-
-    DynamicArray<DynamicArray<size_t> > neighbour_faces(m_vertex_count);
+    // faces around every vertex in face order, the sums then do not depend on the thread count
+    size_t *neighbour_offsets = new size_t[m_vertex_count + 1];
+    memset(neighbour_offsets, 0, (m_vertex_count + 1) * sizeof(size_t));
+    for (size_t fidx = 0; fidx < m_face_count; fidx++)
+    {
+        neighbour_offsets[m_faces[fidx][0] + 1]++;
+        neighbour_offsets[m_faces[fidx][1] + 1]++;
+        neighbour_offsets[m_faces[fidx][2] + 1]++;
+    }
+    for (size_t vidx = 0; vidx < m_vertex_count; vidx++)
+    {
+        neighbour_offsets[vidx + 1] += neighbour_offsets[vidx];
+    }
+    size_t *neighbour_faces = new size_t[m_face_count * 3];
+    size_t *neighbour_fill = new size_t[m_vertex_count];
+    memcpy(neighbour_fill, neighbour_offsets, m_vertex_count * sizeof(size_t));
     for (size_t fidx = 0; fidx < m_face_count; fidx++)
     {
-        neighbour_faces[m_faces[fidx][0]].push_back(fidx);
-        neighbour_faces[m_faces[fidx][1]].push_back(fidx);
-        neighbour_faces[m_faces[fidx][2]].push_back(fidx);
+        neighbour_faces[neighbour_fill[m_faces[fidx][0]]++] = fidx;
+        neighbour_faces[neighbour_fill[m_faces[fidx][1]]++] = fidx;
+        neighbour_faces[neighbour_fill[m_faces[fidx][2]]++] = fidx;
+    }
+    delete[] neighbour_fill;
 
+    releaseArray(m_face_normals);
+    releaseArray(m_vertex_normals);
+    m_face_normals = new vec3i[m_face_count];
+    m_vertex_normals = new vec3[m_vertex_count];
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (long fidx = 0; fidx < (long)m_face_count; fidx++)
+    {
         m_face_normals[fidx] = m_faces[fidx]; // use same indices as face
     }
-
-    DynamicArray<vec3> vertex_normals;
-    for (size_t vidx = 0; vidx < m_vertex_count; vidx++)
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (long vidx = 0; vidx < (long)m_vertex_count; vidx++)
     {
         vec3 n;
-        for (size_t i = 0; i < neighbour_faces[vidx].size(); i++)
+        for (size_t i = neighbour_offsets[vidx]; i < neighbour_offsets[vidx + 1]; i++)
         {
-            n += m_triangle_normals[neighbour_faces[vidx][i]];
+            n += m_triangle_normals[neighbour_faces[i]];
         }
-        vertex_normals.push_back(n.normalized());
+        m_vertex_normals[vidx] = n.normalized();
     }
+    delete[] neighbour_offsets;
+    delete[] neighbour_faces;
 
-    m_vertex_normals = new vec3[vertex_normals.size()];
-    for (size_t i = 0; i < vertex_normals.size(); i++)
+    m_normal_count = m_vertex_count;
+    m_has_vertex_normals = true;
+    if (m_indices || m_packed_vertices)
     {
-        m_vertex_normals[i] = vertex_normals[i];
+        const bool packed = isPacked();
+        weld();
+        if (packed) pack(m_pack_offset, m_pack_scale);
     }
-
-    m_has_vertex_normals = true;
 }
 
 void TriangleMesh::computeTriangleNormals()
 {
     if (m_has_triangle_normals) return;
 
-    DynamicArray<vec3> triangle_normals;
-
-    for (size_t fidx = 0; fidx < m_face_count; fidx++)
+    releaseArray(m_triangle_normals);
+    m_triangle_normals = new vec3[m_face_count];
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (long fidx = 0; fidx < (long)m_face_count; fidx++)
     {
         vec3 u = m_vertices[m_faces[fidx][1]] - m_vertices[m_faces[fidx][0]];
         vec3 v = m_vertices[m_faces[fidx][2]] - m_vertices[m_faces[fidx][0]];
 
-        triangle_normals.push_back(u.cross(v).normalized());
-    }
-
-    m_triangle_normals = new vec3[triangle_normals.size()];
-    for (size_t i = 0; i < triangle_normals.size(); i++)
-    {
-        m_triangle_normals[i] = triangle_normals[i];
+        m_triangle_normals[fidx] = u.cross(v).normalized();
     }
 
     m_has_triangle_normals = true;
 }
 
+/**
+ * Vertices are summed in blocks of MESH_REDUCE_BLOCK and the block sums are
+ * added in order, so the center is the same for any number of threads.
+ */
 void TriangleMesh::computeMeshCenter()
 {
+    const size_t block_count = (m_vertex_count + MESH_REDUCE_BLOCK - 1) / MESH_REDUCE_BLOCK;
+    vec3 *block_sums = new vec3[block_count];
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (long bidx = 0; bidx < (long)block_count; bidx++)
+    {
+        const size_t end = min((size_t)(bidx + 1) * MESH_REDUCE_BLOCK, m_vertex_count);
+        vec3 sum = vec3::ZERO;
+        for (size_t vidx = (size_t)bidx * MESH_REDUCE_BLOCK; vidx < end; vidx++)
+        {
+            sum += m_vertices[vidx];
+        }
+        block_sums[bidx] = sum;
+    }
     vec3 center = vec3::ZERO;
-
-    for (size_t vidx = 0; vidx < m_vertex_count; vidx++)
+    for (size_t bidx = 0; bidx < block_count; bidx++)
     {
-        center += m_vertices[vidx];
+        center += block_sums[bidx];
     }
+    delete[] block_sums;
 
     m_mesh_center = center * (1.0f / m_vertex_count);
+
+    const vec3 mesh_center = m_mesh_center;
+    float bounding_radius = 0.0f;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(max:bounding_radius)
+#endif
+    for (long vidx = 0; vidx < (long)m_vertex_count; vidx++)
+    {
+        bounding_radius = max(bounding_radius, (m_vertices[vidx] - mesh_center).length());
+    }
+    m_bounding_radius = bounding_radius;
 }
 
 void TriangleMesh::computeTangentVectors()
 {
-    if (m_tangent) delete[] m_tangent;
-    if (m_bitangent) delete[] m_bitangent;
+    if (m_has_tangent) return;
+
+    releaseArray(m_tangent);
+    releaseArray(m_bitangent);
     if (m_has_texture_coords)
     {
         m_tangent = new vec3[m_face_count];
         m_bitangent = new vec3[m_face_count];
 
-        for (size_t fidx = 0; fidx < m_face_count; fidx++) {
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+        for (long fidx = 0; fidx < (long)m_face_count; fidx++) {
             vec3 e0 = m_vertices[m_faces[fidx][1]] - m_vertices[m_faces[fidx][0]];
             vec3 e1 = m_vertices[m_faces[fidx][2]] - m_vertices[m_faces[fidx][0]];
             vec2 uv0 = m_texture_coords[m_face_texcoords[fidx][1]] - m_texture_coords[m_face_texcoords[fidx][0]];
@@ -814,58 +1344,1776 @@ void TriangleMesh::computeTangentVectors()
                 f * (-uv1.x * e0.x + uv0.x * e1.x),
                 f * (-uv1.x * e0.y + uv0.x * e1.y),
                 f * (-uv1.x * e0.z + uv0.x * e1.z) );
-            
+
             m_tangent[fidx] = tangent;
             m_bitangent[fidx] = bitangent;
         }
         m_has_tangent = true;
+        if (m_packed_vertices) pack(m_pack_offset, m_pack_scale);
     }
 }
 
-BoundingBox TriangleMesh::getAxisAlignBoundingBox() const
+// computes the missing attributes of mask (MeshAttribute bits) on the mesh and its LODs
+void TriangleMesh::computeAttributes(UINT32 mask)
 {
-    BoundingBox bounding_box(
-         FLOAT_INF,  FLOAT_INF,  FLOAT_INF,
-        -FLOAT_INF, -FLOAT_INF, -FLOAT_INF
-    );
-
-    for (size_t vidx = 0; vidx < m_vertex_count; vidx++)
+    if ((mask & MESH_ATTRIBUTE_TRIANGLE_NORMALS) && !m_has_triangle_normals) computeTriangleNormals();
+    if ((mask & MESH_ATTRIBUTE_VERTEX_NORMALS) && !m_has_vertex_normals) computeVertexNormals();
+    if ((mask & MESH_ATTRIBUTE_TANGENTS) && !m_has_tangent && m_has_texture_coords) computeTangentVectors();
+    for (size_t lidx = 0; lidx < m_lod_count; lidx++)
     {
-        bounding_box.min_x = min(m_vertices[vidx].x, bounding_box.min_x);
-        bounding_box.min_y = min(m_vertices[vidx].y, bounding_box.min_y);
-        bounding_box.min_z = min(m_vertices[vidx].z, bounding_box.min_z);
-        bounding_box.max_x = max(m_vertices[vidx].x, bounding_box.max_x);
-        bounding_box.max_y = max(m_vertices[vidx].y, bounding_box.max_y);
-        bounding_box.max_z = max(m_vertices[vidx].z, bounding_box.max_z);
+        m_lods[lidx]->computeAttributes(mask);
     }
-    
-    return bounding_box;
 }
 
-vec3 TriangleMesh::getMaxBound() const
+// FNV-1a over the bits of the vertex, equal attribute values weld regardless of their OBJ indices
+static inline UINT32 hashWeldedVertex(const WeldedVertex & vertex)
 {
-    vec3 max_bound(-FLOAT_INF, -FLOAT_INF, -FLOAT_INF);
-
-    for (size_t vidx = 0; vidx < m_vertex_count; vidx++)
+    UINT32 words[sizeof(WeldedVertex) / sizeof(UINT32)];
+    memcpy(words, &vertex, sizeof(WeldedVertex));
+    UINT32 hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(WeldedVertex) / sizeof(UINT32); i++)
     {
-        max_bound.x = max(m_vertices[vidx].x, max_bound.x);
-        max_bound.y = max(m_vertices[vidx].y, max_bound.y);
-        max_bound.z = max(m_vertices[vidx].z, max_bound.z);
+        hash = (hash ^ words[i]) * 16777619u;
     }
-
-    return max_bound;
+    return hash ^ (hash >> 15);
 }
 
-vec3 TriangleMesh::getMinBound() const
+/**
+ * Build a single indexed vertex buffer from the separately indexed
+ * attributes, the original arrays are kept for the tools that work on
+ * positions only (normals, simplification, meshlets). Tangents stay per face.
+ * reference : https://github.com/zeux/meshoptimizer#indexing
+ */
+void TriangleMesh::weld()
 {
-    vec3 min_bound(FLOAT_INF, FLOAT_INF, FLOAT_INF);
+    releasePack();
+    releaseWeld();
+    if (m_face_count == 0) return;
+    assert(m_face_count * 3 <= 0xffffffffu);
+
+    const size_t corner_count = m_face_count * 3;
+    size_t table_size = 1;
+    while (table_size < corner_count * 2) table_size <<= 1;
+    UINT32 *table = new UINT32[table_size];     // welded vertex index + 1, 0 for an empty slot
+    memset(table, 0, table_size * sizeof(UINT32));
+    WeldedVertex *vertices = new WeldedVertex[corner_count];
+    m_indices = new UINT32[corner_count];
+
+    size_t vertex_count = 0;
+    for (size_t i = 0; i < corner_count; i++)
+    {
+        const size_t fidx = i / 3;
+        const size_t vidx = i % 3;
+        WeldedVertex vertex;
+        vertex.position = m_vertices[m_faces[fidx][vidx]];
+        vertex.normal = m_has_vertex_normals ? m_vertex_normals[m_face_normals[fidx][vidx]] : vec3::ZERO;
+        vertex.texcoord = m_has_texture_coords ? m_texture_coords[m_face_texcoords[fidx][vidx]] : vec2::ZERO;
+
+        size_t slot = hashWeldedVertex(vertex) & (table_size - 1);
+        while (table[slot] != 0 && memcmp(&vertices[table[slot] - 1], &vertex, sizeof(WeldedVertex)) != 0)
+        {
+            slot = (slot + 1) & (table_size - 1);
+        }
+        if (table[slot] == 0)
+        {
+            vertices[vertex_count] = vertex;
+            table[slot] = (UINT32)++vertex_count;
+        }
+        m_indices[i] = table[slot] - 1;
+    }
 
-    for (size_t vidx = 0; vidx < m_vertex_count; vidx++)
+    m_welded_vertex_count = vertex_count;
+    m_welded_vertices = new WeldedVertex[vertex_count];
+    for (size_t i = 0; i < vertex_count; i++)
     {
-        min_bound.x = max(m_vertices[vidx].x, min_bound.x);
-        min_bound.y = max(m_vertices[vidx].y, min_bound.y);
-        min_bound.z = max(m_vertices[vidx].z, min_bound.z);
+        m_welded_vertices[i] = vertices[i];
     }
+    delete[] vertices;
+    delete[] table;
+}
 
-    return min_bound;
+/**
+ * Replace the welded vertex buffer with its compact form for the vertex
+ * fetch : 16 byte vertices, 16 bit indices when there are at most 65536
+ * vertices and 12 byte tangent frames. The separately indexed arrays are
+ * kept, functions that need the welded buffer weld the mesh again and
+ * pack it back on the same grid.
+ */
+void TriangleMesh::pack()
+{
+    const BoundingBox bounding_box = getAxisAlignBoundingBox();
+    const vec3 extent(bounding_box.max_x - bounding_box.min_x,
+                      bounding_box.max_y - bounding_box.min_y,
+                      bounding_box.max_z - bounding_box.min_z);
+    pack(vec3(bounding_box.min_x, bounding_box.min_y, bounding_box.min_z), extent * (1.0f / 65535.0f));
+}
+
+// positions are quantized to offset + q * scale, meshes that share borders (chunks, levels) share a grid so that no cracks open
+void TriangleMesh::pack(const vec3 & offset, const vec3 & scale)
+{
+    if (m_face_count == 0) return;
+    if (m_indices == nullptr) weld();
+    releasePack();
+
+    m_pack_offset = offset;
+    m_pack_scale = scale;
+    const vec3 inv_scale(scale.x > 0.0f ? 1.0f / scale.x : 0.0f,
+                         scale.y > 0.0f ? 1.0f / scale.y : 0.0f,
+                         scale.z > 0.0f ? 1.0f / scale.z : 0.0f);
+
+    m_packed_vertices = new PackedVertex[m_welded_vertex_count];
+    for (size_t i = 0; i < m_welded_vertex_count; i++)
+    {
+        const WeldedVertex & vertex = m_welded_vertices[i];
+        PackedVertex & packed = m_packed_vertices[i];
+        packed.position[0] = (UINT16)roundf(clamp((vertex.position.x - m_pack_offset.x) * inv_scale.x, 0.0f, 65535.0f));
+        packed.position[1] = (UINT16)roundf(clamp((vertex.position.y - m_pack_offset.y) * inv_scale.y, 0.0f, 65535.0f));
+        packed.position[2] = (UINT16)roundf(clamp((vertex.position.z - m_pack_offset.z) * inv_scale.z, 0.0f, 65535.0f));
+        encodeOctahedral(vertex.normal, packed.normal);
+        packed.texcoord[0] = floatToHalf(vertex.texcoord.x);
+        packed.texcoord[1] = floatToHalf(vertex.texcoord.y);
+        packed.padding = 0;
+    }
+
+    m_packed_index_size = m_welded_vertex_count <= 0x10000 ? sizeof(UINT16) : sizeof(UINT32);
+    m_packed_indices = new byte_t[m_face_count * 3 * m_packed_index_size];
+    for (size_t i = 0; i < m_face_count * 3; i++)
+    {
+        if (m_packed_index_size == sizeof(UINT16))
+            reinterpret_cast<UINT16*>(m_packed_indices)[i] = (UINT16)m_indices[i];
+        else
+            reinterpret_cast<UINT32*>(m_packed_indices)[i] = m_indices[i];
+    }
+
+    if (m_has_tangent)
+    {
+        m_packed_tangents = new PackedTangent[m_face_count];
+        for (size_t fidx = 0; fidx < m_face_count; fidx++)
+        {
+            encodeOctahedral(m_tangent[fidx], m_packed_tangents[fidx].tangent);
+            encodeOctahedral(m_bitangent[fidx], m_packed_tangents[fidx].bitangent);
+            m_packed_tangents[fidx].tangent_length = floatToHalf(m_tangent[fidx].length());
+            m_packed_tangents[fidx].bitangent_length = floatToHalf(m_bitangent[fidx].length());
+        }
+    }
+
+    // the vertex count is shared with the packed buffer
+    releaseArray(m_welded_vertices);
+    releaseArray(m_indices);
+}
+
+// faces are reordered within each meshlet so that the meshlet ranges stay valid
+void TriangleMesh::faceRange(size_t ridx, size_t & face_begin, size_t & face_end) const
+{
+    if (m_meshlet_count > 0)
+    {
+        face_begin = m_meshlets[ridx].face_offset;
+        face_end = face_begin + m_meshlets[ridx].face_count;
+    }
+    else
+    {
+        face_begin = 0;
+        face_end = m_face_count;
+    }
+}
+
+/**
+ * Tipsify : fan around a vertex emitting all of its remaining triangles, then
+ * continue with the vertex of the last fan that will still be in a FIFO cache
+ * of cache_size entries once its remaining triangles are emitted. Dead ends
+ * fall back to recently used vertices, then to the next unemitted triangle.
+ * reference : https://gfx.cs.princeton.edu/pubs/Sander_2007_%3ETR/tipsy.pdf
+ */
+class TriangleOrderOptimizer
+{
+private:
+    const UINT32 *m_indices;
+    size_t  *m_adjacency_offsets;   // faces around every vertex
+    size_t  *m_adjacency;
+    UINT32  *m_live;                // remaining triangles of every vertex in the current range
+    UINT64  *m_cache_time;
+    UINT64   m_time;
+    size_t   m_cache_size;
+    bool    *m_emitted;
+    DynamicArray<UINT32> m_dead_end;
+    DynamicArray<UINT32> m_candidates;
+
+    long nextFan(size_t & cursor, size_t corner_end);
+public:
+    TriangleOrderOptimizer(const UINT32 * indices, size_t face_count, size_t vertex_count, size_t cache_size);
+    ~TriangleOrderOptimizer();
+
+    void optimize(size_t face_begin, size_t face_end, size_t * order);
+};
+
+TriangleOrderOptimizer::TriangleOrderOptimizer(const UINT32 * indices, size_t face_count, size_t vertex_count, size_t cache_size):
+    m_indices(indices),
+    m_time(0),
+    m_cache_size(cache_size)
+{
+    m_adjacency_offsets = new size_t[vertex_count + 1];
+    memset(m_adjacency_offsets, 0, (vertex_count + 1) * sizeof(size_t));
+    for (size_t i = 0; i < face_count * 3; i++)
+    {
+        m_adjacency_offsets[indices[i] + 1]++;
+    }
+    for (size_t vidx = 0; vidx < vertex_count; vidx++)
+    {
+        m_adjacency_offsets[vidx + 1] += m_adjacency_offsets[vidx];
+    }
+    size_t *fill = new size_t[vertex_count];
+    memcpy(fill, m_adjacency_offsets, vertex_count * sizeof(size_t));
+    m_adjacency = new size_t[face_count * 3];
+    for (size_t i = 0; i < face_count * 3; i++)
+    {
+        m_adjacency[fill[indices[i]]++] = i / 3;
+    }
+    delete[] fill;
+
+    m_live = new UINT32[vertex_count];
+    memset(m_live, 0, vertex_count * sizeof(UINT32));
+    m_cache_time = new UINT64[vertex_count];
+    memset(m_cache_time, 0, vertex_count * sizeof(UINT64));
+    m_emitted = new bool[face_count];
+    memset(m_emitted, 0, face_count * sizeof(bool));
+}
+
+TriangleOrderOptimizer::~TriangleOrderOptimizer()
+{
+    delete[] m_adjacency_offsets;
+    delete[] m_adjacency;
+    delete[] m_live;
+    delete[] m_cache_time;
+    delete[] m_emitted;
+}
+
+long TriangleOrderOptimizer::nextFan(size_t & cursor, size_t corner_end)
+{
+    // prefer the candidate that stays longest in the cache without being pushed out by its own fan
+    long best = -1;
+    UINT64 best_priority = 0;
+    for (size_t i = 0; i < m_candidates.size(); i++)
+    {
+        const UINT32 vidx = m_candidates[i];
+        if (m_live[vidx] == 0) continue;
+
+        UINT64 priority = 0;
+        if (m_time - m_cache_time[vidx] + 2 * m_live[vidx] <= m_cache_size)
+        {
+            priority = m_time - m_cache_time[vidx];
+        }
+        if (best < 0 || priority > best_priority)
+        {
+            best = vidx;
+            best_priority = priority;
+        }
+    }
+    if (best >= 0) return best;
+
+    while (m_dead_end.size() > 0)
+    {
+        const UINT32 vidx = m_dead_end.back();
+        m_dead_end.pop_back();
+        if (m_live[vidx] > 0) return vidx;
+    }
+    while (cursor < corner_end)
+    {
+        const UINT32 vidx = m_indices[cursor++];
+        if (m_live[vidx] > 0) return vidx;
+    }
+    return -1;
+}
+
+// write the faces of [face_begin, face_end) in optimized order to order[face_begin, face_end)
+void TriangleOrderOptimizer::optimize(size_t face_begin, size_t face_end, size_t * order)
+{
+    if (face_begin == face_end) return;
+
+    for (size_t i = face_begin * 3; i < face_end * 3; i++)
+    {
+        m_live[m_indices[i]]++;
+    }
+    m_time += m_cache_size + 1;    // flush the cache between ranges
+    m_dead_end.clear();
+
+    size_t written = face_begin;
+    size_t cursor = face_begin * 3;
+    long fan = m_indices[cursor];
+    while (fan >= 0)
+    {
+        m_candidates.clear();
+        for (size_t a = m_adjacency_offsets[fan]; a < m_adjacency_offsets[fan + 1]; a++)
+        {
+            const size_t fidx = m_adjacency[a];
+            if (fidx < face_begin || fidx >= face_end || m_emitted[fidx]) continue;
+
+            m_emitted[fidx] = true;
+            order[written++] = fidx;
+            for (size_t k = 0; k < 3; k++)
+            {
+                const UINT32 vidx = m_indices[fidx * 3 + k];
+                m_dead_end.push_back(vidx);
+                m_candidates.push_back(vidx);
+                m_live[vidx]--;
+                if (m_time - m_cache_time[vidx] > m_cache_size)
+                {
+                    m_cache_time[vidx] = m_time++;
+                }
+            }
+        }
+        fan = nextFan(cursor, face_end * 3);
+    }
+    assert(written == face_end);
+}
+
+// FIFO cache misses of the faces in [face_begin, face_end), or of the faces order[face_begin, face_end),
+// the cache is empty at face_begin
+template<typename T>
+static size_t simulateVertexCache(const T * indices, size_t face_begin, size_t face_end,
+                                  UINT64 * cache_time, UINT64 & time, size_t cache_size,
+                                  UINT32 * face_misses = nullptr, const size_t * order = nullptr)
+{
+    time += cache_size + 1;
+    size_t miss_count = 0;
+    for (size_t fidx = face_begin; fidx < face_end; fidx++)
+    {
+        UINT32 misses = 0;
+        for (size_t k = 0; k < 3; k++)
+        {
+            const size_t vidx = indices[(order ? order[fidx] : fidx) * 3 + k];
+            if (time - cache_time[vidx] > cache_size)
+            {
+                cache_time[vidx] = time++;
+                misses++;
+            }
+        }
+        if (face_misses) face_misses[fidx] = misses;
+        miss_count += misses;
+    }
+    return miss_count;
+}
+
+void TriangleMesh::optimizeVertexCache(size_t cache_size)
+{
+    if (m_face_count == 0) return;
+    const bool packed = isPacked();
+    if (m_indices == nullptr) weld();
+
+    size_t *order = new size_t[m_face_count];
+    UINT64 *cache_time = new UINT64[m_welded_vertex_count];
+    memset(cache_time, 0, m_welded_vertex_count * sizeof(UINT64));
+    UINT64 time = 0;
+    TriangleOrderOptimizer optimizer(m_indices, m_face_count, m_welded_vertex_count, cache_size);
+    for (size_t ridx = 0; ridx < faceRangeCount(); ridx++)
+    {
+        size_t face_begin, face_end;
+        faceRange(ridx, face_begin, face_end);
+        optimizer.optimize(face_begin, face_end, order);
+
+        // small ranges such as meshlets are often already in a good order, keep the better one
+        if (simulateVertexCache(m_indices, face_begin, face_end, cache_time, time, cache_size, nullptr, order) >=
+            simulateVertexCache(m_indices, face_begin, face_end, cache_time, time, cache_size))
+        {
+            for (size_t fidx = face_begin; fidx < face_end; fidx++)
+            {
+                order[fidx] = fidx;
+            }
+        }
+    }
+    permuteFaces(order);
+    delete[] cache_time;
+    delete[] order;
+    if (packed) pack(m_pack_offset, m_pack_scale);
+
+    for (size_t lidx = 0; lidx < m_lod_count; lidx++)
+    {
+        m_lods[lidx]->optimizeVertexCache(cache_size);
+    }
+}
+
+// radix key of how much faces [face_begin, face_end) face away from the mesh center, the ones most likely to occlude others sort first
+UINT32 TriangleMesh::occlusionKey(size_t face_begin, size_t face_end) const
+{
+    vec3 centroid = vec3::ZERO;
+    vec3 normal = vec3::ZERO;
+    float area = 0.0f;
+    for (size_t fidx = face_begin; fidx < face_end; fidx++)
+    {
+        const vec3 & p0 = m_vertices[m_faces[fidx][0]];
+        const vec3 & p1 = m_vertices[m_faces[fidx][1]];
+        const vec3 & p2 = m_vertices[m_faces[fidx][2]];
+        const vec3 n = (p1 - p0).cross(p2 - p0);
+        const float a = n.length();
+        centroid += (p0 + p1 + p2) * (a / 3.0f);
+        normal += n;
+        area += a;
+    }
+    if (area > 0.0f) centroid = centroid * (1.0f / area);
+    return floatToRadixKey(-(centroid - m_mesh_center).dot(normal.normalized()));
+}
+
+/**
+ * Reorder the vertex cache optimized faces by clusters so that the faces
+ * likely to occlude others come first, from any viewpoint outside the mesh.
+ * Clusters start at every cache flush (all three vertices missed) and are
+ * split further while their ACMR stays within threshold times the ACMR of
+ * the whole cluster, then sorted by how much they face away from the mesh
+ * center. With meshlets the clusters are sorted within every meshlet, and the
+ * meshlets themselves by the same measure.
+ * reference : https://gfx.cs.princeton.edu/pubs/Sander_2007_%3ETR/tipsy.pdf
+ */
+void TriangleMesh::optimizeOverdraw(float threshold, size_t cache_size)
+{
+    if (m_face_count == 0) return;
+    const bool packed = isPacked();
+    if (m_indices == nullptr) weld();
+    optimizeVertexCache(cache_size);
+
+    UINT32 *face_misses = new UINT32[m_face_count];
+    UINT64 *cache_time = new UINT64[m_welded_vertex_count];
+    memset(cache_time, 0, m_welded_vertex_count * sizeof(UINT64));
+    UINT64 time = 0;
+    simulateVertexCache(m_indices, 0, m_face_count, cache_time, time, cache_size, face_misses);
+
+    size_t *order = new size_t[m_face_count];
+    DynamicArray<size_t> clusters;
+    DynamicArray<UINT32> keys;
+    for (size_t ridx = 0; ridx < faceRangeCount(); ridx++)
+    {
+        size_t face_begin, face_end;
+        faceRange(ridx, face_begin, face_end);
+
+        // hard boundaries, then soft boundaries within every hard cluster
+        clusters.clear();
+        size_t cluster_begin = face_begin;
+        while (cluster_begin < face_end)
+        {
+            size_t cluster_end = cluster_begin + 1;
+            size_t cluster_misses = face_misses[cluster_begin];
+            while (cluster_end < face_end && face_misses[cluster_end] < 3)
+            {
+                cluster_misses += face_misses[cluster_end++];
+            }
+            const float split_acmr = threshold * cluster_misses / (cluster_end - cluster_begin);
+
+            size_t split_begin = cluster_begin;
+            size_t misses = simulateVertexCache(m_indices, cluster_begin, cluster_begin + 1, cache_time, time, cache_size);
+            clusters.push_back(cluster_begin);
+            for (size_t fidx = cluster_begin + 1; fidx < cluster_end; fidx++)
+            {
+                if ((float)misses / (fidx - split_begin) <= split_acmr && cluster_end - fidx > 1)
+                {
+                    clusters.push_back(fidx);
+                    split_begin = fidx;
+                    misses = 0;
+                    time += cache_size + 1;
+                }
+                for (size_t k = 0; k < 3; k++)
+                {
+                    const UINT32 vidx = m_indices[fidx * 3 + k];
+                    if (time - cache_time[vidx] > cache_size)
+                    {
+                        cache_time[vidx] = time++;
+                        misses++;
+                    }
+                }
+            }
+            cluster_begin = cluster_end;
+        }
+
+        // occlusion potential of every cluster, the largest is drawn first
+        const size_t cluster_count = clusters.size();
+        keys.clear();
+        size_t *cluster_order = new size_t[cluster_count];
+        for (size_t cidx = 0; cidx < cluster_count; cidx++)
+        {
+            const size_t end = cidx + 1 < cluster_count ? clusters[cidx + 1] : face_end;
+            keys.push_back(occlusionKey(clusters[cidx], end));
+            cluster_order[cidx] = cidx;
+        }
+        radixSort(keys.data(), cluster_order, cluster_count);
+
+        size_t written = face_begin;
+        for (size_t i = 0; i < cluster_count; i++)
+        {
+            const size_t cidx = cluster_order[i];
+            const size_t end = cidx + 1 < cluster_count ? clusters[cidx + 1] : face_end;
+            for (size_t fidx = clusters[cidx]; fidx < end; fidx++)
+            {
+                order[written++] = fidx;
+            }
+        }
+        delete[] cluster_order;
+    }
+
+    if (m_meshlet_count > 1)
+    {
+        // the faces of every meshlet keep their clusters, the meshlets move as a whole
+        size_t *meshlet_order = new size_t[m_meshlet_count];
+        keys.clear();
+        for (size_t midx = 0; midx < m_meshlet_count; midx++)
+        {
+            keys.push_back(occlusionKey(m_meshlets[midx].face_offset, m_meshlets[midx].face_offset + m_meshlets[midx].face_count));
+            meshlet_order[midx] = midx;
+        }
+        radixSort(keys.data(), meshlet_order, m_meshlet_count);
+
+        size_t *meshlet_faces = new size_t[m_face_count];
+        Meshlet *meshlets = new Meshlet[m_meshlet_count];
+        size_t written = 0;
+        for (size_t i = 0; i < m_meshlet_count; i++)
+        {
+            meshlets[i] = m_meshlets[meshlet_order[i]];
+            for (size_t fidx = meshlets[i].face_offset; fidx < meshlets[i].face_offset + meshlets[i].face_count; fidx++)
+            {
+                meshlet_faces[written++] = order[fidx];
+            }
+            meshlets[i].face_offset = written - meshlets[i].face_count;
+        }
+        releaseArray(m_meshlets);
+        m_meshlets = meshlets;
+        delete[] order;
+        delete[] meshlet_order;
+        order = meshlet_faces;
+    }
+    permuteFaces(order);
+
+    delete[] order;
+    delete[] cache_time;
+    delete[] face_misses;
+    if (packed) pack(m_pack_offset, m_pack_scale);
+
+    for (size_t lidx = 0; lidx < m_lod_count; lidx++)
+    {
+        m_lods[lidx]->optimizeOverdraw(threshold, cache_size);
+    }
+}
+
+// renumber the welded vertices in the order the faces first use them
+void TriangleMesh::optimizeVertexFetch()
+{
+    if (m_face_count == 0) return;
+    const bool packed = isPacked();
+    if (m_indices == nullptr) weld();
+
+    UINT32 *remap = new UINT32[m_welded_vertex_count];
+    memset(remap, 0xff, m_welded_vertex_count * sizeof(UINT32));
+    WeldedVertex *vertices = new WeldedVertex[m_welded_vertex_count];
+    UINT32 *indices = new UINT32[m_face_count * 3];
+    UINT32 vertex_count = 0;
+    for (size_t i = 0; i < m_face_count * 3; i++)
+    {
+        const UINT32 vidx = m_indices[i];
+        if (remap[vidx] == 0xffffffffu)
+        {
+            vertices[vertex_count] = m_welded_vertices[vidx];
+            remap[vidx] = vertex_count++;
+        }
+        indices[i] = remap[vidx];
+    }
+    releaseWeld();
+    m_welded_vertices = vertices;
+    m_indices = indices;
+    m_welded_vertex_count = vertex_count;
+    delete[] remap;
+    if (packed) pack(m_pack_offset, m_pack_scale);
+
+    for (size_t lidx = 0; lidx < m_lod_count; lidx++)
+    {
+        m_lods[lidx]->optimizeVertexFetch();
+    }
+}
+
+/**
+ * Average cache miss ratio : transformed vertices per face with a FIFO
+ * post-transform cache. Meshlets are drawn independently and in view
+ * dependent order, so the cache starts empty at every meshlet.
+ */
+float TriangleMesh::computeACMR(size_t cache_size) const
+{
+    if (m_face_count == 0 || (m_indices == nullptr && m_packed_indices == nullptr)) return 0.0f;
+
+    UINT64 *cache_time = new UINT64[m_welded_vertex_count];
+    memset(cache_time, 0, m_welded_vertex_count * sizeof(UINT64));
+    UINT64 time = 0;
+    size_t miss_count = 0;
+    for (size_t ridx = 0; ridx < faceRangeCount(); ridx++)
+    {
+        size_t face_begin, face_end;
+        faceRange(ridx, face_begin, face_end);
+        if (m_indices)
+            miss_count += simulateVertexCache(m_indices, face_begin, face_end, cache_time, time, cache_size);
+        else if (m_packed_index_size == sizeof(UINT16))
+            miss_count += simulateVertexCache(reinterpret_cast<const UINT16*>(m_packed_indices), face_begin, face_end, cache_time, time, cache_size);
+        else
+            miss_count += simulateVertexCache(reinterpret_cast<const UINT32*>(m_packed_indices), face_begin, face_end, cache_time, time, cache_size);
+    }
+    delete[] cache_time;
+
+    return (float)miss_count / m_face_count;
+}
+
+template<typename T>
+void TriangleMesh::permuteArray(T * & array, const size_t * order, size_t count)
+{
+    if (array == nullptr) return;
+
+    T *new_array = new T[count];
+    for (size_t i = 0; i < count; i++)
+    {
+        new_array[i] = array[order[i]];
+    }
+    releaseArray(array);
+    array = new_array;
+}
+
+// order[i] is the old index of the face that is moved to position i
+void TriangleMesh::permuteFaces(const size_t * order)
+{
+    permuteArray(m_faces, order, m_face_count);
+    permuteArray(m_face_texcoords, order, m_face_count);
+    permuteArray(m_face_normals, order, m_face_count);
+    permuteArray(m_triangle_normals, order, m_face_count);
+    permuteArray(m_tangent, order, m_face_count);
+    permuteArray(m_bitangent, order, m_face_count);
+    if (m_indices)
+    {
+        UINT32 *indices = new UINT32[m_face_count * 3];
+        for (size_t i = 0; i < m_face_count; i++)
+        {
+            indices[i * 3 + 0] = m_indices[order[i] * 3 + 0];
+            indices[i * 3 + 1] = m_indices[order[i] * 3 + 1];
+            indices[i * 3 + 2] = m_indices[order[i] * 3 + 2];
+        }
+        releaseArray(m_indices);
+        m_indices = indices;
+    }
+    if (m_packed_indices)
+    {
+        const size_t face_size = 3 * m_packed_index_size;
+        byte_t *indices = new byte_t[m_face_count * face_size];
+        for (size_t i = 0; i < m_face_count; i++)
+        {
+            memcpy(indices + i * face_size, m_packed_indices + order[i] * face_size, face_size);
+        }
+        releaseArray(m_packed_indices);
+        m_packed_indices = indices;
+    }
+    permuteArray(m_packed_tangents, order, m_face_count);
+}
+
+struct FaceSortKey
+{
+    UINT64 key;
+    size_t face;
+};
+
+static int compareFaceSortKey(const void * a, const void * b)
+{
+    const UINT64 ka = static_cast<const FaceSortKey*>(a)->key;
+    const UINT64 kb = static_cast<const FaceSortKey*>(b)->key;
+    return (ka > kb) - (ka < kb);
+}
+
+// spread the lower 10 bits of v so that there are two zero bits between each
+// reference : https://fgiesen.wordpress.com/2009/12/13/decoding-morton-codes/
+static inline UINT32 expandBits(UINT32 v)
+{
+    v &= 0x000003ff;
+    v = (v ^ (v << 16)) & 0xff0000ff;
+    v = (v ^ (v <<  8)) & 0x0300f00f;
+    v = (v ^ (v <<  4)) & 0x030c30c3;
+    v = (v ^ (v <<  2)) & 0x09249249;
+    return v;
+}
+
+static inline UINT32 mortonCode(const vec3 & p, const vec3 & min_bound, const vec3 & inv_extent)
+{
+    UINT32 x = clamp((p.x - min_bound.x) * inv_extent.x, 0.0f, 1.0f) * 1023.0f;
+    UINT32 y = clamp((p.y - min_bound.y) * inv_extent.y, 0.0f, 1.0f) * 1023.0f;
+    UINT32 z = clamp((p.z - min_bound.z) * inv_extent.z, 0.0f, 1.0f) * 1023.0f;
+    return (expandBits(x) << 2) | (expandBits(y) << 1) | expandBits(z);
+}
+
+/**
+ * Split the mesh into meshlets of at most max_faces faces. Seeds are taken in
+ * morton order of the face centroids and each meshlet grows over faces sharing
+ * a vertex with it, as long as their normals stay inside the meshlet normal
+ * cone. The faces are then reordered so that every meshlet is a contiguous
+ * face range.
+ */
+void TriangleMesh::buildMeshlets(size_t max_faces)
+{
+    assert(max_faces > 0);
+    if (m_face_count == 0) return;
+
+    computeTriangleNormals();
+
+    const BoundingBox bounding_box = getAxisAlignBoundingBox();
+    const vec3 min_bound(bounding_box.min_x, bounding_box.min_y, bounding_box.min_z);
+    const vec3 extent(
+        bounding_box.max_x - bounding_box.min_x,
+        bounding_box.max_y - bounding_box.min_y,
+        bounding_box.max_z - bounding_box.min_z );
+    const vec3 inv_extent(
+        extent.x > EPSILON ? 1.0f / extent.x : 0.0f,
+        extent.y > EPSILON ? 1.0f / extent.y : 0.0f,
+        extent.z > EPSILON ? 1.0f / extent.z : 0.0f );
+
+    FaceSortKey *keys = new FaceSortKey[m_face_count];
+    for (size_t fidx = 0; fidx < m_face_count; fidx++)
+    {
+        const vec3 centroid = (m_vertices[m_faces[fidx][0]] +
+                               m_vertices[m_faces[fidx][1]] +
+                               m_vertices[m_faces[fidx][2]]) * (1.0f / 3.0f);
+        keys[fidx].key = mortonCode(centroid, min_bound, inv_extent);
+        keys[fidx].face = fidx;
+    }
+    ::qsort(keys, m_face_count, sizeof(FaceSortKey), compareFaceSortKey);
+
+    // faces around each vertex in compressed row storage
+    size_t *vertex_face_offsets = new size_t[m_vertex_count + 1];
+    size_t *vertex_faces = new size_t[m_face_count * 3];
+    memset(vertex_face_offsets, 0, (m_vertex_count + 1) * sizeof(size_t));
+    for (size_t fidx = 0; fidx < m_face_count; fidx++)
+    {
+        for (size_t vidx = 0; vidx < 3; vidx++)
+        {
+            vertex_face_offsets[m_faces[fidx][vidx] + 1]++;
+        }
+    }
+    for (size_t vidx = 0; vidx < m_vertex_count; vidx++)
+    {
+        vertex_face_offsets[vidx + 1] += vertex_face_offsets[vidx];
+    }
+    size_t *vertex_face_fill = new size_t[m_vertex_count];
+    memcpy(vertex_face_fill, vertex_face_offsets, m_vertex_count * sizeof(size_t));
+    for (size_t fidx = 0; fidx < m_face_count; fidx++)
+    {
+        for (size_t vidx = 0; vidx < 3; vidx++)
+        {
+            vertex_faces[vertex_face_fill[m_faces[fidx][vidx]]++] = fidx;
+        }
+    }
+    delete[] vertex_face_fill;
+
+    size_t *order = new size_t[m_face_count];
+    long *visited = new long[m_face_count]; // id of the meshlet that last queued the face
+    for (size_t fidx = 0; fidx < m_face_count; fidx++)
+    {
+        visited[fidx] = -1;
+    }
+    bool *assigned = new bool[m_face_count];
+    memset(assigned, 0, m_face_count * sizeof(bool));
+
+    DynamicArray<Meshlet> meshlets;
+    DynamicArray<size_t> frontier;
+    size_t order_count = 0;
+    for (size_t sidx = 0; sidx < m_face_count; sidx++)
+    {
+        const size_t seed = keys[sidx].face;
+        if (assigned[seed]) continue;
+
+        const long meshlet_id = meshlets.size();
+        Meshlet meshlet;
+        meshlet.face_offset = order_count;
+        meshlet.face_count = 0;
+        meshlet.radius = 0.0f;
+        meshlet.cone_cutoff = 1.0f;
+
+        vec3 normal_sum = vec3::ZERO;
+        frontier.clear();
+        frontier.push_back(seed);
+        visited[seed] = meshlet_id;
+        for (size_t head = 0; head < frontier.size() && meshlet.face_count < max_faces; head++)
+        {
+            const size_t fidx = frontier[head];
+            const vec3 & normal = m_triangle_normals[fidx];
+            if (meshlet.face_count > 0 && normal.dot(normal_sum.normalized()) < MESHLET_CONE_COS)
+            {
+                continue;
+            }
+
+            assigned[fidx] = true;
+            order[order_count++] = fidx;
+            meshlet.face_count++;
+            normal_sum += normal;
+
+            for (size_t vidx = 0; vidx < 3; vidx++)
+            {
+                const long v = m_faces[fidx][vidx];
+                for (size_t i = vertex_face_offsets[v]; i < vertex_face_offsets[v + 1]; i++)
+                {
+                    const size_t neighbour = vertex_faces[i];
+                    if (assigned[neighbour] || visited[neighbour] == meshlet_id) continue;
+                    visited[neighbour] = meshlet_id;
+                    frontier.push_back(neighbour);
+                }
+            }
+        }
+        meshlets.push_back(meshlet);
+    }
+    assert(order_count == m_face_count);
+
+    delete[] assigned;
+    delete[] visited;
+    delete[] vertex_faces;
+    delete[] vertex_face_offsets;
+
+    permuteFaces(order);
+    delete[] order;
+    delete[] keys;
+
+    releaseArray(m_meshlets);
+    m_meshlet_count = meshlets.size();
+    m_meshlets = new Meshlet[m_meshlet_count];
+
+    for (size_t midx = 0; midx < m_meshlet_count; midx++)
+    {
+        Meshlet meshlet = meshlets[midx];
+        const size_t face_end = meshlet.face_offset + meshlet.face_count;
+
+        // bounding sphere around the center of the meshlet AABB
+        vec3 lower( FLOAT_INF,  FLOAT_INF,  FLOAT_INF);
+        vec3 upper(-FLOAT_INF, -FLOAT_INF, -FLOAT_INF);
+        vec3 normal_sum = vec3::ZERO;
+        for (size_t fidx = meshlet.face_offset; fidx < face_end; fidx++)
+        {
+            for (size_t vidx = 0; vidx < 3; vidx++)
+            {
+                const vec3 & p = m_vertices[m_faces[fidx][vidx]];
+                lower = vec3(min(lower.x, p.x), min(lower.y, p.y), min(lower.z, p.z));
+                upper = vec3(max(upper.x, p.x), max(upper.y, p.y), max(upper.z, p.z));
+            }
+            normal_sum += m_triangle_normals[fidx];
+        }
+        meshlet.center = (lower + upper) * 0.5f;
+        meshlet.radius = 0.0f;
+        for (size_t fidx = meshlet.face_offset; fidx < face_end; fidx++)
+        {
+            for (size_t vidx = 0; vidx < 3; vidx++)
+            {
+                meshlet.radius = max(meshlet.radius, (m_vertices[m_faces[fidx][vidx]] - meshlet.center).length());
+            }
+        }
+
+        // normal cone, degenerated faces do not contribute
+        meshlet.cone_axis = normal_sum.normalized();
+        float min_dot = normal_sum.length() > EPSILON ? 1.0f : -1.0f;
+        for (size_t fidx = meshlet.face_offset; fidx < face_end; fidx++)
+        {
+            const vec3 & n = m_triangle_normals[fidx];
+            if (n.length() < 0.5f) continue;
+            min_dot = min(min_dot, n.dot(meshlet.cone_axis));
+        }
+        meshlet.cone_cutoff = min_dot > EPSILON ? sqrtf(1.0f - min_dot * min_dot) : 1.0f;
+
+        m_meshlets[midx] = meshlet;
+    }
+}
+
+// symmetric 4x4 matrix of the squared distance to a set of planes
+// reference : https://www.cs.cmu.edu/~./garland/Papers/quadrics.pdf
+struct Quadric
+{
+    double a2, ab, ac, ad;
+    double     b2, bc, bd;
+    double         c2, cd;
+    double             d2;
+
+    Quadric(): a2(0), ab(0), ac(0), ad(0), b2(0), bc(0), bd(0), c2(0), cd(0), d2(0) {}
+    Quadric(const vec3 & n, float d):
+        a2(n.x * n.x), ab(n.x * n.y), ac(n.x * n.z), ad(n.x * d),
+        b2(n.y * n.y), bc(n.y * n.z), bd(n.y * d),
+        c2(n.z * n.z), cd(n.z * d),
+        d2(d * d) {}
+
+    void operator+= (const Quadric & q)
+    {
+        a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+        b2 += q.b2; bc += q.bc; bd += q.bd;
+        c2 += q.c2; cd += q.cd;
+        d2 += q.d2;
+    }
+
+    double error(const vec3 & p) const
+    {
+        const double x = p.x, y = p.y, z = p.z;
+        const double e = x * (a2 * x + ab * y + ac * z + ad) +
+                         y * (ab * x + b2 * y + bc * z + bd) +
+                         z * (ac * x + bc * y + c2 * z + cd) +
+                             (ad * x + bd * y + cd * z + d2);
+        return e > 0.0 ? e : 0.0;
+    }
+};
+
+struct EdgeCollapse
+{
+    float  cost;
+    size_t from;    // vertex removed by the collapse
+    size_t to;      // vertex kept
+    size_t from_version;
+    size_t to_version;
+};
+
+// binary min-heap on the collapse cost
+static void pushCollapse(DynamicArray<EdgeCollapse> & heap, const EdgeCollapse & collapse)
+{
+    heap.push_back(collapse);
+    size_t idx = heap.size() - 1;
+    while (idx > 0)
+    {
+        size_t parent = (idx - 1) / 2;
+        if (heap[parent].cost <= heap[idx].cost) break;
+        std::swap(heap[parent], heap[idx]);
+        idx = parent;
+    }
+}
+
+static EdgeCollapse popCollapse(DynamicArray<EdgeCollapse> & heap)
+{
+    EdgeCollapse top = heap[0];
+    heap[0] = heap.back();
+    heap.pop_back();
+    size_t idx = 0;
+    while (true)
+    {
+        size_t smallest = idx;
+        size_t left = idx * 2 + 1;
+        size_t right = idx * 2 + 2;
+        if (left < heap.size() && heap[left].cost < heap[smallest].cost) smallest = left;
+        if (right < heap.size() && heap[right].cost < heap[smallest].cost) smallest = right;
+        if (smallest == idx) break;
+        std::swap(heap[smallest], heap[idx]);
+        idx = smallest;
+    }
+    return top;
+}
+
+static inline long faceCorner(const vec3i & face, size_t vidx)
+{
+    if ((size_t)face[0] == vidx) return 0;
+    if ((size_t)face[1] == vidx) return 1;
+    if ((size_t)face[2] == vidx) return 2;
+    return -1;
+}
+
+// compact an attribute array to the entries referenced by the face indices
+template<typename T>
+static T * compactAttribute(const T * array, size_t count, vec3i * face_indices, size_t face_count, size_t * out_count)
+{
+    long *remap = new long[count];
+    for (size_t i = 0; i < count; i++)
+    {
+        remap[i] = -1;
+    }
+    size_t used = 0;
+    for (size_t fidx = 0; fidx < face_count; fidx++)
+    {
+        for (size_t vidx = 0; vidx < 3; vidx++)
+        {
+            long & index = remap[face_indices[fidx][vidx]];
+            if (index < 0) index = used++;
+            face_indices[fidx][vidx] = index;
+        }
+    }
+    T *new_array = new T[used];
+    for (size_t i = 0; i < count; i++)
+    {
+        if (remap[i] >= 0) new_array[remap[i]] = array[i];
+    }
+    delete[] remap;
+    *out_count = used;
+    return new_array;
+}
+
+/**
+ * Quadric error metric simplification by half-edge collapses, returns a new
+ * mesh with roughly target_face_count faces. Vertices on open borders and on
+ * texture coordinate or normal seams are kept in place so that the surface
+ * does not shrink or tear, the collapsed vertices inherit the attributes of
+ * the vertex they merge into. The square root of the largest collapse error
+ * is written to error as an estimate of the geometric deviation.
+ * reference : https://www.cs.cmu.edu/~./garland/Papers/quadrics.pdf
+ */
+TriangleMesh * TriangleMesh::simplify(size_t target_face_count, float * error) const
+{
+    if (m_face_count == 0) return nullptr;
+
+    vec3i *faces = new vec3i[m_face_count];
+    vec3i *face_texcoords = m_face_texcoords ? new vec3i[m_face_count] : nullptr;
+    vec3i *face_normals = m_face_normals ? new vec3i[m_face_count] : nullptr;
+    bool *face_removed = new bool[m_face_count];
+    for (size_t fidx = 0; fidx < m_face_count; fidx++)
+    {
+        faces[fidx] = m_faces[fidx];
+        if (face_texcoords) face_texcoords[fidx] = m_face_texcoords[fidx];
+        if (face_normals) face_normals[fidx] = m_face_normals[fidx];
+        face_removed[fidx] = false;
+    }
+
+    Quadric *quadrics = new Quadric[m_vertex_count];
+    DynamicArray<size_t> *vertex_faces = new DynamicArray<size_t>[m_vertex_count];
+    for (size_t fidx = 0; fidx < m_face_count; fidx++)
+    {
+        const vec3 & p0 = m_vertices[faces[fidx][0]];
+        const vec3 normal = (m_vertices[faces[fidx][1]] - p0).cross(m_vertices[faces[fidx][2]] - p0).normalized();
+        const Quadric plane(normal, -normal.dot(p0));
+        for (size_t vidx = 0; vidx < 3; vidx++)
+        {
+            quadrics[faces[fidx][vidx]] += plane;
+            vertex_faces[faces[fidx][vidx]].push_back(fidx);
+        }
+    }
+
+    // lock vertices on borders, non-manifold edges and attribute seams
+    bool *locked = new bool[m_vertex_count];
+    memset(locked, 0, m_vertex_count * sizeof(bool));
+    for (size_t fidx = 0; fidx < m_face_count; fidx++)
+    {
+        for (size_t cidx = 0; cidx < 3; cidx++)
+        {
+            const size_t a = faces[fidx][cidx];
+            const size_t b = faces[fidx][(cidx + 1) % 3];
+            size_t shared_count = 0;
+            size_t other = 0;
+            for (size_t i = 0; i < vertex_faces[a].size(); i++)
+            {
+                const size_t g = vertex_faces[a][i];
+                if (g != fidx && faceCorner(faces[g], b) >= 0)
+                {
+                    shared_count++;
+                    other = g;
+                }
+            }
+            if (shared_count != 1)
+            {
+                locked[a] = locked[b] = true;
+                continue;
+            }
+            const long ga = faceCorner(faces[other], a);
+            const long gb = faceCorner(faces[other], b);
+            const size_t cb = (cidx + 1) % 3;
+            if (face_texcoords && (face_texcoords[fidx][cidx] != face_texcoords[other][ga] ||
+                                   face_texcoords[fidx][cb] != face_texcoords[other][gb]))
+            {
+                locked[a] = locked[b] = true;
+            }
+            if (face_normals && (face_normals[fidx][cidx] != face_normals[other][ga] ||
+                                 face_normals[fidx][cb] != face_normals[other][gb]))
+            {
+                locked[a] = locked[b] = true;
+            }
+        }
+    }
+
+    size_t *versions = new size_t[m_vertex_count];
+    bool *vertex_removed = new bool[m_vertex_count];
+    memset(versions, 0, m_vertex_count * sizeof(size_t));
+    memset(vertex_removed, 0, m_vertex_count * sizeof(bool));
+
+    DynamicArray<EdgeCollapse> heap;
+    for (size_t fidx = 0; fidx < m_face_count; fidx++)
+    {
+        for (size_t cidx = 0; cidx < 3; cidx++)
+        {
+            const size_t from = faces[fidx][cidx];
+            const size_t to = faces[fidx][(cidx + 1) % 3];
+            if (locked[from]) continue;
+
+            Quadric q = quadrics[from];
+            q += quadrics[to];
+            EdgeCollapse collapse = { (float)q.error(m_vertices[to]), from, to, 0, 0 };
+            pushCollapse(heap, collapse);
+        }
+    }
+
+    DynamicArray<size_t> neighbours;
+    size_t face_count = m_face_count;
+    float max_error = 0.0f;
+    while (face_count > target_face_count && !heap.empty())
+    {
+        const EdgeCollapse collapse = popCollapse(heap);
+        const size_t from = collapse.from;
+        const size_t to = collapse.to;
+        if (vertex_removed[from] || vertex_removed[to] ||
+            versions[from] != collapse.from_version || versions[to] != collapse.to_version)
+        {
+            continue;
+        }
+
+        // the two faces on the edge, they have to agree on the attributes of the kept vertex
+        long edge_faces[2] = { -1, -1 };
+        size_t edge_face_count = 0;
+        for (size_t i = 0; i < vertex_faces[from].size(); i++)
+        {
+            const size_t g = vertex_faces[from][i];
+            if (face_removed[g] || faceCorner(faces[g], to) < 0) continue;
+            if (edge_face_count < 2) edge_faces[edge_face_count] = g;
+            edge_face_count++;
+        }
+        if (edge_face_count != 2) continue;
+        const long to_corner = faceCorner(faces[edge_faces[0]], to);
+        const long to_corner1 = faceCorner(faces[edge_faces[1]], to);
+        if (face_texcoords && face_texcoords[edge_faces[0]][to_corner] != face_texcoords[edge_faces[1]][to_corner1]) continue;
+        if (face_normals && face_normals[edge_faces[0]][to_corner] != face_normals[edge_faces[1]][to_corner1]) continue;
+
+        // link condition, the one-rings of the two vertices may only share the two opposite vertices
+        neighbours.clear();
+        for (size_t i = 0; i < vertex_faces[to].size(); i++)
+        {
+            const size_t g = vertex_faces[to][i];
+            if (face_removed[g]) continue;
+            for (size_t vidx = 0; vidx < 3; vidx++)
+            {
+                neighbours.push_back(faces[g][vidx]);
+            }
+        }
+        size_t shared_vertices = 0;
+        bool flipped = false;
+        for (size_t i = 0; i < vertex_faces[from].size() && !flipped; i++)
+        {
+            const size_t g = vertex_faces[from][i];
+            if (face_removed[g] || faceCorner(faces[g], to) >= 0) continue;
+
+            const long corner = faceCorner(faces[g], from);
+            const size_t v1 = faces[g][(corner + 1) % 3];
+            const size_t v2 = faces[g][(corner + 2) % 3];
+            for (size_t j = 0; j < neighbours.size(); j++)
+            {
+                if (neighbours[j] == v1) { shared_vertices++; break; }
+            }
+
+            // reject collapses that fold the surface over
+            const vec3 e1 = m_vertices[v1] - m_vertices[from];
+            const vec3 e2 = m_vertices[v2] - m_vertices[from];
+            const vec3 f1 = m_vertices[v1] - m_vertices[to];
+            const vec3 f2 = m_vertices[v2] - m_vertices[to];
+            const vec3 old_normal = e1.cross(e2);
+            const vec3 new_normal = f1.cross(f2);
+            if (new_normal.dot(old_normal) < 0.2f * new_normal.length() * old_normal.length() ||
+                new_normal.length() < EPSILON)
+            {
+                flipped = true;
+            }
+        }
+        // walking the closed fan of from only one of the two opposite vertices is met
+        if (flipped || shared_vertices != 1) continue;
+
+        // perform the collapse
+        const long tc_to = face_texcoords ? face_texcoords[edge_faces[0]][to_corner] : 0;
+        const long n_to = face_normals ? face_normals[edge_faces[0]][to_corner] : 0;
+        for (size_t i = 0; i < vertex_faces[from].size(); i++)
+        {
+            const size_t g = vertex_faces[from][i];
+            if (face_removed[g]) continue;
+            if (faceCorner(faces[g], to) >= 0)
+            {
+                face_removed[g] = true;
+                face_count--;
+                continue;
+            }
+            const long corner = faceCorner(faces[g], from);
+            faces[g][corner] = to;
+            if (face_texcoords) face_texcoords[g][corner] = tc_to;
+            if (face_normals) face_normals[g][corner] = n_to;
+            vertex_faces[to].push_back(g);
+        }
+        vertex_removed[from] = true;
+        quadrics[to] += quadrics[from];
+        versions[to]++;
+        max_error = max(max_error, collapse.cost);
+
+        // re-evaluate the edges around the kept vertex
+        for (size_t i = 0; i < vertex_faces[to].size(); i++)
+        {
+            const size_t g = vertex_faces[to][i];
+            if (face_removed[g]) continue;
+            for (size_t vidx = 0; vidx < 3; vidx++)
+            {
+                const size_t other = faces[g][vidx];
+                if (other == to) continue;
+
+                Quadric q = quadrics[to];
+                q += quadrics[other];
+                if (!locked[to])
+                {
+                    EdgeCollapse c = { (float)q.error(m_vertices[other]), to, other, versions[to], versions[other] };
+                    pushCollapse(heap, c);
+                }
+                if (!locked[other])
+                {
+                    EdgeCollapse c = { (float)q.error(m_vertices[to]), other, to, versions[other], versions[to] };
+                    pushCollapse(heap, c);
+                }
+            }
+        }
+    }
+
+    TriangleMesh *mesh = new TriangleMesh();
+    mesh->m_face_count = face_count;
+    mesh->m_faces = new vec3i[face_count];
+    if (face_texcoords) mesh->m_face_texcoords = new vec3i[face_count];
+    if (face_normals) mesh->m_face_normals = new vec3i[face_count];
+    size_t fcount = 0;
+    for (size_t fidx = 0; fidx < m_face_count; fidx++)
+    {
+        if (face_removed[fidx]) continue;
+        mesh->m_faces[fcount] = faces[fidx];
+        if (face_texcoords) mesh->m_face_texcoords[fcount] = face_texcoords[fidx];
+        if (face_normals) mesh->m_face_normals[fcount] = face_normals[fidx];
+        fcount++;
+    }
+    mesh->m_vertices = compactAttribute(m_vertices, m_vertex_count, mesh->m_faces, face_count, &mesh->m_vertex_count);
+    if (m_has_texture_coords && face_texcoords)
+    {
+        mesh->m_texture_coords = compactAttribute(m_texture_coords, m_texcoord_count, mesh->m_face_texcoords, face_count, &mesh->m_texcoord_count);
+        mesh->m_has_texture_coords = true;
+    }
+    if (m_has_vertex_normals && face_normals)
+    {
+        mesh->m_vertex_normals = compactAttribute(m_vertex_normals, m_normal_count, mesh->m_face_normals, face_count, &mesh->m_normal_count);
+        mesh->m_has_vertex_normals = true;
+    }
+    if (m_has_triangle_normals) mesh->computeTriangleNormals();
+    if (m_has_tangent) mesh->computeTangentVectors();
+    mesh->computeMeshCenter();
+    if (m_indices || m_packed_vertices) mesh->weld();
+    if (m_packed_vertices) mesh->pack(m_pack_offset, m_pack_scale);
+
+    delete[] faces;
+    delete[] face_texcoords;
+    delete[] face_normals;
+    delete[] face_removed;
+    delete[] quadrics;
+    delete[] vertex_faces;
+    delete[] locked;
+    delete[] versions;
+    delete[] vertex_removed;
+
+    if (error) *error = sqrtf(max_error);
+    return mesh;
+}
+
+static int compareLong(const void * a, const void * b)
+{
+    const long la = *static_cast<const long*>(a);
+    const long lb = *static_cast<const long*>(b);
+    return (la > lb) - (la < lb);
+}
+
+// as compactAttribute, but in O(face_count log face_count) regardless of the attribute count
+template<typename T>
+static T * compactAttributeSparse(const T * array, vec3i * face_indices, size_t face_count, size_t * out_count)
+{
+    long *used = new long[face_count * 3];
+    for (size_t i = 0; i < face_count * 3; i++)
+    {
+        used[i] = face_indices[i / 3][i % 3];
+    }
+    ::qsort(used, face_count * 3, sizeof(long), compareLong);
+    size_t used_count = 0;
+    for (size_t i = 0; i < face_count * 3; i++)
+    {
+        if (used_count == 0 || used[used_count - 1] != used[i]) used[used_count++] = used[i];
+    }
+
+    T *new_array = new T[used_count];
+    for (size_t i = 0; i < used_count; i++)
+    {
+        new_array[i] = array[used[i]];
+    }
+    for (size_t i = 0; i < face_count * 3; i++)
+    {
+        long & index = face_indices[i / 3][i % 3];
+        index = static_cast<const long*>(::bsearch(&index, used, used_count, sizeof(long), compareLong)) - used;
+    }
+    delete[] used;
+    *out_count = used_count;
+    return new_array;
+}
+
+// copy the given faces into a new mesh, only keeping the attributes they use
+TriangleMesh * TriangleMesh::extractFaces(const size_t * faces, size_t face_count) const
+{
+    if (face_count == 0) return nullptr;
+
+    TriangleMesh *mesh = new TriangleMesh();
+    mesh->m_face_count = face_count;
+    mesh->m_faces = new vec3i[face_count];
+    for (size_t i = 0; i < face_count; i++)
+    {
+        mesh->m_faces[i] = m_faces[faces[i]];
+    }
+    mesh->m_vertices = compactAttributeSparse(m_vertices, mesh->m_faces, face_count, &mesh->m_vertex_count);
+    if (m_has_texture_coords)
+    {
+        mesh->m_face_texcoords = new vec3i[face_count];
+        for (size_t i = 0; i < face_count; i++)
+        {
+            mesh->m_face_texcoords[i] = m_face_texcoords[faces[i]];
+        }
+        mesh->m_texture_coords = compactAttributeSparse(m_texture_coords, mesh->m_face_texcoords, face_count, &mesh->m_texcoord_count);
+        mesh->m_has_texture_coords = true;
+    }
+    if (m_has_vertex_normals)
+    {
+        mesh->m_face_normals = new vec3i[face_count];
+        for (size_t i = 0; i < face_count; i++)
+        {
+            mesh->m_face_normals[i] = m_face_normals[faces[i]];
+        }
+        mesh->m_vertex_normals = compactAttributeSparse(m_vertex_normals, mesh->m_face_normals, face_count, &mesh->m_normal_count);
+        mesh->m_has_vertex_normals = true;
+    }
+    if (m_has_triangle_normals)
+    {
+        mesh->m_triangle_normals = new vec3[face_count];
+        for (size_t i = 0; i < face_count; i++)
+        {
+            mesh->m_triangle_normals[i] = m_triangle_normals[faces[i]];
+        }
+        mesh->m_has_triangle_normals = true;
+    }
+    if (m_has_tangent)
+    {
+        mesh->m_tangent = new vec3[face_count];
+        mesh->m_bitangent = new vec3[face_count];
+        for (size_t i = 0; i < face_count; i++)
+        {
+            mesh->m_tangent[i] = m_tangent[faces[i]];
+            mesh->m_bitangent[i] = m_bitangent[faces[i]];
+        }
+        mesh->m_has_tangent = true;
+    }
+    mesh->computeMeshCenter();
+    if (m_indices || m_packed_vertices) mesh->weld();
+    if (m_packed_vertices) mesh->pack(m_pack_offset, m_pack_scale);
+
+    return mesh;
+}
+
+/**
+ * Build a chain of simplified levels, each with about reduction times the
+ * faces of the previous one. The chain stops early once the simplifier can
+ * not make enough progress, e.g. when only locked vertices are left.
+ */
+void TriangleMesh::buildLODChain(size_t max_levels, float reduction)
+{
+    assert(reduction > 0.0f && reduction < 1.0f);
+    clearLODChain();
+    max_levels = min(max_levels, (size_t)MESH_LOD_MAX_LEVELS);
+
+    const TriangleMesh *previous = this;
+    float error_sum = 0.0f;
+    while (m_lod_count < max_levels)
+    {
+        const size_t target_face_count = previous->m_face_count * reduction;
+        if (target_face_count < MESH_LOD_MIN_FACES) break;
+
+        float error = 0.0f;
+        TriangleMesh *lod = previous->simplify(target_face_count, &error);
+        if (lod == nullptr) break;
+        if (lod->m_face_count > (previous->m_face_count + target_face_count) / 2)
+        {
+            delete lod;
+            break;
+        }
+        if (m_meshlet_count > 0) lod->buildMeshlets();
+
+        // the levels are simplified one from another so the deviations add up
+        error_sum += error;
+        m_lods[m_lod_count] = lod;
+        m_lod_errors[m_lod_count] = error_sum;
+        m_lod_count++;
+        previous = lod;
+    }
+}
+
+void TriangleMesh::clearLODChain()
+{
+    for (size_t lidx = 0; lidx < m_lod_count; lidx++)
+    {
+        delete m_lods[lidx];
+    }
+    m_lod_count = 0;
+}
+
+void TriangleMesh::copyLODChain(const TriangleMesh & tri_mesh)
+{
+    m_lod_count = tri_mesh.m_lod_count;
+    for (size_t lidx = 0; lidx < m_lod_count; lidx++)
+    {
+        m_lods[lidx] = new TriangleMesh(*tri_mesh.m_lods[lidx]);
+        m_lod_errors[lidx] = tri_mesh.m_lod_errors[lidx];
+    }
+}
+
+static UINT64 alignCacheOffset(UINT64 offset)
+{
+    return (offset + MESH_CACHE_ALIGNMENT - 1) / MESH_CACHE_ALIGNMENT * MESH_CACHE_ALIGNMENT;
+}
+
+static void addCacheSection(MeshCacheSection * sections, const void ** arrays, UINT32 & section_count,
+                            UINT32 type, const void * array, size_t element_size, size_t count)
+{
+    if (array == nullptr || count == 0) return;
+
+    sections[section_count].type = type;
+    sections[section_count].element_size = (UINT32)element_size;
+    sections[section_count].count = count;
+    sections[section_count].offset = 0;
+    arrays[section_count] = array;
+    section_count++;
+}
+
+// write the cache at the current position of fp, which has to be MESH_CACHE_ALIGNMENT aligned
+bool TriangleMesh::writeCache(FILE * fp, UINT64 * size, const char * source_filename) const
+{
+    if (m_vertex_count == 0 || m_face_count == 0)
+    {
+        printf("TriangleMesh : empty mesh can not be cached\n");
+        return false;
+    }
+
+    MeshCacheSection sections[MESH_CACHE_SECTION_NUM];
+    const void *arrays[MESH_CACHE_SECTION_NUM];
+    UINT32 section_count = 0;
+    addCacheSection(sections, arrays, section_count, MESH_CACHE_VERTICES, m_vertices, sizeof(vec3), m_vertex_count);
+    addCacheSection(sections, arrays, section_count, MESH_CACHE_FACES, m_faces, sizeof(vec3i), m_face_count);
+    if (m_has_vertex_normals)
+    {
+        addCacheSection(sections, arrays, section_count, MESH_CACHE_VERTEX_NORMALS, m_vertex_normals, sizeof(vec3), m_normal_count);
+        addCacheSection(sections, arrays, section_count, MESH_CACHE_FACE_NORMALS, m_face_normals, sizeof(vec3i), m_face_count);
+    }
+    if (m_has_texture_coords)
+    {
+        addCacheSection(sections, arrays, section_count, MESH_CACHE_TEXTURE_COORDS, m_texture_coords, sizeof(vec2), m_texcoord_count);
+        addCacheSection(sections, arrays, section_count, MESH_CACHE_FACE_TEXCOORDS, m_face_texcoords, sizeof(vec3i), m_face_count);
+    }
+    if (m_has_triangle_normals)
+    {
+        addCacheSection(sections, arrays, section_count, MESH_CACHE_TRIANGLE_NORMALS, m_triangle_normals, sizeof(vec3), m_face_count);
+    }
+    if (m_has_tangent)
+    {
+        addCacheSection(sections, arrays, section_count, MESH_CACHE_TANGENTS, m_tangent, sizeof(vec3), m_face_count);
+        addCacheSection(sections, arrays, section_count, MESH_CACHE_BITANGENTS, m_bitangent, sizeof(vec3), m_face_count);
+    }
+    addCacheSection(sections, arrays, section_count, MESH_CACHE_MESHLETS, m_meshlets, sizeof(Meshlet), m_meshlet_count);
+    if (m_indices)
+    {
+        addCacheSection(sections, arrays, section_count, MESH_CACHE_WELDED_VERTICES, m_welded_vertices, sizeof(WeldedVertex), m_welded_vertex_count);
+        addCacheSection(sections, arrays, section_count, MESH_CACHE_INDICES, m_indices, sizeof(UINT32), m_face_count * 3);
+    }
+    const float pack_bounds[6] = { m_pack_offset.x, m_pack_offset.y, m_pack_offset.z, m_pack_scale.x, m_pack_scale.y, m_pack_scale.z };
+    if (m_packed_vertices)
+    {
+        addCacheSection(sections, arrays, section_count, MESH_CACHE_PACKED_VERTICES, m_packed_vertices, sizeof(PackedVertex), m_welded_vertex_count);
+        addCacheSection(sections, arrays, section_count, MESH_CACHE_PACKED_INDICES, m_packed_indices, 3 * m_packed_index_size, m_face_count);
+        addCacheSection(sections, arrays, section_count, MESH_CACHE_PACKED_TANGENTS, m_packed_tangents, sizeof(PackedTangent), m_face_count);
+        addCacheSection(sections, arrays, section_count, MESH_CACHE_PACK_BOUNDS, pack_bounds, sizeof(float), 6);
+    }
+
+    UINT64 offset = alignCacheOffset(sizeof(MeshCacheHeader) + section_count * sizeof(MeshCacheSection));
+    for (UINT32 sidx = 0; sidx < section_count; sidx++)
+    {
+        sections[sidx].offset = offset;
+        offset = alignCacheOffset(offset + sections[sidx].count * sections[sidx].element_size);
+    }
+
+    MeshCacheHeader header;
+    memset(&header, 0, sizeof(MeshCacheHeader));
+    header.magic = MESH_CACHE_MAGIC;
+    header.version = MESH_CACHE_VERSION;
+    header.section_count = section_count;
+    header.vertex_count = m_vertex_count;
+    header.face_count = m_face_count;
+    BoundingBox bounding_box = getAxisAlignBoundingBox();
+    header.bound_min[0] = bounding_box.min_x;
+    header.bound_min[1] = bounding_box.min_y;
+    header.bound_min[2] = bounding_box.min_z;
+    header.bound_max[0] = bounding_box.max_x;
+    header.bound_max[1] = bounding_box.max_y;
+    header.bound_max[2] = bounding_box.max_z;
+    header.center[0] = m_mesh_center.x;
+    header.center[1] = m_mesh_center.y;
+    header.center[2] = m_mesh_center.z;
+    header.radius = m_bounding_radius;
+    if (source_filename && !MappedFile::fileStamp(source_filename, &header.source_time, &header.source_size))
+    {
+        printf("TriangleMesh : mesh file: %s not found\n", source_filename);
+        return false;
+    }
+
+    const byte_t padding[MESH_CACHE_ALIGNMENT] = { 0 };
+    bool written = fwrite(&header, sizeof(MeshCacheHeader), 1, fp) == 1 &&
+                   fwrite(sections, sizeof(MeshCacheSection), section_count, fp) == section_count;
+    UINT64 position = sizeof(MeshCacheHeader) + section_count * sizeof(MeshCacheSection);
+    for (UINT32 sidx = 0; sidx < section_count && written; sidx++)
+    {
+        written = fwrite(padding, 1, sections[sidx].offset - position, fp) == sections[sidx].offset - position &&
+                  fwrite(arrays[sidx], sections[sidx].element_size, sections[sidx].count, fp) == sections[sidx].count;
+        position = sections[sidx].offset + sections[sidx].count * sections[sidx].element_size;
+    }
+    if (size) *size = position;
+
+    return written;
+}
+
+// the cache of source_filename, loaded in its place until the source changes
+bool TriangleMesh::saveCache(const char * filename, const char * source_filename) const
+{
+    // write to a temporary file first, the target may be mapped by a loaded mesh
+    // and a partially written cache must never be picked up by the loader
+    size_t f_len = strlen(filename);
+    char *temp_filename = new char[f_len + 5];
+    strcpy(temp_filename, filename);
+    strcat(temp_filename, ".tmp");
+
+    FILE *fp = fopen(temp_filename, "wb");
+    if (fp == nullptr)
+    {
+        printf("TriangleMesh : mesh cache: %s open failed\n", temp_filename);
+        delete[] temp_filename;
+        return false;
+    }
+
+    bool written = writeCache(fp, nullptr, source_filename);
+    written = fclose(fp) == 0 && written;
+
+    if (written)
+    {
+        remove(filename);
+        written = rename(temp_filename, filename) == 0;
+    }
+    if (!written)
+    {
+        printf("TriangleMesh : mesh cache: %s write failed\n", filename);
+        remove(temp_filename);
+    }
+    delete[] temp_filename;
+
+    return written;
+}
+
+template<typename T>
+static bool mapCacheSection(byte_t * data, const MeshCacheSection & section, T * & array)
+{
+    if (section.element_size != sizeof(T)) return false;
+
+    array = reinterpret_cast<T*>(data);
+    return true;
+}
+
+// face indices are mapped as is when the integer width matches, otherwise converted
+static bool mapCacheIndices(byte_t * data, const MeshCacheSection & section, vec3i * & array)
+{
+    if (section.element_size == sizeof(vec3i))
+    {
+        array = reinterpret_cast<vec3i*>(data);
+        return true;
+    }
+
+    if (section.element_size != 3 * sizeof(INT32) && section.element_size != 3 * sizeof(INT64)) return false;
+
+    array = new vec3i[section.count];
+    for (size_t i = 0; i < section.count * 3; i++)
+    {
+        array[i / 3][i % 3] = section.element_size == 3 * sizeof(INT32) ?
+            (long)reinterpret_cast<const INT32*>(data)[i] :
+            (long)reinterpret_cast<const INT64*>(data)[i];
+    }
+    return true;
+}
+
+/**
+ * Load a cache file, or a cache stored in the region [offset, offset + size)
+ * of a file. With source_filename, the cache is only loaded if it was
+ * converted from that file as it is now, and fails silently otherwise.
+ */
+bool TriangleMesh::loadCache(const char * filename, UINT64 offset, UINT64 size, const char * source_filename)
+{
+    MappedFile *file = new MappedFile();
+    if (!file->open(filename, offset, size))
+    {
+        delete file;
+        return false;
+    }
+
+    const MeshCacheHeader *header = reinterpret_cast<const MeshCacheHeader*>(file->data());
+    if (file->size() < sizeof(MeshCacheHeader) ||
+        header->magic != MESH_CACHE_MAGIC ||
+        header->version != MESH_CACHE_VERSION ||
+        file->size() < sizeof(MeshCacheHeader) + (UINT64)header->section_count * sizeof(MeshCacheSection))
+    {
+        printf("TriangleMesh : mesh cache: %s is invalid or outdated\n", filename);
+        delete file;
+        return false;
+    }
+    INT64 source_time;
+    UINT64 source_size;
+    if (source_filename && (!MappedFile::fileStamp(source_filename, &source_time, &source_size) ||
+                            header->source_time != source_time || header->source_size != source_size))
+    {
+        delete file;
+        return false;
+    }
+
+    releaseData();
+    clearLODChain();
+    m_mapped_file = file;
+
+    const MeshCacheSection *sections = reinterpret_cast<const MeshCacheSection*>(file->data() + sizeof(MeshCacheHeader));
+    bool valid = true;
+    bool has_pack_bounds = false;
+    for (UINT32 sidx = 0; sidx < header->section_count && valid; sidx++)
+    {
+        const MeshCacheSection & section = sections[sidx];
+        if (section.offset % MESH_CACHE_ALIGNMENT != 0 ||
+            section.offset > file->size() ||
+            section.count * section.element_size > file->size() - section.offset)
+        {
+            valid = false;
+            break;
+        }
+
+        byte_t *data = file->data() + section.offset;
+        switch (section.type)
+        {
+            case MESH_CACHE_VERTICES:
+                valid = section.count == header->vertex_count && mapCacheSection(data, section, m_vertices);
+                break;
+            case MESH_CACHE_VERTEX_NORMALS:
+                valid = mapCacheSection(data, section, m_vertex_normals);
+                m_normal_count = section.count;
+                break;
+            case MESH_CACHE_TEXTURE_COORDS:
+                valid = mapCacheSection(data, section, m_texture_coords);
+                m_texcoord_count = section.count;
+                break;
+            case MESH_CACHE_TRIANGLE_NORMALS:
+                valid = section.count == header->face_count && mapCacheSection(data, section, m_triangle_normals);
+                break;
+            case MESH_CACHE_TANGENTS:
+                valid = section.count == header->face_count && mapCacheSection(data, section, m_tangent);
+                break;
+            case MESH_CACHE_BITANGENTS:
+                valid = section.count == header->face_count && mapCacheSection(data, section, m_bitangent);
+                break;
+            case MESH_CACHE_FACES:
+                valid = section.count == header->face_count && mapCacheIndices(data, section, m_faces);
+                break;
+            case MESH_CACHE_FACE_TEXCOORDS:
+                valid = section.count == header->face_count && mapCacheIndices(data, section, m_face_texcoords);
+                break;
+            case MESH_CACHE_FACE_NORMALS:
+                valid = section.count == header->face_count && mapCacheIndices(data, section, m_face_normals);
+                break;
+            case MESH_CACHE_MESHLETS:
+                // meshlets written with a different layout are dropped, they can be rebuilt
+                if (mapCacheSection(data, section, m_meshlets)) m_meshlet_count = section.count;
+                break;
+            case MESH_CACHE_WELDED_VERTICES:
+                valid = mapCacheSection(data, section, m_welded_vertices);
+                m_welded_vertex_count = section.count;
+                break;
+            case MESH_CACHE_INDICES:
+                valid = section.count == header->face_count * 3 && mapCacheSection(data, section, m_indices);
+                break;
+            case MESH_CACHE_PACKED_VERTICES:
+                valid = mapCacheSection(data, section, m_packed_vertices);
+                m_welded_vertex_count = section.count;
+                break;
+            case MESH_CACHE_PACKED_INDICES:
+                valid = section.count == header->face_count &&
+                        (section.element_size == 3 * sizeof(UINT16) || section.element_size == 3 * sizeof(UINT32));
+                m_packed_indices = data;
+                m_packed_index_size = section.element_size / 3;
+                break;
+            case MESH_CACHE_PACKED_TANGENTS:
+                valid = section.count == header->face_count && mapCacheSection(data, section, m_packed_tangents);
+                break;
+            case MESH_CACHE_PACK_BOUNDS:
+                valid = section.count == 6 && section.element_size == sizeof(float);
+                if (valid)
+                {
+                    const float *bounds = reinterpret_cast<const float*>(data);
+                    m_pack_offset = vec3(bounds[0], bounds[1], bounds[2]);
+                    m_pack_scale = vec3(bounds[3], bounds[4], bounds[5]);
+                    has_pack_bounds = true;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (!valid || m_vertices == nullptr || m_faces == nullptr || (m_indices != nullptr) != (m_welded_vertices != nullptr) ||
+        (m_packed_vertices != nullptr) != (m_packed_indices != nullptr) ||
+        (m_packed_vertices != nullptr && !has_pack_bounds))
+    {
+        printf("TriangleMesh : mesh cache: %s is corrupted\n", filename);
+        releaseData();
+        return false;
+    }
+
+    m_vertex_count = header->vertex_count;
+    m_face_count = header->face_count;
+    m_has_vertex_normals = m_vertex_normals != nullptr && m_face_normals != nullptr;
+    m_has_texture_coords = m_texture_coords != nullptr && m_face_texcoords != nullptr;
+    m_has_triangle_normals = m_triangle_normals != nullptr;
+    m_has_tangent = m_tangent != nullptr && m_bitangent != nullptr;
+    m_mesh_center = vec3(header->center[0], header->center[1], header->center[2]);
+    m_bounding_radius = header->radius;
+
+    return true;
+}
+
+// replace the extension of filename with MESH_CACHE_EXTENSION
+bool TriangleMesh::cacheFilename(const char * filename, char * cache_filename, size_t length)
+{
+    const char *extension = strrchr(filename, '.');
+    const char *separator = strrchr(filename, '/');
+    const char *backslash = strrchr(filename, '\\');
+    if (backslash > separator) separator = backslash;
+    size_t stem_len = (extension && extension > separator) ? extension - filename : strlen(filename);
+    if (stem_len + strlen(MESH_CACHE_EXTENSION) + 1 > length) return false;
+
+    memcpy(cache_filename, filename, stem_len);
+    strcpy(cache_filename + stem_len, MESH_CACHE_EXTENSION);
+    return true;
+}
+
+BoundingBox TriangleMesh::getAxisAlignBoundingBox() const
+{
+    float min_x = FLOAT_INF, min_y = FLOAT_INF, min_z = FLOAT_INF;
+    float max_x = -FLOAT_INF, max_y = -FLOAT_INF, max_z = -FLOAT_INF;
+
+#ifdef _OPENMP
+#pragma omp parallel for reduction(min:min_x,min_y,min_z) reduction(max:max_x,max_y,max_z)
+#endif
+    for (long vidx = 0; vidx < (long)m_vertex_count; vidx++)
+    {
+        min_x = min(m_vertices[vidx].x, min_x);
+        min_y = min(m_vertices[vidx].y, min_y);
+        min_z = min(m_vertices[vidx].z, min_z);
+        max_x = max(m_vertices[vidx].x, max_x);
+        max_y = max(m_vertices[vidx].y, max_y);
+        max_z = max(m_vertices[vidx].z, max_z);
+    }
+
+    return BoundingBox(min_x, min_y, min_z, max_x, max_y, max_z);
+}
+
+vec3 TriangleMesh::getMaxBound() const
+{
+    const BoundingBox bounding_box = getAxisAlignBoundingBox();
+    return vec3(bounding_box.max_x, bounding_box.max_y, bounding_box.max_z);
+}
+
+vec3 TriangleMesh::getMinBound() const
+{
+    const BoundingBox bounding_box = getAxisAlignBoundingBox();
+    return vec3(bounding_box.min_x, bounding_box.min_y, bounding_box.min_z);
 }
\ No newline at end of file
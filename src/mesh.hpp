@@ -8,12 +8,26 @@
 #include "global.hpp"
 #include "maths.hpp"
 #include "darray.hpp"
+#include "mapfile.hpp"
 
 namespace LuGL
 {
 
 #define MAX_OBJ_LINE 256
+#define OBJ_CHUNK_SIZE (1 << 20)  // bytes of an OBJ file parsed by one task
+#define MESH_REDUCE_BLOCK 65536   // vertices summed by one task, fixed so sums do not depend on threads
 #define FLOAT_INF 1e6
+#define MESHLET_MAX_FACES 96
+#define MESHLET_CONE_COS 0.9f
+#define MESH_LOD_MAX_LEVELS 6
+#define MESH_LOD_REDUCTION 0.5f
+#define MESH_LOD_MIN_FACES 64
+#define VERTEX_CACHE_SIZE 16        // FIFO entries modelled by the triangle order optimizer
+#define OVERDRAW_THRESHOLD 1.05f    // ACMR increase allowed to the overdraw optimizer
+#define MESH_CACHE_MAGIC 0x434d4c4c    // "LLMC"
+#define MESH_CACHE_VERSION 4
+#define MESH_CACHE_ALIGNMENT 16
+#define MESH_CACHE_EXTENSION ".lmc"
 
 struct BoundingBox
 {
@@ -119,6 +133,121 @@ public:
 
 #define VERTEX(a) (*(vec3*)&m_vertices[a*3])
 
+/**
+ * A meshlet is a contiguous range of faces in a TriangleMesh with its
+ * bounding sphere and normal cone, so that the pipeline can reject the whole
+ * cluster before any of its vertices are shaded.
+ * reference : https://github.com/zeux/meshoptimizer#mesh-shading
+ */
+struct Meshlet
+{
+    size_t face_offset;
+    size_t face_count;
+    vec3   center;
+    float  radius;
+    vec3   cone_axis;
+    float  cone_cutoff; // sine of the cone spread, 1 if the cone can not be culled
+};
+
+// optional attributes, computed on first use by TriangleMesh::computeAttributes
+enum MeshAttribute
+{
+    MESH_ATTRIBUTE_VERTEX_NORMALS   = 0x1,
+    MESH_ATTRIBUTE_TRIANGLE_NORMALS = 0x2,
+    MESH_ATTRIBUTE_TANGENTS         = 0x4,
+    MESH_ATTRIBUTE_ALL              = 0x7
+};
+
+/**
+ * Vertex of the single indexed buffer built by TriangleMesh::weld. OBJ faces
+ * index positions, normals and texture coordinates separately, welding keeps
+ * each distinct combination once so the pipeline fetches a vertex with one
+ * index and one contiguous read instead of three dependent gathers.
+ */
+struct WeldedVertex
+{
+    vec3 position;
+    vec3 normal;
+    vec2 texcoord;
+};
+
+/**
+ * Compact form of a WeldedVertex built by TriangleMesh::pack, 16 bytes
+ * instead of 32 : positions normalized to 16 bits over the bounding box,
+ * octahedral normals and half precision texture coordinates.
+ */
+struct PackedVertex
+{
+    UINT16 position[3];
+    INT16  normal[2];
+    UINT16 texcoord[2];
+    UINT16 padding;
+};
+
+// per face tangent frame, octahedral directions and half precision lengths
+struct PackedTangent
+{
+    INT16  tangent[2];
+    INT16  bitangent[2];
+    UINT16 tangent_length;
+    UINT16 bitangent_length;
+};
+
+/**
+ * Binary mesh cache (.lmc) : a MeshCacheHeader, then header.section_count
+ * MeshCacheSection entries, then the raw array of every section starting at
+ * a MESH_CACHE_ALIGNMENT aligned offset. Arrays are stored in the in-memory
+ * layout of TriangleMesh, so a mapped cache file is used without parsing or
+ * copying. Index sections written with a different integer width (long is
+ * 4 bytes on Windows) are converted on load. A cache converted from a file
+ * keeps the modification time and the size of the file, the cache next to
+ * an OBJ file is only used while they are the same.
+ */
+enum MeshCacheSectionType
+{
+    MESH_CACHE_VERTICES = 0,
+    MESH_CACHE_VERTEX_NORMALS,
+    MESH_CACHE_TRIANGLE_NORMALS,
+    MESH_CACHE_TEXTURE_COORDS,
+    MESH_CACHE_FACES,
+    MESH_CACHE_FACE_TEXCOORDS,
+    MESH_CACHE_FACE_NORMALS,
+    MESH_CACHE_TANGENTS,
+    MESH_CACHE_BITANGENTS,
+    MESH_CACHE_MESHLETS,
+    MESH_CACHE_WELDED_VERTICES,
+    MESH_CACHE_INDICES,
+    MESH_CACHE_PACKED_VERTICES,
+    MESH_CACHE_PACKED_INDICES,     // element size is 3 times the index size
+    MESH_CACHE_PACKED_TANGENTS,
+    MESH_CACHE_PACK_BOUNDS,        // offset and scale of the packed positions
+    MESH_CACHE_SECTION_NUM
+};
+
+struct MeshCacheHeader
+{
+    UINT32 magic;
+    UINT32 version;
+    UINT32 section_count;
+    UINT32 reserved;
+    UINT64 vertex_count;
+    UINT64 face_count;
+    float  bound_min[3];
+    float  bound_max[3];
+    float  center[3];
+    float  radius;
+    INT64  source_time;     // MappedFile::fileStamp of the converted file, 0 without one
+    UINT64 source_size;
+};
+
+struct MeshCacheSection
+{
+    UINT32 type;
+    UINT32 element_size;
+    UINT64 count;
+    UINT64 offset;  // from the beginning of the cache
+};
+
 class TriangleMesh
 {
 private:
@@ -132,14 +261,46 @@ private:
     vec3    m_mesh_center;
     vec3    *m_tangent;
     vec3    *m_bitangent;
+    Meshlet *m_meshlets;
+    WeldedVertex *m_welded_vertices;
+    UINT32  *m_indices;         // 3 per face into m_welded_vertices
+    PackedVertex  *m_packed_vertices;
+    PackedTangent *m_packed_tangents;
+    byte_t  *m_packed_indices;  // 16 or 32 bit, 3 per face into m_packed_vertices
+    UINT32  m_packed_index_size;
+    vec3    m_pack_offset;
+    vec3    m_pack_scale;
+    float   m_bounding_radius;
+
+    TriangleMesh *m_lods[MESH_LOD_MAX_LEVELS];  // m_lods[i] is level i + 1, level 0 is this mesh
+    float   m_lod_errors[MESH_LOD_MAX_LEVELS];   // geometric error of each level in model space
 
     size_t   m_vertex_count;
     size_t   m_face_count;
+    size_t   m_texcoord_count;
+    size_t   m_normal_count;
+    size_t   m_meshlet_count;
+    size_t   m_welded_vertex_count;    // of the welded or the packed vertex buffer
+    size_t   m_lod_count;
     
     bool     m_has_vertex_normals;
     bool     m_has_triangle_normals;
     bool     m_has_texture_coords;
     bool     m_has_tangent;
+
+    MappedFile *m_mapped_file;  // backing storage of arrays loaded from a mesh cache
+
+    template<typename T> void releaseArray(T * & array);
+    template<typename T> void permuteArray(T * & array, const size_t * order, size_t count);
+    void releaseData();
+    void releaseWeld();
+    void releasePack();
+    void permuteFaces(const size_t * order);
+    void faceRange(size_t ridx, size_t & face_begin, size_t & face_end) const;
+    size_t faceRangeCount() const { return m_meshlet_count > 0 ? m_meshlet_count : 1; }
+    UINT32 occlusionKey(size_t face_begin, size_t face_end) const;
+    void clearLODChain();
+    void copyLODChain(const TriangleMesh & tri_mesh);
 public:
     TriangleMesh();
     TriangleMesh(const char * filename);
@@ -152,6 +313,23 @@ public:
     void computeTriangleNormals();
     void computeMeshCenter();
     void computeTangentVectors();
+    void computeAttributes(UINT32 mask);
+    void buildMeshlets(size_t max_faces = MESHLET_MAX_FACES);
+    void weld();
+    void pack();
+    void pack(const vec3 & offset, const vec3 & scale);
+    void optimizeVertexCache(size_t cache_size = VERTEX_CACHE_SIZE);
+    void optimizeOverdraw(float threshold = OVERDRAW_THRESHOLD, size_t cache_size = VERTEX_CACHE_SIZE);
+    void optimizeVertexFetch();
+    float computeACMR(size_t cache_size = VERTEX_CACHE_SIZE) const;
+    TriangleMesh * simplify(size_t target_face_count, float * error = nullptr) const;
+    TriangleMesh * extractFaces(const size_t * faces, size_t face_count) const;
+    void buildLODChain(size_t max_levels = MESH_LOD_MAX_LEVELS, float reduction = MESH_LOD_REDUCTION);
+    bool loadOBJ(const char * filename);
+    bool saveCache(const char * filename, const char * source_filename = nullptr) const;
+    bool writeCache(FILE * fp, UINT64 * size = nullptr, const char * source_filename = nullptr) const;
+    bool loadCache(const char * filename, UINT64 offset = 0, UINT64 size = 0, const char * source_filename = nullptr);
+    static bool cacheFilename(const char * filename, char * cache_filename, size_t length);
 
     BoundingBox getAxisAlignBoundingBox() const;
     vec3 getMaxBound() const;
@@ -161,9 +339,17 @@ public:
     bool hasTriangleNormals() const { return m_has_triangle_normals; }
     bool hasTextureCoords() const { return m_has_texture_coords; }
     bool hasTangents() const { return m_has_tangent; }
+    bool hasMeshlets() const { return m_meshlet_count > 0; }
+    bool isWelded() const { return m_indices != nullptr; }
+    bool isPacked() const { return m_packed_vertices != nullptr; }
+    bool isMapped() const { return m_mapped_file != nullptr; }
+    const MappedFile * getMappedFile() const { return m_mapped_file; }
 
     size_t vertexCount() const { return m_vertex_count; }
     size_t faceCount() const { return m_face_count; }
+    size_t meshletCount() const { return m_meshlet_count; }
+    size_t weldedVertexCount() const { return m_welded_vertex_count; }
+    size_t lodCount() const { return m_lod_count + 1; }
 
     vec3* getVertices() const { return m_vertices; }
     vec3* getVertexNormals() const { return m_vertex_normals; }
@@ -174,9 +360,50 @@ public:
     vec2* getTextureCoords() const { return m_texture_coords; }
     vec3* getTangents() const { return m_tangent; }
     vec3* getBitangents() const { return m_bitangent; }
+    Meshlet* getMeshlets() const { return m_meshlets; }
+    WeldedVertex* getWeldedVertices() const { return m_welded_vertices; }
+    UINT32* getIndices() const { return m_indices; }
+    PackedVertex* getPackedVertices() const { return m_packed_vertices; }
+    UINT32 getPackedIndexSize() const { return m_packed_index_size; }
+
+    // decode the packed buffers, used by the vertex fetch of the pipeline
+    UINT32 packedIndex(size_t fidx, size_t vidx) const
+    {
+        const size_t i = fidx * 3 + vidx;
+        return m_packed_index_size == sizeof(UINT16) ? reinterpret_cast<const UINT16*>(m_packed_indices)[i] :
+                                                       reinterpret_cast<const UINT32*>(m_packed_indices)[i];
+    }
+    vec3 unpackPosition(const PackedVertex & vertex) const
+    {
+        return vec3(m_pack_offset.x + vertex.position[0] * m_pack_scale.x,
+                    m_pack_offset.y + vertex.position[1] * m_pack_scale.y,
+                    m_pack_offset.z + vertex.position[2] * m_pack_scale.z);
+    }
+    vec3 unpackNormal(const PackedVertex & vertex) const
+    {
+        return m_has_vertex_normals ? decodeOctahedral(vertex.normal) : vec3::ZERO;
+    }
+    vec2 unpackTexcoord(const PackedVertex & vertex) const
+    {
+        return vec2(halfToFloat(vertex.texcoord[0]), halfToFloat(vertex.texcoord[1]));
+    }
+    vec3 unpackTangent(size_t fidx) const
+    {
+        if (m_packed_tangents == nullptr) return vec3::ZERO;
+        return decodeOctahedral(m_packed_tangents[fidx].tangent) * halfToFloat(m_packed_tangents[fidx].tangent_length);
+    }
+    vec3 unpackBitangent(size_t fidx) const
+    {
+        if (m_packed_tangents == nullptr) return vec3::ZERO;
+        return decodeOctahedral(m_packed_tangents[fidx].bitangent) * halfToFloat(m_packed_tangents[fidx].bitangent_length);
+    }
     vec3 getMeshCenter() const { return m_mesh_center; }
+    float getBoundingRadius() const { return m_bounding_radius; }
+    const TriangleMesh * getLOD(size_t level) const { return level == 0 ? this : m_lods[level - 1]; }
+    float getLODError(size_t level) const { return level == 0 ? 0.0f : m_lod_errors[level - 1]; }
 
     void printMeshInfo() const;
+    size_t memorySize() const;
 };
 
 }
@@ -33,36 +33,33 @@ static inline void getMSAAMask(unsigned short* mask, v2f const& v0, v2f const& v
     *mask = 0;
     float tp0, tp1, tp2;
 
-    DynamicArray<vec4> samples;
+    DynamicArray<vec4, 8> samples;  // inline, no allocation per pixel
     switch (Singleton<Global>::get().sample_option)
     {
         case LUGL_SAMPLE_2xMSAA:
             {
-                samples.reserve(2);
                 for (int i = 0; i < 2; i++) {
-                    samples[i] = vec4(
+                    samples.push_back(vec4(
                         pos.x + LUGL_2xMSAA_PATTERN[i][0],
-                        pos.y + LUGL_2xMSAA_PATTERN[i][1], 1.0f, 0.0f);
+                        pos.y + LUGL_2xMSAA_PATTERN[i][1], 1.0f, 0.0f));
                 }
             }
             break;
         case LUGL_SAMPLE_4xMSAA:
             {
-                samples.reserve(4);
                 for (int i = 0; i < 4; i++) {
-                    samples[i] = vec4(
+                    samples.push_back(vec4(
                         pos.x + LUGL_4xMSAA_PATTERN[i][0],
-                        pos.y + LUGL_4xMSAA_PATTERN[i][1], 1.0f, 0.0f);
+                        pos.y + LUGL_4xMSAA_PATTERN[i][1], 1.0f, 0.0f));
                 }
             }
             break;
         case LUGL_SAMPLE_8xMSAA:
             {
-                samples.reserve(8);
                 for (int i = 0; i < 8; i++) {
-                    samples[i] = vec4(
+                    samples.push_back(vec4(
                         pos.x + LUGL_8xMSAA_PATTERN[i][0],
-                        pos.y + LUGL_8xMSAA_PATTERN[i][1], 1.0f, 0.0f);
+                        pos.y + LUGL_8xMSAA_PATTERN[i][1], 1.0f, 0.0f));
                 }
             }
             break;
@@ -76,304 +73,881 @@ static inline void getMSAAMask(unsigned short* mask, v2f const& v0, v2f const& v
 
 void Pipeline::draw(const FrameBuffer & frame_buffer, const Scene & scene, const Shader * shader)
 {
-    // scene.sortEntity();
+    if (Singleton<Global>::get().front_to_back)
+    {
+        scene.sortEntity(); // front to back so that the depth test rejects more fragments
+    }
     frame_buffer.clearDepthBuffer(1.0f);
 
+    const mat4 view_proj_matrix = scene.getCamera().getProjectMatrix() * scene.getCamera().getViewMatrix();
+    const UINT32 attributes = shader->requiredAttributes();
+    shader->resolveQuadPath();
+    if (scene.getEnvmap()) scene.getEnvmap()->updateLoading();
+
     const DynamicArray<Entity*>* entities = scene.getEntities();
     for (size_t eidx = 0; eidx < entities->size(); eidx++)
     {
-        const Entity *entity = (*entities)[eidx];
-        const mat4 mvp_matrix = scene.getCamera().getProjectMatrix() * scene.getCamera().getViewMatrix() * entity->getTransform();
-        const mat3 model_inv_transpose = mat3(entity->getTransform().inversed().transposed());
+        Entity *entity = (*entities)[eidx];
+        if (entity->updateLoading())
+        {
+            drawPlaceholder(frame_buffer, scene, shader, entity, entity->getTransform(), view_proj_matrix);
+            continue;
+        }
+        if (entity->getTriangleMesh()) entity->getTriangleMesh()->computeAttributes(attributes);
+        drawEntity(frame_buffer, scene, shader, entity, entity->getTransform(), view_proj_matrix);
+    }
 
-        const TriangleMesh *mesh = entity->getTriangleMesh();
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif
-        for (size_t fidx = 0; fidx < mesh->faceCount(); fidx++)
+    const DynamicArray<InstancedEntity*>* instanced_entities = scene.getInstancedEntities();
+    for (size_t eidx = 0; eidx < instanced_entities->size(); eidx++)
+    {
+        InstancedEntity *entity = (*instanced_entities)[eidx];
+        if (entity->updateLoading())
         {
-#if 0
-            vdata vd0 = TRIANGLE_VDATA(fidx, 0);
-            vdata vd1 = TRIANGLE_VDATA(fidx, 1);
-            vdata vd2 = TRIANGLE_VDATA(fidx, 2);
-            vd0.position.print();
-            vd1.position.print();
-            vd2.position.print();
-            printf("----------------------------------------------\n");
-#endif
-            // Assembly Stage
-            v2f v0 = shader->vert(TRIANGLE_VDATA(fidx, 0), entity, scene);
-            v2f v1 = shader->vert(TRIANGLE_VDATA(fidx, 1), entity, scene);
-            v2f v2 = shader->vert(TRIANGLE_VDATA(fidx, 2), entity, scene);
-#if 0
-            v0.position.print();
-            v1.position.print();
-            v2.position.print();
-            printf("----------------------------------------------\n");
-#endif
-            v0.t_normal = model_inv_transpose * TRIANGLE_TRIANGLE_NORMAL(fidx);
-            v1.t_normal = model_inv_transpose * TRIANGLE_TRIANGLE_NORMAL(fidx);
-            v2.t_normal = model_inv_transpose * TRIANGLE_TRIANGLE_NORMAL(fidx);
-
-            // Perspective Division
-            PERSPECTIVE_DIVIDE(v0.position);
-            PERSPECTIVE_DIVIDE(v1.position);
-            PERSPECTIVE_DIVIDE(v2.position);
-            
-            // Triangle Screen Clipping
-            if ((v0.position.x < -1.0f && v1.position.x < -1.0f && v2.position.x < -1.0f) ||
-                (v0.position.x >  1.0f && v1.position.x >  1.0f && v2.position.x >  1.0f) ||
-                (v0.position.y < -1.0f && v1.position.y < -1.0f && v2.position.y < -1.0f) ||
-                (v0.position.y >  1.0f && v1.position.y >  1.0f && v2.position.y >  1.0f) ||
-                (v0.position.z <  0.0f && v1.position.z <  0.0f && v2.position.z <  0.0f) || // Near/Far Plane Clipping
-                (v0.position.z >  1.0f && v1.position.z >  1.0f && v2.position.z >  1.0f))
+            for (size_t iidx = 0; iidx < entity->instanceCount(); iidx++)
             {
-                continue;
+                drawPlaceholder(frame_buffer, scene, shader, entity, entity->getInstance(iidx).transform, view_proj_matrix);
             }
+            continue;
+        }
+        if (entity->getTriangleMesh()) entity->getTriangleMesh()->computeAttributes(attributes);
+        drawInstanced(frame_buffer, scene, shader, entity, view_proj_matrix);
+    }
 
-            if (Singleton<Global>::get().backface_culling && !Singleton<Global>::get().wireframe_mode) { // Back-face Culling
-                vec3 u = vec3(v1.position - v0.position);
-                vec3 v = vec3(v2.position - v0.position);
-                vec3 face_normal = u.cross(v);
+    const DynamicArray<StreamingEntity*>* streaming_entities = scene.getStreamingEntities();
+    for (size_t eidx = 0; eidx < streaming_entities->size(); eidx++)
+    {
+        drawStreaming(frame_buffer, scene, shader, (*streaming_entities)[eidx], view_proj_matrix);
+    }
+    Singleton<FrameArena>::get().endFrame();
+    Singleton<VirtualTextureCache>::get().update();
 
-                if (face_normal.z < 0.0f)
+#if 0
+    if (scene.getEnvmap())
+    {
+        float x_center = (float)(frame_buffer.getWidth() - 1) / 2.0f;
+        float y_center = (float)(frame_buffer.getHeight() - 1) / 2.0f;
+        for (long x = 0; x < frame_buffer.getWidth(); x++)
+        {
+            for (long y = 0; y < frame_buffer.getHeight(); y++)
+            {
+                long depth_buffer_pos = frame_buffer.getSize() - frame_buffer.getWidth() * (y + 1) + x;
+                if (depth_test && frame_buffer.depthBuffer()[depth_buffer_pos] < 1.0f)
                 {
                     continue;
                 }
-            }
 
-#ifdef _BARYCENTRIC_TRIANGLE_RASTERIZATION_0_
-            v0.position.x = SCREEN_MAPPING_X(v0.position.x, frame_buffer);
-            v1.position.x = SCREEN_MAPPING_X(v1.position.x, frame_buffer);
-            v2.position.x = SCREEN_MAPPING_X(v2.position.x, frame_buffer);
-            v0.position.y = SCREEN_MAPPING_Y(v0.position.y, frame_buffer);
-            v1.position.y = SCREEN_MAPPING_Y(v1.position.y, frame_buffer);
-            v2.position.y = SCREEN_MAPPING_Y(v2.position.y, frame_buffer);
-
-            // Preconpute Affine transform for barycentric determinant computation
-            // reference : https://stackoverflow.com/questions/24441631/how-exactly-does-opengl-do-perspectively-correct-linear-interpolation
-            const float denom = 1.0f / ((v0.position.x - v2.position.x) * (v1.position.y - v0.position.y) - (v0.position.x - v1.position.x) * (v2.position.y - v0.position.y));
-            const vec3 barycentric_d0 = denom * vec3(
-                v1.position.y - v2.position.y, v2.position.y - v0.position.y, v0.position.y - v1.position.y
-            );
-            const vec3 barycentric_d1 = denom * vec3(
-                v2.position.x - v1.position.x, v0.position.x - v2.position.x, v1.position.x - v0.position.x
-            );
-            const vec3 barycentric_0 = denom * vec3(
-                v1.position.x * v2.position.y - v2.position.x * v1.position.y,
-                v2.position.x * v0.position.y - v0.position.x * v2.position.y,
-                v0.position.x * v1.position.y - v1.position.x * v0.position.y
-            );
-            
-            // AABB Bounding Box of Triangle
-            long x_min = min(v0.position.x, min(v1.position.x, v2.position.x));
-            long x_max = max(v0.position.x, max(v1.position.x, v2.position.x));
-            long y_min = min(v0.position.y, min(v1.position.y, v2.position.y));
-            long y_max = max(v0.position.y, max(v1.position.y, v2.position.y));
+                vec2 sh = vierDir2Spherical(scene.getCamera().getForward());
 
-            for (long x = x_min; x < x_max; x++)
-            {
-                for (long y = y_min; y < y_max; y++)
-                {
-                    vec4 pos(DTOF(x), DTOF(frame_buffer.getHeight() - y), 0.0f, 0.0f);
+                rgb color = scene.getEnvmap()->getPixel(
+                    sh.theta + (float)(y - y_center) / (frame_buffer.getHeight() - 1) * scene.getCamera().getFOV(),
+                    sh.phi + (float)(x - x_center) / (frame_buffer.getWidth() - 1) * scene.getCamera().getFOV()
+                );
 
-                    const vec3 barycentric = pos.x * barycentric_d0 + pos.y * barycentric_d1 + barycentric_0;
-                    if (barycentric.x < 0.0f || barycentric.y < 0.0f || barycentric.z < 0.0f)
-                    {
-                        continue;
-                    }
+                byte_t *color_buffer = frame_buffer.colorBuffer();
+                long color_buffer_pos = (frame_buffer.getSize() - frame_buffer.getWidth() * (y + 1) + x) * 3;
+                color_buffer[color_buffer_pos++] = FLOAT2BYTECOLOR(color.r);
+                color_buffer[color_buffer_pos++] = FLOAT2BYTECOLOR(color.g);
+                color_buffer[color_buffer_pos] = FLOAT2BYTECOLOR(color.b);
+            }
+        }
+    }
+#endif
+}
 
-                    pos.z = barycentric.dot(vec3(v0.position.z, v1.position.z, v2.position.z));
-                    pos.w = barycentric.dot(vec3(v0.position.w, v1.position.w, v2.position.w));
-                    
-                    // Near/Far Plane Clipping
-                    if (pos.z < 0.0f || pos.z > 1.0f)
-                    {
-                        continue;
-                    }
+/**
+ * Replay a compiled command buffer. Culling and LOD selection of the commands
+ * run in parallel first, the draws are then issued in the compiled order and
+ * the global state is only changed where two neighbouring commands differ.
+ * Like draw, entities still loading are drawn as placeholders, the buffer is
+ * compiled again when they are loaded.
+ */
+void Pipeline::submit(const FrameBuffer & frame_buffer, const Scene & scene, CommandBuffer & commands, bool clear_depth)
+{
+    if (!commands.isCompiled())
+    {
+        printf("Pipeline : command buffer has to be compiled before submit\n");
+        return;
+    }
+    if (clear_depth) frame_buffer.clearDepthBuffer(1.0f);
+    if (scene.getEnvmap()) scene.getEnvmap()->updateLoading();
+    commands.updateLoading();
 
-                    const vec3 perspective = (1.0f / pos.w) * barycentric.multiply(vec3(v0.position.w, v1.position.w, v2.position.w));
-
-                    v2f v = v2f(
-                        pos,
-                        mat3( v0.frag_pos.x, v1.frag_pos.x, v2.frag_pos.x,
-                              v0.frag_pos.y, v1.frag_pos.y, v2.frag_pos.y,
-                              v0.frag_pos.z, v1.frag_pos.z, v2.frag_pos.z ) * perspective,
-                        mat3( v0.normal.x, v1.normal.x, v2.normal.x,
-                              v0.normal.y, v1.normal.y, v2.normal.y,
-                              v0.normal.z, v1.normal.z, v2.normal.z ) * perspective,
-                        mat3( v0.t_normal.x, v1.t_normal.x, v2.t_normal.x,
-                              v0.t_normal.y, v1.t_normal.y, v2.t_normal.y,
-                              v0.t_normal.z, v1.t_normal.z, v2.t_normal.z ) * perspective,
-                        vec2( vec3(v0.texcoord.u, v1.texcoord.u, v2.texcoord.u).dot(perspective),
-                              vec3(v0.texcoord.v, v1.texcoord.v, v2.texcoord.v).dot(perspective) )
-                    );
-
-                    pixelShaderBarycentric(frame_buffer, v, shader, entity, scene);
-                }
-            }
+    const Camera & camera = scene.getCamera();
+    const mat4 view_proj_matrix = camera.getProjectMatrix() * camera.getViewMatrix();
+    const Frustum frustum(view_proj_matrix);
+    const size_t command_count = commands.commandCount();
+
+    struct PreparedDraw
+    {
+        const TriangleMesh *mesh;   // selected LOD, nullptr if the draw is culled
+        mat4 mvp_matrix;
+    };
+    PreparedDraw *prepared = Singleton<FrameArena>::get().local().allocateArray<PreparedDraw>(command_count);
+
+#ifdef _OPENMP
+#pragma omp parallel for
 #endif
+    for (size_t cidx = 0; cidx < command_count; cidx++)
+    {
+        const DrawCommand & command = commands.getCommand(cidx);
+        const TriangleMesh *mesh = command.entity->getTriangleMesh();
+        prepared[cidx].mesh = mesh;
+        if (mesh == nullptr || command.instanced || command.loading) continue;
 
-#ifdef _BARYCENTRIC_TRIANGLE_RASTERIZATION_1_
-            v0.position.x = SCREEN_MAPPING_X(v0.position.x, frame_buffer);
-            v1.position.x = SCREEN_MAPPING_X(v1.position.x, frame_buffer);
-            v2.position.x = SCREEN_MAPPING_X(v2.position.x, frame_buffer);
-            v0.position.y = SCREEN_MAPPING_Y(v0.position.y, frame_buffer);
-            v1.position.y = SCREEN_MAPPING_Y(v1.position.y, frame_buffer);
-            v2.position.y = SCREEN_MAPPING_Y(v2.position.y, frame_buffer);
-
-            v0.position.z = 1.0f / v0.position.z;
-            v1.position.z = 1.0f / v1.position.z;
-            v2.position.z = 1.0f / v2.position.z;
-
-            if (Singleton<Global>::get().wireframe_mode)
-            {
-                drawLinePipeline(frame_buffer, v0, v1, shader, entity, scene);
-                drawLinePipeline(frame_buffer, v1, v2, shader, entity, scene);
-                drawLinePipeline(frame_buffer, v2, v0, shader, entity, scene);
+        const vec3 center = vec3(command.transform * vec4(mesh->getMeshCenter(), 1.0f));
+        if (!frustum.intersectSphere(center, mesh->getBoundingRadius() * command.scale))
+        {
+            prepared[cidx].mesh = nullptr;
+            continue;
+        }
+        prepared[cidx].mesh = mesh->getLOD(command.entity->selectLODLevel(camera, command.transform, frame_buffer.getHeight()));
+        prepared[cidx].mvp_matrix = view_proj_matrix * command.transform;
+    }
 
-                continue;
+    const RenderState saved_state;
+    size_t state_id = command_count; // no state applied yet
+    const Shader *shader = nullptr;
+    for (size_t cidx = 0; cidx < command_count; cidx++)
+    {
+        const DrawCommand & command = commands.getCommand(cidx);
+        if (prepared[cidx].mesh == nullptr && !command.loading) continue;
+
+        if (command.state_id != state_id)
+        {
+            command.state.apply();
+            state_id = command.state_id;
+        }
+        if (command.shader != shader)
+        {
+            shader = command.shader;
+            shader->resolveQuadPath();
+        }
+
+        if (command.loading && command.instanced)
+        {
+            const InstancedEntity *entity = static_cast<const InstancedEntity*>(command.entity);
+            for (size_t iidx = 0; iidx < entity->instanceCount(); iidx++)
+            {
+                drawPlaceholder(frame_buffer, scene, command.shader, entity, entity->getInstance(iidx).transform, view_proj_matrix);
             }
+        }
+        else if (command.loading)
+        {
+            drawPlaceholder(frame_buffer, scene, command.shader, command.entity, command.transform, view_proj_matrix);
+        }
+        else if (command.instanced)
+        {
+            drawInstanced(frame_buffer, scene, command.shader, static_cast<const InstancedEntity*>(command.entity), view_proj_matrix);
+        }
+        else
+        {
+            drawMesh(frame_buffer, scene, command.shader, command.entity, prepared[cidx].mesh,
+                command.transform, prepared[cidx].mvp_matrix, command.transform_inv, command.model_inv_transpose);
+        }
+    }
+    saved_state.apply();
+    Singleton<FrameArena>::get().endFrame();
+    Singleton<VirtualTextureCache>::get().update();
+}
+
+// a meshlet is back-facing if every face in its normal cone faces away from
+// every point of its bounding sphere, view_position is in model space
+// reference : https://github.com/zeux/meshoptimizer/blob/master/src/clusterizer.cpp
+static inline bool isMeshletBackfacing(const Meshlet & meshlet, const vec3 & view_position)
+{
+    if (meshlet.cone_cutoff >= 1.0f) return false;
+
+    const vec3 view_dir = meshlet.center - view_position;
+    return view_dir.dot(meshlet.cone_axis) >= meshlet.cone_cutoff * view_dir.length() + meshlet.radius * (1.0f + meshlet.cone_cutoff);
+}
 
-            // AABB Bounding Box of Triangle
-            const long x_min = max(min(v0.position.x, min(v1.position.x, v2.position.x)), 0);
-            const long x_max = min(max(v0.position.x, max(v1.position.x, v2.position.x)), frame_buffer.getWidth() - 1);
-            const long y_min = max(min(v0.position.y, min(v1.position.y, v2.position.y)), 0);
-            const long y_max = min(max(v0.position.y, max(v1.position.y, v2.position.y)), frame_buffer.getHeight() - 1);
+void Pipeline::drawEntity(
+    const FrameBuffer & frame_buffer, const Scene & scene, const Shader * shader,
+    const Entity * entity, const mat4 & model_matrix, const mat4 & view_proj_matrix
+) {
+    const TriangleMesh *mesh = entity->selectLOD(scene.getCamera(), model_matrix, frame_buffer.getHeight());
+    if (mesh == nullptr) return;
+
+    const mat4 mvp_matrix = view_proj_matrix * model_matrix;
+    const mat4 model_inv = model_matrix.inversed();
+    const mat3 model_inv_transpose = mat3(model_inv.transposed());
 
-            const float area = edgeFunction(v0.position, v1.position, v2.position);
-            unsigned short mask;
+    drawMesh(frame_buffer, scene, shader, entity, mesh, model_matrix, mvp_matrix, model_inv, model_inv_transpose);
+}
 
-            for (long x = x_min; x < x_max; x++)
+/**
+ * Box standing in for the mesh of an entity that is still loading. It goes
+ * through the entity shader with the entity material, which has only its
+ * base colors until the textures are loaded too.
+ */
+void Pipeline::drawPlaceholder(
+    const FrameBuffer & frame_buffer, const Scene & scene, const Shader * shader,
+    const Entity * entity, const mat4 & model_matrix, const mat4 & view_proj_matrix
+) {
+    static const vec3 axes[3] = { vec3::UNIT_X, vec3::UNIT_Y, vec3::UNIT_Z };
+    static const float corners[4][2] = { { -1.0f, -1.0f }, { 1.0f, -1.0f }, { 1.0f, 1.0f }, { -1.0f, 1.0f } };
+    static const long quad[2][3] = { { 0, 1, 2 }, { 0, 2, 3 } };
+
+    const mat4 mvp_matrix = view_proj_matrix * model_matrix;
+    const mat4 model_inv = model_matrix.inversed();
+    const mat3 model_inv_transpose = mat3(model_inv.transposed());
+
+    vdata triangle[3];
+    for (long vidx = 0; vidx < 3; vidx++)
+    {
+        triangle[vidx].model_mat = model_matrix;
+        triangle[vidx].model_inv_transpose = model_inv_transpose;
+        triangle[vidx].mvp_mat = mvp_matrix;
+        triangle[vidx].color = vec4::ZERO;
+    }
+    for (long axis = 0; axis < 3; axis++)
+    {
+        for (long side = 0; side < 2; side++)
+        {
+            // tangent cross bitangent is the face normal, so faces wind counter-clockwise seen from outside
+            const vec3 normal = side ? axes[axis] : -axes[axis];
+            const vec3 tangent = side ? axes[(axis + 1) % 3] : axes[(axis + 2) % 3];
+            const vec3 bitangent = side ? axes[(axis + 2) % 3] : axes[(axis + 1) % 3];
+            for (long tidx = 0; tidx < 2; tidx++)
             {
-                for (long y = y_min; y < y_max; y++)
+                for (long vidx = 0; vidx < 3; vidx++)
                 {
-                    vec4 pos(DTOF(x), DTOF(y), 1.0f, 0.0f);
+                    const float *corner = corners[quad[tidx][vidx]];
+                    triangle[vidx].position = (normal + tangent * corner[0] + bitangent * corner[1]) * ENTITY_PLACEHOLDER_EXTENT;
+                    triangle[vidx].normal = normal;
+                    triangle[vidx].texcoord = vec2(corner[0] * 0.5f + 0.5f, corner[1] * 0.5f + 0.5f);
+                    triangle[vidx].tangent = tangent;
+                    triangle[vidx].bitangent = bitangent;
+                }
+                processTriangle(frame_buffer, scene, shader, entity, triangle, normal);
+            }
+        }
+    }
+}
 
-                    float w0, w1, w2;
-                    if (Singleton<Global>::get().sample_option > LUGL_SAMPLE_DEFAULT) {
-                        // float tp0, tp1, tp2;
+void Pipeline::drawMesh(
+    const FrameBuffer & frame_buffer, const Scene & scene, const Shader * shader,
+    const Entity * entity, const TriangleMesh * mesh, const mat4 & model_matrix,
+    const mat4 & mvp_matrix, const mat4 & model_inv, const mat3 & model_inv_transpose
+) {
+    if (mesh->hasMeshlets() && Singleton<Global>::get().cluster_culling)
+    {
+        // Cluster Culling, reject whole meshlets before any vertex is shaded
+        const Frustum frustum(mvp_matrix);
+        const vec3 view_position = vec3(model_inv * vec4(scene.getCamera().getPosition(), 1.0f));
+        const bool cone_culling = Singleton<Global>::get().backface_culling &&
+                                  !Singleton<Global>::get().wireframe_mode &&
+                                  mat3(model_matrix).det() > 0.0f; // mirrored transforms flip the winding
+        const Meshlet *meshlets = mesh->getMeshlets();
+        const size_t meshlet_count = mesh->meshletCount();
+
+        // hand out the nearest meshlets first
+        size_t *order = nullptr;
+        if (Singleton<Global>::get().front_to_back)
+        {
+            LinearArena & arena = Singleton<FrameArena>::get().local();
+            UINT32 *keys = arena.allocateArray<UINT32>(meshlet_count);
+            order = arena.allocateArray<size_t>(meshlet_count);
+            for (size_t midx = 0; midx < meshlet_count; midx++)
+            {
+                keys[midx] = floatToRadixKey((meshlets[midx].center - view_position).length() - meshlets[midx].radius);
+                order[midx] = midx;
+            }
+            radixSort(keys, order, meshlet_count, &arena);
+        }
 
-                        // vec4 pos0(pos.x - 0.1f, pos.y + 0.4f, 1.0f, 0.0f);
-                        // vec4 pos1(pos.x + 0.4f, pos.y + 0.1f, 1.0f, 0.0f);
-                        // vec4 pos2(pos.x - 0.4f, pos.y - 0.1f, 1.0f, 0.0f);
-                        // vec4 pos3(pos.x + 0.1f, pos.y - 0.4f, 1.0f, 0.0f);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for (size_t i = 0; i < meshlet_count; i++)
+        {
+            const Meshlet & meshlet = meshlets[order ? order[i] : i];
+            if (!frustum.intersectSphere(meshlet.center, meshlet.radius))
+            {
+                continue;
+            }
+            if (cone_culling && isMeshletBackfacing(meshlet, view_position))
+            {
+                continue;
+            }
 
-                        // mask = 0;
+            const size_t face_end = meshlet.face_offset + meshlet.face_count;
+            for (size_t fidx = meshlet.face_offset; fidx < face_end; fidx++)
+            {
+                processTriangle(frame_buffer, scene, shader, entity, mesh, fidx, model_matrix, mvp_matrix, model_inv_transpose);
+            }
+        }
+    }
+    else
+    {
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+        for (size_t fidx = 0; fidx < mesh->faceCount(); fidx++)
+        {
+            processTriangle(frame_buffer, scene, shader, entity, mesh, fidx, model_matrix, mvp_matrix, model_inv_transpose);
+        }
+    }
+}
 
-                        // if (!outsideTest(v0, v1, v2, pos0, &tp0, &tp1, &tp2)) mask |= 1;
-                        // if (!outsideTest(v0, v1, v2, pos1, &tp0, &tp1, &tp2)) mask |= 2;
-                        // if (!outsideTest(v0, v1, v2, pos2, &tp0, &tp1, &tp2)) mask |= 4;
-                        // if (!outsideTest(v0, v1, v2, pos3, &tp0, &tp1, &tp2)) mask |= 8;
+struct LuGL::InstanceDraw
+{
+    size_t  index;
+    size_t  level;
+    mat4    mvp_matrix;
+    Frustum frustum;        // in the model space of the instance
+    vec3    view_position;  // in the model space of the instance
+    bool    cone_culling;
+};
+
+static int compareInstanceLevel(const void * a, const void * b)
+{
+    const InstanceDraw *ia = static_cast<const InstanceDraw*>(a);
+    const InstanceDraw *ib = static_cast<const InstanceDraw*>(b);
+    if (ia->level != ib->level) return (ia->level > ib->level) - (ia->level < ib->level);
+    return (ia->index > ib->index) - (ia->index < ib->index);
+}
 
-                        getMSAAMask(&mask, v0, v1, v2, pos);
-                        if (mask == 0) continue;
+// fetch the vertex attributes of a face once and run it for every given instance
+void Pipeline::processInstancedTriangle(
+    const FrameBuffer & frame_buffer, const Scene & scene, const Shader * shader,
+    const InstancedEntity * entity, const TriangleMesh * mesh, size_t fidx,
+    const InstanceDraw * draws, const size_t * draw_indices, size_t draw_count
+) {
+    // the matrices are those of each instance, set below
+    vdata triangle[3];
+    if (mesh->isPacked())
+    {
+        const vdata packed[3] = {
+            PACKED_VDATA(fidx, 0, mat4::IDENTITY, mat4::IDENTITY, mat3::IDENTITY),
+            PACKED_VDATA(fidx, 1, mat4::IDENTITY, mat4::IDENTITY, mat3::IDENTITY),
+            PACKED_VDATA(fidx, 2, mat4::IDENTITY, mat4::IDENTITY, mat3::IDENTITY)
+        };
+        triangle[0] = packed[0];
+        triangle[1] = packed[1];
+        triangle[2] = packed[2];
+    }
+    else if (mesh->isWelded())
+    {
+        const vdata welded[3] = {
+            WELDED_VDATA(fidx, 0, mat4::IDENTITY, mat4::IDENTITY, mat3::IDENTITY),
+            WELDED_VDATA(fidx, 1, mat4::IDENTITY, mat4::IDENTITY, mat3::IDENTITY),
+            WELDED_VDATA(fidx, 2, mat4::IDENTITY, mat4::IDENTITY, mat3::IDENTITY)
+        };
+        triangle[0] = welded[0];
+        triangle[1] = welded[1];
+        triangle[2] = welded[2];
+    }
+    else
+    {
+        const vdata indexed[3] = {
+            TRIANGLE_VDATA(fidx, 0, mat4::IDENTITY, mat4::IDENTITY, mat3::IDENTITY),
+            TRIANGLE_VDATA(fidx, 1, mat4::IDENTITY, mat4::IDENTITY, mat3::IDENTITY),
+            TRIANGLE_VDATA(fidx, 2, mat4::IDENTITY, mat4::IDENTITY, mat3::IDENTITY)
+        };
+        triangle[0] = indexed[0];
+        triangle[1] = indexed[1];
+        triangle[2] = indexed[2];
+    }
+    const vec3 triangle_normal = TRIANGLE_TRIANGLE_NORMAL(fidx);
 
-                        outsideTest(v0, v1, v2, pos, &w0, &w1, &w2);
-                    } else {
-                        if (outsideTest(v0, v1, v2, pos, &w0, &w1, &w2))
-                        {
-                            continue;
-                        }
-                    }
+    for (size_t i = 0; i < draw_count; i++)
+    {
+        const InstanceDraw & draw = draws[draw_indices ? draw_indices[i] : i];
+        const Instance & instance = entity->getInstance(draw.index);
+        for (size_t vidx = 0; vidx < 3; vidx++)
+        {
+            triangle[vidx].model_mat = instance.transform;
+            triangle[vidx].model_inv_transpose = instance.model_inv_transpose;
+            triangle[vidx].mvp_mat = draw.mvp_matrix;
+            triangle[vidx].color = instance.color;
+        }
+        processTriangle(frame_buffer, scene, shader, entity, triangle, triangle_normal);
+    }
+}
 
-                    w0 /= area;
-                    w1 /= area;
-                    w2 /= area;
+/**
+ * Draw every instance of an instanced entity. Instances outside the view
+ * frustum are dropped first, the rest are grouped by their LOD level and each
+ * face of a level is fetched once for all the instances drawing it.
+ */
+void Pipeline::drawInstanced(
+    const FrameBuffer & frame_buffer, const Scene & scene, const Shader * shader,
+    const InstancedEntity * entity, const mat4 & view_proj_matrix
+) {
+    const TriangleMesh *mesh = entity->getTriangleMesh();
+    const size_t instance_count = entity->instanceCount();
+    if (mesh == nullptr || instance_count == 0) return;
+
+    const Camera & camera = scene.getCamera();
+    const Frustum frustum(view_proj_matrix);
+    const bool cluster_culling = Singleton<Global>::get().cluster_culling;
+    const bool backface_culling = Singleton<Global>::get().backface_culling &&
+                                  !Singleton<Global>::get().wireframe_mode;
+
+    // Instance Culling
+    FrameArena & frame_arena = Singleton<FrameArena>::get();
+    bool *visible = frame_arena.local().allocateArray<bool>(instance_count);
+    InstanceDraw *draws = frame_arena.local().allocateArray<InstanceDraw>(instance_count);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (size_t iidx = 0; iidx < instance_count; iidx++)
+    {
+        const Instance & instance = entity->getInstance(iidx);
+        const vec3 center = vec3(instance.transform * vec4(mesh->getMeshCenter(), 1.0f));
+        visible[iidx] = frustum.intersectSphere(center, mesh->getBoundingRadius() * instance.scale);
+        if (!visible[iidx]) continue;
+
+        InstanceDraw & draw = draws[iidx];
+        draw.index = iidx;
+        draw.level = entity->selectLODLevel(camera, instance.transform, frame_buffer.getHeight());
+        draw.mvp_matrix = view_proj_matrix * instance.transform;
+        draw.frustum = Frustum(draw.mvp_matrix);
+        draw.view_position = vec3(instance.transform_inv * vec4(camera.getPosition(), 1.0f));
+        draw.cone_culling = backface_culling && mat3(instance.transform).det() > 0.0f;
+    }
+    size_t draw_count = 0;
+    for (size_t iidx = 0; iidx < instance_count; iidx++)
+    {
+        if (visible[iidx]) draws[draw_count++] = draws[iidx];
+    }
+    ::qsort(draws, draw_count, sizeof(InstanceDraw), compareInstanceLevel);
 
+    for (size_t begin = 0, end = 0; begin < draw_count; begin = end)
+    {
+        const size_t level = draws[begin].level;
+        for (end = begin; end < draw_count && draws[end].level == level; end++);
+        const TriangleMesh *lod = mesh->getLOD(level);
+        const InstanceDraw *level_draws = draws + begin;
+        const size_t level_draw_count = end - begin;
 
-                    const float denom = (w0 * v0.position.z + w1 * v1.position.z + w2 * v2.position.z);
-                    pos.z = 1.0f / denom;
-                    if (isnan(pos.z))
+        if (lod->hasMeshlets() && cluster_culling)
+        {
+            const Meshlet *meshlets = lod->getMeshlets();
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+            {
+                // instances drawing a meshlet, from the arena of each thread
+                size_t *indices = frame_arena.local().allocateArray<size_t>(level_draw_count);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+                for (size_t midx = 0; midx < lod->meshletCount(); midx++)
+                {
+                    const Meshlet & meshlet = meshlets[midx];
+                    size_t index_count = 0;
+                    for (size_t didx = 0; didx < level_draw_count; didx++)
                     {
-                        continue;
+                        const InstanceDraw & draw = level_draws[didx];
+                        if (!draw.frustum.intersectSphere(meshlet.center, meshlet.radius)) continue;
+                        if (draw.cone_culling && isMeshletBackfacing(meshlet, draw.view_position)) continue;
+                        indices[index_count++] = didx;
                     }
+                    if (index_count == 0) continue;
 
-                    // pos.w = w0 * v0.position.w + w1 * v1.position.w + w2 * v2.position.w;
-                    const vec3 barycentric = (1.0f / (w0 * v0.position.w + w1 * v1.position.w + w2 * v2.position.w)) * vec3(w0 * v0.position.w, w1 * v1.position.w, w2 * v2.position.w);
-
-                    // Near/Far Plane Clipping
-                    if (pos.z < 0.0f || pos.z > 0.999f)
+                    const size_t face_end = meshlet.face_offset + meshlet.face_count;
+                    for (size_t fidx = meshlet.face_offset; fidx < face_end; fidx++)
                     {
-                        continue;
+                        processInstancedTriangle(frame_buffer, scene, shader, entity, lod, fidx,
+                            level_draws, indices, index_count);
                     }
-
-                    const v2f v(
-                        pos,
-                        mat3( v0.frag_pos.x, v1.frag_pos.x, v2.frag_pos.x,
-                              v0.frag_pos.y, v1.frag_pos.y, v2.frag_pos.y,
-                              v0.frag_pos.z, v1.frag_pos.z, v2.frag_pos.z ) * barycentric,
-                        mat3( v0.normal.x, v1.normal.x, v2.normal.x,
-                              v0.normal.y, v1.normal.y, v2.normal.y,
-                              v0.normal.z, v1.normal.z, v2.normal.z ) * barycentric,
-                        mat3( v0.t_normal.x, v1.t_normal.x, v2.t_normal.x,
-                              v0.t_normal.y, v1.t_normal.y, v2.t_normal.y,
-                              v0.t_normal.z, v1.t_normal.z, v2.t_normal.z ) * barycentric,
-                        vec2( vec3(v0.texcoord.u, v1.texcoord.u, v2.texcoord.u).dot(barycentric),
-                              vec3(v0.texcoord.v, v1.texcoord.v, v2.texcoord.v).dot(barycentric)),
-                        v0.tangent,
-                        v0.bitangent
-                    );
-
-                    pixelShaderBarycentric(frame_buffer, v, shader, entity, scene, mask);
                 }
             }
+        }
+        else
+        {
+#ifdef _OPENMP
+#pragma omp parallel for
 #endif
-
-#ifdef _FLAT_FILL_TRIANGLE_RASTERIZATION_
-            sortVerticesByY(v0, v1, v2); // v0.position.y <= v1.position.y <= v2.position.y
-
-            // Rasterization Stage
-            if (v0.position.y == v1.position.y)
+            for (size_t fidx = 0; fidx < lod->faceCount(); fidx++)
             {
-                rasterizeFlatTriangle(frame_buffer, v0, v1, v2, shader, entity, scene);
+                processInstancedTriangle(frame_buffer, scene, shader, entity, lod, fidx,
+                    level_draws, nullptr, level_draw_count);
             }
-            else if (v1.position.y == v2.position.y)
+        }
+    }
+}
+
+/**
+ * Draw a streamed mesh chunk by chunk. Chunks in the view frustum are made
+ * resident and drawn front to back, then the nearest chunks just outside of
+ * it are prefetched so that they are ready when the camera turns to them.
+ */
+void Pipeline::drawStreaming(
+    const FrameBuffer & frame_buffer, const Scene & scene, const Shader * shader,
+    const StreamingEntity * entity, const mat4 & view_proj_matrix
+) {
+    StreamingMesh *mesh = entity->getStreamingMesh();
+    if (mesh == nullptr || mesh->chunkCount() == 0) return;
+
+    const mat4 model_matrix = entity->getTransform();
+    const mat4 mvp_matrix = view_proj_matrix * model_matrix;
+    const mat4 model_inv = model_matrix.inversed();
+    const mat3 model_inv_transpose = mat3(model_inv.transposed());
+    const Frustum frustum(mvp_matrix);
+    const vec3 view_position = vec3(model_inv * vec4(scene.getCamera().getPosition(), 1.0f));
+    if (!frustum.intersectSphere(mesh->getMeshCenter(), mesh->getBoundingRadius() * STREAM_PREFETCH_SCALE)) return;
+
+    // Chunk Culling
+    const size_t chunk_count = mesh->chunkCount();
+    LinearArena & arena = Singleton<FrameArena>::get().local();
+    UINT32 *keys = arena.allocateArray<UINT32>(chunk_count * 2);
+    size_t *chunks = arena.allocateArray<size_t>(chunk_count * 2);
+    UINT32 *prefetch_keys = keys + chunk_count;
+    size_t *prefetch_chunks = chunks + chunk_count;
+    size_t visible_count = 0;
+    size_t prefetch_count = 0;
+    for (size_t cidx = 0; cidx < chunk_count; cidx++)
+    {
+        const vec3 center = mesh->getChunkCenter(cidx);
+        const float radius = mesh->getChunkRadius(cidx);
+        const UINT32 key = floatToRadixKey((center - view_position).length() - radius);
+        if (frustum.intersectSphere(center, radius))
+        {
+            keys[visible_count] = key;
+            chunks[visible_count++] = cidx;
+        }
+        else if (!mesh->isResident(cidx) && frustum.intersectSphere(center, radius * STREAM_PREFETCH_SCALE))
+        {
+            prefetch_keys[prefetch_count] = key;
+            prefetch_chunks[prefetch_count++] = cidx;
+        }
+    }
+    radixSort(keys, chunks, visible_count, &arena);
+    radixSort(prefetch_keys, prefetch_chunks, prefetch_count, &arena);
+
+    mesh->beginFrame();
+    for (size_t i = 0; i < visible_count; i++)
+    {
+        const TriangleMesh *chunk = mesh->acquire(chunks[i]);
+        if (chunk == nullptr) continue;
+        drawMesh(frame_buffer, scene, shader, entity, chunk, model_matrix, mvp_matrix, model_inv, model_inv_transpose);
+    }
+    for (size_t i = 0; i < prefetch_count && i < STREAM_PREFETCH_MAX; i++)
+    {
+        if (!mesh->prefetch(prefetch_chunks[i])) break;
+    }
+}
+
+void Pipeline::processTriangle(
+    const FrameBuffer & frame_buffer, const Scene & scene, const Shader * shader,
+    const Entity * entity, const TriangleMesh * mesh, size_t fidx,
+    const mat4 & model_matrix, const mat4 & mvp_matrix, const mat3 & model_inv_transpose
+) {
+#if 0
+    vdata vd0 = TRIANGLE_VDATA(fidx, 0, model_matrix, mvp_matrix, model_inv_transpose);
+    vdata vd1 = TRIANGLE_VDATA(fidx, 1, model_matrix, mvp_matrix, model_inv_transpose);
+    vdata vd2 = TRIANGLE_VDATA(fidx, 2, model_matrix, mvp_matrix, model_inv_transpose);
+    vd0.position.print();
+    vd1.position.print();
+    vd2.position.print();
+    printf("----------------------------------------------\n");
+#endif
+    if (mesh->isPacked())
+    {
+        // decoded from the compact buffers
+        const vdata triangle[3] = {
+            PACKED_VDATA(fidx, 0, model_matrix, mvp_matrix, model_inv_transpose),
+            PACKED_VDATA(fidx, 1, model_matrix, mvp_matrix, model_inv_transpose),
+            PACKED_VDATA(fidx, 2, model_matrix, mvp_matrix, model_inv_transpose)
+        };
+        processTriangle(frame_buffer, scene, shader, entity, triangle, TRIANGLE_TRIANGLE_NORMAL(fidx));
+        return;
+    }
+    if (mesh->isWelded())
+    {
+        // one index and one contiguous read per vertex
+        const vdata triangle[3] = {
+            WELDED_VDATA(fidx, 0, model_matrix, mvp_matrix, model_inv_transpose),
+            WELDED_VDATA(fidx, 1, model_matrix, mvp_matrix, model_inv_transpose),
+            WELDED_VDATA(fidx, 2, model_matrix, mvp_matrix, model_inv_transpose)
+        };
+        processTriangle(frame_buffer, scene, shader, entity, triangle, TRIANGLE_TRIANGLE_NORMAL(fidx));
+        return;
+    }
+    const vdata triangle[3] = {
+        TRIANGLE_VDATA(fidx, 0, model_matrix, mvp_matrix, model_inv_transpose),
+        TRIANGLE_VDATA(fidx, 1, model_matrix, mvp_matrix, model_inv_transpose),
+        TRIANGLE_VDATA(fidx, 2, model_matrix, mvp_matrix, model_inv_transpose)
+    };
+    processTriangle(frame_buffer, scene, shader, entity, triangle, TRIANGLE_TRIANGLE_NORMAL(fidx));
+}
+
+void Pipeline::processTriangle(
+    const FrameBuffer & frame_buffer, const Scene & scene, const Shader * shader,
+    const Entity * entity, const vdata * triangle, const vec3 & triangle_normal
+) {
+    // Assembly Stage
+    v2f v0 = shader->vert(triangle[0], entity, scene);
+    v2f v1 = shader->vert(triangle[1], entity, scene);
+    v2f v2 = shader->vert(triangle[2], entity, scene);
+#if 0
+    v0.position.print();
+    v1.position.print();
+    v2.position.print();
+    printf("----------------------------------------------\n");
+#endif
+    v0.t_normal = triangle[0].model_inv_transpose * triangle_normal;
+    v1.t_normal = triangle[1].model_inv_transpose * triangle_normal;
+    v2.t_normal = triangle[2].model_inv_transpose * triangle_normal;
+
+    // Perspective Division
+    PERSPECTIVE_DIVIDE(v0.position);
+    PERSPECTIVE_DIVIDE(v1.position);
+    PERSPECTIVE_DIVIDE(v2.position);
+    
+    // Triangle Screen Clipping
+    if ((v0.position.x < -1.0f && v1.position.x < -1.0f && v2.position.x < -1.0f) ||
+        (v0.position.x >  1.0f && v1.position.x >  1.0f && v2.position.x >  1.0f) ||
+        (v0.position.y < -1.0f && v1.position.y < -1.0f && v2.position.y < -1.0f) ||
+        (v0.position.y >  1.0f && v1.position.y >  1.0f && v2.position.y >  1.0f) ||
+        (v0.position.z <  0.0f && v1.position.z <  0.0f && v2.position.z <  0.0f) || // Near/Far Plane Clipping
+        (v0.position.z >  1.0f && v1.position.z >  1.0f && v2.position.z >  1.0f))
+    {
+        return;
+    }
+
+    if (Singleton<Global>::get().backface_culling && !Singleton<Global>::get().wireframe_mode) { // Back-face Culling
+        vec3 u = vec3(v1.position - v0.position);
+        vec3 v = vec3(v2.position - v0.position);
+        vec3 face_normal = u.cross(v);
+
+        if (face_normal.z < 0.0f)
+        {
+            return;
+        }
+    }
+
+#ifdef _BARYCENTRIC_TRIANGLE_RASTERIZATION_0_
+    v0.position.x = SCREEN_MAPPING_X(v0.position.x, frame_buffer);
+    v1.position.x = SCREEN_MAPPING_X(v1.position.x, frame_buffer);
+    v2.position.x = SCREEN_MAPPING_X(v2.position.x, frame_buffer);
+    v0.position.y = SCREEN_MAPPING_Y(v0.position.y, frame_buffer);
+    v1.position.y = SCREEN_MAPPING_Y(v1.position.y, frame_buffer);
+    v2.position.y = SCREEN_MAPPING_Y(v2.position.y, frame_buffer);
+
+    // Preconpute Affine transform for barycentric determinant computation
+    // reference : https://stackoverflow.com/questions/24441631/how-exactly-does-opengl-do-perspectively-correct-linear-interpolation
+    const float denom = 1.0f / ((v0.position.x - v2.position.x) * (v1.position.y - v0.position.y) - (v0.position.x - v1.position.x) * (v2.position.y - v0.position.y));
+    const vec3 barycentric_d0 = denom * vec3(
+        v1.position.y - v2.position.y, v2.position.y - v0.position.y, v0.position.y - v1.position.y
+    );
+    const vec3 barycentric_d1 = denom * vec3(
+        v2.position.x - v1.position.x, v0.position.x - v2.position.x, v1.position.x - v0.position.x
+    );
+    const vec3 barycentric_0 = denom * vec3(
+        v1.position.x * v2.position.y - v2.position.x * v1.position.y,
+        v2.position.x * v0.position.y - v0.position.x * v2.position.y,
+        v0.position.x * v1.position.y - v1.position.x * v0.position.y
+    );
+    
+    // AABB Bounding Box of Triangle
+    long x_min = min(v0.position.x, min(v1.position.x, v2.position.x));
+    long x_max = max(v0.position.x, max(v1.position.x, v2.position.x));
+    long y_min = min(v0.position.y, min(v1.position.y, v2.position.y));
+    long y_max = max(v0.position.y, max(v1.position.y, v2.position.y));
+
+    for (long x = x_min; x < x_max; x++)
+    {
+        for (long y = y_min; y < y_max; y++)
+        {
+            vec4 pos(DTOF(x), DTOF(frame_buffer.getHeight() - y), 0.0f, 0.0f);
+
+            const vec3 barycentric = pos.x * barycentric_d0 + pos.y * barycentric_d1 + barycentric_0;
+            if (barycentric.x < 0.0f || barycentric.y < 0.0f || barycentric.z < 0.0f)
             {
-                rasterizeFlatTriangle(frame_buffer, v1, v2, v0, shader, entity, scene);
+                continue;
             }
-            else
+
+            pos.z = barycentric.dot(vec3(v0.position.z, v1.position.z, v2.position.z));
+            pos.w = barycentric.dot(vec3(v0.position.w, v1.position.w, v2.position.w));
+            
+            // Near/Far Plane Clipping
+            if (pos.z < 0.0f || pos.z > 1.0f)
             {
-                float alpha = (v1.position.y - v0.position.y) / (v2.position.y - v0.position.y);
-                v2f v3 = V2F_LERP_LINEAR(v0, v2, alpha);
-                rasterizeFlatTriangle(frame_buffer, v1, v3, v0, shader, entity, scene);
-                rasterizeFlatTriangle(frame_buffer, v1, v3, v2, shader, entity, scene);
+                continue;
             }
-#endif
+
+            const vec3 perspective = (1.0f / pos.w) * barycentric.multiply(vec3(v0.position.w, v1.position.w, v2.position.w));
+
+            v2f v = v2f(
+                pos,
+                mat3( v0.frag_pos.x, v1.frag_pos.x, v2.frag_pos.x,
+                      v0.frag_pos.y, v1.frag_pos.y, v2.frag_pos.y,
+                      v0.frag_pos.z, v1.frag_pos.z, v2.frag_pos.z ) * perspective,
+                mat3( v0.normal.x, v1.normal.x, v2.normal.x,
+                      v0.normal.y, v1.normal.y, v2.normal.y,
+                      v0.normal.z, v1.normal.z, v2.normal.z ) * perspective,
+                mat3( v0.t_normal.x, v1.t_normal.x, v2.t_normal.x,
+                      v0.t_normal.y, v1.t_normal.y, v2.t_normal.y,
+                      v0.t_normal.z, v1.t_normal.z, v2.t_normal.z ) * perspective,
+                vec2( vec3(v0.texcoord.u, v1.texcoord.u, v2.texcoord.u).dot(perspective),
+                      vec3(v0.texcoord.v, v1.texcoord.v, v2.texcoord.v).dot(perspective) )
+            );
+
+            pixelShaderBarycentric(frame_buffer, v, shader, entity, scene);
         }
     }
+#endif
 
-#if 0
-    if (scene.getEnvmap())
+#ifdef _BARYCENTRIC_TRIANGLE_RASTERIZATION_1_
+    v0.position.x = SCREEN_MAPPING_X(v0.position.x, frame_buffer);
+    v1.position.x = SCREEN_MAPPING_X(v1.position.x, frame_buffer);
+    v2.position.x = SCREEN_MAPPING_X(v2.position.x, frame_buffer);
+    v0.position.y = SCREEN_MAPPING_Y(v0.position.y, frame_buffer);
+    v1.position.y = SCREEN_MAPPING_Y(v1.position.y, frame_buffer);
+    v2.position.y = SCREEN_MAPPING_Y(v2.position.y, frame_buffer);
+
+    v0.position.z = 1.0f / v0.position.z;
+    v1.position.z = 1.0f / v1.position.z;
+    v2.position.z = 1.0f / v2.position.z;
+
+    if (Singleton<Global>::get().wireframe_mode)
     {
-        float x_center = (float)(frame_buffer.getWidth() - 1) / 2.0f;
-        float y_center = (float)(frame_buffer.getHeight() - 1) / 2.0f;
-        for (long x = 0; x < frame_buffer.getWidth(); x++)
+        drawLinePipeline(frame_buffer, v0, v1, shader, entity, scene);
+        drawLinePipeline(frame_buffer, v1, v2, shader, entity, scene);
+        drawLinePipeline(frame_buffer, v2, v0, shader, entity, scene);
+
+        return;
+    }
+
+    // AABB Bounding Box of Triangle
+    const long x_min = max(min(v0.position.x, min(v1.position.x, v2.position.x)), 0);
+    const long x_max = min(max(v0.position.x, max(v1.position.x, v2.position.x)), frame_buffer.getWidth() - 1);
+    const long y_min = max(min(v0.position.y, min(v1.position.y, v2.position.y)), 0);
+    const long y_max = min(max(v0.position.y, max(v1.position.y, v2.position.y)), frame_buffer.getHeight() - 1);
+
+    const float area = edgeFunction(v0.position, v1.position, v2.position);
+    const bool msaa = Singleton<Global>::get().sample_option > LUGL_SAMPLE_DEFAULT;
+
+    // Pixels are shaded in 2x2 quads, the texture coordinates of all four
+    // pixels give the derivatives that pick the mip level of the textures.
+    // Pixels of a quad outside the triangle only take part in the derivatives.
+    // The quad is depth tested first and then shaded at once by fragQuad, so
+    // that shaders sample their textures for the 4 pixels together.
+    for (long quad_x = x_min; quad_x < x_max; quad_x += 2)
+    {
+        for (long quad_y = y_min; quad_y < y_max; quad_y += 2)
         {
-            for (long y = 0; y < frame_buffer.getHeight(); y++)
+            vec4 pos[4];
+            float w0[4], w1[4], w2[4];
+            unsigned short mask[4];
+            bool covered[4];
+            bool quad_covered = false;
+            for (long q = 0; q < 4; q++)
             {
-                long depth_buffer_pos = frame_buffer.getSize() - frame_buffer.getWidth() * (y + 1) + x;
-                if (depth_test && frame_buffer.depthBuffer()[depth_buffer_pos] < 1.0f)
+                const long x = quad_x + (q & 1);
+                const long y = quad_y + (q >> 1);
+                pos[q] = vec4(DTOF(x), DTOF(y), 1.0f, 0.0f);
+
+                bool outside = outsideTest(v0, v1, v2, pos[q], &w0[q], &w1[q], &w2[q]);
+                mask[q] = 0;
+                if (msaa)
+                {
+                    getMSAAMask(&mask[q], v0, v1, v2, pos[q]);
+                    outside = mask[q] == 0;
+                }
+                covered[q] = !outside && x < x_max && y < y_max;
+                quad_covered |= covered[q];
+
+                w0[q] /= area;
+                w1[q] /= area;
+                w2[q] /= area;
+            }
+            if (!quad_covered) continue;
+
+            vec3 barycentric[4];
+            vec2 texcoord[4];
+            for (long q = 0; q < 4; q++)
+            {
+                // pos.w = w0 * v0.position.w + w1 * v1.position.w + w2 * v2.position.w;
+                barycentric[q] = (1.0f / (w0[q] * v0.position.w + w1[q] * v1.position.w + w2[q] * v2.position.w)) *
+                    vec3(w0[q] * v0.position.w, w1[q] * v1.position.w, w2[q] * v2.position.w);
+                texcoord[q] = vec2( vec3(v0.texcoord.u, v1.texcoord.u, v2.texcoord.u).dot(barycentric[q]),
+                                    vec3(v0.texcoord.v, v1.texcoord.v, v2.texcoord.v).dot(barycentric[q]) );
+            }
+            const vec2 texcoord_dx = texcoord[1] - texcoord[0];
+            const vec2 texcoord_dy = texcoord[2] - texcoord[0];
+
+            v2f v[4];
+            bool active[4];
+            bool quad_active = false;
+            for (long q = 0; q < 4; q++)
+            {
+                active[q] = false;
+                v[q].texcoord = texcoord[q];
+                v[q].texcoord_dx = texcoord_dx;
+                v[q].texcoord_dy = texcoord_dy;
+                if (!covered[q]) continue;
+
+                const float denom = (w0[q] * v0.position.z + w1[q] * v1.position.z + w2[q] * v2.position.z);
+                pos[q].z = 1.0f / denom;
+                if (isnan(pos[q].z))
                 {
                     continue;
                 }
 
-                vec2 sh = vierDir2Spherical(scene.getCamera().getForward());
+                // Near/Far Plane Clipping
+                if (pos[q].z < 0.0f || pos[q].z > 0.999f)
+                {
+                    continue;
+                }
 
-                rgb color = scene.getEnvmap()->getPixel(
-                    sh.theta + (float)(y - y_center) / (frame_buffer.getHeight() - 1) * scene.getCamera().getFOV(),
-                    sh.phi + (float)(x - x_center) / (frame_buffer.getWidth() - 1) * scene.getCamera().getFOV()
+                v[q] = v2f(
+                    pos[q],
+                    mat3( v0.frag_pos.x, v1.frag_pos.x, v2.frag_pos.x,
+                          v0.frag_pos.y, v1.frag_pos.y, v2.frag_pos.y,
+                          v0.frag_pos.z, v1.frag_pos.z, v2.frag_pos.z ) * barycentric[q],
+                    mat3( v0.normal.x, v1.normal.x, v2.normal.x,
+                          v0.normal.y, v1.normal.y, v2.normal.y,
+                          v0.normal.z, v1.normal.z, v2.normal.z ) * barycentric[q],
+                    mat3( v0.t_normal.x, v1.t_normal.x, v2.t_normal.x,
+                          v0.t_normal.y, v1.t_normal.y, v2.t_normal.y,
+                          v0.t_normal.z, v1.t_normal.z, v2.t_normal.z ) * barycentric[q],
+                    texcoord[q],
+                    v0.tangent,
+                    v0.bitangent
                 );
+                v[q].texcoord_dx = texcoord_dx;
+                v[q].texcoord_dy = texcoord_dy;
 
-                byte_t *color_buffer = frame_buffer.colorBuffer();
-                long color_buffer_pos = (frame_buffer.getSize() - frame_buffer.getWidth() * (y + 1) + x) * 3;
-                color_buffer[color_buffer_pos++] = FLOAT2BYTECOLOR(color.r);
-                color_buffer[color_buffer_pos++] = FLOAT2BYTECOLOR(color.g);
-                color_buffer[color_buffer_pos] = FLOAT2BYTECOLOR(color.b);
+                active[q] = depthTestBarycentric(frame_buffer, v[q], mask[q]);
+                quad_active |= active[q];
+            }
+            if (!quad_active) continue;
+
+            vec4 color[4];
+            shader->fragQuad(v, active, entity, scene, color);
+            for (long q = 0; q < 4; q++)
+            {
+                if (active[q]) writeBarycentric(frame_buffer, v[q], color[q], mask[q]);
             }
         }
     }
 #endif
+
+#ifdef _FLAT_FILL_TRIANGLE_RASTERIZATION_
+    sortVerticesByY(v0, v1, v2); // v0.position.y <= v1.position.y <= v2.position.y
+
+    // Rasterization Stage
+    if (v0.position.y == v1.position.y)
+    {
+        rasterizeFlatTriangle(frame_buffer, v0, v1, v2, shader, entity, scene);
+    }
+    else if (v1.position.y == v2.position.y)
+    {
+        rasterizeFlatTriangle(frame_buffer, v1, v2, v0, shader, entity, scene);
+    }
+    else
+    {
+        float alpha = (v1.position.y - v0.position.y) / (v2.position.y - v0.position.y);
+        v2f v3 = V2F_LERP_LINEAR(v0, v2, alpha);
+        rasterizeFlatTriangle(frame_buffer, v1, v3, v0, shader, entity, scene);
+        rasterizeFlatTriangle(frame_buffer, v1, v3, v2, shader, entity, scene);
+    }
+#endif
 }
 
 void Pipeline::drawLinePipeline(
@@ -508,12 +1082,22 @@ void Pipeline::pixelShaderBarycentric(
     const FrameBuffer & frame_buffer, const v2f & v, const Shader * shader,
     const Entity * entity, const Scene & scene, unsigned short mask
 ) {
+    if (!depthTestBarycentric(frame_buffer, v, mask)) return;
+
+    // Fragment Shader 
+    rgba color = shader->frag(v, entity, scene);
+    writeBarycentric(frame_buffer, v, color, mask);
+}
+
+// returns false if the pixel is hidden, clears the MSAA samples of mask that are
+bool Pipeline::depthTestBarycentric(const FrameBuffer & frame_buffer, const v2f & v, unsigned short & mask)
+{
     // Depth Test
     long x = v.position.x;
     long y = v.position.y;
     if (x < 0 || x >= frame_buffer.getWidth() || y < 0 || y >= frame_buffer.getHeight())
     {
-        return;
+        return false;
     }
 
     if (Singleton<Global>::get().sample_option > LUGL_SAMPLE_DEFAULT)
@@ -537,9 +1121,28 @@ void Pipeline::pixelShaderBarycentric(
                 }
             }
         }
-        if ((mask & full_mask) == 0) return;
+        return (mask & full_mask) != 0;
+    }
 
-        rgba color = shader->frag(v, entity, scene);
+    long depth_buffer_pos = frame_buffer.getSize() - frame_buffer.getWidth() * (y + 1) + x;
+    return !(Singleton<Global>::get().depth_test && (frame_buffer.depthBuffer()[depth_buffer_pos] <= v.position.z));
+}
+
+// writes the color and depth of a pixel that passed depthTestBarycentric
+void Pipeline::writeBarycentric(const FrameBuffer & frame_buffer, const v2f & v, const vec4 & color, unsigned short mask)
+{
+    long x = v.position.x;
+    long y = v.position.y;
+
+    if (Singleton<Global>::get().sample_option > LUGL_SAMPLE_DEFAULT)
+    {
+        int sample_count = 0;
+        switch (Singleton<Global>::get().sample_option)
+        {
+            case LUGL_SAMPLE_2xMSAA: sample_count = 2; break;
+            case LUGL_SAMPLE_4xMSAA: sample_count = 4; break;
+            case LUGL_SAMPLE_8xMSAA: sample_count = 8; break;
+        }
 
         long rgb_sum[3] = { 0, 0, 0 };
         float depth_sum = 0.0f;
@@ -575,18 +1178,10 @@ void Pipeline::pixelShaderBarycentric(
     }
     else
     {
-        long depth_buffer_pos = frame_buffer.getSize() - frame_buffer.getWidth() * (y + 1) + x;
-        if (Singleton<Global>::get().depth_test && (frame_buffer.depthBuffer()[depth_buffer_pos] <= v.position.z))
-        {
-            return;
-        }
-
         // TODO: here we ignore alpha channel
+        long depth_buffer_pos = frame_buffer.getSize() - frame_buffer.getWidth() * (y + 1) + x;
         frame_buffer.depthBuffer()[depth_buffer_pos] = v.position.z;
 
-        // Fragment Shader 
-        rgba color = shader->frag(v, entity, scene);
-
         byte_t *color_buffer = frame_buffer.colorBuffer();
         long color_buffer_pos = (frame_buffer.getSize() - frame_buffer.getWidth() * (y + 1) + x) * 3;
         color_buffer[color_buffer_pos++] = FLOAT2BYTECOLOR(color.r);
@@ -11,6 +11,7 @@
 #include "rasterizer.hpp"
 #include "entity.hpp"
 #include "scene.hpp"
+#include "command.hpp"
 
 namespace LuGL
 {
@@ -31,15 +32,39 @@ namespace LuGL
 #define TRIANGLE_TANGENT(fidx) (mesh->hasTangents()?mesh->getTangents()[fidx]:vec3::ZERO)
 #define TRIANGLE_BITANGENT(fidx) (mesh->hasTangents()?mesh->getBitangents()[fidx]:vec3::ZERO)
 
-#define TRIANGLE_VDATA(fidx,vidx) { .model_mat = entity->getTransform(),       \
-                                    .model_inv_transpose = model_inv_transpose,\
-                                    .mvp_mat = mvp_matrix,                     \
-                                    .position = TRIANGLE_VERTEX(fidx, vidx),   \
-                                    .normal = TRIANGLE_NORMAL(fidx, vidx),     \
-                                    .texcoord = TRIANGLE_TEXCOORD(fidx, vidx), \
-                                    .color = vec4::ZERO,                       \
-                                    .tangent = TRIANGLE_TANGENT(fidx),         \
-                                    .bitangent = TRIANGLE_BITANGENT(fidx) }
+#define TRIANGLE_VDATA(fidx,vidx,model,mvp,inv_t) { .model_mat = model,                        \
+                                                    .model_inv_transpose = inv_t,              \
+                                                    .mvp_mat = mvp,                            \
+                                                    .position = TRIANGLE_VERTEX(fidx, vidx),   \
+                                                    .normal = TRIANGLE_NORMAL(fidx, vidx),     \
+                                                    .texcoord = TRIANGLE_TEXCOORD(fidx, vidx), \
+                                                    .color = vec4::ZERO,                       \
+                                                    .tangent = TRIANGLE_TANGENT(fidx),         \
+                                                    .bitangent = TRIANGLE_BITANGENT(fidx) }
+
+#define WELDED_VERTEX(fidx,vidx) (mesh->getWeldedVertices()[mesh->getIndices()[(fidx) * 3 + (vidx)]])
+
+#define WELDED_VDATA(fidx,vidx,model,mvp,inv_t) { .model_mat = model,                             \
+                                                  .model_inv_transpose = inv_t,                   \
+                                                  .mvp_mat = mvp,                                 \
+                                                  .position = WELDED_VERTEX(fidx, vidx).position, \
+                                                  .normal = WELDED_VERTEX(fidx, vidx).normal,     \
+                                                  .texcoord = WELDED_VERTEX(fidx, vidx).texcoord, \
+                                                  .color = vec4::ZERO,                            \
+                                                  .tangent = TRIANGLE_TANGENT(fidx),              \
+                                                  .bitangent = TRIANGLE_BITANGENT(fidx) }
+
+#define PACKED_VERTEX(fidx,vidx) (mesh->getPackedVertices()[mesh->packedIndex(fidx, vidx)])
+
+#define PACKED_VDATA(fidx,vidx,model,mvp,inv_t) { .model_mat = model,                                          \
+                                                  .model_inv_transpose = inv_t,                                \
+                                                  .mvp_mat = mvp,                                              \
+                                                  .position = mesh->unpackPosition(PACKED_VERTEX(fidx, vidx)), \
+                                                  .normal = mesh->unpackNormal(PACKED_VERTEX(fidx, vidx)),     \
+                                                  .texcoord = mesh->unpackTexcoord(PACKED_VERTEX(fidx, vidx)), \
+                                                  .color = vec4::ZERO,                                         \
+                                                  .tangent = mesh->unpackTangent(fidx),                        \
+                                                  .bitangent = mesh->unpackBitangent(fidx) }
 
 #define SCREEN_MAPPING_X(x,frame_buffer) FTOD((x * 0.5f + 0.5f) * frame_buffer.getWidth())
 #define SCREEN_MAPPING_Y(y,frame_buffer) FTOD((y * 0.5f + 0.5f) * frame_buffer.getHeight())
@@ -51,16 +76,56 @@ namespace LuGL
                                           vec3::lerp(v0.tangent,  v1.tangent,  alpha), \
                                           vec3::lerp(v0.bitangent, v1.bitangent, alpha))
 
+struct InstanceDraw;
+
 class Pipeline
 {
 public:
     static void draw(const FrameBuffer & frame_buffer, const Scene & scene, const Shader * shader);
+    static void submit(const FrameBuffer & frame_buffer, const Scene & scene, CommandBuffer & commands, bool clear_depth = true);
 
 private:
+    static void drawEntity(
+        const FrameBuffer & frame_buffer, const Scene & scene, const Shader * shader,
+        const Entity * entity, const mat4 & model_matrix, const mat4 & view_proj_matrix
+    );
+    static void drawPlaceholder(
+        const FrameBuffer & frame_buffer, const Scene & scene, const Shader * shader,
+        const Entity * entity, const mat4 & model_matrix, const mat4 & view_proj_matrix
+    );
+    static void drawMesh(
+        const FrameBuffer & frame_buffer, const Scene & scene, const Shader * shader,
+        const Entity * entity, const TriangleMesh * mesh, const mat4 & model_matrix,
+        const mat4 & mvp_matrix, const mat4 & model_inv, const mat3 & model_inv_transpose
+    );
+    static void drawInstanced(
+        const FrameBuffer & frame_buffer, const Scene & scene, const Shader * shader,
+        const InstancedEntity * entity, const mat4 & view_proj_matrix
+    );
+    static void drawStreaming(
+        const FrameBuffer & frame_buffer, const Scene & scene, const Shader * shader,
+        const StreamingEntity * entity, const mat4 & view_proj_matrix
+    );
+    static void processTriangle(
+        const FrameBuffer & frame_buffer, const Scene & scene, const Shader * shader,
+        const Entity * entity, const TriangleMesh * mesh, size_t fidx,
+        const mat4 & model_matrix, const mat4 & mvp_matrix, const mat3 & model_inv_transpose
+    );
+    static void processTriangle(
+        const FrameBuffer & frame_buffer, const Scene & scene, const Shader * shader,
+        const Entity * entity, const vdata * triangle, const vec3 & triangle_normal
+    );
+    static void processInstancedTriangle(
+        const FrameBuffer & frame_buffer, const Scene & scene, const Shader * shader,
+        const InstancedEntity * entity, const TriangleMesh * mesh, size_t fidx,
+        const InstanceDraw * draws, const size_t * draw_indices, size_t draw_count
+    );
     static void pixelShaderBarycentric(
         const FrameBuffer & frame_buffer, const v2f & v, const Shader * shader,
         const Entity * entity, const Scene & scene, unsigned short mask = 0
     );
+    static bool depthTestBarycentric(const FrameBuffer & frame_buffer, const v2f & v, unsigned short & mask);
+    static void writeBarycentric(const FrameBuffer & frame_buffer, const v2f & v, const vec4 & color, unsigned short mask);
     static void pixelShaderWireframe(
         const FrameBuffer & frame_buffer, long x, long y, const Shader * shader,
         const Entity * entity, const Scene & scene
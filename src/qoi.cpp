@@ -0,0 +1,229 @@
+#include "qoi.hpp"
+
+using namespace LuGL;
+
+#define QOI_HASH(r, g, b, a) (((r) * 3 + (g) * 5 + (b) * 7 + (a) * 11) & 63)
+
+static UINT32 readBigEndian(const byte_t * data)
+{
+    return ((UINT32)data[0] << 24) | ((UINT32)data[1] << 16) | ((UINT32)data[2] << 8) | (UINT32)data[3];
+}
+
+static void writeBigEndian(byte_t * data, UINT32 value)
+{
+    data[0] = (byte_t)(value >> 24);
+    data[1] = (byte_t)(value >> 16);
+    data[2] = (byte_t)(value >> 8);
+    data[3] = (byte_t)value;
+}
+
+bool QOICodec::isStream(const byte_t * data, size_t size)
+{
+    return size >= QOI_HEADER_SIZE + QOI_PADDING_SIZE && readBigEndian(data) == QOI_MAGIC;
+}
+
+// encode rows [row_begin, row_end) counted from the top, returns the bytes written
+size_t QOICodec::encodeRows(const byte_t * pixels, long width, long height, bool top_down, long row_begin, long row_end, byte_t * stream)
+{
+    const size_t row_size = width * 3;
+    // the decoder holds the last pixel of the previous chunk, and a color index the chunk can not rely on
+    UINT32 index[64];
+    UINT64 index_valid = 0;
+    byte_t r = 0, g = 0, b = 0;
+    if (row_begin > 0)
+    {
+        const long row = top_down ? row_begin - 1 : height - row_begin;
+        const byte_t *last = pixels + row * row_size + row_size - 3;
+        r = last[2];
+        g = last[1];
+        b = last[0];
+    }
+
+    byte_t *ptr = stream;
+    long run = 0;
+    for (long y = row_begin; y < row_end; y++)
+    {
+        const byte_t *src = pixels + (top_down ? y : height - 1 - y) * row_size;
+        for (long x = 0; x < width; x++, src += 3)
+        {
+            if (src[2] == r && src[1] == g && src[0] == b)
+            {
+                if (++run == 62)
+                {
+                    *ptr++ = QOI_OP_RUN | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0)
+            {
+                *ptr++ = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+
+            const signed char vr = (signed char)(src[2] - r);
+            const signed char vg = (signed char)(src[1] - g);
+            const signed char vb = (signed char)(src[0] - b);
+            r = src[2];
+            g = src[1];
+            b = src[0];
+            const UINT32 color = r | (g << 8) | (b << 16);
+            const long hash = QOI_HASH(r, g, b, 255);
+            if ((index_valid >> hash & 1) && index[hash] == color)
+            {
+                *ptr++ = QOI_OP_INDEX | hash;
+                continue;
+            }
+            index[hash] = color;
+            index_valid |= 1ULL << hash;
+
+            const signed char vg_r = vr - vg;
+            const signed char vg_b = vb - vg;
+            if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+            {
+                *ptr++ = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+            }
+            else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8)
+            {
+                *ptr++ = QOI_OP_LUMA | (vg + 32);
+                *ptr++ = (vg_r + 8) << 4 | (vg_b + 8);
+            }
+            else
+            {
+                *ptr++ = QOI_OP_RGB;
+                *ptr++ = r;
+                *ptr++ = g;
+                *ptr++ = b;
+            }
+        }
+    }
+    if (run > 0) *ptr++ = QOI_OP_RUN | (run - 1);
+    return ptr - stream;
+}
+
+byte_t * QOICodec::encode(const byte_t * pixels, long width, long height, bool top_down, size_t * size)
+{
+    *size = 0;
+    if (width <= 0 || height <= 0 || height > QOI_PIXELS_MAX / width)
+    {
+        printf("QOICodec : image size: %ld * %ld unsupported\n", width, height);
+        return nullptr;
+    }
+
+    // QOI_OP_RGB is the longest op of an opaque pixel
+    const long chunk_rows = max(QOI_CHUNK_PIXELS / width, 1L);
+    const long chunk_count = (height + chunk_rows - 1) / chunk_rows;
+    const size_t chunk_capacity = chunk_rows * width * 4;
+    byte_t *chunks = new byte_t[chunk_capacity * chunk_count];
+    size_t *chunk_offsets = new size_t[chunk_count + 1];
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) if(chunk_count > 1)
+#endif
+    for (long cidx = 0; cidx < chunk_count; cidx++)
+    {
+        const long row_begin = cidx * chunk_rows;
+        const long row_end = min(row_begin + chunk_rows, height);
+        chunk_offsets[cidx + 1] = encodeRows(pixels, width, height, top_down, row_begin, row_end, chunks + cidx * chunk_capacity);
+    }
+    chunk_offsets[0] = QOI_HEADER_SIZE;
+    for (long cidx = 0; cidx < chunk_count; cidx++)
+    {
+        chunk_offsets[cidx + 1] += chunk_offsets[cidx];
+    }
+
+    *size = chunk_offsets[chunk_count] + QOI_PADDING_SIZE;
+    byte_t *stream = new byte_t[*size];
+    writeBigEndian(stream, QOI_MAGIC);
+    writeBigEndian(stream + 4, (UINT32)width);
+    writeBigEndian(stream + 8, (UINT32)height);
+    stream[12] = 3;     // RGB
+    stream[13] = 0;     // sRGB with linear alpha
+#ifdef _OPENMP
+#pragma omp parallel for if(chunk_count > 1)
+#endif
+    for (long cidx = 0; cidx < chunk_count; cidx++)
+    {
+        memcpy(stream + chunk_offsets[cidx], chunks + cidx * chunk_capacity, chunk_offsets[cidx + 1] - chunk_offsets[cidx]);
+    }
+    memset(stream + chunk_offsets[chunk_count], 0, QOI_PADDING_SIZE);
+    stream[*size - 1] = 1;
+
+    delete[] chunks;
+    delete[] chunk_offsets;
+    return stream;
+}
+
+byte_t * QOICodec::decode(const byte_t * data, size_t size, long * width, long * height)
+{
+    *width = 0;
+    *height = 0;
+    if (!isStream(data, size)) return nullptr;
+    const long w = readBigEndian(data + 4);
+    const long h = readBigEndian(data + 8);
+    const byte_t channels = data[12];
+    if (w == 0 || h == 0 || h > QOI_PIXELS_MAX / w || channels < 3 || channels > 4 || data[13] > 1) return nullptr;
+
+    byte_t *pixels = new byte_t[w * h * 3];
+    byte_t index[64][4];
+    memset(index, 0, sizeof(index));
+    byte_t px[4] = { 0, 0, 0, 255 };
+    // ops are at most 5 bytes, reading the last one never goes past the padding
+    const byte_t *ptr = data + QOI_HEADER_SIZE;
+    const byte_t *end = data + size - QOI_PADDING_SIZE;
+    long run = 0;
+    for (long y = 0; y < h; y++)
+    {
+        byte_t *dst = pixels + (h - 1 - y) * w * 3;
+        for (long x = 0; x < w; x++, dst += 3)
+        {
+            if (run > 0)
+            {
+                run--;
+            }
+            else if (ptr < end)
+            {
+                const byte_t b1 = *ptr++;
+                if (b1 == QOI_OP_RGB)
+                {
+                    memcpy(px, ptr, 3);
+                    ptr += 3;
+                }
+                else if (b1 == QOI_OP_RGBA)
+                {
+                    memcpy(px, ptr, 4);
+                    ptr += 4;
+                }
+                else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX)
+                {
+                    memcpy(px, index[b1], 4);
+                }
+                else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF)
+                {
+                    px[0] += ((b1 >> 4) & 0x03) - 2;
+                    px[1] += ((b1 >> 2) & 0x03) - 2;
+                    px[2] += (b1 & 0x03) - 2;
+                }
+                else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA)
+                {
+                    const byte_t b2 = *ptr++;
+                    const int vg = (b1 & 0x3f) - 32;
+                    px[0] += vg - 8 + ((b2 >> 4) & 0x0f);
+                    px[1] += vg;
+                    px[2] += vg - 8 + (b2 & 0x0f);
+                }
+                else
+                {
+                    run = b1 & 0x3f;
+                }
+                memcpy(index[QOI_HASH(px[0], px[1], px[2], px[3])], px, 4);
+            }
+            dst[0] = px[2];
+            dst[1] = px[1];
+            dst[2] = px[0];
+        }
+    }
+
+    *width = w;
+    *height = h;
+    return pixels;
+}
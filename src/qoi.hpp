@@ -0,0 +1,53 @@
+#ifndef __QOI_HPP__
+#define __QOI_HPP__
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "global.hpp"
+
+namespace LuGL
+{
+
+// QOI File Format
+// reference : https://qoiformat.org/qoi-specification.pdf
+
+#define QOI_MAGIC 0x716f6966U       // "qoif", stored big endian
+#define QOI_EXTENSION ".qoi"
+#define QOI_HEADER_SIZE 14L
+#define QOI_PADDING_SIZE 8L         // 7 zero bytes and a byte of 1 end the stream
+#define QOI_PIXELS_MAX 400000000L
+#define QOI_CHUNK_PIXELS (1L << 16) // pixels of the whole rows encoded by one thread
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xc0
+#define QOI_OP_RGB   0xfe
+#define QOI_OP_RGBA  0xff
+#define QOI_MASK_2   0xc0
+
+/**
+ * Lossless QOI codec for 24 bit images, with the pixels in BGR rows from
+ * bottom to top as BMPImage stores them. The encoder splits the image in
+ * chunks of whole rows encoded in parallel. A chunk starts from the last
+ * pixel of the previous chunk and an empty color index, and ends its run,
+ * so the chunks concatenated are a standard QOI stream any decoder reads,
+ * the same for any number of threads.
+ */
+class QOICodec
+{
+private:
+    static size_t encodeRows(const byte_t * pixels, long width, long height, bool top_down, long row_begin, long row_end, byte_t * stream);
+
+public:
+    static bool isStream(const byte_t * data, size_t size);
+    // stream of *size bytes allocated with new[], rows from top to bottom if top_down
+    static byte_t * encode(const byte_t * pixels, long width, long height, bool top_down, size_t * size);
+    // pixels allocated with new[], the alpha of 4 channel streams is dropped, nullptr if the stream is invalid
+    static byte_t * decode(const byte_t * data, size_t size, long * width, long * height);
+};
+
+}
+
+#endif
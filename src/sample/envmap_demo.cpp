@@ -28,11 +28,10 @@ int envmap_demo() {
     Entity ent = Entity(config);
     entity_ptr = &ent;
 
-    ent.getTriangleMesh()->computeTriangleNormals();
-    ent.getTriangleMesh()->computeVertexNormals();
+    // normals and tangents are computed by the pipeline when a shader first needs them
     ent.getTriangleMesh()->printMeshInfo();
 
-    Envmap envmap("assets/envmaps/env01.bmp");
+    Envmap envmap("assets/envmaps/env01.bmp", true);  // SH coefficients are computed while the first frames are drawn
 
     scene.addEntity(&ent);
     // scene.addLight((Light*)&dir_light);
@@ -0,0 +1,43 @@
+#include "sample.hpp"
+#include <chrono>
+
+using namespace LuGL;
+
+static long fileSize(const char* filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (fp == nullptr) return 0;
+    fseek(fp, 0L, SEEK_END);
+    long size = ftell(fp);
+    fclose(fp);
+    return size;
+}
+
+// convert an image between BMP and QOI, the format written follows the extension of output,
+// the written image is read back and compared with the input pixel by pixel,
+// times are wall clock since the QOI encoder runs on all threads
+int image_convert(const char* input, const char* output)
+{
+    typedef std::chrono::steady_clock steady_clock;
+    steady_clock::time_point start = steady_clock::now();
+    BMPImage image(input);
+    if (!image.isLoaded()) return 1;
+    steady_clock::time_point loaded = steady_clock::now();
+    image.writeImage(output);
+    steady_clock::time_point written = steady_clock::now();
+
+    BMPImage reloaded(output);
+    if (!reloaded.isLoaded() ||
+        reloaded.getImageWidth() != image.getImageWidth() ||
+        reloaded.getImageHeight() != image.getImageHeight() ||
+        memcmp(reloaded.getImageBufferConst(), image.getImageBufferConst(), image.getImageWidth() * image.getImageHeight() * 3) != 0)
+    {
+        printf("image_convert : image file: %s differs from %s\n", output, input);
+        return 1;
+    }
+
+    printf("%s -> %s\n", input, output);
+    printf("  read : %8.2f ms, %ld bytes\n", std::chrono::duration<float, std::milli>(loaded - start).count(), fileSize(input));
+    printf(" write : %8.2f ms, %ld bytes\n", std::chrono::duration<float, std::milli>(written - loaded).count(), fileSize(output));
+    return 0;
+}
@@ -85,9 +85,15 @@ int main_demo(const char* model)
     // ent.getMaterial()->diffuse.setBaseColor(base_color);
     // ent.getMaterial()->specular.setBaseColor(base_color);
 
-    ent.getTriangleMesh()->computeTriangleNormals();
-    ent.getTriangleMesh()->computeVertexNormals();
-    ent.getTriangleMesh()->computeTangentVectors();
+    // normals and tangents are computed by the pipeline when a shader first needs them
+    if (!ent.getTriangleMesh()->hasMeshlets()) ent.getTriangleMesh()->buildMeshlets();
+    ent.getTriangleMesh()->buildLODChain();
+    if (!ent.getTriangleMesh()->isMapped())
+    {
+        // mesh caches are written already optimized
+        ent.getTriangleMesh()->optimizeOverdraw();
+        ent.getTriangleMesh()->optimizeVertexFetch();
+    }
     ent.getTriangleMesh()->printMeshInfo();
     // ent.setTransform(mat4::fromAxisAngle(vec3::UNIT_X, -PI / 2));
 
@@ -307,7 +313,7 @@ void keyboardEventCallback(AppWindow *window, KEY_CODE key, bool pressed)
                     BMPImage screenshot_img(frame_buffer.getWidth(), frame_buffer.getHeight());
                     memcpy(screenshot_img.getImageBuffer(), ss_uni_img.getImageBufferConst(), img_size);
                     screenshot_img.setReverseY(true);
-                    screenshot_img.writeImage("screenshot.bmp");
+                    screenshot_img.writeImage("screenshot.qoi");
                 }
                 break;
             default:
@@ -0,0 +1,63 @@
+#include "sample.hpp"
+
+using namespace LuGL;
+
+// convert an OBJ file into a mesh cache next to it, with normals, tangents and meshlets precomputed
+// and the faces reordered for vertex cache reuse and overdraw,
+// or into a streaming mesh split in chunks that are loaded on demand,
+// optionally with the compact vertex buffers only read by the pipeline
+int mesh_convert(const char* filename, bool streaming, bool packed)
+{
+    char cache_filename[MAX_OBJ_LINE];
+    if (!TriangleMesh::cacheFilename(filename, cache_filename, MAX_OBJ_LINE))
+    {
+        printf("mesh_convert : file name: %s is too long\n", filename);
+        return 1;
+    }
+    if (streaming)
+    {
+        strcpy(strrchr(cache_filename, '.'), STREAM_MESH_EXTENSION);
+    }
+
+    clock_t start = clock();
+    TriangleMesh mesh;
+    if (!mesh.loadOBJ(filename)) return 1;
+    clock_t parsed = clock();
+
+    mesh.computeTriangleNormals();
+    mesh.computeVertexNormals();
+    mesh.computeTangentVectors();
+    if (packed) mesh.pack();
+
+    if (streaming)
+    {
+        if (!StreamingMesh::build(mesh, cache_filename)) return 1;
+        StreamingMesh streamed(cache_filename);
+        printf("%s -> %s\n", filename, cache_filename);
+        printf("  obj parse : %8.2f ms\n", (parsed - start) * 1000.0f / CLOCKS_PER_SEC);
+        printf("     chunks : %lu\n", streamed.chunkCount());
+        return streamed.chunkCount() > 0 ? 0 : 1;
+    }
+
+    const float acmr = mesh.computeACMR();
+    mesh.buildMeshlets();
+    mesh.optimizeOverdraw();
+    mesh.optimizeVertexFetch();
+    mesh.printMeshInfo();
+    if (!mesh.saveCache(cache_filename, filename)) return 1;
+
+    clock_t mapped = clock();
+    TriangleMesh cached(cache_filename);
+    clock_t end = clock();
+    if (!cached.isMapped() || cached.faceCount() != mesh.faceCount())
+    {
+        printf("mesh_convert : mesh cache: %s reload failed\n", cache_filename);
+        return 1;
+    }
+
+    printf("%s -> %s\n", filename, cache_filename);
+    printf("  obj parse : %8.2f ms\n", (parsed - start) * 1000.0f / CLOCKS_PER_SEC);
+    printf("  cache map : %8.2f ms\n", (end - mapped) * 1000.0f / CLOCKS_PER_SEC);
+    printf("       ACMR : %8.3f -> %.3f\n", acmr, cached.computeACMR());
+    return 0;
+}
@@ -58,14 +58,12 @@ int normal_mapping_demo() {
     Entity ent = Entity(config);
     entity_ptr = &ent;
 
-    ent.getTriangleMesh()->computeTriangleNormals();
-    ent.getTriangleMesh()->computeVertexNormals();
-    ent.getTriangleMesh()->computeTangentVectors();
+    // normals and tangents are computed by the pipeline when a shader first needs them
     ent.getTriangleMesh()->printMeshInfo();
     mesh_center = ent.getTriangleMesh()->getMeshCenter();
     // ent.setTransform(mat4::fromAxisAngle(vec3::UNIT_X, -PI / 2));
 
-    Envmap envmap("assets/envmaps/env01.bmp");
+    Envmap envmap("assets/envmaps/env01.bmp", true);  // SH coefficients are computed while the first frames are drawn
 
     scene.addEntity(&ent);
     scene.addLight((Light*)&dir_light);
@@ -22,5 +22,9 @@ int main_demo(const char* model);
 int blank_demo();
 int colormap_demo();
 int normal_mapping_demo();
+int mesh_convert(const char* filename, bool streaming = false, bool packed = false);
+int texture_bench(const char* filename, long repeat = 4);
+int texture_convert(const char* filename, const char* format_name = nullptr);
+int image_convert(const char* input, const char* output);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,107 @@
+#include "sample.hpp"
+
+using namespace LuGL;
+
+#define BENCH_SCREEN_SIZE 1024
+#define BENCH_REPEAT      2
+
+struct SamplePattern
+{
+    const char *name;
+    float angle;    // degrees of rotation of the texture on screen
+    float scale;    // texels per pixel
+};
+
+// sample the texture once per pixel of a screen mapped by the pattern, returns Msamples/s
+static float samplePattern(const Texture & texture, const SamplePattern & pattern, vec4 & sum)
+{
+    // a repeating sampler wraps the coordinates itself
+    const bool wrap = texture.getSampler().wrap_u != TEXTURE_WRAP_REPEAT;
+    const float cos_angle = cosf(pattern.angle * PI / 180.0f);
+    const float sin_angle = sinf(pattern.angle * PI / 180.0f);
+    // texture coordinates per pixel along the screen x and y
+    const vec2 dx = vec2(cos_angle * pattern.scale / texture.getTextureWidth(), sin_angle * pattern.scale / texture.getTextureHeight());
+    const vec2 dy = vec2(-sin_angle * pattern.scale / texture.getTextureWidth(), cos_angle * pattern.scale / texture.getTextureHeight());
+
+    clock_t start = clock();
+    for (long repeat = 0; repeat < BENCH_REPEAT; repeat++)
+    {
+        for (long y = 0; y < BENCH_SCREEN_SIZE; y++)
+        {
+            for (long x = 0; x < BENCH_SCREEN_SIZE; x++)
+            {
+                const float px = (float)(x - BENCH_SCREEN_SIZE / 2);
+                const float py = (float)(y - BENCH_SCREEN_SIZE / 2);
+                vec2 texcoord = vec2(0.5f + dx.u * px + dy.u * py, 0.5f + dx.v * px + dy.v * py);
+                if (wrap)
+                {
+                    texcoord.u -= floorf(texcoord.u);
+                    texcoord.v -= floorf(texcoord.v);
+                }
+                sum += Texture::sampler(texture, texcoord, dx, dy);
+            }
+        }
+    }
+    const float seconds = (float)(clock() - start) / CLOCKS_PER_SEC;
+    return BENCH_REPEAT * BENCH_SCREEN_SIZE * BENCH_SCREEN_SIZE / (seconds * 1e6f);
+}
+
+/**
+ * Bilinear and trilinear sampling throughput of the linear and tiled texture
+ * layouts. The image is repeated repeat x repeat times so that the texture
+ * does not fit in the caches, and compared with the image itself sampled
+ * with a repeating sampler, which reads the same texels.
+ */
+int texture_bench(const char* filename, long repeat)
+{
+    BMPImage source_image(filename);
+    if (!source_image.isLoaded())
+    {
+        printf("texture_bench : texture: %s load failed\n", filename);
+        return 1;
+    }
+    const size_t source_line = source_image.getImageWidth() * 3;
+    BMPImage bmp_image(source_image.getImageWidth() * repeat, source_image.getImageHeight() * repeat);
+    for (long y = 0; y < bmp_image.getImageHeight(); y++)
+    {
+        for (long r = 0; r < repeat; r++)
+        {
+            memcpy(bmp_image.getImageBuffer() + (y * repeat + r) * source_line,
+                   source_image.getImageBufferConst() + (y % source_image.getImageHeight()) * source_line, source_line);
+        }
+    }
+
+    const SamplePattern patterns[] = {
+        { "aligned",     0.0f, 1.0f },
+        { "rotated 30",  30.0f, 1.0f },
+        { "rotated 90",  90.0f, 1.0f },
+        { "minified 4x", 30.0f, 4.0f },
+    };
+    const TextureFormat formats[] = { TEXTURE_FORMAT_RGBA32F, TEXTURE_FORMAT_RGBA8, TEXTURE_FORMAT_BC1 };
+    const char format_names[][8] = { "rgba32f", "rgba8", "bc1" };
+
+    LUGL_TEXTURE_FILTERING(true);
+    LUGL_TEXTURE_MIPMAPPING(true);
+    vec4 sum;
+    printf("%s repeated %ldx%ld, %ldx%ld, Msamples/s linear / tiled / tiled with a repeating sampler\n", filename, repeat, repeat, (long)bmp_image.getImageWidth(), (long)bmp_image.getImageHeight());
+    for (size_t fidx = 0; fidx < sizeof(formats) / sizeof(formats[0]); fidx++)
+    {
+        LUGL_TEXTURE_TILING(false);
+        Texture linear(bmp_image, formats[fidx]);
+        LUGL_TEXTURE_TILING(true);
+        Texture tiled(bmp_image, formats[fidx]);
+        Texture repeated(source_image, formats[fidx]);
+        repeated.setSampler(SamplerState(TEXTURE_WRAP_REPEAT));
+
+        printf("  %-8s", format_names[fidx]);
+        for (size_t pidx = 0; pidx < sizeof(patterns) / sizeof(patterns[0]); pidx++)
+        {
+            const float linear_rate = samplePattern(linear, patterns[pidx], sum);
+            const float tiled_rate = samplePattern(tiled, patterns[pidx], sum);
+            const float repeated_rate = samplePattern(repeated, patterns[pidx], sum);
+            printf(" | %s %6.1f / %6.1f / %6.1f", patterns[pidx].name, linear_rate, tiled_rate, repeated_rate);
+        }
+        printf("\n");
+    }
+    return sum.x >= 0.0f ? 0 : 1;
+}
@@ -0,0 +1,59 @@
+#include "sample.hpp"
+
+using namespace LuGL;
+
+// convert a BMP file into a texture container next to it, with the texels encoded
+// in format and the whole mip chain precomputed, loaded later by mapping the file
+int texture_convert(const char* filename, const char* format_name)
+{
+    TextureFormat format = TEXTURE_FORMAT_RGBA32F;
+    if (format_name && !Texture::parseFormat(format_name, &format))
+    {
+        printf("texture_convert : unknown texture format: %s\n", format_name);
+        return 1;
+    }
+    char container_filename[MAX_OBJ_LINE];
+    if (!Texture::containerFilename(filename, container_filename, MAX_OBJ_LINE))
+    {
+        printf("texture_convert : file name: %s is too long\n", filename);
+        return 1;
+    }
+
+    clock_t start = clock();
+    BMPImage bmp_image(filename);
+    if (!bmp_image.isLoaded()) return 1;
+    Texture texture(bmp_image, format);
+    clock_t encoded = clock();
+    if (!texture.saveContainer(container_filename)) return 1;
+
+    clock_t mapped = clock();
+    Texture container(container_filename, format);
+    clock_t end = clock();
+    if (container.getTextureWidth() != texture.getTextureWidth() ||
+        container.getTextureHeight() != texture.getTextureHeight() ||
+        container.getFormat() != texture.getFormat() ||
+        container.getLayout() != texture.getLayout())
+    {
+        printf("texture_convert : texture container: %s reload failed\n", container_filename);
+        return 1;
+    }
+    for (long y = 0; y < texture.getTextureHeight(); y++)
+    {
+        for (long x = 0; x < texture.getTextureWidth(); x++)
+        {
+            const vec4 expected = texture.colorAt(x, y);
+            const vec4 color = container.colorAt(x, y);
+            if (memcmp(&expected, &color, sizeof(vec4)) != 0)
+            {
+                printf("texture_convert : texture container: %s differs at texel (%ld, %ld)\n", container_filename, x, y);
+                return 1;
+            }
+        }
+    }
+
+    printf("%s -> %s\n", filename, container_filename);
+    printf("   bmp encode : %8.2f ms\n", (encoded - start) * 1000.0f / CLOCKS_PER_SEC);
+    printf("container map : %8.2f ms\n", (end - mapped) * 1000.0f / CLOCKS_PER_SEC);
+    printf("       levels : %ld\n", container.levelCount());
+    return 0;
+}
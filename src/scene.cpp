@@ -184,6 +184,16 @@ void Scene::addEntity(Entity * entity)
     m_entities.push_back(entity);
 }
 
+void Scene::addInstancedEntity(InstancedEntity * entity)
+{
+    m_instanced_entities.push_back(entity);
+}
+
+void Scene::addStreamingEntity(StreamingEntity * entity)
+{
+    m_streaming_entities.push_back(entity);
+}
+
 void Scene::setEnvmap(Envmap * envmap)
 {
     m_envmap = envmap;
@@ -201,20 +211,27 @@ Camera & Scene::getCamera()
 
 void Scene::sortEntity() const
 {
-    size_t entity_count = m_entities.size();
-    if (entity_count > 1)
+    const size_t entity_count = m_entities.size();
+    if (entity_count < 2) return;
+
+    const mat4 view_matrix = m_camera.getViewMatrix();
+    LinearArena & arena = Singleton<FrameArena>::get().local();
+    UINT32 *keys = arena.allocateArray<UINT32>(entity_count);
+#ifdef _OPENMP
+#pragma omp parallel for if(entity_count >= RADIX_SORT_PARALLEL_MIN)
+#endif
+    for (size_t i = 0; i < entity_count; i++)
     {
-        for (size_t i = 0; i < entity_count; i++)
-        {
-            Entity *entity = m_entities[i];
-            vec3 center = entity->getTriangleMesh()->getMeshCenter();
-            vec4 model_position(center, 1.0f);
-            vec4 world_position = entity->getTransform() * model_position;
-            vec4 view_position = m_camera.getViewMatrix() * world_position;
-            entity->setDistance(-view_position.z);
-        }
+        Entity *entity = m_entities[i];
+        const TriangleMesh *mesh = entity->getTriangleMesh();
+        vec3 center = mesh ? mesh->getMeshCenter() : vec3::ZERO;
+        vec4 model_position(center, 1.0f);
+        vec4 world_position = entity->getTransform() * model_position;
+        vec4 view_position = view_matrix * world_position;
+        entity->setDistance(-view_position.z);
+        keys[i] = floatToRadixKey(-view_position.z);
     }
-    m_entities.sort(Entity::compareDistance);
+    radixSort(keys, m_entities.data(), entity_count, &arena);
 }
 
 void Scene::setBackground(const vec3 & color)
@@ -77,6 +77,8 @@ class Scene
 private:
     vec3                    m_background;
     mutable DynamicArray<Entity*>   m_entities;
+    DynamicArray<InstancedEntity*>  m_instanced_entities;
+    DynamicArray<StreamingEntity*>  m_streaming_entities;
     DynamicArray<Light*>    m_lights;
     Camera                  m_camera;
     Envmap*                 m_envmap;
@@ -89,6 +91,8 @@ public:
     ~Scene() {}
 
     void addEntity(Entity * entity);
+    void addInstancedEntity(InstancedEntity * entity);
+    void addStreamingEntity(StreamingEntity * entity);
     void setEnvmap(Envmap * envmap);
     void addLight(Light * light);
     Camera & getCamera();
@@ -96,6 +100,8 @@ public:
     void setBackground(const vec3 & color);
 
     const DynamicArray<Entity*> * getEntities() const { return &m_entities; }
+    const DynamicArray<InstancedEntity*> * getInstancedEntities() const { return &m_instanced_entities; }
+    const DynamicArray<StreamingEntity*> * getStreamingEntities() const { return &m_streaming_entities; }
     const DynamicArray<Light*> *  getLights() const { return &m_lights; }
 
     const Camera& getCamera() const { return m_camera; }
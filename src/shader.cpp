@@ -1,7 +1,21 @@
 #include "shader.hpp"
+#include <typeinfo>
 
 using namespace LuGL;
 
+void Shader::fragQuad(const v2f * in, const bool * active, const Entity * entity, const Scene & scene, vec4 * out) const
+{
+    for (long q = 0; q < 4; q++)
+    {
+        if (active[q]) out[q] = frag(in[q], entity, scene);
+    }
+}
+
+static mat3 tbnMatrix(const v2f & in)
+{
+    return TBN_MATRIX;
+}
+
 v2f UnlitShader::vert(const vdata in, const Entity * entity, const Scene & scene) const
 {
     __unused_variable(entity);
@@ -40,6 +54,26 @@ vec4 UnlitShader::frag(const v2f in, const Entity * entity, const Scene & scene)
     return SAMPLER_2D(TEXTURE_ALBEDO, in.texcoord);
 }
 
+// the fast path of a built-in shader would skip the frag of a subclass
+bool UnlitShader::hasQuadFastPath() const
+{
+    return typeid(*this) == typeid(UnlitShader);
+}
+
+void UnlitShader::fragQuad(const v2f * in, const bool * active, const Entity * entity, const Scene & scene, vec4 * out) const
+{
+    if (!m_quad_fast_path)
+    {
+        Shader::fragQuad(in, active, entity, scene, out);
+        return;
+    }
+    __unused_variable(active);
+    __unused_variable(scene);
+
+    QUAD_TEXCOORDS(texcoords);
+    SAMPLER_2D_QUAD(TEXTURE_ALBEDO, texcoords, out);
+}
+
 vec4 TriangleNormalShader::frag(const v2f in, const Entity * entity, const Scene & scene) const
 {
     __unused_variable(entity);
@@ -90,19 +124,58 @@ vec4 BlinnPhongShader::frag(const v2f in, const Entity * entity, const Scene & s
     const float ambient_strength = 0.1f;
     const float diffuse_strength = 1.0f;
 
-    vec3 normal = vec3(SAMPLER_2D(TEXTURE_NORMAL, in.texcoord)) * 2.0f - vec3(1.0f, 1.0f, 1.0f);
-    float specular_strength = (SAMPLER_2D(TEXTURE_SPECULAR, in.texcoord)).length();
+    MaterialSample sample;
+    SAMPLE_MATERIAL(in.texcoord, sample);
+    vec3 normal = vec3(sample.normal) * 2.0f - vec3(1.0f, 1.0f, 1.0f);
+    float specular_strength = sample.specular.length();
     normal = (TBN_MATRIX * normal).normalized();
 
     vec3 view_dir = (scene.getCamera().getPosition() - in.frag_pos).normalized();
     LightComp light_comp = scene.calcLight(normal, in.frag_pos, view_dir);
-    vec3 color = ambient_strength * vec3(SAMPLER_2D(TEXTURE_ALBEDO, in.texcoord)) +
-                 diffuse_strength * light_comp.diffuse.multiply(vec3(SAMPLER_2D(TEXTURE_DIFFUSE, in.texcoord))) +
-                 specular_strength * light_comp.specular.multiply(vec3(SAMPLER_2D(TEXTURE_SPECULAR, in.texcoord)));
+    vec3 color = ambient_strength * vec3(sample.albedo) +
+                 diffuse_strength * light_comp.diffuse.multiply(vec3(sample.diffuse)) +
+                 specular_strength * light_comp.specular.multiply(vec3(sample.specular));
 
     return vec4(color, 1.0f);
 }
 
+bool BlinnPhongShader::hasQuadFastPath() const
+{
+    return typeid(*this) == typeid(BlinnPhongShader);
+}
+
+void BlinnPhongShader::fragQuad(const v2f * in, const bool * active, const Entity * entity, const Scene & scene, vec4 * out) const
+{
+    if (!m_quad_fast_path)
+    {
+        Shader::fragQuad(in, active, entity, scene, out);
+        return;
+    }
+    const float ambient_strength = 0.1f;
+    const float diffuse_strength = 1.0f;
+
+    QUAD_TEXCOORDS(texcoords);
+    MaterialSample samples[4];
+    SAMPLE_MATERIAL_QUAD(texcoords, samples);
+
+    for (long q = 0; q < 4; q++)
+    {
+        if (!active[q]) continue;
+
+        vec3 normal = vec3(samples[q].normal) * 2.0f - vec3(1.0f, 1.0f, 1.0f);
+        float specular_strength = samples[q].specular.length();
+        normal = (tbnMatrix(in[q]) * normal).normalized();
+
+        vec3 view_dir = (scene.getCamera().getPosition() - in[q].frag_pos).normalized();
+        LightComp light_comp = scene.calcLight(normal, in[q].frag_pos, view_dir);
+        vec3 color = ambient_strength * vec3(samples[q].albedo) +
+                     diffuse_strength * light_comp.diffuse.multiply(vec3(samples[q].diffuse)) +
+                     specular_strength * light_comp.specular.multiply(vec3(samples[q].specular));
+
+        out[q] = vec4(color, 1.0f);
+    }
+}
+
 vec4 NormalMappingShader::frag(const v2f in, const Entity * entity, const Scene & scene) const
 {
     vec3 normal = vec3(SAMPLER_2D(TEXTURE_NORMAL, in.texcoord)) * 2.0f - vec3(1.0f, 1.0f, 1.0f);
@@ -110,4 +183,34 @@ vec4 NormalMappingShader::frag(const v2f in, const Entity * entity, const Scene
 
     vec3 normal_color = (normal + vec3(1.0f, 1.0f, 1.0f)) * 0.5f;
     return vec4(normal_color, 1.0f);
-}
\ No newline at end of file
+}
+
+bool NormalMappingShader::hasQuadFastPath() const
+{
+    return typeid(*this) == typeid(NormalMappingShader);
+}
+
+void NormalMappingShader::fragQuad(const v2f * in, const bool * active, const Entity * entity, const Scene & scene, vec4 * out) const
+{
+    if (!m_quad_fast_path)
+    {
+        Shader::fragQuad(in, active, entity, scene, out);
+        return;
+    }
+    __unused_variable(scene);
+
+    QUAD_TEXCOORDS(texcoords);
+    vec4 normals[4];
+    SAMPLER_2D_QUAD(TEXTURE_NORMAL, texcoords, normals);
+
+    for (long q = 0; q < 4; q++)
+    {
+        if (!active[q]) continue;
+
+        vec3 normal = vec3(normals[q]) * 2.0f - vec3(1.0f, 1.0f, 1.0f);
+        normal = (tbnMatrix(in[q]) * normal).normalized();
+
+        vec3 normal_color = (normal + vec3(1.0f, 1.0f, 1.0f)) * 0.5f;
+        out[q] = vec4(normal_color, 1.0f);
+    }
+}
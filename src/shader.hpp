@@ -17,7 +17,15 @@
 namespace LuGL
 {
 
-#define SAMPLER_2D(tex,coord) (Texture::sampler(tex,coord))
+// the mip level is picked by the derivatives of in.texcoord across the pixel quad
+#define SAMPLER_2D(tex,coord) (Texture::sampler(tex,coord,in.texcoord_dx,in.texcoord_dy))
+#define SAMPLER_2D_GRAD(tex,coord,dx,dy) (Texture::sampler(tex,coord,dx,dy))
+// in fragQuad, samples the 4 coords of the quad into colors
+#define SAMPLER_2D_QUAD(tex,coords,colors) (Texture::sample4(tex,coords,in[0].texcoord_dx,in[0].texcoord_dy,colors))
+#define QUAD_TEXCOORDS(name) const vec2 name[4] = { in[0].texcoord, in[1].texcoord, in[2].texcoord, in[3].texcoord }
+// all the maps of the material at once, into a MaterialSample or the 4 of a quad
+#define SAMPLE_MATERIAL(coord,sample) (Material::sample(*entity->getMaterial(),coord,in.texcoord_dx,in.texcoord_dy,sample))
+#define SAMPLE_MATERIAL_QUAD(coords,samples) (Material::sample4(*entity->getMaterial(),coords,in[0].texcoord_dx,in[0].texcoord_dy,samples))
 #define TEXTURE_ALBEDO (entity->getMaterial()->albedo)
 #define TEXTURE_DIFFUSE (entity->getMaterial()->diffuse)
 #define TEXTURE_SPECULAR (entity->getMaterial()->specular)
@@ -46,6 +54,8 @@ struct v2f
     vec2 texcoord;
     vec3 tangent;
     vec3 bitangent;
+    vec2 texcoord_dx;   // texcoord derivatives along x and y in the 2x2 quad, zero if unknown
+    vec2 texcoord_dy;
 
     v2f() {}
 
@@ -65,9 +75,23 @@ class Scene;
 
 class Shader
 {
+protected:
+    mutable bool m_quad_fast_path;  // resolved per draw by resolveQuadPath
 public:
+    Shader(): m_quad_fast_path(false) {}
+
     virtual v2f vert(const vdata in, const Entity * entity, const Scene & scene) const = 0;
     virtual vec4 frag(const v2f in, const Entity * entity, const Scene & scene) const = 0;
+    // the 4 pixels of a 2x2 quad, only the pixels with active set are written and the others
+    // only have their texcoord, the default shades the active pixels one by one with frag;
+    // the built-in shaders shade the quad at once only as themselves, their subclasses go through frag
+    virtual void fragQuad(const v2f * in, const bool * active, const Entity * entity, const Scene & scene, vec4 * out) const;
+    // true if fragQuad shades the quad at once for the dynamic type of the shader
+    virtual bool hasQuadFastPath() const { return false; }
+    // called by the pipeline before a draw, so that fragQuad does not check the type per quad
+    void resolveQuadPath() const { m_quad_fast_path = hasQuadFastPath(); }
+    // MeshAttribute bits read by the shader, computed by the pipeline before the first draw
+    virtual UINT32 requiredAttributes() const { return MESH_ATTRIBUTE_ALL; }
 };
 
 #define MODEL_MATRIX        (in.model_mat)
@@ -84,18 +108,23 @@ class UnlitShader : public Shader
 public:
     virtual v2f vert(const vdata in, const Entity * entity, const Scene & scene) const;
     virtual vec4 frag(const v2f in, const Entity * entity, const Scene & scene) const;
+    virtual void fragQuad(const v2f * in, const bool * active, const Entity * entity, const Scene & scene, vec4 * out) const;
+    virtual bool hasQuadFastPath() const;
+    virtual UINT32 requiredAttributes() const { return 0; }
 };
 
 class TriangleNormalShader : public UnlitShader
 {
 public:
     virtual vec4 frag(const v2f in, const Entity * entity, const Scene & scene) const;
+    virtual UINT32 requiredAttributes() const { return MESH_ATTRIBUTE_TRIANGLE_NORMALS; }
 };
 
 class VertexNormalShader : public UnlitShader
 {
 public:
     virtual vec4 frag(const v2f in, const Entity * entity, const Scene & scene) const;
+    virtual UINT32 requiredAttributes() const { return MESH_ATTRIBUTE_VERTEX_NORMALS; }
 };
 
 class DepthShader : public UnlitShader
@@ -108,18 +137,23 @@ class LitShader : public Shader
 {
 public:
     virtual v2f vert(const vdata in, const Entity * entity, const Scene & scene) const;
+    virtual UINT32 requiredAttributes() const { return MESH_ATTRIBUTE_VERTEX_NORMALS | MESH_ATTRIBUTE_TANGENTS; }
 };
 
 class BlinnPhongShader : LitShader
 {
 public:
     virtual vec4 frag(const v2f in, const Entity * entity, const Scene & scene) const;
+    virtual void fragQuad(const v2f * in, const bool * active, const Entity * entity, const Scene & scene, vec4 * out) const;
+    virtual bool hasQuadFastPath() const;
 };
 
 class NormalMappingShader : public LitShader
 {
 public:
     virtual vec4 frag(const v2f in, const Entity * entity, const Scene & scene) const;
+    virtual void fragQuad(const v2f * in, const bool * active, const Entity * entity, const Scene & scene, vec4 * out) const;
+    virtual bool hasQuadFastPath() const;
 };
 
 }
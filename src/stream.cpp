@@ -0,0 +1,313 @@
+#include "stream.hpp"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace LuGL;
+
+StreamingMesh::StreamingMesh():
+    m_filename(nullptr),
+    m_chunks(nullptr),
+    m_chunk_count(0),
+    m_face_count(0),
+    m_center(vec3::ZERO),
+    m_radius(0.0f),
+    m_budget(STREAM_MEMORY_BUDGET),
+    m_resident_size(0),
+    m_resident_count(0),
+    m_load_count(0),
+    m_tick(0),
+    m_frame(0) {}
+
+StreamingMesh::StreamingMesh(const char * filename, size_t budget):
+    StreamingMesh()
+{
+    m_budget = budget;
+    open(filename);
+}
+
+StreamingMesh::~StreamingMesh()
+{
+    close();
+}
+
+bool StreamingMesh::open(const char * filename)
+{
+    close();
+
+    MappedFile header_file;
+    if (!header_file.open(filename, 0, sizeof(StreamMeshHeader))) return false;
+    const StreamMeshHeader header = *reinterpret_cast<const StreamMeshHeader*>(header_file.data());
+    header_file.close();
+    if (header.magic != STREAM_MESH_MAGIC || header.version != STREAM_MESH_VERSION || header.chunk_count == 0)
+    {
+        printf("StreamingMesh : mesh file: %s is invalid or outdated\n", filename);
+        return false;
+    }
+
+    MappedFile table_file;
+    if (!table_file.open(filename, header.table_offset, header.chunk_count * sizeof(StreamChunkEntry))) return false;
+    const StreamChunkEntry *entries = reinterpret_cast<const StreamChunkEntry*>(table_file.data());
+
+    m_chunk_count = header.chunk_count;
+    m_chunks = new StreamChunk[m_chunk_count];
+    for (size_t cidx = 0; cidx < m_chunk_count; cidx++)
+    {
+        m_chunks[cidx].entry = entries[cidx];
+        m_chunks[cidx].mesh = nullptr;
+        m_chunks[cidx].last_used = 0;
+        m_chunks[cidx].last_frame = 0;
+    }
+    m_face_count = header.face_count;
+    m_center = vec3(header.center[0], header.center[1], header.center[2]);
+    m_radius = header.radius;
+
+    size_t f_len = strlen(filename);
+    m_filename = new char[f_len + 1];
+    strcpy(m_filename, filename);
+    return true;
+}
+
+void StreamingMesh::close()
+{
+    for (size_t cidx = 0; cidx < m_chunk_count; cidx++)
+    {
+        delete m_chunks[cidx].mesh;
+    }
+    delete[] m_chunks;
+    delete[] m_filename;
+    m_chunks = nullptr;
+    m_filename = nullptr;
+    m_chunk_count = 0;
+    m_face_count = 0;
+    m_resident_size = 0;
+    m_resident_count = 0;
+}
+
+vec3 StreamingMesh::getChunkCenter(size_t cidx) const
+{
+    const float *center = m_chunks[cidx].entry.center;
+    return vec3(center[0], center[1], center[2]);
+}
+
+void StreamingMesh::setBudget(size_t budget)
+{
+    m_budget = budget;
+    makeRoom(0, m_chunk_count, false);
+}
+
+// evict chunks until size more bytes fit in the budget, least recently used
+// first among the chunks not drawn this frame. Once only chunks drawn this frame
+// are left, the most recently used goes first, so that a view needing more than
+// the budget keeps a stable part resident instead of cycling through all of it.
+// keep is never evicted and neither are the chunks drawn this frame if keep_frame
+bool StreamingMesh::makeRoom(size_t size, size_t keep, bool keep_frame)
+{
+    while (m_resident_size + size > m_budget)
+    {
+        size_t victim = m_chunk_count;
+        size_t frame_victim = m_chunk_count;
+        for (size_t cidx = 0; cidx < m_chunk_count; cidx++)
+        {
+            const StreamChunk & chunk = m_chunks[cidx];
+            if (chunk.mesh == nullptr || cidx == keep) continue;
+            if (chunk.last_frame == m_frame)
+            {
+                if (frame_victim == m_chunk_count || chunk.last_used > m_chunks[frame_victim].last_used) frame_victim = cidx;
+            }
+            else if (victim == m_chunk_count || chunk.last_used < m_chunks[victim].last_used)
+            {
+                victim = cidx;
+            }
+        }
+        if (victim == m_chunk_count && !keep_frame) victim = frame_victim;
+        if (victim == m_chunk_count) return false;
+        evict(victim);
+    }
+    return true;
+}
+
+bool StreamingMesh::load(size_t cidx)
+{
+    StreamChunk & chunk = m_chunks[cidx];
+    TriangleMesh *mesh = new TriangleMesh();
+    if (!mesh->loadCache(m_filename, chunk.entry.offset, chunk.entry.size))
+    {
+        delete mesh;
+        return false;
+    }
+    chunk.mesh = mesh;
+    m_resident_size += chunk.entry.size;
+    m_resident_count++;
+    m_load_count++;
+    return true;
+}
+
+void StreamingMesh::evict(size_t cidx)
+{
+    StreamChunk & chunk = m_chunks[cidx];
+    delete chunk.mesh;
+    chunk.mesh = nullptr;
+    m_resident_size -= chunk.entry.size;
+    m_resident_count--;
+}
+
+// mesh of a chunk to draw, loaded on demand, the budget is exceeded by this chunk at most
+const TriangleMesh * StreamingMesh::acquire(size_t cidx)
+{
+    assert(cidx < m_chunk_count);
+    StreamChunk & chunk = m_chunks[cidx];
+    if (chunk.mesh == nullptr)
+    {
+        makeRoom(chunk.entry.size, cidx, false);
+        if (!load(cidx)) return nullptr;
+    }
+    chunk.last_used = ++m_tick;
+    chunk.last_frame = m_frame;
+    return chunk.mesh;
+}
+
+// load a chunk ahead of its first draw if it fits without evicting chunks drawn this frame
+bool StreamingMesh::prefetch(size_t cidx)
+{
+    assert(cidx < m_chunk_count);
+    StreamChunk & chunk = m_chunks[cidx];
+    if (chunk.mesh == nullptr)
+    {
+        if (!makeRoom(chunk.entry.size, cidx, true) || !load(cidx)) return false;
+        chunk.mesh->getMappedFile()->willNeed();
+    }
+    chunk.last_used = ++m_tick;
+    return true;
+}
+
+static inline UINT32 expandMortonBits(UINT32 v)
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8))  & 0x0300f00f;
+    v = (v | (v << 4))  & 0x030c30c3;
+    v = (v | (v << 2))  & 0x09249249;
+    return v;
+}
+
+/**
+ * Split a mesh into chunks of chunk_faces faces along the Morton curve of the
+ * face centroids, so that every chunk is spatially compact and can be culled
+ * on its own, and write them into a streaming mesh file.
+ * reference : https://developer.nvidia.com/blog/thinking-parallel-part-iii-tree-construction-gpu/
+ */
+bool StreamingMesh::build(const TriangleMesh & mesh, const char * filename, size_t chunk_faces)
+{
+    const size_t face_count = mesh.faceCount();
+    if (face_count == 0 || chunk_faces == 0)
+    {
+        printf("StreamingMesh : empty mesh can not be streamed\n");
+        return false;
+    }
+
+    const vec3 *vertices = mesh.getVertices();
+    const vec3i *faces = mesh.getFaces();
+    const BoundingBox bounding_box = mesh.getAxisAlignBoundingBox();
+    const vec3 bound_min(bounding_box.min_x, bounding_box.min_y, bounding_box.min_z);
+    const vec3 extent(
+        max(bounding_box.max_x - bounding_box.min_x, EPSILON),
+        max(bounding_box.max_y - bounding_box.min_y, EPSILON),
+        max(bounding_box.max_z - bounding_box.min_z, EPSILON) );
+
+    UINT32 *keys = new UINT32[face_count];
+    size_t *order = new size_t[face_count];
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (size_t fidx = 0; fidx < face_count; fidx++)
+    {
+        const vec3 centroid = (vertices[faces[fidx][0]] + vertices[faces[fidx][1]] + vertices[faces[fidx][2]]) * (1.0f / 3.0f);
+        const vec3 p = centroid - bound_min;
+        keys[fidx] = expandMortonBits((UINT32)(p.x / extent.x * 1023.0f)) |
+                     expandMortonBits((UINT32)(p.y / extent.y * 1023.0f)) << 1 |
+                     expandMortonBits((UINT32)(p.z / extent.z * 1023.0f)) << 2;
+        order[fidx] = fidx;
+    }
+    radixSort(keys, order, face_count);
+    delete[] keys;
+
+    size_t f_len = strlen(filename);
+    char *temp_filename = new char[f_len + 5];
+    strcpy(temp_filename, filename);
+    strcat(temp_filename, ".tmp");
+    FILE *fp = fopen(temp_filename, "wb");
+    if (fp == nullptr)
+    {
+        printf("StreamingMesh : mesh file: %s open failed\n", temp_filename);
+        delete[] temp_filename;
+        delete[] order;
+        return false;
+    }
+
+    const size_t chunk_count = (face_count + chunk_faces - 1) / chunk_faces;
+    StreamChunkEntry *entries = new StreamChunkEntry[chunk_count];
+    StreamMeshHeader header;
+    memset(&header, 0, sizeof(StreamMeshHeader));
+    const byte_t padding[MESH_CACHE_ALIGNMENT] = { 0 };
+
+    // the header is rewritten once the table offset is known
+    bool written = fwrite(&header, sizeof(StreamMeshHeader), 1, fp) == 1;
+    UINT64 position = sizeof(StreamMeshHeader);
+    for (size_t cidx = 0; cidx < chunk_count && written; cidx++)
+    {
+        const size_t begin = cidx * chunk_faces;
+        const size_t count = min(chunk_faces, face_count - begin);
+        TriangleMesh *chunk = mesh.extractFaces(order + begin, count);
+        chunk->buildMeshlets();
+        chunk->optimizeOverdraw();
+        chunk->optimizeVertexFetch();
+
+        const size_t padding_size = (MESH_CACHE_ALIGNMENT - position % MESH_CACHE_ALIGNMENT) % MESH_CACHE_ALIGNMENT;
+        written = fwrite(padding, 1, padding_size, fp) == padding_size;
+        position += padding_size;
+
+        StreamChunkEntry & entry = entries[cidx];
+        entry.offset = position;
+        entry.face_count = count;
+        entry.center[0] = chunk->getMeshCenter().x;
+        entry.center[1] = chunk->getMeshCenter().y;
+        entry.center[2] = chunk->getMeshCenter().z;
+        entry.radius = chunk->getBoundingRadius();
+        written = written && chunk->writeCache(fp, &entry.size);
+        position += entry.size;
+        delete chunk;
+    }
+
+    header.magic = STREAM_MESH_MAGIC;
+    header.version = STREAM_MESH_VERSION;
+    header.chunk_count = (UINT32)chunk_count;
+    header.vertex_count = mesh.vertexCount();
+    header.face_count = face_count;
+    header.table_offset = position;
+    header.center[0] = mesh.getMeshCenter().x;
+    header.center[1] = mesh.getMeshCenter().y;
+    header.center[2] = mesh.getMeshCenter().z;
+    header.radius = mesh.getBoundingRadius();
+    written = written &&
+              fwrite(entries, sizeof(StreamChunkEntry), chunk_count, fp) == chunk_count &&
+              fseek(fp, 0, SEEK_SET) == 0 &&
+              fwrite(&header, sizeof(StreamMeshHeader), 1, fp) == 1;
+    written = fclose(fp) == 0 && written;
+
+    if (written)
+    {
+        remove(filename);
+        written = rename(temp_filename, filename) == 0;
+    }
+    if (!written)
+    {
+        printf("StreamingMesh : mesh file: %s write failed\n", filename);
+        remove(temp_filename);
+    }
+
+    delete[] temp_filename;
+    delete[] entries;
+    delete[] order;
+    return written;
+}
@@ -0,0 +1,119 @@
+#ifndef __STREAM_HPP__
+#define __STREAM_HPP__
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include "global.hpp"
+#include "maths.hpp"
+#include "mesh.hpp"
+#include "mapfile.hpp"
+
+namespace LuGL
+{
+
+#define STREAM_MESH_MAGIC 0x534d4c4c    // "LLMS"
+#define STREAM_MESH_VERSION 2
+#define STREAM_MESH_EXTENSION ".lsm"
+#define STREAM_CHUNK_FACES 16384
+#define STREAM_MEMORY_BUDGET (256 << 20)
+#define STREAM_PREFETCH_SCALE 2.0f      // chunks within this many radii of the view frustum are prefetched
+#define STREAM_PREFETCH_MAX 4           // chunks prefetched per frame
+
+/**
+ * Streaming mesh file (.lsm) : a StreamMeshHeader, the mesh cache (.lmc) of
+ * every chunk at a MESH_CACHE_ALIGNMENT aligned offset, then the table of
+ * StreamChunkEntry at header.table_offset. A chunk is a spatially coherent
+ * set of faces with its own compacted attributes, so it is drawn on its own.
+ */
+struct StreamMeshHeader
+{
+    UINT32 magic;
+    UINT32 version;
+    UINT32 chunk_count;
+    UINT32 reserved;
+    UINT64 vertex_count;
+    UINT64 face_count;
+    UINT64 table_offset;
+    float  center[3];
+    float  radius;
+};
+
+struct StreamChunkEntry
+{
+    UINT64 offset;
+    UINT64 size;
+    UINT64 face_count;
+    float  center[3];
+    float  radius;
+};
+
+struct StreamChunk
+{
+    StreamChunkEntry entry;
+    TriangleMesh    *mesh;      // resident data, nullptr while on disk
+    UINT64          last_used;  // tick of the last access, for the LRU
+    UINT64          last_frame; // frame of the last draw
+};
+
+/**
+ * A mesh kept on disk and loaded chunk by chunk. Resident chunks are mapped
+ * from the streaming file and evicted in least recently used order once they
+ * take more than the memory budget, a mesh larger than memory can be drawn
+ * without ever being loaded as a whole.
+ */
+class StreamingMesh
+{
+private:
+    char        *m_filename;
+    StreamChunk *m_chunks;
+    size_t      m_chunk_count;
+    size_t      m_face_count;
+    vec3        m_center;
+    float       m_radius;
+
+    size_t      m_budget;
+    size_t      m_resident_size;
+    size_t      m_resident_count;
+    size_t      m_load_count;
+    UINT64      m_tick;
+    UINT64      m_frame;
+
+    bool load(size_t cidx);
+    void evict(size_t cidx);
+    bool makeRoom(size_t size, size_t keep, bool keep_frame);
+public:
+    StreamingMesh();
+    StreamingMesh(const char * filename, size_t budget = STREAM_MEMORY_BUDGET);
+    ~StreamingMesh();
+
+    StreamingMesh(const StreamingMesh &) = delete;
+    StreamingMesh & operator= (const StreamingMesh &) = delete;
+
+    bool open(const char * filename);
+    void close();
+    static bool build(const TriangleMesh & mesh, const char * filename, size_t chunk_faces = STREAM_CHUNK_FACES);
+
+    void beginFrame() { m_frame++; }
+    const TriangleMesh * acquire(size_t cidx);
+    bool prefetch(size_t cidx);
+
+    void setBudget(size_t budget);
+    size_t getBudget() const { return m_budget; }
+    size_t residentSize() const { return m_resident_size; }
+    size_t residentCount() const { return m_resident_count; }
+    size_t loadCount() const { return m_load_count; }
+
+    size_t chunkCount() const { return m_chunk_count; }
+    size_t faceCount() const { return m_face_count; }
+    bool isResident(size_t cidx) const { return m_chunks[cidx].mesh != nullptr; }
+    vec3 getChunkCenter(size_t cidx) const;
+    float getChunkRadius(size_t cidx) const { return m_chunks[cidx].entry.radius; }
+    vec3 getMeshCenter() const { return m_center; }
+    float getBoundingRadius() const { return m_radius; }
+};
+
+}
+
+#endif
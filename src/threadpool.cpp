@@ -0,0 +1,63 @@
+#include "threadpool.hpp"
+
+using namespace LuGL;
+
+ThreadPool::ThreadPool(size_t worker_count):
+    m_workers(nullptr),
+    m_worker_count(worker_count),
+    m_stop(false)
+{
+    if (m_worker_count == 0)
+    {
+        const size_t hardware_threads = std::thread::hardware_concurrency();
+        m_worker_count = hardware_threads > 1 ? hardware_threads - 1 : 1;
+    }
+    m_workers = new std::thread[m_worker_count];
+    for (size_t widx = 0; widx < m_worker_count; widx++)
+    {
+        m_workers[widx] = std::thread(&ThreadPool::workerLoop, this);
+    }
+}
+
+// queued tasks are finished before the workers are joined
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_all();
+    for (size_t widx = 0; widx < m_worker_count; widx++)
+    {
+        m_workers[widx].join();
+    }
+    delete[] m_workers;
+}
+
+void ThreadPool::workerLoop()
+{
+    while (true)
+    {
+        std::packaged_task<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this] { return m_stop || !m_tasks.empty(); });
+            if (m_tasks.empty()) return;
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
+
+std::future<void> ThreadPool::submit(const std::function<void()> & task)
+{
+    std::packaged_task<void()> packaged(task);
+    std::future<void> future = packaged.get_future();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(std::move(packaged));
+    }
+    m_condition.notify_one();
+    return future;
+}
@@ -0,0 +1,49 @@
+#ifndef __THREADPOOL_HPP__
+#define __THREADPOOL_HPP__
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <deque>
+#include "global.hpp"
+
+namespace LuGL
+{
+
+/**
+ * Worker threads running tasks in submission order, for work that has to
+ * overlap with rendering such as loading assets. Data parallel loops inside
+ * a frame keep using OpenMP. The pool of Singleton<ThreadPool> has one worker
+ * less than the hardware threads, and at least one.
+ */
+class ThreadPool
+{
+private:
+    std::thread                 *m_workers;
+    size_t                      m_worker_count;
+    std::deque<std::packaged_task<void()> > m_tasks;
+    std::mutex                  m_mutex;
+    std::condition_variable     m_condition;
+    bool                        m_stop;
+
+    void workerLoop();
+public:
+    ThreadPool(size_t worker_count = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool & operator= (const ThreadPool &) = delete;
+
+    std::future<void> submit(const std::function<void()> & task);
+
+    size_t workerCount() const { return m_worker_count; }
+};
+
+}
+
+#endif